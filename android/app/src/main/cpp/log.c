@@ -123,6 +123,7 @@ void android_chiaki_jni_log_init(AndroidChiakiJNILog *log, JNIEnv *env, jobject
 	log->log.level_mask = (uint32_t)E->GetIntField(env, log->java_log, E->GetFieldID(env, log_class, "levelMask", "I"));
 	log->log.cb = android_chiaki_log_cb;
 	log->log.user = log;
+	log->log.rate_limit_pending = NULL;
 }
 
 void android_chiaki_jni_log_fini(AndroidChiakiJNILog *log, JNIEnv *env)
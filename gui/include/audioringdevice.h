@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIORINGDEVICE_H
+#define CHIAKI_AUDIORINGDEVICE_H
+
+#include <chiaki/audioring.h>
+
+#include <QIODevice>
+
+/**
+ * Read-only QIODevice for QAudioOutput in pull mode that plays from a ChiakiAudioRing.
+ * Never runs dry, silence is returned whenever the ring has nothing to play.
+ */
+class AudioRingDevice : public QIODevice
+{
+	Q_OBJECT
+
+	private:
+		ChiakiAudioRing *ring;
+
+	protected:
+		qint64 readData(char *data, qint64 maxlen) override;
+		qint64 writeData(const char *data, qint64 len) override;
+
+	public:
+		AudioRingDevice(ChiakiAudioRing *ring, QObject *parent = nullptr);
+
+		bool isSequential() const override	{ return true; }
+		qint64 bytesAvailable() const override;
+};
+
+#endif // CHIAKI_AUDIORINGDEVICE_H
@@ -4,6 +4,7 @@
 #define CHIAKI_SESSIONLOG_H
 
 #include <chiaki/log.h>
+#include <chiaki/logasync.h>
 
 #include <QString>
 #include <QDir>
@@ -19,6 +20,8 @@ class SessionLog
 	private:
 		StreamSession *session;
 		ChiakiLog log;
+		ChiakiLogAsync log_async;
+		bool log_async_active;
 		QFile *file;
 		QMutex file_mutex;
 
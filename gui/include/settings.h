@@ -100,6 +100,34 @@ class Settings : public QObject
 		QString GetAudioOutDevice() const;
 		void SetAudioOutDevice(QString device_name);
 
+		ChiakiThreadPriority GetStreamThreadPriority() const;
+		void SetStreamThreadPriority(ChiakiThreadPriority priority);
+
+		/**
+		 * @return cpus the stream thread may run on, 0 for any
+		 */
+		uint64_t GetStreamThreadCpuMask() const		{ return settings.value("settings/stream_thread_cpu_mask", 0).toULongLong(); }
+		void SetStreamThreadCpuMask(uint64_t mask)	{ settings.setValue("settings/stream_thread_cpu_mask", (qulonglong)mask); }
+
+		/**
+		 * @return whether controller input is sent on the GUI thread as it happens instead of by the timer thread
+		 */
+		bool GetFeedbackImmediate() const		{ return settings.value("settings/feedback_immediate", false).toBool(); }
+		void SetFeedbackImmediate(bool enabled)	{ settings.setValue("settings/feedback_immediate", enabled); }
+
+		/**
+		 * @return whether to request DualSense haptics from a PS5 and play them on the controllers' rumble motors
+		 */
+		bool GetHapticsRumble() const			{ return settings.value("settings/haptics_rumble", false).toBool(); }
+		void SetHapticsRumble(bool enabled)		{ settings.setValue("settings/haptics_rumble", enabled); }
+
+		/**
+		 * @param host_key identifies the host, its regist key
+		 * @return whether a profile reported by a previous session with this host has been stored
+		 */
+		bool GetNetworkProfile(const QByteArray &host_key, ChiakiNetworkProfile *profile);
+		void SetNetworkProfile(const QByteArray &host_key, const ChiakiNetworkProfile &profile);
+
 		ChiakiConnectVideoProfile GetVideoProfile();
 
 		DisconnectAction GetDisconnectAction();
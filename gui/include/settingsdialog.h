@@ -27,6 +27,10 @@ class SettingsDialog : public QDialog
 		QComboBox *codec_combo_box;
 		QLineEdit *audio_buffer_size_edit;
 		QComboBox *audio_device_combo_box;
+		QComboBox *stream_thread_priority_combo_box;
+		QLineEdit *stream_thread_cpus_edit;
+		QCheckBox *feedback_immediate_check_box;
+		QCheckBox *haptics_rumble_check_box;
 		QCheckBox *pi_decoder_check_box;
 		QComboBox *hw_decoder_combo_box;
 
@@ -45,6 +49,10 @@ class SettingsDialog : public QDialog
 		void CodecSelected();
 		void AudioBufferSizeEdited();
 		void AudioOutputSelected();
+		void StreamThreadPrioritySelected();
+		void StreamThreadCpusEdited();
+		void FeedbackImmediateChanged();
+		void HapticsRumbleChanged();
 		void HardwareDecodeEngineSelected();
 		void UpdateHardwareDecodeEngineComboBox();
 
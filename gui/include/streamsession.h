@@ -5,6 +5,8 @@
 
 #include <chiaki/session.h>
 #include <chiaki/opusdecoder.h>
+#include <chiaki/audioring.h>
+#include <chiaki/haptics.h>
 #include <chiaki/ffmpegdecoder.h>
 
 #if CHIAKI_LIB_ENABLE_PI_DECODER
@@ -25,9 +27,10 @@
 #include <QImage>
 #include <QMouseEvent>
 #include <QTimer>
+#include <QVector>
 
 class QAudioOutput;
-class QIODevice;
+class AudioRingDevice;
 class QKeyEvent;
 class Settings;
 
@@ -52,8 +55,13 @@ struct StreamSessionConnectInfo
 	QByteArray morning;
 	ChiakiConnectVideoProfile video_profile;
 	unsigned int audio_buffer_size;
+	ChiakiThreadSched stream_thread_sched;
+	bool network_profile_valid;
+	ChiakiNetworkProfile network_profile;
 	bool fullscreen;
 	bool enable_keyboard;
+	bool feedback_immediate;
+	bool haptics_rumble;
 
 	StreamSessionConnectInfo(Settings *settings, ChiakiTarget target, QString host, QByteArray regist_key, QByteArray morning, bool fullscreen);
 };
@@ -76,8 +84,7 @@ class StreamSession : public QObject
 		QMap<QPair<QString, SetsuTrackingId>, uint8_t> setsu_ids;
 		ChiakiControllerState setsu_state;
 		SetsuDevice *setsu_motion_device;
-		ChiakiOrientationTracker orient_tracker;
-		bool orient_dirty;
+		QVector<ChiakiMotionSample> motion_samples; // read since the last poll, pushed to the session at once
 #endif
 
 		ChiakiControllerState keyboard_state;
@@ -91,11 +98,26 @@ class StreamSession : public QObject
 		QAudioDeviceInfo audio_out_device_info;
 		unsigned int audio_buffer_size;
 		QAudioOutput *audio_output;
-		QIODevice *audio_io;
+		AudioRingDevice *audio_device;
+		// decoded audio waits here for audio_output to pull it through audio_device
+		ChiakiAudioRing audio_ring;
+		bool audio_ring_valid;
+		uint64_t audio_sync_delay_us;
+
+		// PS5 haptics, played on the rumble motors of the controllers
+		ChiakiHapticsPipeline haptics_pipeline;
+		bool haptics_pipeline_valid;
+		uint8_t haptics_rumble_left;	// last ones sent, only touched from the pipeline's timer
+		uint8_t haptics_rumble_right;
 
 		QMap<Qt::Key, int> key_map;
 
+		Settings *settings;
+		QByteArray regist_key;
+
 		void PushAudioFrame(int16_t *buf, size_t samples_count);
+		void FiniAudio();
+		void HapticsReport(int8_t *buf, size_t samples_count);
 #if CHIAKI_GUI_ENABLE_SETSU
 		void HandleSetsuEvent(SetsuEvent *event);
 #endif
@@ -118,6 +140,12 @@ class StreamSession : public QObject
 
 		ChiakiLog *GetChiakiLog()				{ return log.GetChiakiLog(); }
 		QList<Controller *> GetControllers()	{ return controllers.values(); }
+
+		/**
+		 * Time from decoding an audio frame until it is played, including the buffer of the audio device.
+		 * Must be called from the thread of this object.
+		 */
+		uint64_t GetAudioLatencyUs();
 		ChiakiFfmpegDecoder *GetFfmpegDecoder()	{ return ffmpeg_decoder; }
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 		ChiakiPiDecoder *GetPiDecoder()	{ return pi_decoder; }
@@ -134,6 +162,7 @@ class StreamSession : public QObject
 	private slots:
 		void UpdateGamepads();
 		void SendFeedbackState();
+		void UpdateAVSync();
 };
 
 Q_DECLARE_METATYPE(ChiakiQuitReason)
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <audioringdevice.h>
+
+AudioRingDevice::AudioRingDevice(ChiakiAudioRing *ring, QObject *parent)
+	: QIODevice(parent),
+	ring(ring)
+{
+}
+
+qint64 AudioRingDevice::readData(char *data, qint64 maxlen)
+{
+	size_t frame_size = ring->channels * sizeof(int16_t);
+	size_t frames = static_cast<size_t>(maxlen) / frame_size;
+	chiaki_audio_ring_read(ring, reinterpret_cast<int16_t *>(data), frames);
+	return static_cast<qint64>(frames * frame_size);
+}
+
+qint64 AudioRingDevice::writeData(const char *data, qint64 len)
+{
+	Q_UNUSED(data);
+	Q_UNUSED(len);
+	return -1;
+}
+
+qint64 AudioRingDevice::bytesAvailable() const
+{
+	return static_cast<qint64>(chiaki_audio_ring_fill(ring) * ring->channels * sizeof(int16_t)) + QIODevice::bytesAvailable();
+}
@@ -17,7 +17,12 @@ static void LogCb(ChiakiLogLevel level, const char *msg, void *user);
 SessionLog::SessionLog(StreamSession *session, uint32_t level_mask, const QString &filename)
 	: session(session)
 {
-	chiaki_log_init(&log, level_mask, LogCb, this);
+	// file and console output happens on the async log thread, so it never stalls the stream
+	log_async_active = chiaki_log_async_init(&log_async, 10, LogCb, this) == CHIAKI_ERR_SUCCESS;
+	if(log_async_active)
+		chiaki_log_init(&log, level_mask, chiaki_log_async_cb, &log_async);
+	else
+		chiaki_log_init(&log, level_mask, LogCb, this);
 
 	if(filename.isEmpty())
 	{
@@ -44,6 +49,8 @@ SessionLog::SessionLog(StreamSession *session, uint32_t level_mask, const QStrin
 
 SessionLog::~SessionLog()
 {
+	if(log_async_active)
+		chiaki_log_async_fini(&log_async);
 	delete file;
 }
 
@@ -5,6 +5,8 @@
 
 #include <chiaki/config.h>
 
+#include <string.h>
+
 #define SETTINGS_VERSION 2
 
 static void MigrateSettingsTo2(QSettings *settings)
@@ -216,6 +218,23 @@ void Settings::SetAudioBufferSize(unsigned int size)
 	settings.setValue("settings/audio_buffer_size", size);
 }
 
+static const QMap<ChiakiThreadPriority, QString> thread_priority_values = {
+	{ CHIAKI_THREAD_PRIORITY_DEFAULT, "default" },
+	{ CHIAKI_THREAD_PRIORITY_HIGH, "high" },
+	{ CHIAKI_THREAD_PRIORITY_REALTIME, "realtime" }
+};
+
+ChiakiThreadPriority Settings::GetStreamThreadPriority() const
+{
+	auto v = settings.value("settings/stream_thread_priority", thread_priority_values[CHIAKI_THREAD_PRIORITY_DEFAULT]).toString();
+	return thread_priority_values.key(v, CHIAKI_THREAD_PRIORITY_DEFAULT);
+}
+
+void Settings::SetStreamThreadPriority(ChiakiThreadPriority priority)
+{
+	settings.setValue("settings/stream_thread_priority", thread_priority_values[priority]);
+}
+
 ChiakiConnectVideoProfile Settings::GetVideoProfile()
 {
 	ChiakiConnectVideoProfile profile = {};
@@ -246,6 +265,38 @@ void Settings::SetDisconnectAction(DisconnectAction action)
 	settings.setValue("settings/disconnect_action", disconnect_action_values[action]);
 }
 
+static QString NetworkProfileGroup(const QByteArray &host_key)
+{
+	return "network_profiles/" + QString::fromLatin1(host_key.toHex());
+}
+
+bool Settings::GetNetworkProfile(const QByteArray &host_key, ChiakiNetworkProfile *profile)
+{
+	settings.beginGroup(NetworkProfileGroup(host_key));
+	bool valid = settings.contains("mtu_in") && settings.contains("mtu_out") && settings.contains("rtt_us");
+	if(valid)
+	{
+		*profile = {};
+		QByteArray local_addr = settings.value("local_addr").toString().toLatin1();
+		strncpy(profile->local_addr, local_addr.constData(), sizeof(profile->local_addr) - 1);
+		profile->mtu_in = settings.value("mtu_in").toUInt();
+		profile->mtu_out = settings.value("mtu_out").toUInt();
+		profile->rtt_us = settings.value("rtt_us").toULongLong();
+	}
+	settings.endGroup();
+	return valid;
+}
+
+void Settings::SetNetworkProfile(const QByteArray &host_key, const ChiakiNetworkProfile &profile)
+{
+	settings.beginGroup(NetworkProfileGroup(host_key));
+	settings.setValue("local_addr", QString::fromLatin1(profile.local_addr));
+	settings.setValue("mtu_in", profile.mtu_in);
+	settings.setValue("mtu_out", profile.mtu_out);
+	settings.setValue("rtt_us", (qulonglong)profile.rtt_us);
+	settings.endGroup();
+}
+
 void Settings::LoadRegisteredHosts()
 {
 	registered_hosts.clear();
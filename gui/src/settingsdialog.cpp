@@ -18,6 +18,7 @@
 #include <QMap>
 #include <QCheckBox>
 #include <QLineEdit>
+#include <QRegularExpressionValidator>
 #include <QtConcurrent>
 #include <QFutureWatcher>
 
@@ -197,6 +198,46 @@ SettingsDialog::SettingsDialog(Settings *settings, QWidget *parent) : QDialog(pa
 	audio_buffer_size_edit->setPlaceholderText(tr("Default (%1)").arg(settings->GetAudioBufferSizeDefault()));
 	connect(audio_buffer_size_edit, &QLineEdit::textEdited, this, &SettingsDialog::AudioBufferSizeEdited);
 
+	stream_thread_priority_combo_box = new QComboBox(this);
+	static const QList<QPair<ChiakiThreadPriority, QString>> thread_priority_strings = {
+		{ CHIAKI_THREAD_PRIORITY_DEFAULT, tr("Default") },
+		{ CHIAKI_THREAD_PRIORITY_HIGH, tr("High") },
+		{ CHIAKI_THREAD_PRIORITY_REALTIME, tr("Real-time") }
+	};
+	auto current_thread_priority = settings->GetStreamThreadPriority();
+	for(const auto &p : thread_priority_strings)
+	{
+		stream_thread_priority_combo_box->addItem(p.second, (int)p.first);
+		if(current_thread_priority == p.first)
+			stream_thread_priority_combo_box->setCurrentIndex(stream_thread_priority_combo_box->count() - 1);
+	}
+	connect(stream_thread_priority_combo_box, SIGNAL(currentIndexChanged(int)), this, SLOT(StreamThreadPrioritySelected()));
+	stream_settings_layout->addRow(tr("Stream Thread Priority:"), stream_thread_priority_combo_box);
+
+	stream_thread_cpus_edit = new QLineEdit(this);
+	stream_thread_cpus_edit->setValidator(new QRegularExpressionValidator(QRegularExpression("[0-9, ]*"), stream_thread_cpus_edit));
+	QStringList stream_thread_cpus;
+	uint64_t stream_thread_cpu_mask = settings->GetStreamThreadCpuMask();
+	for(int i=0; i<64; i++)
+	{
+		if(stream_thread_cpu_mask & (1ull << i))
+			stream_thread_cpus.append(QString::number(i));
+	}
+	stream_thread_cpus_edit->setText(stream_thread_cpus.join(", "));
+	stream_thread_cpus_edit->setPlaceholderText(tr("Any (e.g. 2, 3)"));
+	stream_settings_layout->addRow(tr("Stream Thread CPUs:"), stream_thread_cpus_edit);
+	connect(stream_thread_cpus_edit, &QLineEdit::textEdited, this, &SettingsDialog::StreamThreadCpusEdited);
+
+	feedback_immediate_check_box = new QCheckBox(this);
+	stream_settings_layout->addRow(tr("Send Input Immediately:"), feedback_immediate_check_box);
+	feedback_immediate_check_box->setChecked(settings->GetFeedbackImmediate());
+	connect(feedback_immediate_check_box, &QCheckBox::stateChanged, this, &SettingsDialog::FeedbackImmediateChanged);
+
+	haptics_rumble_check_box = new QCheckBox(this);
+	stream_settings_layout->addRow(tr("PS5 Haptics as Rumble:"), haptics_rumble_check_box);
+	haptics_rumble_check_box->setChecked(settings->GetHapticsRumble());
+	connect(haptics_rumble_check_box, &QCheckBox::stateChanged, this, &SettingsDialog::HapticsRumbleChanged);
+
 	// Decode Settings
 
 	auto decode_settings = new QGroupBox(tr("Decode Settings"));
@@ -347,6 +388,34 @@ void SettingsDialog::AudioOutputSelected()
 	settings->SetAudioOutDevice(audio_device_combo_box->currentText());
 }
 
+void SettingsDialog::StreamThreadPrioritySelected()
+{
+	settings->SetStreamThreadPriority((ChiakiThreadPriority)stream_thread_priority_combo_box->currentData().toInt());
+}
+
+void SettingsDialog::StreamThreadCpusEdited()
+{
+	uint64_t mask = 0;
+	for(const auto &cpu : stream_thread_cpus_edit->text().split(','))
+	{
+		bool ok;
+		unsigned int i = cpu.trimmed().toUInt(&ok);
+		if(ok && i < 64)
+			mask |= 1ull << i;
+	}
+	settings->SetStreamThreadCpuMask(mask);
+}
+
+void SettingsDialog::FeedbackImmediateChanged()
+{
+	settings->SetFeedbackImmediate(feedback_immediate_check_box->isChecked());
+}
+
+void SettingsDialog::HapticsRumbleChanged()
+{
+	settings->SetHapticsRumble(haptics_rumble_check_box->isChecked());
+}
+
 void SettingsDialog::HardwareDecodeEngineSelected()
 {
 	settings->SetHardwareDecoder(hw_decoder_combo_box->currentData().toString());
@@ -3,17 +3,29 @@
 #include <streamsession.h>
 #include <settings.h>
 #include <controllermanager.h>
+#include <audioringdevice.h>
 
 #include <chiaki/base64.h>
 
 #include <QKeyEvent>
 #include <QAudioOutput>
+#include <QSocketNotifier>
 
 #include <cstring>
+#include <cstdlib>
+#include <algorithm>
 #include <chiaki/session.h>
 
 #define SETSU_UPDATE_INTERVAL_MS 4
 
+// lowest fill of the audio ring to hold, a large device buffer raises it
+#define AUDIO_RING_TARGET_MS 20
+
+#define AV_SYNC_UPDATE_INTERVAL_MS 1000
+
+// changes of the haptics delay below this are not applied, each one is audible as a gap or a jump
+#define HAPTICS_DELAY_TOLERANCE_US 5000
+
 StreamSessionConnectInfo::StreamSessionConnectInfo(Settings *settings, ChiakiTarget target, QString host, QByteArray regist_key, QByteArray morning, bool fullscreen)
 	: settings(settings)
 {
@@ -29,12 +41,19 @@ StreamSessionConnectInfo::StreamSessionConnectInfo(Settings *settings, ChiakiTar
 	this->regist_key = regist_key;
 	this->morning = morning;
 	audio_buffer_size = settings->GetAudioBufferSize();
+	stream_thread_sched.priority = settings->GetStreamThreadPriority();
+	stream_thread_sched.cpu_mask = settings->GetStreamThreadCpuMask();
+	network_profile = {};
+	network_profile_valid = settings->GetNetworkProfile(regist_key, &network_profile);
 	this->fullscreen = fullscreen;
 	this->enable_keyboard = false; // TODO: from settings
+	feedback_immediate = settings->GetFeedbackImmediate();
+	haptics_rumble = settings->GetHapticsRumble();
 }
 
 static void AudioSettingsCb(uint32_t channels, uint32_t rate, void *user);
 static void AudioFrameCb(int16_t *buf, size_t samples_count, void *user);
+static void HapticsReportCb(int8_t *buf, size_t samples_count, void *user);
 static void EventCb(ChiakiEvent *event, void *user);
 #if CHIAKI_GUI_ENABLE_SETSU
 static void SessionSetsuCb(SetsuEvent *event, void *user);
@@ -49,7 +68,14 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	pi_decoder(nullptr),
 #endif
 	audio_output(nullptr),
-	audio_io(nullptr)
+	audio_device(nullptr),
+	audio_ring_valid(false),
+	audio_sync_delay_us(0),
+	haptics_pipeline_valid(false),
+	haptics_rumble_left(0),
+	haptics_rumble_right(0),
+	settings(connect_info.settings),
+	regist_key(connect_info.regist_key)
 {
 	connected = false;
 	ChiakiErrorCode err;
@@ -108,6 +134,11 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	chiaki_connect_info.video_profile = connect_info.video_profile;
 	chiaki_connect_info.video_profile_auto_downgrade = true;
 	chiaki_connect_info.enable_keyboard = false;
+	// the PS5 only sends haptics instead of rumble when it sees a DualSense
+	chiaki_connect_info.enable_dualsense = chiaki_connect_info.ps5 && connect_info.haptics_rumble;
+	chiaki_connect_info.takion_thread_sched = connect_info.stream_thread_sched;
+	chiaki_connect_info.network_profile_valid = connect_info.network_profile_valid;
+	chiaki_connect_info.network_profile = connect_info.network_profile;
 
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 	if(connect_info.decoder == Decoder::Pi && chiaki_connect_info.video_profile.codec != CHIAKI_CODEC_H264)
@@ -131,11 +162,27 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	if(err != CHIAKI_ERR_SUCCESS)
 		throw ChiakiException("Chiaki Session Init failed: " + QString::fromLocal8Bit(chiaki_error_string(err)));
 
+	chiaki_session_set_feedback_immediate(&session, connect_info.feedback_immediate);
+
 	chiaki_opus_decoder_set_cb(&opus_decoder, AudioSettingsCb, AudioFrameCb, this);
 	ChiakiAudioSink audio_sink;
 	chiaki_opus_decoder_get_sink(&opus_decoder, &audio_sink);
 	chiaki_session_set_audio_sink(&session, &audio_sink);
 
+	if(chiaki_connect_info.enable_dualsense)
+	{
+		ChiakiHapticsConfig haptics_config;
+		chiaki_haptics_config_dualsense(&haptics_config);
+		err = chiaki_haptics_pipeline_init(&haptics_pipeline, GetChiakiLog(), true, &haptics_config, HapticsReportCb, this);
+		if(err == CHIAKI_ERR_SUCCESS)
+		{
+			haptics_pipeline_valid = true;
+			chiaki_session_set_haptics_pipeline(&session, &haptics_pipeline);
+		}
+		else
+			CHIAKI_LOGE(GetChiakiLog(), "Failed to init Haptics Pipeline: %s", chiaki_error_string(err));
+	}
+
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 	if(pi_decoder)
 		chiaki_session_set_video_sample_cb(&session, chiaki_pi_decoder_video_sample_cb, pi_decoder);
@@ -156,22 +203,37 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 #if CHIAKI_GUI_ENABLE_SETSU
 	setsu_motion_device = nullptr;
 	chiaki_controller_state_set_idle(&setsu_state);
-	orient_dirty = true;
-	chiaki_orientation_tracker_init(&orient_tracker);
 	setsu = setsu_new();
-	auto timer = new QTimer(this);
-	connect(timer, &QTimer::timeout, this, [this]{
-		setsu_poll(setsu, SessionSetsuCb, this);
-		if(orient_dirty)
+	if(setsu)
+	{
+		auto poll_setsu = [this]{
+			setsu_poll(setsu, SessionSetsuCb, this);
+			if(!motion_samples.isEmpty())
+			{
+				chiaki_session_push_motion(&session, motion_samples.constData(), (size_t)motion_samples.size());
+				motion_samples.clear();
+			}
+		};
+		int setsu_fd = setsu_get_fd(setsu);
+		if(setsu_fd >= 0)
 		{
-			chiaki_orientation_tracker_apply_to_controller_state(&orient_tracker, &setsu_state);
-			SendFeedbackState();
-			orient_dirty = false;
+			// only wake up when the kernel has touchpad/motion reports or hotplug events for us
+			auto notifier = new QSocketNotifier(setsu_fd, QSocketNotifier::Read, this);
+			connect(notifier, &QSocketNotifier::activated, this, poll_setsu);
 		}
-	});
-	timer->start(SETSU_UPDATE_INTERVAL_MS);
+		else
+		{
+			auto timer = new QTimer(this);
+			connect(timer, &QTimer::timeout, this, poll_setsu);
+			timer->start(SETSU_UPDATE_INTERVAL_MS);
+		}
+	}
 #endif
 
+	auto av_sync_timer = new QTimer(this);
+	connect(av_sync_timer, &QTimer::timeout, this, &StreamSession::UpdateAVSync);
+	av_sync_timer->start(AV_SYNC_UPDATE_INTERVAL_MS);
+
 	key_map = connect_info.key_map;
 	UpdateGamepads();
 }
@@ -179,14 +241,19 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 StreamSession::~StreamSession()
 {
 	chiaki_session_join(&session);
+	// the session pushes frames into it until joined
+	if(haptics_pipeline_valid)
+		chiaki_haptics_pipeline_fini(&haptics_pipeline);
 	chiaki_session_fini(&session);
 	chiaki_opus_decoder_fini(&opus_decoder);
+	FiniAudio();
 #if CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 	for(auto controller : controllers)
 		delete controller;
 #endif
 #if CHIAKI_GUI_ENABLE_SETSU
-	setsu_free(setsu);
+	if(setsu)
+		setsu_free(setsu);
 #endif
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 	if(pi_decoder)
@@ -346,11 +413,32 @@ void StreamSession::SendFeedbackState()
 	chiaki_session_set_controller_state(&session, &state);
 }
 
-void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
+void StreamSession::FiniAudio()
 {
+	// the device buffer is only known while it is still open
+	uint64_t latency_us = GetAudioLatencyUs();
+	if(audio_output)
+		audio_output->stop();
 	delete audio_output;
 	audio_output = nullptr;
-	audio_io = nullptr;
+	delete audio_device;
+	audio_device = nullptr;
+
+	if(!audio_ring_valid)
+		return;
+	ChiakiAudioRingStats stats;
+	chiaki_audio_ring_stats(&audio_ring, &stats);
+	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Ring had a latency of %.1f ms (%.1f ms including the device) at a rate of %.4f, underruns %llu, overflow frames %llu",
+				(double)stats.latency_us / 1000.0, (double)latency_us / 1000.0, stats.ratio,
+				(unsigned long long)stats.underruns, (unsigned long long)stats.overflow_frames);
+	chiaki_audio_ring_fini(&audio_ring);
+	audio_ring_valid = false;
+	audio_sync_delay_us = 0;
+}
+
+void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
+{
+	FiniAudio();
 
 	QAudioFormat audio_format;
 	audio_format.setSampleRate(rate);
@@ -370,18 +458,112 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 
 	audio_output = new QAudioOutput(audio_device_info, audio_format, this);
 	audio_output->setBufferSize(audio_buffer_size);
-	audio_io = audio_output->start();
 
-	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Device %s opened with %u channels @ %u Hz, buffer size %u",
+	// The device pulls about a period at a time, so the ring must hold at least that much to not run dry in between.
+	// periodSize() is only known after start(), but backends mostly split the buffer into a few periods.
+	size_t frame_size = channels * sizeof(int16_t);
+	size_t buffer_frames = audio_buffer_size / frame_size;
+	size_t target_frames = rate * AUDIO_RING_TARGET_MS / 1000;
+	if(buffer_frames / 2 > target_frames)
+		target_frames = buffer_frames / 2;
+	ChiakiErrorCode err = chiaki_audio_ring_init(&audio_ring, channels, rate, target_frames * 4 + buffer_frames, target_frames);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to init Audio Ring: %s", chiaki_error_string(err));
+		delete audio_output;
+		audio_output = nullptr;
+		return;
+	}
+	audio_ring_valid = true;
+
+	audio_device = new AudioRingDevice(&audio_ring, this);
+	audio_device->open(QIODevice::ReadOnly);
+	audio_output->start(audio_device);
+
+	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Device %s opened with %u channels @ %u Hz, buffer size %u, target latency %.1f ms",
 				audio_device_info.deviceName().toLocal8Bit().constData(),
-				channels, rate, audio_output->bufferSize());
+				channels, rate, audio_output->bufferSize(),
+				(double)target_frames * 1000.0 / (double)rate);
 }
 
 void StreamSession::PushAudioFrame(int16_t *buf, size_t samples_count)
 {
-	if(!audio_io)
+	// Frames are pushed from the audio receiver's playout thread. InitAudio() runs on the thread of this object,
+	// invoked through a BlockingQueuedConnection from the Takion thread in chiaki_audio_receiver_stream_info().
+	// The audio receiver holds its sink_mutex around both, so the ring can't change while writing.
+	if(!audio_ring_valid)
 		return;
-	audio_io->write((const char *)buf, static_cast<qint64>(samples_count * 2 * 2));
+	chiaki_audio_ring_write(&audio_ring, buf, samples_count);
+}
+
+uint64_t StreamSession::GetAudioLatencyUs()
+{
+	if(!audio_ring_valid || !audio_output)
+		return 0;
+	ChiakiAudioRingStats stats;
+	chiaki_audio_ring_stats(&audio_ring, &stats);
+	size_t frame_size = audio_ring.channels * sizeof(int16_t);
+	qint64 device_bytes = audio_output->bufferSize() - audio_output->bytesFree();
+	if(device_bytes < 0)
+		device_bytes = 0;
+	return stats.latency_us + static_cast<uint64_t>(device_bytes) / frame_size * 1000000 / audio_ring.rate;
+}
+
+void StreamSession::HapticsReport(int8_t *buf, size_t samples_count)
+{
+	// the motors can't follow the waveform, so each report becomes the strength of its peak
+	int peak[2] = { 0, 0 };
+	for(size_t i = 0; i < samples_count * CHIAKI_HAPTICS_STREAM_CHANNELS; i++)
+		peak[i % 2] = std::max(peak[i % 2], std::abs((int)buf[i]));
+	uint8_t left = static_cast<uint8_t>(std::min(peak[0] * 2, 0xff));
+	uint8_t right = static_cast<uint8_t>(std::min(peak[1] * 2, 0xff));
+	if(left == haptics_rumble_left && right == haptics_rumble_right)
+		return;
+	haptics_rumble_left = left;
+	haptics_rumble_right = right;
+	QMetaObject::invokeMethod(this, [this, left, right]() {
+		for(auto controller : controllers)
+			controller->SetRumble(left, right);
+	});
+}
+
+void StreamSession::UpdateAVSync()
+{
+	if(haptics_pipeline_valid)
+	{
+		// haptics are not part of the sync, they just follow the audio including its corrections
+		ChiakiHapticsStats stats;
+		chiaki_haptics_pipeline_stats(&haptics_pipeline, &stats);
+		// both measured from the arrival of a frame, so each including its own jitter buffer
+		uint64_t audio_latency_us = chiaki_session_get_audio_jitter_delay_us(&session) + GetAudioLatencyUs();
+		uint64_t delay_us = audio_latency_us > stats.latency_us ? audio_latency_us - stats.latency_us : 0;
+		uint64_t diff_us = delay_us > stats.delay_us ? delay_us - stats.delay_us : stats.delay_us - delay_us;
+		if(diff_us >= HAPTICS_DELAY_TOLERANCE_US)
+			chiaki_haptics_pipeline_set_delay(&haptics_pipeline, delay_us);
+	}
+
+	if(!audio_ring_valid || !audio_output)
+		return;
+
+	// The configured latency rather than the measured one, which would lag behind while a new delay is reached.
+	// Decoding and presenting video is assumed to take no time, so nothing is reported for it.
+	uint64_t audio_playout_us = audio_ring.target_frames * 1000000 / audio_ring.rate
+		+ static_cast<uint64_t>(audio_output->bufferSize()) / (audio_ring.channels * sizeof(int16_t)) * 1000000 / audio_ring.rate;
+	chiaki_av_sync_set_playout_delay(&session.av_sync, CHIAKI_AV_SYNC_STREAM_AUDIO, audio_playout_us, 0);
+
+	ChiakiAVSyncCorrection correction;
+	chiaki_av_sync_correction(&session.av_sync, &correction);
+	if(!correction.valid)
+		return;
+
+	// Only audio can be held back here, late audio is left to the audio ring's drift compensation.
+	uint64_t delay_us = correction.delay_us[CHIAKI_AV_SYNC_STREAM_AUDIO];
+	if(delay_us == audio_sync_delay_us)
+		return;
+	audio_sync_delay_us = delay_us;
+	chiaki_audio_ring_set_delay(&audio_ring, static_cast<size_t>(delay_us * audio_ring.rate / 1000000));
+	CHIAKI_LOGI(log.GetChiakiLog(), "Audio/Video skew is %.1f ms, delaying audio by %.1f ms, audio latency now %.1f ms",
+				(double)correction.skew_us / 1000.0, (double)delay_us / 1000.0, (double)GetAudioLatencyUs() / 1000.0);
 }
 
 void StreamSession::Event(ChiakiEvent *event)
@@ -407,6 +589,13 @@ void StreamSession::Event(ChiakiEvent *event)
 			});
 			break;
 		}
+		case CHIAKI_EVENT_NETWORK_PROFILE: {
+			ChiakiNetworkProfile profile = event->network_profile;
+			QMetaObject::invokeMethod(this, [this, profile]() {
+				settings->SetNetworkProfile(regist_key, profile);
+			});
+			break;
+		}
 		default:
 			break;
 	}
@@ -467,8 +656,8 @@ void StreamSession::HandleSetsuEvent(SetsuEvent *event)
 						break;
 					CHIAKI_LOGI(GetChiakiLog(), "Setsu Motion Device %s disconnected", event->path);
 					setsu_motion_device = nullptr;
-					chiaki_orientation_tracker_init(&orient_tracker);
-					orient_dirty = true;
+					motion_samples.clear();
+					chiaki_session_reset_motion(&session);
 					break;
 			}
 			break;
@@ -508,13 +697,15 @@ void StreamSession::HandleSetsuEvent(SetsuEvent *event)
 		case SETSU_EVENT_BUTTON_UP:
 			setsu_state.buttons &= ~CHIAKI_CONTROLLER_BUTTON_TOUCHPAD;
 			break;
-		case SETSU_EVENT_MOTION:
-			chiaki_orientation_tracker_update(&orient_tracker,
-					event->motion.gyro_x, event->motion.gyro_y, event->motion.gyro_z,
-					event->motion.accel_x, event->motion.accel_y, event->motion.accel_z,
-					event->motion.timestamp);
-			orient_dirty = true;
+		case SETSU_EVENT_MOTION: {
+			ChiakiMotionSample sample = {
+				event->motion.gyro_x, event->motion.gyro_y, event->motion.gyro_z,
+				event->motion.accel_x, event->motion.accel_y, event->motion.accel_z,
+				event->motion.timestamp
+			};
+			motion_samples.append(sample);
 			break;
+		}
 	}
 }
 #endif
@@ -533,6 +724,7 @@ class StreamSessionPrivate
 		}
 
 		static void PushAudioFrame(StreamSession *session, int16_t *buf, size_t samples_count)	{ session->PushAudioFrame(buf, samples_count); }
+		static void HapticsReport(StreamSession *session, int8_t *buf, size_t samples_count)	{ session->HapticsReport(buf, samples_count); }
 		static void Event(StreamSession *session, ChiakiEvent *event)							{ session->Event(event); }
 #if CHIAKI_GUI_ENABLE_SETSU
 		static void HandleSetsuEvent(StreamSession *session, SetsuEvent *event)					{ session->HandleSetsuEvent(event); }
@@ -552,6 +744,12 @@ static void AudioFrameCb(int16_t *buf, size_t samples_count, void *user)
 	StreamSessionPrivate::PushAudioFrame(session, buf, samples_count);
 }
 
+static void HapticsReportCb(int8_t *buf, size_t samples_count, void *user)
+{
+	auto session = reinterpret_cast<StreamSession *>(user);
+	StreamSessionPrivate::HapticsReport(session, buf, samples_count);
+}
+
 static void EventCb(ChiakiEvent *event, void *user)
 {
 	auto session = reinterpret_cast<StreamSession *>(user);
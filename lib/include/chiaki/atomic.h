@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_ATOMIC_H
+#define CHIAKI_ATOMIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <windows.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Minimal portable atomics for lock-free structures inside the library.
+ * Loads have acquire, stores have release and read-modify-write operations have
+ * sequentially consistent semantics.
+ * Only ever access the underlying variables through these functions.
+ */
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+static inline uint32_t chiaki_atomic_load_u32(volatile uint32_t *p) { return (uint32_t)InterlockedCompareExchange((volatile LONG *)p, 0, 0); }
+static inline void chiaki_atomic_store_u32(volatile uint32_t *p, uint32_t v) { InterlockedExchange((volatile LONG *)p, (LONG)v); }
+static inline uint32_t chiaki_atomic_fetch_add_u32(volatile uint32_t *p, uint32_t v) { return (uint32_t)InterlockedExchangeAdd((volatile LONG *)p, (LONG)v); }
+static inline uint32_t chiaki_atomic_exchange_u32(volatile uint32_t *p, uint32_t v) { return (uint32_t)InterlockedExchange((volatile LONG *)p, (LONG)v); }
+static inline bool chiaki_atomic_cas_u32(volatile uint32_t *p, uint32_t *expected, uint32_t desired)
+{
+	uint32_t prev = (uint32_t)InterlockedCompareExchange((volatile LONG *)p, (LONG)desired, (LONG)*expected);
+	if(prev == *expected)
+		return true;
+	*expected = prev;
+	return false;
+}
+
+static inline uint64_t chiaki_atomic_load_u64(volatile uint64_t *p) { return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)p, 0, 0); }
+static inline void chiaki_atomic_store_u64(volatile uint64_t *p, uint64_t v) { InterlockedExchange64((volatile LONG64 *)p, (LONG64)v); }
+static inline uint64_t chiaki_atomic_fetch_add_u64(volatile uint64_t *p, uint64_t v) { return (uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)p, (LONG64)v); }
+static inline uint64_t chiaki_atomic_exchange_u64(volatile uint64_t *p, uint64_t v) { return (uint64_t)InterlockedExchange64((volatile LONG64 *)p, (LONG64)v); }
+static inline bool chiaki_atomic_cas_u64(volatile uint64_t *p, uint64_t *expected, uint64_t desired)
+{
+	uint64_t prev = (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)p, (LONG64)desired, (LONG64)*expected);
+	if(prev == *expected)
+		return true;
+	*expected = prev;
+	return false;
+}
+
+static inline void *chiaki_atomic_load_ptr(void *volatile *p) { return InterlockedCompareExchangePointer(p, NULL, NULL); }
+static inline void chiaki_atomic_store_ptr(void *volatile *p, void *v) { InterlockedExchangePointer(p, v); }
+static inline void *chiaki_atomic_exchange_ptr(void *volatile *p, void *v) { return InterlockedExchangePointer(p, v); }
+static inline bool chiaki_atomic_cas_ptr(void *volatile *p, void **expected, void *desired)
+{
+	void *prev = InterlockedCompareExchangePointer(p, desired, *expected);
+	if(prev == *expected)
+		return true;
+	*expected = prev;
+	return false;
+}
+
+#else
+
+static inline uint32_t chiaki_atomic_load_u32(volatile uint32_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void chiaki_atomic_store_u32(volatile uint32_t *p, uint32_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline uint32_t chiaki_atomic_fetch_add_u32(volatile uint32_t *p, uint32_t v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+static inline uint32_t chiaki_atomic_exchange_u32(volatile uint32_t *p, uint32_t v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline bool chiaki_atomic_cas_u32(volatile uint32_t *p, uint32_t *expected, uint32_t desired)
+{
+	return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t chiaki_atomic_load_u64(volatile uint64_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void chiaki_atomic_store_u64(volatile uint64_t *p, uint64_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline uint64_t chiaki_atomic_fetch_add_u64(volatile uint64_t *p, uint64_t v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+static inline uint64_t chiaki_atomic_exchange_u64(volatile uint64_t *p, uint64_t v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline bool chiaki_atomic_cas_u64(volatile uint64_t *p, uint64_t *expected, uint64_t desired)
+{
+	return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void *chiaki_atomic_load_ptr(void *volatile *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void chiaki_atomic_store_ptr(void *volatile *p, void *v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline void *chiaki_atomic_exchange_ptr(void *volatile *p, void *v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline bool chiaki_atomic_cas_ptr(void *volatile *p, void **expected, void *desired)
+{
+	return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_ATOMIC_H
@@ -9,14 +9,24 @@
 #include "takion.h"
 #include "thread.h"
 #include "packetstats.h"
+#include "jitterbuffer.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE 64
+
 typedef void (*ChiakiAudioSinkHeader)(ChiakiAudioHeader *header, void *user);
 typedef void (*ChiakiAudioSinkFrame)(uint8_t *buf, size_t buf_size, void *user);
 
+/**
+ * Called instead of ChiakiAudioSinkFrame for a frame that was lost.
+ *
+ * @param next_buf the frame following the lost one if available, for in-band FEC, otherwise NULL to conceal the loss
+ */
+typedef void (*ChiakiAudioSinkFrameLost)(uint8_t *next_buf, size_t next_buf_size, void *user);
+
 /**
  * Sink that receives Audio encoded as Opus
  */
@@ -25,6 +35,7 @@ typedef struct chiaki_audio_sink_t
 	void *user;
 	ChiakiAudioSinkHeader header_cb;
 	ChiakiAudioSinkFrame frame_cb;
+	ChiakiAudioSinkFrameLost frame_lost_cb; // optional
 } ChiakiAudioSink;
 
 typedef struct chiaki_audio_receiver_t
@@ -32,9 +43,32 @@ typedef struct chiaki_audio_receiver_t
 	struct chiaki_session_t *session;
 	ChiakiLog *log;
 	ChiakiMutex mutex;
+
+	/**
+	 * Held around every call into the sinks, which come from the receiving thread and the jitter buffer's playout thread.
+	 * Taken after mutex, if both are needed.
+	 */
+	ChiakiMutex sink_mutex;
 	ChiakiSeqNum16 frame_index_prev;
-	bool frame_index_startup; // whether frame_index_prev has definitely not wrapped yet
 	ChiakiPacketStats *packet_stats;
+
+	/**
+	 * Frames received within the last CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE frames up to and including frame_window_end,
+	 * bit i corresponds to frame_window_end - i.
+	 * Frames before the first one received are marked as received so they are neither recovered nor counted as missed.
+	 */
+	bool frame_window_valid;
+	ChiakiSeqNum16 frame_window_end;
+	uint64_t frame_window_received;
+	uint64_t frames_recovered;
+	uint64_t frames_missed;
+
+	/**
+	 * Audio frames are played out from here by the jitter buffer's own thread once the stream info is known,
+	 * so a sink that blocks holds up neither the receiving thread nor the shared timer service.
+	 * Haptics frames are passed on directly.
+	 */
+	ChiakiJitterBuffer jitter_buffer;
 } ChiakiAudioReceiver;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats);
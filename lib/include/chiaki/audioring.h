@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIORING_H
+#define CHIAKI_AUDIORING_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maximum deviation of the playback rate from the nominal one used to hold the target fill.
+ */
+#define CHIAKI_AUDIO_RING_RATIO_MAX 0.005
+
+/**
+ * Lock-free single-producer single-consumer ring of interleaved 16 bit PCM,
+ * meant to sit between a decoder pushing frames and an audio device pulling them.
+ *
+ * Because the clock of the sender and the one of the local audio device never run at exactly the same rate,
+ * the consumer side tracks the fill level and resamples slightly (at most CHIAKI_AUDIO_RING_RATIO_MAX)
+ * to keep it close to the target, instead of letting the latency grow or run empty over time.
+ *
+ * chiaki_audio_ring_write() must only be called from one thread and chiaki_audio_ring_read() from one other thread.
+ * Anything else is safe to call from anywhere.
+ */
+typedef struct chiaki_audio_ring_t
+{
+	int16_t *buf;
+	size_t size; // in frames of all channels, power of two
+	unsigned int channels;
+	unsigned int rate;
+	size_t target_frames;
+	volatile uint64_t delay_frames; // added to target_frames, e.g. to hold audio back for lip-sync
+
+	// total frames written and read, only ever increasing
+	volatile uint64_t write_pos;
+	volatile uint64_t read_pos;
+
+	// only touched by the consumer
+	bool playing; // false while buffering up to the target after start or an underrun
+	double frac; // position between read_pos and read_pos + 1 for interpolation
+	double fill_avg; // smoothed fill in frames
+
+	volatile uint64_t latency_us;
+	volatile uint64_t ratio_ppm; // current playback rate relative to nominal, times 1000000
+	volatile uint64_t underruns;
+	volatile uint64_t overflow_frames;
+} ChiakiAudioRing;
+
+typedef struct chiaki_audio_ring_stats_t
+{
+	uint64_t latency_us; // smoothed time a frame spends in the ring
+	double ratio; // current playback rate relative to nominal
+	uint64_t underruns; // times the ring ran empty while playing
+	uint64_t overflow_frames; // frames dropped because the ring was full
+} ChiakiAudioRingStats;
+
+/**
+ * @param capacity_frames will be rounded up to the next power of two
+ * @param target_frames fill level to hold, must be less than capacity_frames
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_ring_init(ChiakiAudioRing *ring, unsigned int channels, unsigned int rate, size_t capacity_frames, size_t target_frames);
+CHIAKI_EXPORT void chiaki_audio_ring_fini(ChiakiAudioRing *ring);
+
+/**
+ * Hold the given number of frames on top of the target fill, which is reached gradually through the resampling.
+ * Clamped so the ring can still take a few target fills more.
+ */
+CHIAKI_EXPORT void chiaki_audio_ring_set_delay(ChiakiAudioRing *ring, size_t delay_frames);
+
+/**
+ * Producer side. Frames that don't fit anymore are dropped.
+ *
+ * @return number of frames written
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_write(ChiakiAudioRing *ring, const int16_t *buf, size_t frames);
+
+/**
+ * Consumer side. Always fills all of buf, with silence where no data is available.
+ *
+ * @return number of frames in buf that contain actual data, the rest is silence
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_read(ChiakiAudioRing *ring, int16_t *buf, size_t frames);
+
+/**
+ * @return number of frames currently buffered
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_fill(ChiakiAudioRing *ring);
+
+CHIAKI_EXPORT void chiaki_audio_ring_stats(ChiakiAudioRing *ring, ChiakiAudioRingStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AUDIORING_H
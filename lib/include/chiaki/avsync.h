@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AVSYNC_H
+#define CHIAKI_AVSYNC_H
+
+#include "common.h"
+#include "thread.h"
+#include "seqnum.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// default maximum audio/video skew before any correction is asked for
+#define CHIAKI_AV_SYNC_BOUND_DEFAULT_US 40000
+
+// arrivals per stream to take the minimum transit offset from
+#define CHIAKI_AV_SYNC_WINDOW_SIZE 128
+
+// arrivals per stream needed before corrections are given
+#define CHIAKI_AV_SYNC_SAMPLES_MIN 16
+
+typedef enum {
+	CHIAKI_AV_SYNC_STREAM_AUDIO,
+	CHIAKI_AV_SYNC_STREAM_VIDEO,
+	CHIAKI_AV_SYNC_STREAMS_COUNT
+} ChiakiAVSyncStream;
+
+typedef struct chiaki_av_sync_stream_state_t
+{
+	// frames per second as rate_num / rate_den, so frame durations like 1/60 s don't accumulate rounding errors
+	uint64_t rate_num; // 0 until known, arrivals are ignored then
+	uint64_t rate_den;
+	bool index_valid;
+	ChiakiSeqNum16 index_last;
+	uint64_t index_ext; // index_last extended to 64 bits
+
+	// arrival time minus sender time of recent frames
+	int64_t offsets_us[CHIAKI_AV_SYNC_WINDOW_SIZE];
+	size_t offsets_count;
+	size_t offsets_next;
+
+	uint64_t playout_delay_us;
+	uint64_t droppable_us;
+} ChiakiAVSyncStreamState;
+
+/**
+ * Estimates how far apart audio and video are presented and what the frontend should do about it.
+ *
+ * Frame indices of both streams count from the start of the stream at their nominal frame rate,
+ * so index / frame rate serves as a common sender clock. The smallest difference between arrival and sender time
+ * over a window of recent frames estimates each stream's transit delay without the jitter.
+ * Adding the frontend's playout delay of each stream gives its presentation time relative to the content.
+ *
+ * Thread-safe.
+ */
+typedef struct chiaki_av_sync_t
+{
+	ChiakiMutex mutex;
+	uint64_t bound_us;
+	ChiakiAVSyncStreamState streams[CHIAKI_AV_SYNC_STREAMS_COUNT];
+} ChiakiAVSync;
+
+typedef struct chiaki_av_sync_correction_t
+{
+	bool valid; // false until both streams have enough arrivals, everything else is 0 then
+	int64_t skew_us; // presentation of audio minus presentation of video, positive if audio comes late
+
+	/**
+	 * Total delay to hold the stream back by, in addition to the playout delay reported for it.
+	 * Only ever non-zero for the stream that is presented earlier and only if the skew exceeds the bound.
+	 */
+	uint64_t delay_us[CHIAKI_AV_SYNC_STREAMS_COUNT];
+
+	/**
+	 * Amount of already buffered data to drop from the stream now.
+	 * Only ever non-zero for the stream that is presented later, preferred over delaying the other one
+	 * and never more than the droppable amount reported for it.
+	 */
+	uint64_t drop_us[CHIAKI_AV_SYNC_STREAMS_COUNT];
+} ChiakiAVSyncCorrection;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_av_sync_init(ChiakiAVSync *sync);
+CHIAKI_EXPORT void chiaki_av_sync_fini(ChiakiAVSync *sync);
+
+/**
+ * @param bound_us maximum skew that is tolerated without correction
+ */
+CHIAKI_EXPORT void chiaki_av_sync_set_bound(ChiakiAVSync *sync, uint64_t bound_us);
+
+/**
+ * Set the nominal frame rate of the stream as rate_num / rate_den frames per second,
+ * e.g. the sample rate over the samples per frame for audio, which drops all arrivals so far if it changes.
+ *
+ * @param rate_num 0 if unknown
+ */
+CHIAKI_EXPORT void chiaki_av_sync_set_frame_rate(ChiakiAVSync *sync, ChiakiAVSyncStream stream, uint64_t rate_num, uint64_t rate_den);
+
+/**
+ * Report that the frame with the given index has arrived.
+ *
+ * @param arrival_us local time of arrival, e.g. chiaki_time_now_monotonic_us()
+ */
+CHIAKI_EXPORT void chiaki_av_sync_push(ChiakiAVSync *sync, ChiakiAVSyncStream stream, ChiakiSeqNum16 frame_index, uint64_t arrival_us);
+
+/**
+ * Report the frontend's delay between the arrival of a frame of the stream and its presentation.
+ * This must not include any delay applied because of a previous correction, otherwise the correction would undo itself.
+ *
+ * @param droppable_us part of playout_delay_us that is buffered data the frontend could drop to catch up
+ */
+CHIAKI_EXPORT void chiaki_av_sync_set_playout_delay(ChiakiAVSync *sync, ChiakiAVSyncStream stream, uint64_t playout_delay_us, uint64_t droppable_us);
+
+CHIAKI_EXPORT void chiaki_av_sync_correction(ChiakiAVSync *sync, ChiakiAVSyncCorrection *correction);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AVSYNC_H
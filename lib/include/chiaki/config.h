@@ -5,5 +5,8 @@
 
 #define CHIAKI_LIB_ENABLE_OPUS 1
 #define CHIAKI_LIB_ENABLE_PI_DECODER 0
+#define CHIAKI_LIB_ENABLE_TRACE 0
+
+#define CHIAKI_LOG_COMPILE_MASK (((int)CHIAKI_LOG_DEBUG << 1) - 1)
 
 #endif // CHIAKI_CONFIG_H
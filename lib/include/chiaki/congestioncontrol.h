@@ -4,8 +4,9 @@
 #define CHIAKI_CONGESTIONCONTROL_H
 
 #include "takion.h"
-#include "thread.h"
+#include "timer.h"
 #include "packetstats.h"
+#include "trendline.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,14 +16,23 @@ typedef struct chiaki_congestion_control_t
 {
 	ChiakiTakion *takion;
 	ChiakiPacketStats *stats;
-	ChiakiThread thread;
-	ChiakiBoolPredCond stop_cond;
+	ChiakiTimer timer;
+	ChiakiPacketStatsSnapshot stats_prev; // only touched by the timer callback
+	ChiakiOveruseDetector detector; // only touched by the timer callback
 } ChiakiCongestionControl;
 
+/**
+ * Start sending congestion reports for stats from the timer service of takion.
+ *
+ * Besides forwarding received and lost packets, the one-way delay trend of stats is watched
+ * to detect queues building up on the path before packets are actually dropped.
+ * While that is the case, reports are sent more often and include additional loss
+ * so the host lowers its bitrate early.
+ */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats);
 
 /**
- * Stop control and join the thread
+ * Stop control, no more reports are sent after this returns
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_stop(ChiakiCongestionControl *control);
 
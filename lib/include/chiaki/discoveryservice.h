@@ -5,6 +5,7 @@
 #define CHIAKI_DISCOVERYSERVICE_H
 
 #include "discovery.h"
+#include "timer.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -40,8 +41,9 @@ typedef struct chiaki_discovery_service_t
 	size_t hosts_count;
 	ChiakiMutex state_mutex;
 
-	ChiakiThread thread;
-	ChiakiBoolPredCond stop_cond;
+	ChiakiDiscoveryThread discovery_thread;
+	ChiakiTimerService *timer_service; // shared
+	ChiakiTimer ping_timer;
 } ChiakiDiscoveryService;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryService *service, ChiakiDiscoveryServiceOptions *options, ChiakiLog *log);
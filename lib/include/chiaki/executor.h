@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_EXECUTOR_H
+#define CHIAKI_EXECUTOR_H
+
+#include "common.h"
+#include "thread.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_EXECUTOR_WORKERS_MAX 64
+
+typedef void (*ChiakiExecutorTaskCb)(void *user);
+
+typedef struct chiaki_executor_task_t
+{
+	ChiakiExecutorTaskCb cb;
+	void *user;
+} ChiakiExecutorTask;
+
+typedef struct chiaki_executor_t ChiakiExecutor;
+
+typedef struct chiaki_executor_worker_t
+{
+	ChiakiExecutor *executor;
+	size_t index;
+	ChiakiThread thread;
+
+	/**
+	 * Deque of tasks, the owning worker pushes and pops at the tail,
+	 * other workers steal from the head.
+	 */
+	ChiakiMutex mutex;
+	ChiakiExecutorTask *tasks;
+	size_t tasks_size; // power of 2
+	uint64_t head;
+	uint64_t tail;
+} ChiakiExecutorWorker;
+
+/**
+ * Fixed number of worker threads running short tasks, with one work-stealing deque per worker.
+ *
+ * Tasks must not block for long, as every blocked task takes away a whole worker.
+ */
+struct chiaki_executor_t
+{
+	ChiakiExecutorWorker *workers;
+	size_t workers_count;
+	volatile uint32_t next_worker; // round robin target for tasks submitted from outside
+	volatile uint64_t pending; // tasks submitted, but not yet taken by a worker
+	volatile uint32_t sleeping; // workers waiting on cond
+
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	bool should_stop;
+};
+
+/**
+ * @param workers_count number of threads, 0 to use the number of cpus
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_init(ChiakiExecutor *executor, size_t workers_count);
+
+/**
+ * Stop all workers. Tasks that have not started yet are dropped,
+ * so owners of tasks must make sure they have finished before.
+ */
+CHIAKI_EXPORT void chiaki_executor_fini(ChiakiExecutor *executor);
+
+/**
+ * Schedule cb to be called once on any of the workers.
+ *
+ * When called from a task, the new task is queued on the same worker, to be run next
+ * unless another idle worker steals it first.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_submit(ChiakiExecutor *executor, ChiakiExecutorTaskCb cb, void *user);
+
+/**
+ * Get the executor shared by everything in the process, starting it if necessary.
+ * Requires chiaki_lib_init() to have been called.
+ *
+ * @return the executor or NULL on failure
+ */
+CHIAKI_EXPORT ChiakiExecutor *chiaki_executor_shared_ref();
+
+/**
+ * Release a reference from chiaki_executor_shared_ref(), stopping the executor after the last one.
+ */
+CHIAKI_EXPORT void chiaki_executor_shared_unref(ChiakiExecutor *executor);
+
+/**
+ * Called by chiaki_lib_init()
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_shared_init();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_EXECUTOR_H
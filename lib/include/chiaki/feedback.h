@@ -64,6 +64,10 @@ CHIAKI_EXPORT void chiaki_feedback_history_event_set_touchpad(ChiakiFeedbackHist
 
 /**
  * Ring buffer of ChiakiFeedbackHistoryEvent
+ *
+ * The formatted bytes are kept up to date on every push, newest event first, so they never have to be rebuilt
+ * from all events. New events are prepended in front of them in a buffer of twice the maximum formatted size,
+ * which only has to be compacted again once the front is reached.
  */
 typedef struct chiaki_feedback_history_buffer_t
 {
@@ -71,6 +75,11 @@ typedef struct chiaki_feedback_history_buffer_t
 	size_t size;
 	size_t begin;
 	size_t len;
+
+	uint8_t *bytes;
+	size_t bytes_size;
+	size_t bytes_begin;
+	size_t bytes_len;
 } ChiakiFeedbackHistoryBuffer;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_history_buffer_init(ChiakiFeedbackHistoryBuffer *feedback_history_buffer, size_t size);
@@ -86,6 +95,17 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_history_buffer_format(ChiakiFeedba
  */
 CHIAKI_EXPORT void chiaki_feedback_history_buffer_push(ChiakiFeedbackHistoryBuffer *feedback_history_buffer, ChiakiFeedbackHistoryEvent *event);
 
+/**
+ * Get the formatted buffer without copying it, as chiaki_feedback_history_buffer_format() would write it.
+ *
+ * @return pointer valid until the next push
+ */
+static inline const uint8_t *chiaki_feedback_history_buffer_bytes(ChiakiFeedbackHistoryBuffer *feedback_history_buffer, size_t *size)
+{
+	*size = feedback_history_buffer->bytes_len;
+	return feedback_history_buffer->bytes + feedback_history_buffer->bytes_begin;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,34 +6,93 @@
 #include "controller.h"
 #include "takion.h"
 #include "thread.h"
+#include "timer.h"
 #include "common.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Buckets of the input latency histogram,
+ * bucket 0 counts latencies up to CHIAKI_FEEDBACK_LATENCY_HIST_BASE_US, bucket i up to CHIAKI_FEEDBACK_LATENCY_HIST_BASE_US << i
+ * and the last one everything above.
+ */
+#define CHIAKI_FEEDBACK_LATENCY_HIST_BUCKETS 10
+#define CHIAKI_FEEDBACK_LATENCY_HIST_BASE_US 125
+
+/**
+ * Latency from a controller state change being set to the packet carrying it having been handed to the socket.
+ * Motion only updates are not counted, they are deliberately held back.
+ */
+typedef struct chiaki_feedback_sender_stats_t
+{
+	uint64_t sent; // changes sent, all changes set in between two sends count as one with the latency of the first
+	uint64_t latency_sum_us;
+	uint64_t latency_max_us;
+	uint64_t latency_hist[CHIAKI_FEEDBACK_LATENCY_HIST_BUCKETS];
+} ChiakiFeedbackSenderStats;
+
+/**
+ * @return upper bound of the bucket that the given fraction of the latencies falls into, 0 if empty and UINT64_MAX for the open last bucket
+ */
+CHIAKI_EXPORT uint64_t chiaki_feedback_sender_stats_latency_percentile_us(const ChiakiFeedbackSenderStats *stats, double fraction);
+
 typedef struct chiaki_feedback_sender_t
 {
 	ChiakiLog *log;
 	ChiakiTakion *takion;
-	ChiakiThread thread;
+	ChiakiTimer timer; // periodic, restarted immediately when the controller state changes
 
 	ChiakiSeqNum16 state_seq_num;
 
 	ChiakiSeqNum16 history_seq_num;
 	ChiakiFeedbackHistoryBuffer history_buf;
 
-	bool should_stop;
 	ChiakiControllerState controller_state_prev;
 	ChiakiControllerState controller_state;
 	bool controller_state_changed;
+	bool motion_pending; // timer has been started for a motion update, which is not sent right away
+	uint64_t change_us; // time the oldest unsent change was set, 0 if there is none
+	bool immediate;
 	ChiakiMutex state_mutex;
-	ChiakiCond state_cond;
+
+	// written with atomics under state_mutex, read by anyone
+	volatile uint64_t stats_sent;
+	volatile uint64_t stats_latency_sum_us;
+	volatile uint64_t stats_latency_max_us;
+	volatile uint64_t stats_latency_hist[CHIAKI_FEEDBACK_LATENCY_HIST_BUCKETS];
 } ChiakiFeedbackSender;
 
+/**
+ * Start sending feedback on the timer service of takion.
+ */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_init(ChiakiFeedbackSender *feedback_sender, ChiakiTakion *takion);
 CHIAKI_EXPORT void chiaki_feedback_sender_fini(ChiakiFeedbackSender *feedback_sender);
-CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_controller_state(ChiakiFeedbackSender *feedback_sender, ChiakiControllerState *state);
+
+/**
+ * Any change is sent right away, without a minimum spacing between packets.
+ *
+ * @param change_us chiaki_time_now_monotonic_us() of when the change was made, taken by the caller before waiting on any locks
+ * so the latency in the stats covers these too
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_controller_state(ChiakiFeedbackSender *feedback_sender, ChiakiControllerState *state, uint64_t change_us);
+
+/**
+ * Take only gyro, accel and orient from state.
+ * Unlike other changes, these are not sent right away but coalesced into at most one feedback state
+ * every FEEDBACK_STATE_TIMEOUT_MIN_MS, since motion changes with every sample.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_motion(ChiakiFeedbackSender *feedback_sender, ChiakiControllerState *state);
+
+/**
+ * In immediate mode, chiaki_feedback_sender_set_controller_state() sends on the calling thread
+ * instead of waking up the timer, which saves the hand-off to the timer thread and its 1 ms granularity
+ * at the cost of formatting, encrypting and sending on the caller.
+ */
+CHIAKI_EXPORT void chiaki_feedback_sender_set_immediate(ChiakiFeedbackSender *feedback_sender, bool immediate);
+
+CHIAKI_EXPORT void chiaki_feedback_sender_stats(ChiakiFeedbackSender *feedback_sender, ChiakiFeedbackSenderStats *stats);
 
 #ifdef __cplusplus
 }
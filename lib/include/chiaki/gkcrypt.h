@@ -6,6 +6,7 @@
 #include "common.h"
 #include "log.h"
 #include "thread.h"
+#include "executor.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -34,10 +35,11 @@ typedef struct chiaki_gkcrypt_t {
 	uint64_t key_buf_key_pos_min; // minimal key pos currently in key_buf
 	size_t key_buf_start_offset; // offset in key_buf of the minimal key pos
 	uint64_t last_key_pos;        // last key pos that has been requested
-	bool key_buf_thread_stop;
+	bool key_buf_stop;
+	bool key_buf_task_pending; // a task to generate the next chunk is queued or running
 	ChiakiMutex key_buf_mutex;
-	ChiakiCond key_buf_cond;
-	ChiakiThread key_buf_thread;
+	ChiakiCond key_buf_cond; // signaled when the task finishes after key_buf_stop was set
+	ChiakiExecutor *executor;
 
 	uint8_t iv[CHIAKI_GKCRYPT_BLOCK_SIZE];
 	uint8_t key_base[CHIAKI_GKCRYPT_BLOCK_SIZE];
@@ -50,9 +52,10 @@ typedef struct chiaki_gkcrypt_t {
 struct chiaki_session_t;
 
 /**
- * @param key_buf_chunks if > 0, use a thread to generate the ctr mode key stream
+ * @param key_buf_chunks if > 0, generate the ctr mode key stream ahead of time in tasks on executor
+ * @param executor may be NULL if key_buf_chunks is 0
  */
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, ChiakiExecutor *executor, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
 
 CHIAKI_EXPORT void chiaki_gkcrypt_fini(ChiakiGKCrypt *gkcrypt);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gen_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size);
@@ -64,12 +67,12 @@ CHIAKI_EXPORT void chiaki_gkcrypt_gen_new_gmac_key(ChiakiGKCrypt *gkcrypt, uint6
 CHIAKI_EXPORT void chiaki_gkcrypt_gen_tmp_gmac_key(ChiakiGKCrypt *gkcrypt, uint64_t index, uint8_t *key_out);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gmac(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out);
 
-static inline ChiakiGKCrypt *chiaki_gkcrypt_new(ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+static inline ChiakiGKCrypt *chiaki_gkcrypt_new(ChiakiLog *log, ChiakiExecutor *executor, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
 {
 	ChiakiGKCrypt *gkcrypt = CHIAKI_NEW(ChiakiGKCrypt);
 	if(!gkcrypt)
 		return NULL;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(gkcrypt, log, key_buf_chunks, index, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(gkcrypt, log, executor, key_buf_chunks, index, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		free(gkcrypt);
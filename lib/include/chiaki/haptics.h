@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_HAPTICS_H
+#define CHIAKI_HAPTICS_H
+
+#include "common.h"
+#include "log.h"
+#include "seqnum.h"
+#include "jitterbuffer.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// haptics frames are interleaved signed 8 bit samples, observed to be stereo at 3 kHz
+#define CHIAKI_HAPTICS_STREAM_RATE 3000
+#define CHIAKI_HAPTICS_STREAM_CHANNELS 2
+
+#define CHIAKI_HAPTICS_CHANNELS_MAX 2
+#define CHIAKI_HAPTICS_REPORT_SAMPLES_MAX 0x100
+
+/**
+ * @param buf report_samples interleaved signed 8 bit samples per channel
+ */
+typedef void (*ChiakiHapticsReportCallback)(int8_t *buf, size_t samples_count, void *user);
+
+typedef struct chiaki_haptics_config_t
+{
+	unsigned int stream_rate;
+	unsigned int channels; // of both the stream and the reports
+	unsigned int report_rate; // sample rate of the reports
+	size_t report_samples; // samples per channel in each report, which determines the report cadence
+} ChiakiHapticsConfig;
+
+/**
+ * Haptics for the DualSense over Bluetooth, where each output report carries 32 stereo samples at 3 kHz.
+ */
+CHIAKI_EXPORT void chiaki_haptics_config_dualsense(ChiakiHapticsConfig *config);
+
+typedef struct chiaki_haptics_stats_t
+{
+	uint64_t reports;
+	uint64_t latency_us; // from arrival of a frame to the report that completes it, without delay_us
+	uint64_t delay_us; // currently applied from chiaki_haptics_pipeline_set_delay()
+	ChiakiJitterBufferStats jitter_buffer;
+} ChiakiHapticsStats;
+
+/**
+ * Takes the haptics frames of a session instead of the raw haptics sink, buffers them against jitter,
+ * resamples them to the rate of the controller and passes them on in chunks of exactly one output report.
+ *
+ * Playout is driven by a thread of the jitter buffer, at the nominal rate of the stream,
+ * so the reports are passed to the callback from there.
+ */
+typedef struct chiaki_haptics_pipeline_t
+{
+	ChiakiLog *log;
+	ChiakiHapticsConfig config;
+
+	ChiakiJitterBuffer jitter_buffer;
+	bool started; // frame duration is known and playout runs, only touched by the receiving thread
+
+	// resampler, only touched from the jitter buffer's callbacks
+	double step; // input samples per output sample
+	double pos; // position of the next output sample between prev and the next input sample
+	int8_t prev[CHIAKI_HAPTICS_CHANNELS_MAX];
+	size_t frame_samples; // per channel of the last frame, used to fill lost ones
+	int8_t report[CHIAKI_HAPTICS_REPORT_SAMPLES_MAX * CHIAKI_HAPTICS_CHANNELS_MAX];
+	size_t report_fill;
+	size_t delay_samples; // output samples of delay currently applied
+	size_t skip_samples; // output samples still to drop for a reduced delay
+
+	volatile uint64_t delay_us; // requested
+	volatile uint64_t delay_applied_us; // delay_samples, for the stats
+	volatile uint64_t reports;
+
+	ChiakiHapticsReportCallback report_cb;
+	void *report_cb_user;
+} ChiakiHapticsPipeline;
+
+/**
+ * To use it for a session, set it with chiaki_session_set_haptics_pipeline() before the session is started.
+ * chiaki_haptics_pipeline_fini() must then only be called after the session has been joined.
+ *
+ * @param playout_thread false to not start any playout thread, chiaki_haptics_pipeline_play() must be called manually then
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_haptics_pipeline_init(ChiakiHapticsPipeline *pipeline, ChiakiLog *log, bool playout_thread,
+		const ChiakiHapticsConfig *config, ChiakiHapticsReportCallback report_cb, void *report_cb_user);
+CHIAKI_EXPORT void chiaki_haptics_pipeline_fini(ChiakiHapticsPipeline *pipeline);
+
+/**
+ * Called by the haptics receiver for every frame.
+ * The frame duration is derived from the size of the first one, playout starts from there.
+ *
+ * @param arrival_us local time the frame arrived, e.g. chiaki_time_now_monotonic_us()
+ */
+CHIAKI_EXPORT void chiaki_haptics_pipeline_push(ChiakiHapticsPipeline *pipeline, ChiakiSeqNum16 frame_index, const uint8_t *buf, size_t buf_size, uint64_t arrival_us);
+
+/**
+ * Resample all frames that are due at now_us and pass on every report completed by them.
+ * Called by the playout thread, if there is one.
+ */
+CHIAKI_EXPORT void chiaki_haptics_pipeline_play(ChiakiHapticsPipeline *pipeline, uint64_t now_us);
+
+/**
+ * Delay the output on top of the pipeline's own latency, e.g. to line it up with the audio
+ * after the corrections from ChiakiAVSync have been applied to it.
+ * Applied with the next frame by inserting silence or dropping samples, so it should not be changed for small differences.
+ */
+CHIAKI_EXPORT void chiaki_haptics_pipeline_set_delay(ChiakiHapticsPipeline *pipeline, uint64_t delay_us);
+
+CHIAKI_EXPORT void chiaki_haptics_pipeline_stats(ChiakiHapticsPipeline *pipeline, ChiakiHapticsStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_HAPTICS_H
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_JITTERBUFFER_H
+#define CHIAKI_JITTERBUFFER_H
+
+#include "common.h"
+#include "log.h"
+#include "thread.h"
+#include "seqnum.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_JITTER_BUFFER_SIZE_EXP 6 // => 64 frames
+#define CHIAKI_JITTER_BUFFER_SIZE (1 << CHIAKI_JITTER_BUFFER_SIZE_EXP)
+#define CHIAKI_JITTER_BUFFER_FRAME_SIZE_MAX 0x100
+
+typedef void (*ChiakiJitterBufferFrameCallback)(uint8_t *buf, size_t buf_size, void *user);
+
+/**
+ * Called instead of ChiakiJitterBufferFrameCallback for a frame that is missing at its playout time.
+ *
+ * @param next_buf the frame following the lost one if it is already there, so its redundancy can be used to recover
+ * the lost one (e.g. Opus in-band FEC), NULL if the lost frame can only be concealed.
+ */
+typedef void (*ChiakiJitterBufferLostCallback)(uint8_t *next_buf, size_t next_buf_size, void *user);
+
+typedef struct chiaki_jitter_buffer_frame_t
+{
+	bool present;
+	size_t buf_size;
+	uint8_t buf[CHIAKI_JITTER_BUFFER_FRAME_SIZE_MAX];
+} ChiakiJitterBufferFrame;
+
+typedef struct chiaki_jitter_buffer_stats_t
+{
+	uint64_t played; // frames passed to the frame callback
+	uint64_t recovered; // lost frames passed to the lost callback together with the next frame
+	uint64_t concealed; // lost frames passed to the lost callback without any data, including underruns
+	uint64_t late; // frames that arrived after their playout time
+	uint64_t dropped; // frames skipped to reduce the delay
+	uint64_t underruns; // times the buffer ran empty while playing
+	uint64_t delay_us; // playout delay currently aimed for, target frames times the frame duration
+} ChiakiJitterBufferStats;
+
+/**
+ * Buffers frames with consecutive indices that arrive with varying delay, possibly out of order,
+ * and plays them out at their nominal rate with a delay adapting to the measured arrival jitter.
+ *
+ * Frames missing at their playout time are reported as lost, and when the buffer runs empty,
+ * a few frames are concealed before it stops and buffers up again.
+ * A delay above the target is reduced by occasionally skipping a frame.
+ *
+ * Thread-safe, but chiaki_jitter_buffer_play() must only ever run on one thread at a time.
+ * The callbacks are called from it without the mutex held, so a slow callback never holds up pushing frames.
+ */
+typedef struct chiaki_jitter_buffer_t
+{
+	ChiakiLog *log;
+	ChiakiMutex mutex;
+	ChiakiJitterBufferFrame frames[CHIAKI_JITTER_BUFFER_SIZE];
+	uint64_t frame_duration_us; // 0 until configured, nothing is buffered then
+
+	bool index_valid; // whether any frame has been pushed since the last reset
+	ChiakiSeqNum16 next_index; // next frame to play out
+	ChiakiSeqNum16 last_index; // newest frame pushed
+
+	bool started; // whether playout has started since the last reset, so earlier frames can't be taken anymore
+	bool playing;
+	uint64_t playout_next_us; // time the frame at next_index is due
+	uint64_t underrun_frames; // frames concealed in a row because the buffer was empty
+	uint64_t frames_since_drop;
+
+	// RFC 3550 style inter-arrival jitter of pushed frames
+	bool arrival_prev_valid;
+	uint64_t arrival_prev_us;
+	ChiakiSeqNum16 arrival_prev_index;
+	double jitter_us;
+	size_t target_frames;
+
+	ChiakiJitterBufferStats stats;
+
+	ChiakiJitterBufferFrameCallback frame_cb;
+	ChiakiJitterBufferLostCallback lost_cb;
+	void *cb_user;
+
+	// see chiaki_jitter_buffer_playout_start()
+	bool playout_running;
+	bool playout_stop;
+	ChiakiCond playout_cond;
+	ChiakiThread playout_thread;
+} ChiakiJitterBuffer;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_jitter_buffer_init(ChiakiJitterBuffer *jitter_buffer, ChiakiLog *log,
+		ChiakiJitterBufferFrameCallback frame_cb, ChiakiJitterBufferLostCallback lost_cb, void *cb_user);
+CHIAKI_EXPORT void chiaki_jitter_buffer_fini(ChiakiJitterBuffer *jitter_buffer);
+
+/**
+ * Set the duration of a single frame and drop everything buffered.
+ */
+CHIAKI_EXPORT void chiaki_jitter_buffer_set_frame_duration(ChiakiJitterBuffer *jitter_buffer, uint64_t frame_duration_us);
+
+/**
+ * @param arrival_us local time the frame arrived, e.g. chiaki_time_now_monotonic_us()
+ * @return whether the frame was taken, false for duplicates, late frames and if no frame duration is set yet
+ */
+CHIAKI_EXPORT bool chiaki_jitter_buffer_push(ChiakiJitterBuffer *jitter_buffer, ChiakiSeqNum16 index, const uint8_t *buf, size_t buf_size, uint64_t arrival_us);
+
+/**
+ * Play out all frames that are due at now_us.
+ * Should be called at least once per frame duration.
+ */
+CHIAKI_EXPORT void chiaki_jitter_buffer_play(ChiakiJitterBuffer *jitter_buffer, uint64_t now_us);
+
+/**
+ * Start a thread of its own that calls chiaki_jitter_buffer_play() twice per frame duration,
+ * so callbacks that may block, like an audio sink, don't hold up any shared thread.
+ * chiaki_jitter_buffer_play() must not be called manually while it runs.
+ * Does nothing if the thread is already running.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_jitter_buffer_playout_start(ChiakiJitterBuffer *jitter_buffer, const char *thread_name);
+
+/**
+ * Stop and join the thread from chiaki_jitter_buffer_playout_start(), if running.
+ * Called by chiaki_jitter_buffer_fini() too.
+ */
+CHIAKI_EXPORT void chiaki_jitter_buffer_playout_stop(ChiakiJitterBuffer *jitter_buffer);
+
+CHIAKI_EXPORT void chiaki_jitter_buffer_stats(ChiakiJitterBuffer *jitter_buffer, ChiakiJitterBufferStats *stats);
+
+/**
+ * @return current playout delay in frames that is aimed for
+ */
+CHIAKI_EXPORT size_t chiaki_jitter_buffer_target_frames(ChiakiJitterBuffer *jitter_buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_JITTERBUFFER_H
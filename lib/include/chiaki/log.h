@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <chiaki/config.h>
+
 #include "common.h"
 
 #ifdef __cplusplus
@@ -22,6 +24,15 @@ typedef enum {
 
 #define CHIAKI_LOG_ALL ((1 << 5) - 1)
 
+/**
+ * Levels not in this mask are compiled out of the CHIAKI_LOG* macros,
+ * their arguments are not evaluated at all.
+ * Configured through CHIAKI_LIB_LOG_COMPILE_LEVEL in CMake.
+ */
+#ifndef CHIAKI_LOG_COMPILE_MASK
+#define CHIAKI_LOG_COMPILE_MASK CHIAKI_LOG_ALL
+#endif
+
 CHIAKI_EXPORT char chiaki_log_level_char(ChiakiLogLevel level);
 
 typedef void (*ChiakiLogCb)(ChiakiLogLevel level, const char *msg, void *user);
@@ -31,6 +42,7 @@ typedef struct chiaki_log_t
 	uint32_t level_mask;
 	ChiakiLogCb cb;
 	void *user;
+	void *volatile rate_limit_pending; // ChiakiLogRateLimit call sites with summaries for this log, see chiaki_log_rate_limit_flush()
 } ChiakiLog;
 
 CHIAKI_EXPORT void chiaki_log_init(ChiakiLog *log, uint32_t level_mask, ChiakiLogCb cb, void *user);
@@ -44,11 +56,71 @@ CHIAKI_EXPORT void chiaki_log(ChiakiLog *log, ChiakiLogLevel level, const char *
 CHIAKI_EXPORT void chiaki_log_hexdump(ChiakiLog *log, ChiakiLogLevel level, const uint8_t *buf, size_t buf_size);
 CHIAKI_EXPORT void chiaki_log_hexdump_raw(ChiakiLog *log, ChiakiLogLevel level, const uint8_t *buf, size_t buf_size);
 
-#define CHIAKI_LOGD(log, ...) do { chiaki_log((log), CHIAKI_LOG_DEBUG, __VA_ARGS__); } while(0)
-#define CHIAKI_LOGV(log, ...) do { chiaki_log((log), CHIAKI_LOG_VERBOSE, __VA_ARGS__); } while(0)
-#define CHIAKI_LOGI(log, ...) do { chiaki_log((log), CHIAKI_LOG_INFO, __VA_ARGS__); } while(0)
-#define CHIAKI_LOGW(log, ...) do { chiaki_log((log), CHIAKI_LOG_WARNING, __VA_ARGS__); } while(0)
-#define CHIAKI_LOGE(log, ...) do { chiaki_log((log), CHIAKI_LOG_ERROR, __VA_ARGS__); } while(0)
+#define CHIAKI_LOG_ENABLED(level) ((CHIAKI_LOG_COMPILE_MASK & (level)) != 0)
+
+#define CHIAKI_LOGD(log, ...) do { if(CHIAKI_LOG_ENABLED(CHIAKI_LOG_DEBUG)) chiaki_log((log), CHIAKI_LOG_DEBUG, __VA_ARGS__); } while(0)
+#define CHIAKI_LOGV(log, ...) do { if(CHIAKI_LOG_ENABLED(CHIAKI_LOG_VERBOSE)) chiaki_log((log), CHIAKI_LOG_VERBOSE, __VA_ARGS__); } while(0)
+#define CHIAKI_LOGI(log, ...) do { if(CHIAKI_LOG_ENABLED(CHIAKI_LOG_INFO)) chiaki_log((log), CHIAKI_LOG_INFO, __VA_ARGS__); } while(0)
+#define CHIAKI_LOGW(log, ...) do { if(CHIAKI_LOG_ENABLED(CHIAKI_LOG_WARNING)) chiaki_log((log), CHIAKI_LOG_WARNING, __VA_ARGS__); } while(0)
+#define CHIAKI_LOGE(log, ...) do { if(CHIAKI_LOG_ENABLED(CHIAKI_LOG_ERROR)) chiaki_log((log), CHIAKI_LOG_ERROR, __VA_ARGS__); } while(0)
+
+#define CHIAKI_LOG_RATE_LIMIT_INTERVAL_MS 1000
+#define CHIAKI_LOG_RATE_LIMIT_BURST 5
+
+/**
+ * State of a single rate limited call site, see CHIAKI_LOG_RATE_LIMITED.
+ */
+typedef struct chiaki_log_rate_limit_t
+{
+	volatile uint64_t window_start_ms;
+	volatile uint32_t count;
+	volatile uint32_t suppressed;
+
+	// set while the call site is in the rate_limit_pending list of a log, see chiaki_log_rate_limit_flush()
+	volatile uint32_t pending;
+	struct chiaki_log_rate_limit_t *next;
+	ChiakiLogLevel level;
+	const char *file;
+	int line;
+} ChiakiLogRateLimit;
+
+/**
+ * Decide whether a rate limited call site may log now.
+ * When a new interval begins and messages have been suppressed in the previous one,
+ * a summary with their count is logged first.
+ *
+ * The first suppressed message adds rate_limit to the list of log, so once it suppressed a message,
+ * rate_limit must stay valid until it has been flushed with chiaki_log_rate_limit_flush(log, true).
+ * While it is in that list, messages suppressed for other logs are summarized into log too.
+ */
+CHIAKI_EXPORT bool chiaki_log_rate_limit_check(ChiakiLog *log, ChiakiLogLevel level, ChiakiLogRateLimit *rate_limit, const char *file, int line);
+
+/**
+ * Log the summaries of suppressed messages for all rate limited call sites in the list of log,
+ * so the count of the last interval of a flood is not lost if the call site is never hit again.
+ * Should be called periodically, and must be called with force before log is destroyed.
+ * Must not be called concurrently for the same log.
+ *
+ * @param force also log the summaries of intervals that have not ended yet
+ */
+CHIAKI_EXPORT void chiaki_log_rate_limit_flush(ChiakiLog *log, bool force);
+
+/**
+ * Run stmt at most CHIAKI_LOG_RATE_LIMIT_BURST times per CHIAKI_LOG_RATE_LIMIT_INTERVAL_MS for this call site.
+ * The limit is shared by all threads and logs passing through the call site.
+ */
+#define CHIAKI_LOG_RATE_LIMITED(log, level, stmt) do { \
+		static ChiakiLogRateLimit chiaki_log_rate_limit_ = { 0 }; \
+		if(CHIAKI_LOG_ENABLED(level) && chiaki_log_rate_limit_check((log), (level), &chiaki_log_rate_limit_, __FILE__, __LINE__)) \
+			stmt; \
+	} while(0)
+
+#define CHIAKI_LOGD_RL(log, ...) CHIAKI_LOG_RATE_LIMITED(log, CHIAKI_LOG_DEBUG, chiaki_log((log), CHIAKI_LOG_DEBUG, __VA_ARGS__))
+#define CHIAKI_LOGV_RL(log, ...) CHIAKI_LOG_RATE_LIMITED(log, CHIAKI_LOG_VERBOSE, chiaki_log((log), CHIAKI_LOG_VERBOSE, __VA_ARGS__))
+#define CHIAKI_LOGI_RL(log, ...) CHIAKI_LOG_RATE_LIMITED(log, CHIAKI_LOG_INFO, chiaki_log((log), CHIAKI_LOG_INFO, __VA_ARGS__))
+#define CHIAKI_LOGW_RL(log, ...) CHIAKI_LOG_RATE_LIMITED(log, CHIAKI_LOG_WARNING, chiaki_log((log), CHIAKI_LOG_WARNING, __VA_ARGS__))
+#define CHIAKI_LOGE_RL(log, ...) CHIAKI_LOG_RATE_LIMITED(log, CHIAKI_LOG_ERROR, chiaki_log((log), CHIAKI_LOG_ERROR, __VA_ARGS__))
+#define CHIAKI_LOG_HEXDUMP_RL(log, level, buf, buf_size) CHIAKI_LOG_RATE_LIMITED(log, level, chiaki_log_hexdump((log), (level), (buf), (buf_size)))
 
 typedef struct chiaki_log_sniffer_t
 {
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_LOGASYNC_H
+#define CHIAKI_LOGASYNC_H
+
+#include "log.h"
+#include "thread.h"
+#include "stoppipe.h"
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_LOG_ASYNC_MSG_SIZE 0x100
+
+typedef struct chiaki_log_async_slot_t
+{
+	volatile uint64_t seq;
+	ChiakiLogLevel level;
+	char *msg_heap; // only set if the message did not fit into msg
+	char msg[CHIAKI_LOG_ASYNC_MSG_SIZE];
+} ChiakiLogAsyncSlot;
+
+/**
+ * Asynchronous logging backend.
+ *
+ * Messages are formatted on the calling thread directly into a slot of a lock-free
+ * multi-producer single-consumer ring and dispatched to the actual sink from a background thread.
+ * Pushing a message never blocks. If the ring is full, the message is dropped and counted,
+ * a summary of the dropped messages is logged once there is room again.
+ *
+ * To use it, initialize a ChiakiLog with chiaki_log_async_cb as the callback
+ * and the ChiakiLogAsync as the user pointer:
+ *
+ *     chiaki_log_async_init(&async, 10, chiaki_log_cb_print, NULL);
+ *     chiaki_log_init(&log, CHIAKI_LOG_ALL, chiaki_log_async_cb, &async);
+ */
+typedef struct chiaki_log_async_t
+{
+	ChiakiLogCb cb;
+	void *cb_user;
+
+	ChiakiLogAsyncSlot *slots;
+	uint64_t slots_mask;
+	volatile uint64_t enqueue_pos;
+	uint64_t dequeue_pos; // only accessed by the thread
+
+	volatile uint64_t dropped;
+	uint64_t dropped_reported; // only accessed by the thread
+
+	volatile uint32_t sleeping; // set by the thread before it waits on wakeup_pipe, cleared by the producer that wakes it
+	volatile uint32_t should_stop;
+	ChiakiStopPipe wakeup_pipe;
+	ChiakiThread thread;
+} ChiakiLogAsync;
+
+/**
+ * @param size_exp the ring will hold 2^size_exp messages
+ * @param cb sink that all messages are dispatched to from the background thread, NULL for chiaki_log_cb_print
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_log_async_init(ChiakiLogAsync *async, size_t size_exp, ChiakiLogCb cb, void *cb_user);
+
+/**
+ * Stops the background thread after dispatching all messages that are still queued.
+ * No other thread may log into the ChiakiLogAsync anymore when this is called.
+ */
+CHIAKI_EXPORT void chiaki_log_async_fini(ChiakiLogAsync *async);
+
+/**
+ * ChiakiLogCb that pushes an already formatted message, user must be a ChiakiLogAsync.
+ * chiaki_log() detects this callback and formats directly into the ring instead.
+ */
+CHIAKI_EXPORT void chiaki_log_async_cb(ChiakiLogLevel level, const char *msg, void *user);
+
+CHIAKI_EXPORT void chiaki_log_async_pushv(ChiakiLogAsync *async, ChiakiLogLevel level, const char *fmt, va_list args);
+
+/**
+ * @return total number of messages that have been dropped because the ring was full
+ */
+CHIAKI_EXPORT uint64_t chiaki_log_async_dropped(ChiakiLogAsync *async);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_LOGASYNC_H
@@ -15,6 +15,17 @@ extern "C" {
 typedef void (*ChiakiOpusDecoderSettingsCallback)(uint32_t channels, uint32_t rate, void *user);
 typedef void (*ChiakiOpusDecoderFrameCallback)(int16_t *buf, size_t samples_count, void *user);
 
+typedef enum {
+	CHIAKI_OPUS_DECODER_FORMAT_S16,
+	CHIAKI_OPUS_DECODER_FORMAT_FLOAT
+} ChiakiOpusDecoderFormat;
+
+/**
+ * @param buf interleaved samples of the format given to chiaki_opus_decoder_set_batch(), pointing into the caller's memory
+ * @param samples_count samples per channel
+ */
+typedef void (*ChiakiOpusDecoderBatchCallback)(void *buf, size_t samples_count, void *user);
+
 typedef struct chiaki_opus_decoder_t
 {
 	ChiakiLog *log;
@@ -26,12 +37,50 @@ typedef struct chiaki_opus_decoder_t
 	ChiakiOpusDecoderSettingsCallback settings_cb;
 	ChiakiOpusDecoderFrameCallback frame_cb;
 	void *cb_user;
+
+	// batching into caller memory, see chiaki_opus_decoder_set_batch()
+	ChiakiOpusDecoderBatchCallback batch_cb; // NULL if frames are passed to frame_cb one by one
+	ChiakiOpusDecoderFormat batch_format;
+	uint8_t *batch_mem;
+	size_t batch_mem_size;
+	size_t batch_samples; // as requested by the caller
+
+	// layout of batch_mem for the current audio header, batch_slots is 0 if it does not fit
+	size_t batch_frames_max; // whole frames per batch covering at least batch_samples
+	size_t batch_slot_size;
+	size_t batch_slots;
+	size_t batch_slot_cur;
+	size_t batch_frames_cur; // frames decoded into the current slot
+	size_t batch_samples_cur; // samples per channel decoded into the current slot
 } ChiakiOpusDecoder;
 
 CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLog *log);
 CHIAKI_EXPORT void chiaki_opus_decoder_fini(ChiakiOpusDecoder *decoder);
 CHIAKI_EXPORT void chiaki_opus_decoder_get_sink(ChiakiOpusDecoder *decoder, ChiakiAudioSink *sink);
 
+/**
+ * Instead of passing each decoded frame to the frame callback, decode them directly into mem
+ * and pass batches of at least batch_samples samples per channel to batch_cb, together with the user of chiaki_opus_decoder_set_cb().
+ *
+ * mem is used as a ring of slots of whole frames each, so a batch stays valid until the decoder has come around to its slot again.
+ * Pass mem_size of at least two batches to be able to process one batch while the next one is decoded.
+ * Must be called before the session is started, pass batch_cb = NULL to go back to frame_cb.
+ *
+ * @param mem caller-owned memory, must stay valid until the decoder is finalized or batching is disabled
+ */
+CHIAKI_EXPORT void chiaki_opus_decoder_set_batch(ChiakiOpusDecoder *decoder, ChiakiOpusDecoderFormat format,
+		void *mem, size_t mem_size, size_t batch_samples, ChiakiOpusDecoderBatchCallback batch_cb);
+
+/**
+ * Pass the frames decoded so far to the batch callback, even if the batch is not full yet.
+ */
+CHIAKI_EXPORT void chiaki_opus_decoder_flush(ChiakiOpusDecoder *decoder);
+
+static inline size_t chiaki_opus_decoder_format_sample_size(ChiakiOpusDecoderFormat format)
+{
+	return format == CHIAKI_OPUS_DECODER_FORMAT_FLOAT ? sizeof(float) : sizeof(int16_t);
+}
+
 static inline void chiaki_opus_decoder_set_cb(ChiakiOpusDecoder *decoder, ChiakiOpusDecoderSettingsCallback settings_cb, ChiakiOpusDecoderFrameCallback frame_cb, void *user)
 {
 	decoder->settings_cb = settings_cb;
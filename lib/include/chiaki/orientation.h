@@ -24,6 +24,16 @@ CHIAKI_EXPORT void chiaki_orientation_init(ChiakiOrientation *orient);
 CHIAKI_EXPORT void chiaki_orientation_update(ChiakiOrientation *orient,
 		float gx, float gy, float gz, float ax, float ay, float az, float beta, float time_step_sec);
 
+/**
+ * Single reading of an IMU, in the units of ChiakiControllerState
+ */
+typedef struct chiaki_motion_sample_t
+{
+	float gyro_x, gyro_y, gyro_z;
+	float accel_x, accel_y, accel_z;
+	uint32_t timestamp_us; // may wrap around
+} ChiakiMotionSample;
+
 /**
  * Extension of ChiakiOrientation, also tracking an absolute timestamp and the current gyro/accel state
  */
@@ -39,6 +49,13 @@ typedef struct chiaki_orientation_tracker_t
 CHIAKI_EXPORT void chiaki_orientation_tracker_init(ChiakiOrientationTracker *tracker);
 CHIAKI_EXPORT void chiaki_orientation_tracker_update(ChiakiOrientationTracker *tracker,
 		float gx, float gy, float gz, float ax, float ay, float az, uint32_t timestamp_us);
+
+/**
+ * Integrate all samples in order, equivalent to calling chiaki_orientation_tracker_update() for each of them,
+ * but with the per-sample preparation done for the whole batch at once.
+ */
+CHIAKI_EXPORT void chiaki_orientation_tracker_update_batch(ChiakiOrientationTracker *tracker,
+		const ChiakiMotionSample *samples, size_t samples_count);
 CHIAKI_EXPORT void chiaki_orientation_tracker_apply_to_controller_state(ChiakiOrientationTracker *tracker,
 		ChiakiControllerState *state);
 
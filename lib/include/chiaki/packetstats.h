@@ -5,23 +5,93 @@
 
 #include "thread.h"
 #include "seqnum.h"
+#include "trendline.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-typedef struct chiaki_packet_stats_t
-{
-	ChiakiMutex mutex;
+/**
+ * Buckets of the loss burst and reorder distance histograms,
+ * bucket i counts values in (2^(i-1), 2^i], i.e. 1, 2, 3-4, 5-8, 9-16 and the last one everything above.
+ */
+#define CHIAKI_PACKET_STATS_HIST_BUCKETS 6
 
-	// For generations of packets, i.e. where we know the number of expected packets per generation
+/**
+ * Number of sequence numbers up to the highest one received that are remembered as received or not,
+ * late packets older than that are neither counted as recovered nor as duplicates.
+ */
+#define CHIAKI_PACKET_STATS_SEQ_WINDOW 256
+
+/**
+ * All counters are cumulative since chiaki_packet_stats_init() when returned from chiaki_packet_stats_snapshot()
+ * and relative to the previous snapshot when returned from chiaki_packet_stats_snapshot_window().
+ */
+typedef struct chiaki_packet_stats_snapshot_t
+{
+	uint64_t timestamp_us; // for windows: duration of the window
 	uint64_t gen_received;
 	uint64_t gen_lost;
+	uint64_t seq_received; // excluding duplicates
+	uint64_t seq_lost; // gaps in sequence numbers, excluding late packets that filled them later
+	uint64_t seq_duplicates; // packets with a sequence number that had already been received
+	uint64_t loss_burst_hist[CHIAKI_PACKET_STATS_HIST_BUCKETS];
+	uint64_t reorder_hist[CHIAKI_PACKET_STATS_HIST_BUCKETS];
+	uint64_t goodput_bytes;
+	uint64_t fec_recovered; // frames that were lost but recovered from redundant units
+	uint64_t fec_missed; // frames that were neither received nor recovered
+	double jitter_ms; // current RFC 3550 inter-arrival jitter estimate, not windowed
+	double delay_trend; // current slope of the one-way delay trendline, not windowed
+	uint64_t delay_deltas; // number of samples that went into the trendline so far
+} ChiakiPacketStatsSnapshot;
 
-	// For sequential packets, i.e. where packets are identified by a sequence number
-	ChiakiSeqNum16 seq_min; // sequence number that was max at the last reset
-	ChiakiSeqNum16 seq_max; // currently maximal sequence number
-	uint64_t seq_received; // total received packets since the last reset
+static inline uint64_t chiaki_packet_stats_snapshot_received(const ChiakiPacketStatsSnapshot *s) { return s->gen_received + s->seq_received; }
+static inline uint64_t chiaki_packet_stats_snapshot_lost(const ChiakiPacketStatsSnapshot *s) { return s->gen_lost + s->seq_lost; }
+CHIAKI_EXPORT uint64_t chiaki_packet_stats_snapshot_goodput_bps(const ChiakiPacketStatsSnapshot *window);
+
+/**
+ * @return upper bound of the highest non-empty histogram bucket, 0 if empty and UINT64_MAX for the open last bucket
+ */
+CHIAKI_EXPORT uint64_t chiaki_packet_stats_hist_max(const uint64_t hist[CHIAKI_PACKET_STATS_HIST_BUCKETS]);
+
+/**
+ * Packet statistics of a stream.
+ *
+ * The push functions are lock-free and only meant to be called from the thread receiving the packets.
+ * Readers take snapshots of the cumulative counters and compute their own windows from them,
+ * so any number of readers can observe the stats without interfering with each other.
+ */
+typedef struct chiaki_packet_stats_t
+{
+	// cumulative counters, written with atomics by the receiving thread, read by anyone
+	volatile uint64_t gen_received;
+	volatile uint64_t gen_lost;
+	volatile uint64_t seq_received;
+	volatile uint64_t seq_lost;
+	volatile uint64_t seq_recovered;
+	volatile uint64_t seq_duplicates;
+	volatile uint64_t loss_burst_hist[CHIAKI_PACKET_STATS_HIST_BUCKETS];
+	volatile uint64_t reorder_hist[CHIAKI_PACKET_STATS_HIST_BUCKETS];
+	volatile uint64_t goodput_bytes;
+	volatile uint64_t fec_recovered;
+	volatile uint64_t fec_missed;
+	volatile uint64_t jitter_us_x16; // scaled by 16 like in RFC 3550 A.8
+	volatile uint64_t seq_interval_us; // nominal time between sequential packets, 0 if unknown
+	volatile uint64_t delay_trend_bits; // double from delay_trendline
+	volatile uint64_t delay_deltas;
+
+	// only touched by the receiving thread
+	bool seq_started;
+	ChiakiSeqNum16 seq_max;
+	ChiakiSeqNum16 seq_last;
+	uint64_t seq_last_arrival_us;
+	uint64_t seq_ext_max; // seq_max extended to 64 bits, as the sender clock for delay_trendline
+	uint64_t seq_received_mask[CHIAKI_PACKET_STATS_SEQ_WINDOW / 64]; // bit seq_num % CHIAKI_PACKET_STATS_SEQ_WINDOW
+	ChiakiTrendline delay_trendline;
+
+	// baseline for chiaki_packet_stats_get()
+	ChiakiMutex mutex;
+	ChiakiPacketStatsSnapshot get_prev;
 } ChiakiPacketStats;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_packet_stats_init(ChiakiPacketStats *stats);
@@ -29,6 +99,28 @@ CHIAKI_EXPORT void chiaki_packet_stats_fini(ChiakiPacketStats *stats);
 CHIAKI_EXPORT void chiaki_packet_stats_reset(ChiakiPacketStats *stats);
 CHIAKI_EXPORT void chiaki_packet_stats_push_generation(ChiakiPacketStats *stats, uint64_t received, uint64_t lost);
 CHIAKI_EXPORT void chiaki_packet_stats_push_seq(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num);
+CHIAKI_EXPORT void chiaki_packet_stats_push_goodput(ChiakiPacketStats *stats, uint64_t bytes);
+
+/**
+ * Count frames recovered from redundant (FEC) units and frames that could not be recovered.
+ */
+CHIAKI_EXPORT void chiaki_packet_stats_push_fec(ChiakiPacketStats *stats, uint64_t recovered, uint64_t missed);
+
+/**
+ * Set the nominal interval between sequential packets, which enables jitter and delay trend calculation for them.
+ */
+CHIAKI_EXPORT void chiaki_packet_stats_set_seq_interval(ChiakiPacketStats *stats, uint64_t interval_us);
+
+CHIAKI_EXPORT void chiaki_packet_stats_snapshot(ChiakiPacketStats *stats, ChiakiPacketStatsSnapshot *snapshot);
+
+/**
+ * Take a new snapshot into *prev and write the difference to the old value of *prev into *window.
+ */
+CHIAKI_EXPORT void chiaki_packet_stats_snapshot_window(ChiakiPacketStats *stats, ChiakiPacketStatsSnapshot *prev, ChiakiPacketStatsSnapshot *window);
+
+/**
+ * Get received and lost packets since the last reset.
+ */
 CHIAKI_EXPORT void chiaki_packet_stats_get(ChiakiPacketStats *stats, bool reset, uint64_t *received, uint64_t *lost);
 
 #ifdef __cplusplus
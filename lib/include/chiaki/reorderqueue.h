@@ -19,44 +19,57 @@ typedef enum chiaki_reorder_queue_drop_strategy_t {
 typedef struct chiaki_reorder_queue_entry_t
 {
 	void *user;
-	bool set;
 } ChiakiReorderQueueEntry;
 
 typedef void (*ChiakiReorderQueueDropCb)(uint64_t seq_num, void *elem_user, void *cb_user);
 typedef bool (*ChiakiReorderQueueSeqNumGt)(uint64_t a, uint64_t b);
 typedef bool (*ChiakiReorderQueueSeqNumLt)(uint64_t a, uint64_t b);
 typedef uint64_t (*ChiakiReorderQueueSeqNumAdd)(uint64_t a, uint64_t b);
-typedef uint64_t (*ChiakiReorderQueueSeqNumSub)(uint64_t a, uint64_t b);
 
+/**
+ * All operations exist as variants specialised for the width of the sequence numbers,
+ * e.g. chiaki_reorder_queue_push_16() and chiaki_reorder_queue_push_32(), in which all sequence number
+ * comparisons are inlined. The variants without suffix dispatch to them based on how the queue was initialized.
+ */
 typedef struct chiaki_reorder_queue_t
 {
 	size_t size_exp; // real size = 2^size * sizeof(ChiakiReorderQueueEntry)
 	ChiakiReorderQueueEntry *queue;
+	uint64_t *occupied; // bitmap of entries in queue holding an element, all bits outside of [begin, begin + count) are clear
 	uint64_t begin;
 	uint64_t count;
-	ChiakiReorderQueueSeqNumGt seq_num_gt;
-	ChiakiReorderQueueSeqNumLt seq_num_lt;
-	ChiakiReorderQueueSeqNumAdd seq_num_add;
-	ChiakiReorderQueueSeqNumSub seq_num_sub;
+	uint64_t count_max; // high-water mark of count
+	size_t size_exp_max; // the queue grows up to this size instead of dropping
+	unsigned int seq_num_bits; // 16 or 32
 	ChiakiReorderQueueDropStrategy drop_strategy;
 	ChiakiReorderQueueDropCb drop_cb;
 	void *drop_cb_user;
 } ChiakiReorderQueue;
 
 /**
+ * Kept for compatibility, use chiaki_reorder_queue_init_16() or chiaki_reorder_queue_init_32() instead.
+ * The functions are not stored, only the width of the sequence numbers is derived from seq_num_add.
+ *
  * @param size exponent for 2
  * @param seq_num_start sequence number of the first expected element
+ * @return CHIAKI_ERR_INVALID_DATA if seq_num_add does not wrap around at 16 or 32 bits
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_init(ChiakiReorderQueue *queue, size_t size_exp,
 		uint64_t seq_num_start, ChiakiReorderQueueSeqNumGt seq_num_gt, ChiakiReorderQueueSeqNumLt seq_num_lt, ChiakiReorderQueueSeqNumAdd seq_num_add);
 
 /**
- * Helper to initialize a queue using ChiakiSeqNum16 sequence numbers
+ * Initialize a queue using ChiakiSeqNum16 sequence numbers
+ *
+ * @param size exponent for 2
+ * @param seq_num_start sequence number of the first expected element
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_init_16(ChiakiReorderQueue *queue, size_t size_exp, ChiakiSeqNum16 seq_num_start);
 
 /**
- * Helper to initialize a queue using ChiakiSeqNum32 sequence numbers
+ * Initialize a queue using ChiakiSeqNum32 sequence numbers
+ *
+ * @param size exponent for 2
+ * @param seq_num_start sequence number of the first expected element
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_init_32(ChiakiReorderQueue *queue, size_t size_exp, ChiakiSeqNum32 seq_num_start);
 
@@ -73,6 +86,23 @@ static inline void chiaki_reorder_queue_set_drop_cb(ChiakiReorderQueue *queue, C
 	queue->drop_cb_user = user;
 }
 
+/**
+ * Let the queue grow up to 2^size_exp_max entries when a packet arrives that does not fit in anymore,
+ * before resorting to the drop strategy.
+ * By default, the queue never grows.
+ */
+static inline void chiaki_reorder_queue_set_size_exp_max(ChiakiReorderQueue *queue, size_t size_exp_max)
+{
+	queue->size_exp_max = size_exp_max;
+}
+
+/**
+ * Resize the queue, keeping all of its elements.
+ *
+ * @return CHIAKI_ERR_BUF_TOO_SMALL if the current count does not fit into the new size
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_resize(ChiakiReorderQueue *queue, size_t size_exp);
+
 static inline size_t chiaki_reorder_queue_size(ChiakiReorderQueue *queue)
 {
 	return ((size_t)1) << queue->size_exp;
@@ -83,17 +113,35 @@ static inline uint64_t chiaki_reorder_queue_count(ChiakiReorderQueue *queue)
 	return queue->count;
 }
 
+/**
+ * @return highest count the queue ever had
+ */
+static inline uint64_t chiaki_reorder_queue_count_max(ChiakiReorderQueue *queue)
+{
+	return queue->count_max;
+}
+
 /**
  * Push a packet into the queue.
  *
- * Depending on the set drop strategy, this might drop elements and call the drop callback with the dropped elements.
+ * If the packet does not fit and the queue may not grow any further,
+ * depending on the set drop strategy, this might drop elements and call the drop callback with the dropped elements.
  * The callback will also be called with the new element íf there is already an element with the same sequence number
  * or if the sequence number is less than queue->begin, i.e. the next element to be pulled.
  *
  * @param seq_num
  * @param user pointer to be associated with the element
  */
-CHIAKI_EXPORT void chiaki_reorder_queue_push(ChiakiReorderQueue *queue, uint64_t seq_num, void *user);
+CHIAKI_EXPORT void chiaki_reorder_queue_push_16(ChiakiReorderQueue *queue, uint64_t seq_num, void *user);
+CHIAKI_EXPORT void chiaki_reorder_queue_push_32(ChiakiReorderQueue *queue, uint64_t seq_num, void *user);
+
+static inline void chiaki_reorder_queue_push(ChiakiReorderQueue *queue, uint64_t seq_num, void *user)
+{
+	if(queue->seq_num_bits == 16)
+		chiaki_reorder_queue_push_16(queue, seq_num, user);
+	else
+		chiaki_reorder_queue_push_32(queue, seq_num, user);
+}
 
 /**
  * Pull the next element in order from the queue.
@@ -104,24 +152,49 @@ CHIAKI_EXPORT void chiaki_reorder_queue_push(ChiakiReorderQueue *queue, uint64_t
  * @param user pointer where the user pointer of the pulled packet is written, undefined contents if false is returned
  * @return true if an element was pulled in order
  */
-CHIAKI_EXPORT bool chiaki_reorder_queue_pull(ChiakiReorderQueue *queue, uint64_t *seq_num, void **user);
+CHIAKI_EXPORT bool chiaki_reorder_queue_pull_16(ChiakiReorderQueue *queue, uint64_t *seq_num, void **user);
+CHIAKI_EXPORT bool chiaki_reorder_queue_pull_32(ChiakiReorderQueue *queue, uint64_t *seq_num, void **user);
+
+static inline bool chiaki_reorder_queue_pull(ChiakiReorderQueue *queue, uint64_t *seq_num, void **user)
+{
+	if(queue->seq_num_bits == 16)
+		return chiaki_reorder_queue_pull_16(queue, seq_num, user);
+	return chiaki_reorder_queue_pull_32(queue, seq_num, user);
+}
 
 /**
  * Peek the element at a specific index inside the queue.
  *
  * @param index Offset to be added to the begin sequence number, this is NOT a sequence number itself! (0 <= index < count)
- * @param seq_num pointer where the sequence number of the peeked packet is written, undefined contents if false is returned
+ * @param seq_num pointer where the sequence number of the peeked packet is written, undefined contents if false is returned, may be NULL
  * @param user pointer where the user pointer of the pulled packet is written, undefined contents if false is returned
  * @return true if an element was peeked, false if there is no element at index.
  */
-CHIAKI_EXPORT bool chiaki_reorder_queue_peek(ChiakiReorderQueue *queue, uint64_t index, uint64_t *seq_num, void **user);
+CHIAKI_EXPORT bool chiaki_reorder_queue_peek_16(ChiakiReorderQueue *queue, uint64_t index, uint64_t *seq_num, void **user);
+CHIAKI_EXPORT bool chiaki_reorder_queue_peek_32(ChiakiReorderQueue *queue, uint64_t index, uint64_t *seq_num, void **user);
+
+static inline bool chiaki_reorder_queue_peek(ChiakiReorderQueue *queue, uint64_t index, uint64_t *seq_num, void **user)
+{
+	if(queue->seq_num_bits == 16)
+		return chiaki_reorder_queue_peek_16(queue, index, seq_num, user);
+	return chiaki_reorder_queue_peek_32(queue, index, seq_num, user);
+}
 
 /**
  * Drop a specific element from the queue.
  * begin will not be changed.
  * @param index Offset to be added to the begin sequence number, this is NOT a sequence number itself! (0 <= index < count)
  */
-CHIAKI_EXPORT void chiaki_reorder_queue_drop(ChiakiReorderQueue *queue, uint64_t index);
+CHIAKI_EXPORT void chiaki_reorder_queue_drop_16(ChiakiReorderQueue *queue, uint64_t index);
+CHIAKI_EXPORT void chiaki_reorder_queue_drop_32(ChiakiReorderQueue *queue, uint64_t index);
+
+static inline void chiaki_reorder_queue_drop(ChiakiReorderQueue *queue, uint64_t index)
+{
+	if(queue->seq_num_bits == 16)
+		chiaki_reorder_queue_drop_16(queue, index);
+	else
+		chiaki_reorder_queue_drop_32(queue, index);
+}
 
 #ifdef __cplusplus
 }
@@ -10,6 +10,9 @@ extern "C" {
 #endif
 
 typedef struct chiaki_session_t ChiakiSession;
+typedef struct chiaki_network_profile_t ChiakiNetworkProfile;
+
+#define CHIAKI_SENKUSHA_MTU_PROBES_MAX 8
 
 typedef struct senkusha_t
 {
@@ -28,6 +31,13 @@ typedef struct senkusha_t
 	uint32_t ping_tag;
 	uint32_t mtu_id;
 
+	/**
+	 * MTU probes of the current search round, identified by mtu id (in) or ping tag (out)
+	 */
+	uint32_t mtu_probe_ids[CHIAKI_SENKUSHA_MTU_PROBES_MAX];
+	size_t mtu_probes_count;
+	uint32_t mtu_probes_received; // bit i set if probe i has been answered
+
 	/**
 	 * signaled on change of state_finished or should_stop
 	 */
@@ -41,7 +51,14 @@ typedef struct senkusha_t
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_init(ChiakiSenkusha *senkusha, ChiakiSession *session);
 CHIAKI_EXPORT void chiaki_senkusha_fini(ChiakiSenkusha *senkusha);
-CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint32_t *mtu_in, uint32_t *mtu_out, uint64_t *rtt_us);
+
+/**
+ * Measure RTT and MTU in both directions.
+ * @param cached optional profile from a previous session with the same host, only validated instead of searching from scratch
+ * if it was measured on the same local interface
+ * @param profile filled with the measured values on success
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, const ChiakiNetworkProfile *cached, ChiakiNetworkProfile *profile);
 
 #ifdef __cplusplus
 }
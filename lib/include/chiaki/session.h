@@ -14,6 +14,11 @@
 #include "audio.h"
 #include "controller.h"
 #include "stoppipe.h"
+#include "timer.h"
+#include "executor.h"
+#include "avsync.h"
+#include "haptics.h"
+#include "orientation.h"
 
 #include <stdint.h>
 
@@ -69,6 +74,21 @@ CHIAKI_EXPORT void chiaki_connect_video_profile_preset(ChiakiConnectVideoProfile
 
 #define CHIAKI_SESSION_AUTH_SIZE 0x10
 
+#define CHIAKI_NETWORK_PROFILE_LOCAL_ADDR_SIZE 64
+
+/**
+ * Network parameters measured by Senkusha for one host, reported in CHIAKI_EVENT_NETWORK_PROFILE.
+ * The frontend may store it per host and pass it back in ChiakiConnectInfo on the next connect,
+ * so only a short validation instead of the full measurement is needed.
+ */
+typedef struct chiaki_network_profile_t
+{
+	char local_addr[CHIAKI_NETWORK_PROFILE_LOCAL_ADDR_SIZE]; // numeric address of the local interface the profile was measured on, null terminated
+	uint32_t mtu_in;
+	uint32_t mtu_out;
+	uint64_t rtt_us;
+} ChiakiNetworkProfile;
+
 typedef struct chiaki_connect_info_t
 {
 	bool ps5;
@@ -79,6 +99,20 @@ typedef struct chiaki_connect_info_t
 	bool video_profile_auto_downgrade; // Downgrade video_profile if server does not seem to support it.
 	bool enable_keyboard;
 	bool enable_dualsense;
+
+	/**
+	 * Scheduling of the thread receiving the stream, which also runs the video and audio callbacks,
+	 * so decoding and audio output happen on it unless the frontend hands them off to own threads.
+	 * Leave zeroed to keep the system defaults.
+	 */
+	ChiakiThreadSched takion_thread_sched;
+
+	/**
+	 * Profile reported by a previous session with the same host.
+	 * Only used if it was measured on the same local interface and it still validates.
+	 */
+	bool network_profile_valid;
+	ChiakiNetworkProfile network_profile;
 } ChiakiConnectInfo;
 
 
@@ -130,6 +164,28 @@ typedef struct chiaki_trigger_effects_event_t
 	uint8_t right[10];
 } ChiakiTriggerEffectsEvent;
 
+/**
+ * Consecutive phases between chiaki_session_start() and the first video frame.
+ */
+typedef enum {
+	CHIAKI_SESSION_STARTUP_PHASE_SESSION_REQUEST, // http session request, including retries with another version
+	CHIAKI_SESSION_STARTUP_PHASE_CTRL, // ctrl until the session id has been received
+	CHIAKI_SESSION_STARTUP_PHASE_LOGIN_PIN, // waiting for the user to enter the login pin
+	CHIAKI_SESSION_STARTUP_PHASE_SENKUSHA, // mtu and rtt measurement
+	CHIAKI_SESSION_STARTUP_PHASE_CRYPTO, // waiting for key generation that did not finish during the phases before
+	CHIAKI_SESSION_STARTUP_PHASE_STREAM_CONNECTION, // takion handshake until the streaminfo has been received
+	CHIAKI_SESSION_STARTUP_PHASE_FIRST_FRAME, // until the first video frame has been passed to the video sample callback
+	CHIAKI_SESSION_STARTUP_PHASES_COUNT
+} ChiakiSessionStartupPhase;
+
+CHIAKI_EXPORT const char *chiaki_session_startup_phase_string(ChiakiSessionStartupPhase phase);
+
+typedef struct chiaki_startup_timings_event_t
+{
+	uint64_t phase_us[CHIAKI_SESSION_STARTUP_PHASES_COUNT];
+	uint64_t total_us; // sum of all phases
+} ChiakiStartupTimingsEvent;
+
 typedef enum {
 	CHIAKI_EVENT_CONNECTED,
 	CHIAKI_EVENT_LOGIN_PIN_REQUEST,
@@ -139,6 +195,9 @@ typedef enum {
 	CHIAKI_EVENT_RUMBLE,
 	CHIAKI_EVENT_QUIT,
 	CHIAKI_EVENT_TRIGGER_EFFECTS,
+	CHIAKI_EVENT_STARTUP_TIMINGS,
+	CHIAKI_EVENT_NETWORK_PROFILE,
+	CHIAKI_EVENT_NETWORK_STATS, // rtt or path mtu changed during the stream
 } ChiakiEventType;
 
 typedef struct chiaki_event_t
@@ -150,6 +209,9 @@ typedef struct chiaki_event_t
 		ChiakiKeyboardEvent keyboard;
 		ChiakiRumbleEvent rumble;
 		ChiakiTriggerEffectsEvent trigger_effects;
+		ChiakiStartupTimingsEvent startup_timings;
+		ChiakiNetworkProfile network_profile;
+		ChiakiTakionNetworkStats network_stats;
 		struct
 		{
 			bool pin_incorrect; // false on first request, true if the pin entered before was incorrect
@@ -182,6 +244,9 @@ typedef struct chiaki_session_t
 		bool video_profile_auto_downgrade;
 		bool enable_keyboard;
 		bool enable_dualsense;
+		ChiakiThreadSched takion_thread_sched;
+		bool network_profile_valid;
+		ChiakiNetworkProfile network_profile;
 	} connect_info;
 
 	ChiakiTarget target;
@@ -194,6 +259,11 @@ typedef struct chiaki_session_t
 	uint32_t mtu_out;
 	uint64_t rtt_us;
 	ChiakiECDH ecdh;
+	bool crypto_prepared; // handshake_key and ecdh have been generated in the background, protected by state_mutex
+	ChiakiErrorCode crypto_prepare_err;
+
+	ChiakiStartupTimingsEvent startup_timings;
+	uint64_t startup_mark_ns; // end of the last finished startup phase, 0 after the timings have been reported
 
 	ChiakiQuitReason quit_reason;
 	char *quit_reason_str; // additional reason string from remote
@@ -204,12 +274,23 @@ typedef struct chiaki_session_t
 	void *video_sample_cb_user;
 	ChiakiAudioSink audio_sink;
 	ChiakiAudioSink haptics_sink;
+	ChiakiHapticsPipeline *haptics_pipeline; // takes the haptics frames instead of haptics_sink if set
 
 	ChiakiThread session_thread;
 
 	ChiakiCond state_cond;
 	ChiakiMutex state_mutex;
 	ChiakiStopPipe stop_pipe;
+	ChiakiTimerService *timer_service; // shared, runs periodic work of the stream and senkusha
+	ChiakiExecutor *executor; // shared, runs background work such as key stream generation
+	ChiakiTimer log_flush_timer; // logs the summaries of rate limited messages once a flood stopped
+
+	/**
+	 * Fed with frame arrivals by the audio and video receivers.
+	 * The frontend reports its playout delays and applies the corrections from here, see ChiakiAVSync.
+	 */
+	ChiakiAVSync av_sync;
+	volatile uint64_t audio_jitter_delay_us; // playout delay of the audio jitter buffer, set by the audio receiver
 	bool should_stop;
 	bool ctrl_failed;
 	bool ctrl_session_id_received;
@@ -225,6 +306,12 @@ typedef struct chiaki_session_t
 	ChiakiStreamConnection stream_connection;
 
 	ChiakiControllerState controller_state;
+
+	// fused from the samples of chiaki_session_push_motion(), protected by stream_connection.feedback_sender_mutex like controller_state
+	ChiakiOrientationTracker motion_tracker;
+	bool motion_active;
+
+	bool feedback_immediate; // protected by stream_connection.feedback_sender_mutex
 } ChiakiSession;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, ChiakiConnectInfo *connect_info, ChiakiLog *log);
@@ -233,6 +320,36 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_start(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_stop(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_join(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_controller_state(ChiakiSession *session, ChiakiControllerState *state);
+/**
+ * Integrate IMU samples at their full rate, e.g. everything read from the sensor since the last call.
+ * Only the resulting orientation and the last gyro/accel readings are sent, with the next feedback state.
+ *
+ * Once called, gyro, accel and orient passed to chiaki_session_set_controller_state() are ignored
+ * until chiaki_session_reset_motion().
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_push_motion(ChiakiSession *session, const ChiakiMotionSample *samples, size_t samples_count);
+
+/**
+ * Forget the orientation from chiaki_session_push_motion(), e.g. when the motion sensor is gone.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_reset_motion(ChiakiSession *session);
+/**
+ * Send controller state changes on the thread calling chiaki_session_set_controller_state()
+ * instead of the timer thread, see chiaki_feedback_sender_set_immediate().
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_feedback_immediate(ChiakiSession *session, bool immediate);
+
+/**
+ * Get the latency of controller state changes to the wire for the current stream.
+ *
+ * @return CHIAKI_ERR_UNINITIALIZED if there is no stream sending feedback
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_get_feedback_stats(ChiakiSession *session, ChiakiFeedbackSenderStats *stats);
+/**
+ * Get the delay added by the audio jitter buffer before frames reach the audio sink,
+ * e.g. to line up other outputs with the audio.
+ */
+CHIAKI_EXPORT uint64_t chiaki_session_get_audio_jitter_delay_us(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_login_pin(ChiakiSession *session, const uint8_t *pin, size_t pin_size);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_goto_bed(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_keyboard_set_text(ChiakiSession *session, const char *text);
@@ -267,6 +384,20 @@ static inline void chiaki_session_set_haptics_sink(ChiakiSession *session, Chiak
 	session->haptics_sink = *sink;
 }
 
+/**
+ * @param pipeline must stay valid until the session has been joined, NULL to deliver the raw frames to the haptics sink again
+ */
+static inline void chiaki_session_set_haptics_pipeline(ChiakiSession *session, ChiakiHapticsPipeline *pipeline)
+{
+	session->haptics_pipeline = pipeline;
+}
+
+/*
+ * Internal, called by the other parts of the session.
+ */
+void chiaki_session_send_event(ChiakiSession *session, ChiakiEvent *event);
+void chiaki_session_startup_phase_done(ChiakiSession *session, ChiakiSessionStartupPhase phase);
+
 #ifdef __cplusplus
 }
 #endif
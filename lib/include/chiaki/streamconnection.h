@@ -45,6 +45,9 @@ typedef struct chiaki_stream_connection_t
 	 */
 	ChiakiMutex feedback_sender_mutex;
 
+	ChiakiTimer heartbeat_timer;
+	ChiakiTakionNetworkStats network_stats_reported; // only touched by the heartbeat timer callback
+
 	/**
 	 * signaled on change of state_finished or should_stop
 	 */
@@ -12,6 +12,7 @@
 #include "reorderqueue.h"
 #include "feedback.h"
 #include "takionsendbuffer.h"
+#include "timer.h"
 
 #include <stdbool.h>
 
@@ -108,13 +109,42 @@ typedef struct chiaki_takion_connect_info_t
 	bool enable_crypt;
 	bool enable_dualsense;
 	uint8_t protocol_version;
+
+	/**
+	 * Runs periodic work such as re-sending unacked data packets, must outlive the ChiakiTakion.
+	 */
+	ChiakiTimerService *timer_service;
+
+	/**
+	 * Applied by the receiving thread to itself, which also runs all callbacks
+	 * and therefore video and audio decoding.
+	 */
+	ChiakiThreadSched thread_sched;
+
+	/**
+	 * Estimates of the connection, used to cap the growth of the data reorder queue.
+	 * If any of them is 0, the queue keeps its minimum size.
+	 * rtt_us is replaced by the live estimate from data acks once there is one.
+	 */
+	uint64_t rtt_us;
+	uint64_t bandwidth_bps;
+	uint32_t mtu;
 } ChiakiTakionConnectInfo;
 
 
+typedef struct chiaki_takion_network_stats_t
+{
+	uint64_t rtt_us; // smoothed, from data acks, 0 if unknown
+	uint64_t rtt_var_us;
+	uint32_t path_mtu; // as currently known by the os for the socket, 0 if unknown
+} ChiakiTakionNetworkStats;
+
 typedef struct chiaki_takion_t
 {
 	ChiakiLog *log;
 	uint8_t version;
+	ChiakiTimerService *timer_service;
+	ChiakiThreadSched thread_sched;
 
 	/**
 	 * Whether encryption should be used.
@@ -142,6 +172,11 @@ typedef struct chiaki_takion_t
 	ChiakiGKCrypt *gkcrypt_remote; // if NULL (default), remote gmacs are IGNORED (!) and everything is expected to be unencrypted
 
 	ChiakiReorderQueue data_queue;
+	size_t data_queue_size_exp_max;
+	uint64_t rtt_us_initial;
+	uint64_t bandwidth_bps;
+	uint32_t mtu;
+	uint64_t data_queue_busy_ms; // last time data_queue was non-empty while grown
 	ChiakiTakionSendBuffer send_buffer;
 
 	ChiakiTakionCallback cb;
@@ -225,7 +260,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_state(ChiakiTakion *ta
 /**
  * Thread-safe while Takion is running.
  */
-CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_history(ChiakiTakion *takion, ChiakiSeqNum16 seq_num, uint8_t *payload, size_t payload_size);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_history(ChiakiTakion *takion, ChiakiSeqNum16 seq_num, const uint8_t *payload, size_t payload_size);
+
+/**
+ * Thread-safe while Takion is running.
+ */
+CHIAKI_EXPORT void chiaki_takion_get_network_stats(ChiakiTakion *takion, ChiakiTakionNetworkStats *stats);
 
 #define CHIAKI_TAKION_V9_AV_HEADER_SIZE_VIDEO 0x17
 #define CHIAKI_TAKION_V9_AV_HEADER_SIZE_AUDIO 0x12
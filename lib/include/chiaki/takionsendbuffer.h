@@ -6,6 +6,7 @@
 #include "common.h"
 #include "log.h"
 #include "thread.h"
+#include "timer.h"
 #include "seqnum.h"
 
 #include <stdbool.h>
@@ -28,16 +29,23 @@ typedef struct chiaki_takion_send_buffer_t
 	size_t packets_count; // current count
 
 	ChiakiMutex mutex;
-	ChiakiCond cond;
-	bool should_stop;
-	ChiakiThread thread;
+	ChiakiTimer resend_timer; // armed on takion->timer_service while there are packets
+
+	/**
+	 * Round trip estimate like in RFC 6298, sampled from acks of packets that were never re-sent.
+	 * Determines the resend timeout. Protected by mutex, see chiaki_takion_send_buffer_rtt().
+	 */
+	uint64_t srtt_us;
+	uint64_t rttvar_us;
+	uint64_t rtt_samples;
 } ChiakiTakionSendBuffer;
 
 
 /**
- * Init a Send Buffer and start a thread that automatically re-sends packets on takion.
+ * Init a Send Buffer that automatically re-sends packets on takion from its timer service.
+ * The rtt estimate starts out with takion->rtt_us_initial.
  *
- * @param takion if NULL, the Send Buffer thread will effectively do nothing (for unit testing)
+ * @param takion if NULL, nothing is ever re-sent (for unit testing)
  * @param size number of packet slots
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuffer *send_buffer, ChiakiTakion *takion, size_t size);
@@ -54,6 +62,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuf
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count);
 
+/**
+ * Thread-safe.
+ *
+ * @param srtt_us smoothed round trip time, 0 if nothing is known yet
+ * @param rttvar_us optional, round trip time variation
+ */
+CHIAKI_EXPORT void chiaki_takion_send_buffer_rtt(ChiakiTakionSendBuffer *send_buffer, uint64_t *srtt_us, uint64_t *rttvar_us);
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,6 +29,8 @@ typedef struct chiaki_thread_t
 	void *ret;
 #else
 	pthread_t thread;
+	ChiakiThreadFunc func;
+	void *arg;
 #endif
 } ChiakiThread;
 
@@ -36,6 +38,50 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_create(ChiakiThread *thread, ChiakiT
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_join(ChiakiThread *thread, void **retval);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const char *name);
 
+typedef enum {
+	CHIAKI_THREAD_PRIORITY_DEFAULT = 0, // leave as inherited from the creating thread
+	CHIAKI_THREAD_PRIORITY_LOW,
+	CHIAKI_THREAD_PRIORITY_NORMAL,
+	CHIAKI_THREAD_PRIORITY_HIGH, // SCHED_RR, or niceness -10 where real-time scheduling is not permitted
+	CHIAKI_THREAD_PRIORITY_REALTIME // SCHED_FIFO
+} ChiakiThreadPriority;
+
+CHIAKI_EXPORT const char *chiaki_thread_priority_string(ChiakiThreadPriority priority);
+
+/**
+ * @param thread thread to change or NULL for the calling thread.
+ * On Linux, niceness can only be changed for the calling thread.
+ * @return CHIAKI_ERR_THREAD if the priority is not supported or not permitted for this process
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_priority(ChiakiThread *thread, ChiakiThreadPriority priority);
+
+/**
+ * Restrict a thread to the cpus in cpu_mask (bit i = cpu i). Not supported on macOS.
+ *
+ * @param thread thread to change or NULL for the calling thread
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_affinity(ChiakiThread *thread, uint64_t cpu_mask);
+
+/**
+ * Scheduling parameters for a thread, a zeroed struct leaves everything as it is.
+ */
+typedef struct chiaki_thread_sched_t
+{
+	ChiakiThreadPriority priority;
+	uint64_t cpu_mask; // 0 for any cpu
+} ChiakiThreadSched;
+
+struct chiaki_log_t;
+
+/**
+ * Apply sched to the calling thread.
+ * If the priority is not permitted, lower ones down to CHIAKI_THREAD_PRIORITY_HIGH are tried instead.
+ * Failures are only logged, as the thread still works, just with less predictable latency.
+ *
+ * @param name used in log messages
+ */
+CHIAKI_EXPORT void chiaki_thread_sched_apply(const ChiakiThreadSched *sched, const char *name, struct chiaki_log_t *log);
+
 
 typedef struct chiaki_mutex_t
 {
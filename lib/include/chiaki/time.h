@@ -15,6 +15,34 @@ CHIAKI_EXPORT uint64_t chiaki_time_now_monotonic_us();
 
 static inline uint64_t chiaki_time_now_monotonic_ms() { return chiaki_time_now_monotonic_us() / 1000; }
 
+/**
+ * Nanoseconds from a monotonic clock that is not slewed by NTP
+ * (CLOCK_MONOTONIC_RAW on Linux, mach_absolute_time() on Apple, QueryPerformanceCounter() on Windows).
+ *
+ * Cost per call is about 20-40 ns where the kernel serves it from the vDSO (Linux >= 5.3 on x86-64 and arm64),
+ * older kernels fall back to a syscall costing several hundred ns.
+ */
+CHIAKI_EXPORT uint64_t chiaki_time_now_ns();
+
+/**
+ * Raw hardware counter for timestamps in hot paths: the invariant TSC on x86-64, cntvct_el0 on arm64,
+ * mach_absolute_time() on Apple and QueryPerformanceCounter() on Windows.
+ * Cost per call is about 5-10 ns on x86-64 and arm64.
+ *
+ * Only differences of two values are meaningful, convert them with chiaki_time_ticks_to_ns().
+ * Where no usable counter exists, or before chiaki_lib_init() has calibrated it,
+ * this returns chiaki_time_now_ns(), so values from before and after initialization must not be mixed.
+ */
+CHIAKI_EXPORT uint64_t chiaki_time_ticks();
+
+CHIAKI_EXPORT uint64_t chiaki_time_ticks_to_ns(uint64_t ticks);
+
+/**
+ * Calibrate chiaki_time_ticks(), takes around 10 ms on x86-64.
+ * Called by chiaki_lib_init()
+ */
+CHIAKI_EXPORT void chiaki_time_init();
+
 #ifdef __cplusplus
 }
 #endif
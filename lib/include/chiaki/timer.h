@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_TIMER_H
+#define CHIAKI_TIMER_H
+
+#include "common.h"
+#include "thread.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_TIMER_WHEEL_BITS 6
+#define CHIAKI_TIMER_WHEEL_SLOTS (1 << CHIAKI_TIMER_WHEEL_BITS)
+#define CHIAKI_TIMER_WHEEL_LEVELS 4 // => 1 ms resolution, timers further than 2^24 ms (~4.6 h) ahead are re-scheduled on the way
+
+typedef void (*ChiakiTimerCb)(void *user);
+
+typedef struct chiaki_timer_link_t
+{
+	struct chiaki_timer_link_t *prev;
+	struct chiaki_timer_link_t *next;
+} ChiakiTimerLink;
+
+typedef struct chiaki_timer_service_t ChiakiTimerService;
+
+typedef struct chiaki_timer_t
+{
+	ChiakiTimerLink link; // must be first
+	ChiakiTimerService *service;
+	ChiakiTimerCb cb;
+	void *user;
+	uint64_t expires_ms;
+	uint64_t period_ms;
+	bool pending;
+	uint8_t level;
+	uint8_t slot;
+} ChiakiTimer;
+
+/**
+ * Hierarchical timer wheel running the callbacks of all of its timers on a single thread.
+ *
+ * Callbacks must not block, anything taking longer should be handed off to another thread.
+ */
+struct chiaki_timer_service_t
+{
+	ChiakiTimerLink wheel[CHIAKI_TIMER_WHEEL_LEVELS][CHIAKI_TIMER_WHEEL_SLOTS];
+	uint64_t occupied[CHIAKI_TIMER_WHEEL_LEVELS]; // bitmap of non-empty slots per level
+	uint64_t now_tick; // ms, everything up to this has been processed
+	uint64_t wakeup_tick; // ms the thread is sleeping until, 0 while it is awake
+	ChiakiTimer *running;
+	unsigned int cancel_waiters;
+	bool should_stop;
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	ChiakiCond idle_cond;
+	ChiakiThread thread;
+};
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_service_init(ChiakiTimerService *service);
+
+/**
+ * Stop the thread. All timers must have been canceled before.
+ */
+CHIAKI_EXPORT void chiaki_timer_service_fini(ChiakiTimerService *service);
+
+/**
+ * Get the timer service shared by everything in the process, starting it if necessary.
+ * Requires chiaki_lib_init() to have been called.
+ *
+ * @return the service or NULL on failure
+ */
+CHIAKI_EXPORT ChiakiTimerService *chiaki_timer_service_shared_ref();
+
+/**
+ * Release a reference from chiaki_timer_service_shared_ref(), stopping the service after the last one.
+ */
+CHIAKI_EXPORT void chiaki_timer_service_shared_unref(ChiakiTimerService *service);
+
+/**
+ * Called by chiaki_lib_init()
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_service_shared_init();
+
+CHIAKI_EXPORT void chiaki_timer_init(ChiakiTimer *timer, ChiakiTimerService *service, ChiakiTimerCb cb, void *user);
+
+/**
+ * (Re-)start the timer, replacing any previous schedule.
+ * May be called from any thread, including inside of any timer callback.
+ *
+ * @param delay_ms time until the first call of the callback
+ * @param period_ms time between subsequent calls, 0 for a one-shot timer
+ */
+CHIAKI_EXPORT void chiaki_timer_start(ChiakiTimer *timer, uint64_t delay_ms, uint64_t period_ms);
+
+/**
+ * Cancel the timer.
+ *
+ * When called outside of the callback of the timer, it is guaranteed that the callback is neither running
+ * nor going to be called anymore after this returns, so the caller must not hold any locks the callback takes.
+ */
+CHIAKI_EXPORT void chiaki_timer_cancel(ChiakiTimer *timer);
+
+CHIAKI_EXPORT bool chiaki_timer_pending(ChiakiTimer *timer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_TIMER_H
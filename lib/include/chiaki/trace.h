@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_TRACE_H
+#define CHIAKI_TRACE_H
+
+#include <chiaki/config.h>
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Low-overhead tracing of library threads.
+ *
+ * Every thread records into its own ring buffer of CHIAKI_TRACE_RING_SIZE events,
+ * so recording never takes a lock. Once the ring is full, the oldest events are overwritten.
+ * Rings of exited threads are reused by new ones, keeping their events until they are overwritten.
+ * All names passed in must be string literals or otherwise live until the trace is dumped.
+ *
+ * The result can be dumped in Chrome Trace Event JSON format, which is understood by
+ * chrome://tracing and https://ui.perfetto.dev
+ *
+ * Only available if built with CHIAKI_LIB_ENABLE_TRACE, otherwise all CHIAKI_TRACE_* macros are no-ops.
+ */
+
+#if CHIAKI_LIB_ENABLE_TRACE
+
+#ifndef CHIAKI_TRACE_RING_SIZE
+#define CHIAKI_TRACE_RING_SIZE (1 << 15)
+#endif
+
+typedef enum
+{
+	CHIAKI_TRACE_EVENT_BEGIN,
+	CHIAKI_TRACE_EVENT_END,
+	CHIAKI_TRACE_EVENT_COUNTER,
+	CHIAKI_TRACE_EVENT_INSTANT
+} ChiakiTraceEventType;
+
+CHIAKI_EXPORT void chiaki_trace_event(ChiakiTraceEventType type, const char *name, int64_t value);
+
+/**
+ * Set the name of the calling thread as it appears in the trace.
+ */
+CHIAKI_EXPORT void chiaki_trace_thread_name(const char *name);
+
+/**
+ * Hand the ring of the calling thread on to threads started later.
+ * Called automatically at the end of threads started with chiaki_thread_create().
+ */
+CHIAKI_EXPORT void chiaki_trace_thread_exit();
+
+/**
+ * Write all recorded events of all threads as Chrome Trace Event JSON.
+ * Events recorded concurrently while dumping may be torn or missing,
+ * so preferably dump after the session has been stopped.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_trace_dump(FILE *f);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_trace_dump_file(const char *filename);
+
+#define CHIAKI_TRACE_BEGIN(name) chiaki_trace_event(CHIAKI_TRACE_EVENT_BEGIN, (name), 0)
+#define CHIAKI_TRACE_END(name) chiaki_trace_event(CHIAKI_TRACE_EVENT_END, (name), 0)
+#define CHIAKI_TRACE_COUNTER(name, value) chiaki_trace_event(CHIAKI_TRACE_EVENT_COUNTER, (name), (int64_t)(value))
+#define CHIAKI_TRACE_INSTANT(name) chiaki_trace_event(CHIAKI_TRACE_EVENT_INSTANT, (name), 0)
+#define CHIAKI_TRACE_THREAD_NAME(name) chiaki_trace_thread_name(name)
+#define CHIAKI_TRACE_THREAD_EXIT() chiaki_trace_thread_exit()
+
+#else
+
+#define CHIAKI_TRACE_BEGIN(name) do {} while(0)
+#define CHIAKI_TRACE_END(name) do {} while(0)
+#define CHIAKI_TRACE_COUNTER(name, value) do {} while(0)
+#define CHIAKI_TRACE_INSTANT(name) do {} while(0)
+#define CHIAKI_TRACE_THREAD_NAME(name) do {} while(0)
+#define CHIAKI_TRACE_THREAD_EXIT() do {} while(0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_TRACE_H
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_TRENDLINE_H
+#define CHIAKI_TRENDLINE_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_TRENDLINE_WINDOW_SIZE 20
+
+/**
+ * Trendline filter over one-way delay variations, in the style of Google Congestion Control.
+ *
+ * For every packet, the difference between its inter-arrival and inter-departure time is accumulated
+ * and smoothed. The slope of a least squares fit over the last CHIAKI_TRENDLINE_WINDOW_SIZE
+ * samples tells whether queues along the path are building up (positive) or draining (negative).
+ *
+ * Not thread-safe.
+ */
+typedef struct chiaki_trendline_t
+{
+	uint64_t first_arrival_us;
+	uint64_t prev_arrival_us;
+	uint64_t prev_send_us;
+	double accumulated_delay_ms;
+	double smoothed_delay_ms;
+	uint64_t deltas_count;
+
+	double window_x[CHIAKI_TRENDLINE_WINDOW_SIZE]; // arrival time in ms since first packet
+	double window_y[CHIAKI_TRENDLINE_WINDOW_SIZE]; // smoothed delay in ms
+	size_t window_count;
+	size_t window_next;
+
+	double trend; // last calculated slope
+} ChiakiTrendline;
+
+CHIAKI_EXPORT void chiaki_trendline_init(ChiakiTrendline *trendline);
+
+/**
+ * @param arrival_us local time the packet arrived
+ * @param send_us time the packet was sent by the remote, any offset is fine as only differences are used
+ */
+CHIAKI_EXPORT void chiaki_trendline_update(ChiakiTrendline *trendline, uint64_t arrival_us, uint64_t send_us);
+
+static inline double chiaki_trendline_trend(ChiakiTrendline *trendline) { return trendline->trend; }
+static inline uint64_t chiaki_trendline_deltas_count(ChiakiTrendline *trendline) { return trendline->deltas_count; }
+
+typedef enum
+{
+	CHIAKI_BANDWIDTH_USAGE_NORMAL,
+	CHIAKI_BANDWIDTH_USAGE_UNDERUSING,
+	CHIAKI_BANDWIDTH_USAGE_OVERUSING
+} ChiakiBandwidthUsage;
+
+CHIAKI_EXPORT const char *chiaki_bandwidth_usage_string(ChiakiBandwidthUsage usage);
+
+/**
+ * Compares the trend of a ChiakiTrendline against an adaptive threshold to decide
+ * whether the path is overused, i.e. queues are building up.
+ *
+ * Not thread-safe.
+ */
+typedef struct chiaki_overuse_detector_t
+{
+	double threshold;
+	uint64_t last_update_ms;
+	double overuse_time_ms;
+	unsigned int overuse_count;
+	double prev_trend;
+	ChiakiBandwidthUsage usage;
+} ChiakiOveruseDetector;
+
+CHIAKI_EXPORT void chiaki_overuse_detector_init(ChiakiOveruseDetector *detector);
+
+/**
+ * @param trend current value of chiaki_trendline_trend()
+ * @param deltas_count current value of chiaki_trendline_deltas_count()
+ * @param now_ms current monotonic time
+ */
+CHIAKI_EXPORT ChiakiBandwidthUsage chiaki_overuse_detector_detect(ChiakiOveruseDetector *detector, double trend, uint64_t deltas_count, uint64_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_TRENDLINE_H
@@ -2,10 +2,16 @@
 
 #include <chiaki/audioreceiver.h>
 #include <chiaki/session.h>
+#include <chiaki/time.h>
+#include <chiaki/atomic.h>
 
 #include <string.h>
 
+#include "bitops.h"
+
 static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, bool is_haptics, uint8_t *buf, size_t buf_size);
+static void audio_receiver_play_frame(uint8_t *buf, size_t buf_size, void *user);
+static void audio_receiver_play_lost(uint8_t *next_buf, size_t next_buf_size, void *user);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, ChiakiSession *session, ChiakiPacketStats *packet_stats)
 {
@@ -14,20 +20,52 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *au
 	audio_receiver->packet_stats = packet_stats;
 
 	audio_receiver->frame_index_prev = 0;
-	audio_receiver->frame_index_startup = true;
+
+	audio_receiver->frame_window_valid = false;
+	audio_receiver->frame_window_end = 0;
+	audio_receiver->frame_window_received = 0;
+	audio_receiver->frames_recovered = 0;
+	audio_receiver->frames_missed = 0;
 
 	ChiakiErrorCode err = chiaki_mutex_init(&audio_receiver->mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
+	err = chiaki_mutex_init(&audio_receiver->sink_mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	err = chiaki_jitter_buffer_init(&audio_receiver->jitter_buffer, audio_receiver->log,
+			audio_receiver_play_frame, audio_receiver_play_lost, audio_receiver);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_sink_mutex;
+
 	return CHIAKI_ERR_SUCCESS;
+
+error_sink_mutex:
+	chiaki_mutex_fini(&audio_receiver->sink_mutex);
+error_mutex:
+	chiaki_mutex_fini(&audio_receiver->mutex);
+	return err;
 }
 
 CHIAKI_EXPORT void chiaki_audio_receiver_fini(ChiakiAudioReceiver *audio_receiver)
 {
-#ifdef CHIAKI_LIB_ENABLE_OPUS
-	opus_decoder_destroy(audio_receiver->opus_decoder);
-#endif
+	chiaki_jitter_buffer_playout_stop(&audio_receiver->jitter_buffer);
+
+	if(audio_receiver->frames_recovered || audio_receiver->frames_missed)
+		CHIAKI_LOGI(audio_receiver->log, "Audio Receiver recovered %llu frames from FEC units, missed %llu",
+				(unsigned long long)audio_receiver->frames_recovered, (unsigned long long)audio_receiver->frames_missed);
+
+	ChiakiJitterBufferStats stats;
+	chiaki_jitter_buffer_stats(&audio_receiver->jitter_buffer, &stats);
+	if(stats.played)
+		CHIAKI_LOGI(audio_receiver->log, "Audio Jitter Buffer played %llu frames, recovered %llu, concealed %llu, late %llu, dropped %llu, underruns %llu",
+				(unsigned long long)stats.played, (unsigned long long)stats.recovered, (unsigned long long)stats.concealed,
+				(unsigned long long)stats.late, (unsigned long long)stats.dropped, (unsigned long long)stats.underruns);
+
+	chiaki_jitter_buffer_fini(&audio_receiver->jitter_buffer);
+	chiaki_mutex_fini(&audio_receiver->sink_mutex);
 	chiaki_mutex_fini(&audio_receiver->mutex);
 }
 
@@ -42,12 +80,93 @@ CHIAKI_EXPORT void chiaki_audio_receiver_stream_info(ChiakiAudioReceiver *audio_
 	CHIAKI_LOGI(audio_receiver->log, "  frame size = %d", audio_header->frame_size);
 	CHIAKI_LOGI(audio_receiver->log, "  unknown = %d", audio_header->unknown);
 
+	uint64_t frame_duration_us = audio_header->rate ? (uint64_t)audio_header->frame_size * 1000000 / audio_header->rate : 0;
+	if(audio_receiver->packet_stats && frame_duration_us)
+		chiaki_packet_stats_set_seq_interval(audio_receiver->packet_stats, frame_duration_us);
+
 	if(audio_receiver->session->audio_sink.header_cb)
+	{
+		// the sink must not be reconfigured while the playout thread is passing a frame to it
+		chiaki_mutex_lock(&audio_receiver->sink_mutex);
 		audio_receiver->session->audio_sink.header_cb(audio_header, audio_receiver->session->audio_sink.user);
+		chiaki_mutex_unlock(&audio_receiver->sink_mutex);
+	}
+
+	chiaki_jitter_buffer_set_frame_duration(&audio_receiver->jitter_buffer, frame_duration_us);
+	chiaki_av_sync_set_frame_rate(&audio_receiver->session->av_sync, CHIAKI_AV_SYNC_STREAM_AUDIO,
+			frame_duration_us ? audio_header->rate : 0, audio_header->frame_size);
+	if(frame_duration_us)
+		chiaki_jitter_buffer_playout_start(&audio_receiver->jitter_buffer, "Chiaki Audio");
 
 	chiaki_mutex_unlock(&audio_receiver->mutex);
 }
 
+static void audio_receiver_play_frame(uint8_t *buf, size_t buf_size, void *user)
+{
+	ChiakiAudioReceiver *audio_receiver = user;
+	chiaki_mutex_lock(&audio_receiver->sink_mutex);
+	if(audio_receiver->session->audio_sink.frame_cb)
+		audio_receiver->session->audio_sink.frame_cb(buf, buf_size, audio_receiver->session->audio_sink.user);
+	chiaki_mutex_unlock(&audio_receiver->sink_mutex);
+}
+
+static void audio_receiver_play_lost(uint8_t *next_buf, size_t next_buf_size, void *user)
+{
+	ChiakiAudioReceiver *audio_receiver = user;
+	chiaki_mutex_lock(&audio_receiver->sink_mutex);
+	if(audio_receiver->session->audio_sink.frame_lost_cb)
+		audio_receiver->session->audio_sink.frame_lost_cb(next_buf, next_buf_size, audio_receiver->session->audio_sink.user);
+	chiaki_mutex_unlock(&audio_receiver->sink_mutex);
+}
+
+/**
+ * Mark frame_index as received in the sliding window, advancing it if necessary.
+ *
+ * @param missed incremented by the number of frames that leave the window without having been received
+ * @return true if the frame is new, false if it was already received or is too old to tell
+ */
+static bool audio_receiver_window_mark(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, uint64_t *missed)
+{
+	if(!audio_receiver->frame_window_valid)
+	{
+		// everything before the very first frame belongs to no stream we know of
+		audio_receiver->frame_window_valid = true;
+		audio_receiver->frame_window_end = frame_index;
+		audio_receiver->frame_window_received = UINT64_MAX;
+		return true;
+	}
+
+	if(chiaki_seq_num_16_gt(frame_index, audio_receiver->frame_window_end))
+	{
+		ChiakiSeqNum16 shift = frame_index - audio_receiver->frame_window_end;
+		uint64_t received = audio_receiver->frame_window_received;
+		if(shift >= CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE)
+		{
+			*missed += CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE - popcount64(received);
+			*missed += shift - CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE;
+			received = 0;
+		}
+		else
+		{
+			uint64_t leaving = UINT64_MAX << (CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE - shift);
+			*missed += shift - popcount64(received & leaving);
+			received <<= shift;
+		}
+		audio_receiver->frame_window_received = received | 1;
+		audio_receiver->frame_window_end = frame_index;
+		return true;
+	}
+
+	ChiakiSeqNum16 age = audio_receiver->frame_window_end - frame_index;
+	if(age >= CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE)
+		return false;
+	uint64_t bit = (uint64_t)1 << age;
+	if(audio_receiver->frame_window_received & bit)
+		return false;
+	audio_receiver->frame_window_received |= bit;
+	return true;
+}
+
 CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_receiver, ChiakiTakionAVPacket *packet)
 {
 	if(packet->codec != 5)
@@ -82,29 +201,42 @@ CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_re
 		return;
 	}
 
-	if(packet->frame_index > (1 << 15))
-		audio_receiver->frame_index_startup = false;
-
+	// Source units are the frames starting at frame_index,
+	// FEC units are copies of the fec_units_count frames right before it.
+	// Since the source units come first, all frames of the packet are known to the window
+	// by the time the FEC units are checked, so a single pass is enough.
+	uint64_t missed = 0;
+	uint64_t recovered = 0;
 	for(size_t i = 0; i < source_units_count + fec_units_count; i++)
 	{
-		ChiakiSeqNum16 frame_index;
-		if(i < source_units_count)
-			frame_index = packet->frame_index + i;
-		else
-		{
-			// fec
-			size_t fec_index = i - source_units_count;
+		bool fec = i >= source_units_count;
+		ChiakiSeqNum16 frame_index = fec
+			? packet->frame_index - fec_units_count + (i - source_units_count)
+			: packet->frame_index + i;
 
-			// first packets will contain the same frame multiple times, ignore those
-			if(audio_receiver->frame_index_startup && packet->frame_index + fec_index < fec_units_count + 1)
-				continue;
-
-			frame_index = packet->frame_index - fec_units_count + fec_index;
-		}
+		if(!audio_receiver_window_mark(audio_receiver, frame_index, &missed))
+			continue;
+		if(fec)
+			recovered++;
 
 		chiaki_audio_receiver_frame(audio_receiver, frame_index, packet->is_haptics, packet->data + unit_size * i, unit_size);
 	}
 
+	if(!packet->is_haptics && source_units_count)
+	{
+		// frames reach the sink only after the jitter buffer's delay, which the frontend knows nothing about
+		ChiakiJitterBufferStats jitter_stats;
+		chiaki_jitter_buffer_stats(&audio_receiver->jitter_buffer, &jitter_stats);
+		chiaki_atomic_store_u64(&audio_receiver->session->audio_jitter_delay_us, jitter_stats.delay_us);
+		chiaki_av_sync_push(&audio_receiver->session->av_sync, CHIAKI_AV_SYNC_STREAM_AUDIO,
+				packet->frame_index + source_units_count - 1, chiaki_time_now_monotonic_us() + jitter_stats.delay_us);
+	}
+
+	audio_receiver->frames_recovered += recovered;
+	audio_receiver->frames_missed += missed;
+	if(audio_receiver->packet_stats && (recovered || missed))
+		chiaki_packet_stats_push_fec(audio_receiver->packet_stats, recovered, missed);
+
 	if(audio_receiver->packet_stats)
 		chiaki_packet_stats_push_seq(audio_receiver->packet_stats, packet->frame_index);
 }
@@ -113,14 +245,36 @@ static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, Chi
 {
 	chiaki_mutex_lock(&audio_receiver->mutex);
 
+	if(!is_haptics && audio_receiver->jitter_buffer.frame_duration_us)
+	{
+		// the jitter buffer takes care of reordering and duplicates itself
+		if(chiaki_jitter_buffer_push(&audio_receiver->jitter_buffer, frame_index, buf, buf_size, chiaki_time_now_monotonic_us())
+			&& audio_receiver->packet_stats)
+			chiaki_packet_stats_push_goodput(audio_receiver->packet_stats, buf_size);
+		goto beach;
+	}
+
+	if(is_haptics && audio_receiver->session->haptics_pipeline)
+	{
+		chiaki_haptics_pipeline_push(audio_receiver->session->haptics_pipeline, frame_index, buf, buf_size, chiaki_time_now_monotonic_us());
+		if(audio_receiver->packet_stats)
+			chiaki_packet_stats_push_goodput(audio_receiver->packet_stats, buf_size);
+		goto beach;
+	}
+
 	if(!chiaki_seq_num_16_gt(frame_index, audio_receiver->frame_index_prev))
 		goto beach;
 	audio_receiver->frame_index_prev = frame_index;
 
+	if(audio_receiver->packet_stats)
+		chiaki_packet_stats_push_goodput(audio_receiver->packet_stats, buf_size);
+
+	chiaki_mutex_lock(&audio_receiver->sink_mutex);
 	if(is_haptics && audio_receiver->session->haptics_sink.frame_cb)
 		audio_receiver->session->haptics_sink.frame_cb(buf, buf_size, audio_receiver->session->haptics_sink.user);
 	else if(!is_haptics && audio_receiver->session->audio_sink.frame_cb)
 		audio_receiver->session->audio_sink.frame_cb(buf, buf_size, audio_receiver->session->audio_sink.user);
+	chiaki_mutex_unlock(&audio_receiver->sink_mutex);
 
 beach:
 	chiaki_mutex_unlock(&audio_receiver->mutex);
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/audioring.h>
+#include <chiaki/atomic.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// weight of a new fill sample in the moving average, the consumer usually reads every few ms
+#define AUDIO_RING_FILL_SMOOTHING (1.0 / 32.0)
+
+// rate deviation per relative fill error, so CHIAKI_AUDIO_RING_RATIO_MAX is reached at half the target off
+#define AUDIO_RING_RATIO_GAIN (CHIAKI_AUDIO_RING_RATIO_MAX * 2.0)
+
+#define FRAME(ring, pos) (&(ring)->buf[((pos) & ((ring)->size - 1)) * (ring)->channels])
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_ring_init(ChiakiAudioRing *ring, unsigned int channels, unsigned int rate, size_t capacity_frames, size_t target_frames)
+{
+	if(!channels || !rate || !target_frames || target_frames >= capacity_frames)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->size = 1;
+	while(ring->size < capacity_frames)
+		ring->size <<= 1;
+	ring->buf = calloc(ring->size * channels, sizeof(int16_t));
+	if(!ring->buf)
+		return CHIAKI_ERR_MEMORY;
+	ring->channels = channels;
+	ring->rate = rate;
+	ring->target_frames = target_frames;
+	ring->ratio_ppm = 1000000;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_fini(ChiakiAudioRing *ring)
+{
+	free(ring->buf);
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_write(ChiakiAudioRing *ring, const int16_t *buf, size_t frames)
+{
+	uint64_t write_pos = ring->write_pos;
+	size_t free_frames = ring->size - (size_t)(write_pos - chiaki_atomic_load_u64(&ring->read_pos));
+	if(frames > free_frames)
+	{
+		chiaki_atomic_fetch_add_u64(&ring->overflow_frames, frames - free_frames);
+		frames = free_frames;
+	}
+
+	size_t offset = (size_t)(write_pos & (ring->size - 1));
+	size_t first = ring->size - offset;
+	if(first > frames)
+		first = frames;
+	memcpy(FRAME(ring, write_pos), buf, first * ring->channels * sizeof(int16_t));
+	if(frames > first)
+		memcpy(ring->buf, buf + first * ring->channels, (frames - first) * ring->channels * sizeof(int16_t));
+
+	// publishes the frames copied above
+	chiaki_atomic_store_u64(&ring->write_pos, write_pos + frames);
+	return frames;
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_set_delay(ChiakiAudioRing *ring, size_t delay_frames)
+{
+	size_t max = ring->size > ring->target_frames * 2 ? ring->size - ring->target_frames * 2 : 0;
+	if(delay_frames > max)
+		delay_frames = max;
+	chiaki_atomic_store_u64(&ring->delay_frames, delay_frames);
+}
+
+static double audio_ring_ratio(ChiakiAudioRing *ring, size_t target_frames)
+{
+	double error = (ring->fill_avg - (double)target_frames) / (double)target_frames;
+	double ratio = error * AUDIO_RING_RATIO_GAIN;
+	if(ratio > CHIAKI_AUDIO_RING_RATIO_MAX)
+		ratio = CHIAKI_AUDIO_RING_RATIO_MAX;
+	else if(ratio < -CHIAKI_AUDIO_RING_RATIO_MAX)
+		ratio = -CHIAKI_AUDIO_RING_RATIO_MAX;
+	return 1.0 + ratio;
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_read(ChiakiAudioRing *ring, int16_t *buf, size_t frames)
+{
+	uint64_t write_pos = chiaki_atomic_load_u64(&ring->write_pos);
+	uint64_t read_pos = ring->read_pos;
+	size_t fill = (size_t)(write_pos - read_pos);
+	size_t target_frames = ring->target_frames + (size_t)chiaki_atomic_load_u64(&ring->delay_frames);
+	size_t played = 0;
+
+	if(!ring->playing)
+	{
+		ring->fill_avg = (double)fill;
+		if(fill < target_frames)
+			goto beach;
+		ring->playing = true;
+		ring->frac = 0.0;
+	}
+
+	ring->fill_avg += ((double)fill - ring->fill_avg) * AUDIO_RING_FILL_SMOOTHING;
+	double ratio = audio_ring_ratio(ring, target_frames);
+	chiaki_atomic_store_u64(&ring->ratio_ppm, (uint64_t)llround(ratio * 1000000.0));
+
+	for(; played < frames; played++)
+	{
+		// interpolating needs the frame after the current one as well
+		if(read_pos + 1 >= write_pos)
+		{
+			ring->playing = false;
+			chiaki_atomic_fetch_add_u64(&ring->underruns, 1);
+			break;
+		}
+		const int16_t *a = FRAME(ring, read_pos);
+		const int16_t *b = FRAME(ring, read_pos + 1);
+		int16_t *out = buf + played * ring->channels;
+		for(unsigned int c = 0; c < ring->channels; c++)
+			out[c] = (int16_t)lrint((double)a[c] + (double)(b[c] - a[c]) * ring->frac);
+		ring->frac += ratio;
+		while(ring->frac >= 1.0)
+		{
+			ring->frac -= 1.0;
+			read_pos++;
+		}
+	}
+
+	// frees the frames consumed above for the producer
+	chiaki_atomic_store_u64(&ring->read_pos, read_pos);
+
+beach:
+	if(played < frames)
+		memset(buf + played * ring->channels, 0, (frames - played) * ring->channels * sizeof(int16_t));
+	chiaki_atomic_store_u64(&ring->latency_us, (uint64_t)(ring->fill_avg * 1000000.0 / (double)ring->rate));
+	return played;
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_fill(ChiakiAudioRing *ring)
+{
+	// load read_pos first so write_pos can only be newer and the difference never negative
+	uint64_t read_pos = chiaki_atomic_load_u64(&ring->read_pos);
+	return (size_t)(chiaki_atomic_load_u64(&ring->write_pos) - read_pos);
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_stats(ChiakiAudioRing *ring, ChiakiAudioRingStats *stats)
+{
+	stats->latency_us = chiaki_atomic_load_u64(&ring->latency_us);
+	stats->ratio = (double)chiaki_atomic_load_u64(&ring->ratio_ppm) / 1000000.0;
+	stats->underruns = chiaki_atomic_load_u64(&ring->underruns);
+	stats->overflow_frames = chiaki_atomic_load_u64(&ring->overflow_frames);
+}
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/avsync.h>
+
+#include <string.h>
+
+static void stream_reset(ChiakiAVSyncStreamState *state)
+{
+	state->index_valid = false;
+	state->offsets_count = 0;
+	state->offsets_next = 0;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_av_sync_init(ChiakiAVSync *sync)
+{
+	memset(sync, 0, sizeof(*sync));
+	sync->bound_us = CHIAKI_AV_SYNC_BOUND_DEFAULT_US;
+	return chiaki_mutex_init(&sync->mutex, false);
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_fini(ChiakiAVSync *sync)
+{
+	chiaki_mutex_fini(&sync->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_set_bound(ChiakiAVSync *sync, uint64_t bound_us)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	sync->bound_us = bound_us;
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_set_frame_rate(ChiakiAVSync *sync, ChiakiAVSyncStream stream, uint64_t rate_num, uint64_t rate_den)
+{
+	if(!rate_den)
+		rate_num = 0;
+	chiaki_mutex_lock(&sync->mutex);
+	ChiakiAVSyncStreamState *state = &sync->streams[stream];
+	if(state->rate_num != rate_num || state->rate_den != rate_den)
+	{
+		state->rate_num = rate_num;
+		state->rate_den = rate_den;
+		stream_reset(state);
+	}
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_push(ChiakiAVSync *sync, ChiakiAVSyncStream stream, ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	ChiakiAVSyncStreamState *state = &sync->streams[stream];
+	if(!state->rate_num)
+		goto beach;
+
+	if(!state->index_valid)
+	{
+		// indices count from the start of the stream, so the first one is taken as is
+		state->index_valid = true;
+		state->index_last = frame_index;
+		state->index_ext = frame_index;
+	}
+	else if(chiaki_seq_num_16_gt(frame_index, state->index_last))
+	{
+		state->index_ext += (ChiakiSeqNum16)(frame_index - state->index_last);
+		state->index_last = frame_index;
+	}
+	else
+	{
+		// late frames only raise the offset, which the minimum ignores anyway
+		goto beach;
+	}
+
+	// computed from the index each time instead of summing up rounded frame durations
+	uint64_t sender_us = state->index_ext * 1000000 * state->rate_den / state->rate_num;
+	state->offsets_us[state->offsets_next] = (int64_t)arrival_us - (int64_t)sender_us;
+	state->offsets_next = (state->offsets_next + 1) % CHIAKI_AV_SYNC_WINDOW_SIZE;
+	if(state->offsets_count < CHIAKI_AV_SYNC_WINDOW_SIZE)
+		state->offsets_count++;
+
+beach:
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_set_playout_delay(ChiakiAVSync *sync, ChiakiAVSyncStream stream, uint64_t playout_delay_us, uint64_t droppable_us)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	ChiakiAVSyncStreamState *state = &sync->streams[stream];
+	state->playout_delay_us = playout_delay_us;
+	state->droppable_us = droppable_us < playout_delay_us ? droppable_us : playout_delay_us;
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+/**
+ * @return presentation time of the stream relative to the common sender clock
+ */
+static int64_t stream_presentation_offset(ChiakiAVSyncStreamState *state)
+{
+	int64_t offset_min = state->offsets_us[0];
+	for(size_t i = 1; i < state->offsets_count; i++)
+	{
+		if(state->offsets_us[i] < offset_min)
+			offset_min = state->offsets_us[i];
+	}
+	return offset_min + (int64_t)state->playout_delay_us;
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_correction(ChiakiAVSync *sync, ChiakiAVSyncCorrection *correction)
+{
+	memset(correction, 0, sizeof(*correction));
+	chiaki_mutex_lock(&sync->mutex);
+
+	ChiakiAVSyncStreamState *audio = &sync->streams[CHIAKI_AV_SYNC_STREAM_AUDIO];
+	ChiakiAVSyncStreamState *video = &sync->streams[CHIAKI_AV_SYNC_STREAM_VIDEO];
+	if(audio->offsets_count < CHIAKI_AV_SYNC_SAMPLES_MIN || video->offsets_count < CHIAKI_AV_SYNC_SAMPLES_MIN)
+		goto beach;
+
+	correction->valid = true;
+	correction->skew_us = stream_presentation_offset(audio) - stream_presentation_offset(video);
+
+	uint64_t skew_abs = correction->skew_us < 0 ? (uint64_t)-correction->skew_us : (uint64_t)correction->skew_us;
+	if(skew_abs <= sync->bound_us)
+		goto beach;
+
+	// catching up on the late stream keeps the latency low, only the remainder is made up by holding back the early one
+	ChiakiAVSyncStream late = correction->skew_us > 0 ? CHIAKI_AV_SYNC_STREAM_AUDIO : CHIAKI_AV_SYNC_STREAM_VIDEO;
+	ChiakiAVSyncStream early = late == CHIAKI_AV_SYNC_STREAM_AUDIO ? CHIAKI_AV_SYNC_STREAM_VIDEO : CHIAKI_AV_SYNC_STREAM_AUDIO;
+	uint64_t drop = sync->streams[late].droppable_us;
+	if(drop > skew_abs)
+		drop = skew_abs;
+	correction->drop_us[late] = drop;
+	correction->delay_us[early] = skew_abs - drop;
+
+beach:
+	chiaki_mutex_unlock(&sync->mutex);
+}
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_BITOPS_H
+#define CHIAKI_BITOPS_H
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+ * Count trailing zeros, v must not be 0
+ */
+static inline unsigned int ctz64(uint64_t v)
+{
+#if defined(_MSC_VER)
+	unsigned long r;
+	if(_BitScanForward(&r, (unsigned long)v))
+		return (unsigned int)r;
+	_BitScanForward(&r, (unsigned long)(v >> 32));
+	return (unsigned int)r + 32;
+#else
+	return (unsigned int)__builtin_ctzll(v);
+#endif
+}
+
+/**
+ * Count leading zeros, v must not be 0
+ */
+static inline unsigned int clz64(uint64_t v)
+{
+#if defined(_MSC_VER)
+	unsigned long r;
+	if(_BitScanReverse(&r, (unsigned long)(v >> 32)))
+		return 31 - (unsigned int)r;
+	_BitScanReverse(&r, (unsigned long)v);
+	return 63 - (unsigned int)r;
+#else
+	return (unsigned int)__builtin_clzll(v);
+#endif
+}
+
+/**
+ * Count set bits
+ */
+static inline unsigned int popcount64(uint64_t v)
+{
+#if defined(_MSC_VER)
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (unsigned int)((v * 0x0101010101010101ULL) >> 56);
+#else
+	return (unsigned int)__builtin_popcountll(v);
+#endif
+}
+
+static inline uint64_t rotr64(uint64_t v, unsigned int n)
+{
+	n &= 63;
+	return n ? (v >> n) | (v << (64 - n)) : v;
+}
+
+#endif // CHIAKI_BITOPS_H
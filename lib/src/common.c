@@ -3,6 +3,9 @@
 #include <chiaki/common.h>
 #include <chiaki/fec.h>
 #include <chiaki/random.h>
+#include <chiaki/executor.h>
+#include <chiaki/timer.h>
+#include <chiaki/time.h>
 
 #include <galois.h>
 
@@ -103,7 +106,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_lib_init()
 	}
 #endif
 
-	return CHIAKI_ERR_SUCCESS;
+	chiaki_time_init();
+
+	ChiakiErrorCode err = chiaki_timer_service_shared_init();
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	return chiaki_executor_shared_init();
 }
 
 CHIAKI_EXPORT const char *chiaki_codec_name(ChiakiCodec codec)
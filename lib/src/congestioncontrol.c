@@ -1,68 +1,75 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/congestioncontrol.h>
+#include <chiaki/trace.h>
+#include <chiaki/time.h>
 
 #define CONGESTION_CONTROL_INTERVAL_MS 200
+#define CONGESTION_CONTROL_OVERUSE_INTERVAL_MS 50
 
-static void *congestion_control_thread_func(void *user)
+// loss reported on top of the measured one while overusing, relative to received packets
+#define CONGESTION_CONTROL_OVERUSE_LOSS_PERMILLE 50
+
+static void congestion_control_shape(ChiakiCongestionControl *control, ChiakiPacketStatsSnapshot *window, ChiakiTakionCongestionPacket *packet)
 {
-	ChiakiCongestionControl *control = user;
+	ChiakiBandwidthUsage usage_prev = control->detector.usage;
+	ChiakiBandwidthUsage usage = chiaki_overuse_detector_detect(&control->detector,
+		window->delay_trend, window->delay_deltas, chiaki_time_now_monotonic_ms());
+	CHIAKI_TRACE_COUNTER("congestion_control_usage", usage);
+	if(usage != usage_prev)
+		CHIAKI_LOGI(control->takion->log, "Congestion Control detected %s path, delay trend: %.4f",
+			chiaki_bandwidth_usage_string(usage), window->delay_trend);
 
-	ChiakiErrorCode err = chiaki_bool_pred_cond_lock(&control->stop_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
+	if(usage != CHIAKI_BANDWIDTH_USAGE_OVERUSING || !packet->received)
+		return;
+
+	uint64_t lost = (uint64_t)packet->lost + ((uint64_t)packet->received * CONGESTION_CONTROL_OVERUSE_LOSS_PERMILLE + 999) / 1000;
+	packet->lost = lost > UINT16_MAX ? UINT16_MAX : (uint16_t)lost;
+}
+
+static uint64_t congestion_control_interval_ms(ChiakiCongestionControl *control)
+{
+	return control->detector.usage == CHIAKI_BANDWIDTH_USAGE_OVERUSING
+		? CONGESTION_CONTROL_OVERUSE_INTERVAL_MS
+		: CONGESTION_CONTROL_INTERVAL_MS;
+}
 
-	while(true)
-	{
-		err = chiaki_bool_pred_cond_timedwait(&control->stop_cond, CONGESTION_CONTROL_INTERVAL_MS);
-		if(err != CHIAKI_ERR_TIMEOUT)
-			break;
+static void congestion_control_timer_cb(void *user)
+{
+	ChiakiCongestionControl *control = user;
 
-		uint64_t received;
-		uint64_t lost;
-		chiaki_packet_stats_get(control->stats, true, &received, &lost);
-		ChiakiTakionCongestionPacket packet = { 0 };
-		packet.received = (uint16_t)received;
-		packet.lost = (uint16_t)lost;
-		CHIAKI_LOGV(control->takion->log, "Sending Congestion Control Packet, received: %u, lost: %u",
-			(unsigned int)packet.received, (unsigned int)packet.lost);
-		chiaki_takion_send_congestion(control->takion, &packet);
-	}
+	ChiakiPacketStatsSnapshot window;
+	chiaki_packet_stats_snapshot_window(control->stats, &control->stats_prev, &window);
+	ChiakiTakionCongestionPacket packet = { 0 };
+	packet.received = (uint16_t)chiaki_packet_stats_snapshot_received(&window);
+	packet.lost = (uint16_t)chiaki_packet_stats_snapshot_lost(&window);
+	congestion_control_shape(control, &window, &packet);
+	CHIAKI_LOGV(control->takion->log, "Sending Congestion Control Packet, received: %u, lost: %u, jitter: %.2f ms, delay trend: %.4f, goodput: %llu kbit/s, fec recovered: %llu, missed: %llu, duplicates: %llu",
+		(unsigned int)packet.received, (unsigned int)packet.lost,
+		window.jitter_ms, window.delay_trend, (unsigned long long)(chiaki_packet_stats_snapshot_goodput_bps(&window) / 1000),
+		(unsigned long long)window.fec_recovered, (unsigned long long)window.fec_missed,
+		(unsigned long long)window.seq_duplicates);
+	chiaki_takion_send_congestion(control->takion, &packet);
 
-	chiaki_bool_pred_cond_unlock(&control->stop_cond);
-	return NULL;
+	// one-shot instead of periodic because the interval depends on the result
+	chiaki_timer_start(&control->timer, congestion_control_interval_ms(control), 0);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats)
 {
 	control->takion = takion;
 	control->stats = stats;
+	chiaki_overuse_detector_init(&control->detector);
+	chiaki_packet_stats_snapshot(control->stats, &control->stats_prev);
 
-	ChiakiErrorCode err = chiaki_bool_pred_cond_init(&control->stop_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-
-	err = chiaki_thread_create(&control->thread, congestion_control_thread_func, control);
-	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		chiaki_bool_pred_cond_fini(&control->stop_cond);
-		return err;
-	}
-
-	chiaki_thread_set_name(&control->thread, "Chiaki Congestion Control");
+	chiaki_timer_init(&control->timer, takion->timer_service, congestion_control_timer_cb, control);
+	chiaki_timer_start(&control->timer, congestion_control_interval_ms(control), 0);
 
 	return CHIAKI_ERR_SUCCESS;
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_stop(ChiakiCongestionControl *control)
 {
-	ChiakiErrorCode err = chiaki_bool_pred_cond_signal(&control->stop_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-
-	err = chiaki_thread_join(&control->thread, NULL);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-
-	return chiaki_bool_pred_cond_fini(&control->stop_cond);
+	chiaki_timer_cancel(&control->timer);
+	return CHIAKI_ERR_SUCCESS;
 }
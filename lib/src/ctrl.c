@@ -4,6 +4,7 @@
 #include <chiaki/session.h>
 #include <chiaki/base64.h>
 #include <chiaki/http.h>
+#include <chiaki/trace.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -84,8 +85,6 @@ typedef struct ctrl_keyboard_text_response_t
 	uint32_t text_length2;
 } CtrlKeyboardTextResponseMessage;
 
-void chiaki_session_send_event(ChiakiSession *session, ChiakiEvent *event);
-
 static void *ctrl_thread_func(void *user);
 static ChiakiErrorCode ctrl_message_send(ChiakiCtrl *ctrl, uint16_t type, const uint8_t *payload, size_t payload_size);
 static void ctrl_enable_optional_features(ChiakiCtrl *ctrl);
@@ -273,6 +272,7 @@ static void ctrl_failed(ChiakiCtrl *ctrl, ChiakiQuitReason reason)
 static void *ctrl_thread_func(void *user)
 {
 	ChiakiCtrl *ctrl = user;
+	CHIAKI_TRACE_THREAD_NAME("Chiaki Ctrl");
 
 	ChiakiErrorCode err = chiaki_mutex_lock(&ctrl->notif_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
@@ -5,6 +5,7 @@
 #include <chiaki/discovery.h>
 #include <chiaki/http.h>
 #include <chiaki/log.h>
+#include <chiaki/trace.h>
 
 #include <string.h>
 #include <stdio.h>
@@ -287,6 +288,7 @@ static void *discovery_thread_func(void *user)
 {
 	ChiakiDiscoveryThread *thread = user;
 	ChiakiDiscovery *discovery = thread->discovery;
+	CHIAKI_TRACE_THREAD_NAME("Chiaki Discovery");
 
 	while(1)
 	{
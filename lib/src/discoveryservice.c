@@ -11,8 +11,7 @@
 #include <netinet/in.h>
 #endif
 
-static void *discovery_service_thread_func(void *user);
-static void discovery_service_ping(ChiakiDiscoveryService *service);
+static void discovery_service_ping(void *user);
 static void discovery_service_drop_old_hosts(ChiakiDiscoveryService *service);
 static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *user);
 static void discovery_service_report_state(ChiakiDiscoveryService *service);
@@ -53,19 +52,23 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryServi
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_send_addr;
 
-	err = chiaki_bool_pred_cond_init(&service->stop_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
+	service->timer_service = chiaki_timer_service_shared_ref();
+	if(!service->timer_service)
+	{
+		err = CHIAKI_ERR_UNKNOWN;
 		goto error_discovery;
+	}
 
-	err = chiaki_thread_create(&service->thread, discovery_service_thread_func, service);
+	err = chiaki_discovery_thread_start(&service->discovery_thread, &service->discovery, discovery_service_host_received, service);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_stop_cond;
+		goto error_timer_service;
 
-	chiaki_thread_set_name(&service->thread, "Chiaki Discovery Service");
+	chiaki_timer_init(&service->ping_timer, service->timer_service, discovery_service_ping, service);
+	chiaki_timer_start(&service->ping_timer, service->options.ping_ms, service->options.ping_ms);
 
 	return CHIAKI_ERR_SUCCESS;
-error_stop_cond:
-	chiaki_bool_pred_cond_fini(&service->stop_cond);
+error_timer_service:
+	chiaki_timer_service_shared_unref(service->timer_service);
 error_discovery:
 	chiaki_discovery_fini(&service->discovery);
 error_send_addr:
@@ -81,9 +84,9 @@ error_hosts:
 
 CHIAKI_EXPORT void chiaki_discovery_service_fini(ChiakiDiscoveryService *service)
 {
-	chiaki_bool_pred_cond_signal(&service->stop_cond);
-	chiaki_thread_join(&service->thread, NULL);
-	chiaki_bool_pred_cond_fini(&service->stop_cond);
+	chiaki_timer_cancel(&service->ping_timer);
+	chiaki_discovery_thread_stop(&service->discovery_thread);
+	chiaki_timer_service_shared_unref(service->timer_service);
 	chiaki_discovery_fini(&service->discovery);
 	chiaki_mutex_fini(&service->state_mutex);
 	free(service->options.send_addr);
@@ -100,36 +103,9 @@ CHIAKI_EXPORT void chiaki_discovery_service_fini(ChiakiDiscoveryService *service
 	free(service->hosts);
 }
 
-static void *discovery_service_thread_func(void *user)
+static void discovery_service_ping(void *user)
 {
 	ChiakiDiscoveryService *service = user;
-
-	ChiakiErrorCode err = chiaki_bool_pred_cond_lock(&service->stop_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
-
-	ChiakiDiscoveryThread discovery_thread;
-	err = chiaki_discovery_thread_start(&discovery_thread, &service->discovery, discovery_service_host_received, service);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
-
-	while(true)
-	{
-		err = chiaki_bool_pred_cond_timedwait(&service->stop_cond, service->options.ping_ms);
-		if(err != CHIAKI_ERR_TIMEOUT)
-			break;
-		discovery_service_ping(service);
-	}
-
-	chiaki_discovery_thread_stop(&discovery_thread);
-
-beach:
-	chiaki_bool_pred_cond_unlock(&service->stop_cond);
-	return NULL;
-}
-
-static void discovery_service_ping(ChiakiDiscoveryService *service)
-{
 	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
 
@@ -0,0 +1,306 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/executor.h>
+#include <chiaki/atomic.h>
+#include <chiaki/trace.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#define EXECUTOR_THREAD_LOCAL __declspec(thread)
+#else
+#define EXECUTOR_THREAD_LOCAL __thread
+#endif
+
+#define EXECUTOR_DEQUE_SIZE_INIT 64
+
+// worker whose thread this is, if any
+static EXECUTOR_THREAD_LOCAL ChiakiExecutorWorker *current_worker = NULL;
+
+static size_t executor_cpu_count()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long r = sysconf(_SC_NPROCESSORS_ONLN);
+	return r > 0 ? (size_t)r : 1;
+#endif
+}
+
+static ChiakiErrorCode worker_push(ChiakiExecutorWorker *worker, ChiakiExecutorTask *task)
+{
+	chiaki_mutex_lock(&worker->mutex);
+	if(worker->tail - worker->head == worker->tasks_size)
+	{
+		size_t size_new = worker->tasks_size * 2;
+		ChiakiExecutorTask *tasks_new = malloc(size_new * sizeof(ChiakiExecutorTask));
+		if(!tasks_new)
+		{
+			chiaki_mutex_unlock(&worker->mutex);
+			return CHIAKI_ERR_MEMORY;
+		}
+		for(uint64_t i=worker->head; i<worker->tail; i++)
+			tasks_new[i & (size_new - 1)] = worker->tasks[i & (worker->tasks_size - 1)];
+		free(worker->tasks);
+		worker->tasks = tasks_new;
+		worker->tasks_size = size_new;
+	}
+	worker->tasks[worker->tail & (worker->tasks_size - 1)] = *task;
+	worker->tail++;
+	chiaki_mutex_unlock(&worker->mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static bool worker_pop(ChiakiExecutorWorker *worker, ChiakiExecutorTask *task)
+{
+	chiaki_mutex_lock(&worker->mutex);
+	bool r = worker->tail != worker->head;
+	if(r)
+	{
+		worker->tail--;
+		*task = worker->tasks[worker->tail & (worker->tasks_size - 1)];
+	}
+	chiaki_mutex_unlock(&worker->mutex);
+	return r;
+}
+
+static bool worker_steal(ChiakiExecutorWorker *victim, ChiakiExecutorTask *task)
+{
+	chiaki_mutex_lock(&victim->mutex);
+	bool r = victim->tail != victim->head;
+	if(r)
+	{
+		*task = victim->tasks[victim->head & (victim->tasks_size - 1)];
+		victim->head++;
+	}
+	chiaki_mutex_unlock(&victim->mutex);
+	return r;
+}
+
+static bool worker_take(ChiakiExecutorWorker *worker, ChiakiExecutorTask *task)
+{
+	ChiakiExecutor *executor = worker->executor;
+	if(worker_pop(worker, task))
+		return true;
+	for(size_t i=1; i<executor->workers_count; i++)
+	{
+		ChiakiExecutorWorker *victim = &executor->workers[(worker->index + i) % executor->workers_count];
+		if(worker_steal(victim, task))
+		{
+			CHIAKI_TRACE_INSTANT("executor_steal");
+			return true;
+		}
+	}
+	return false;
+}
+
+static void *worker_thread_func(void *user)
+{
+	ChiakiExecutorWorker *worker = user;
+	ChiakiExecutor *executor = worker->executor;
+	current_worker = worker;
+	CHIAKI_TRACE_THREAD_NAME("Chiaki Worker");
+
+	while(true)
+	{
+		ChiakiExecutorTask task;
+		if(worker_take(worker, &task))
+		{
+			chiaki_atomic_fetch_add_u64(&executor->pending, (uint64_t)-1);
+			task.cb(task.user);
+			continue;
+		}
+
+		chiaki_mutex_lock(&executor->mutex);
+		chiaki_atomic_fetch_add_u32(&executor->sleeping, 1);
+		while(!executor->should_stop && !chiaki_atomic_load_u64(&executor->pending))
+			chiaki_cond_wait(&executor->cond, &executor->mutex);
+		chiaki_atomic_fetch_add_u32(&executor->sleeping, (uint32_t)-1);
+		bool stop = executor->should_stop;
+		chiaki_mutex_unlock(&executor->mutex);
+		if(stop)
+			break;
+	}
+
+	current_worker = NULL;
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_init(ChiakiExecutor *executor, size_t workers_count)
+{
+	if(!workers_count)
+		workers_count = executor_cpu_count();
+	if(workers_count > CHIAKI_EXECUTOR_WORKERS_MAX)
+		workers_count = CHIAKI_EXECUTOR_WORKERS_MAX;
+
+	executor->next_worker = 0;
+	executor->pending = 0;
+	executor->sleeping = 0;
+	executor->should_stop = false;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&executor->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	err = chiaki_cond_init(&executor->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	executor->workers = calloc(workers_count, sizeof(ChiakiExecutorWorker));
+	if(!executor->workers)
+	{
+		err = CHIAKI_ERR_MEMORY;
+		goto error_cond;
+	}
+
+	// all deques must exist before any worker starts stealing
+	for(executor->workers_count=0; executor->workers_count<workers_count; executor->workers_count++)
+	{
+		ChiakiExecutorWorker *worker = &executor->workers[executor->workers_count];
+		worker->executor = executor;
+		worker->index = executor->workers_count;
+		worker->head = 0;
+		worker->tail = 0;
+		worker->tasks_size = EXECUTOR_DEQUE_SIZE_INIT;
+		worker->tasks = malloc(worker->tasks_size * sizeof(ChiakiExecutorTask));
+		if(!worker->tasks)
+		{
+			err = CHIAKI_ERR_MEMORY;
+			goto error_workers;
+		}
+		err = chiaki_mutex_init(&worker->mutex, false);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			free(worker->tasks);
+			goto error_workers;
+		}
+	}
+
+	size_t started;
+	for(started=0; started<workers_count; started++)
+	{
+		ChiakiExecutorWorker *worker = &executor->workers[started];
+		err = chiaki_thread_create(&worker->thread, worker_thread_func, worker);
+		if(err != CHIAKI_ERR_SUCCESS)
+			goto error_threads;
+		char name[0x20];
+		snprintf(name, sizeof(name), "Chiaki Worker %u", (unsigned int)started);
+		chiaki_thread_set_name(&worker->thread, name);
+	}
+
+	return CHIAKI_ERR_SUCCESS;
+error_threads:
+	chiaki_mutex_lock(&executor->mutex);
+	executor->should_stop = true;
+	chiaki_cond_broadcast(&executor->cond);
+	chiaki_mutex_unlock(&executor->mutex);
+	for(size_t i=0; i<started; i++)
+		chiaki_thread_join(&executor->workers[i].thread, NULL);
+error_workers:
+	for(size_t i=0; i<executor->workers_count; i++)
+	{
+		chiaki_mutex_fini(&executor->workers[i].mutex);
+		free(executor->workers[i].tasks);
+	}
+	free(executor->workers);
+error_cond:
+	chiaki_cond_fini(&executor->cond);
+error_mutex:
+	chiaki_mutex_fini(&executor->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_executor_fini(ChiakiExecutor *executor)
+{
+	chiaki_mutex_lock(&executor->mutex);
+	executor->should_stop = true;
+	chiaki_cond_broadcast(&executor->cond);
+	chiaki_mutex_unlock(&executor->mutex);
+
+	for(size_t i=0; i<executor->workers_count; i++)
+		chiaki_thread_join(&executor->workers[i].thread, NULL);
+
+	for(size_t i=0; i<executor->workers_count; i++)
+	{
+		chiaki_mutex_fini(&executor->workers[i].mutex);
+		free(executor->workers[i].tasks);
+	}
+	free(executor->workers);
+	chiaki_cond_fini(&executor->cond);
+	chiaki_mutex_fini(&executor->mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_submit(ChiakiExecutor *executor, ChiakiExecutorTaskCb cb, void *user)
+{
+	ChiakiExecutorWorker *worker = current_worker;
+	if(!worker || worker->executor != executor)
+	{
+		uint32_t next = chiaki_atomic_fetch_add_u32(&executor->next_worker, 1);
+		worker = &executor->workers[next % executor->workers_count];
+	}
+
+	ChiakiExecutorTask task = { cb, user };
+	ChiakiErrorCode err = worker_push(worker, &task);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	chiaki_atomic_fetch_add_u64(&executor->pending, 1);
+	// sleeping is incremented before pending is checked under the mutex, so no wakeup can be lost here
+	if(chiaki_atomic_load_u32(&executor->sleeping))
+	{
+		chiaki_mutex_lock(&executor->mutex);
+		chiaki_cond_signal(&executor->cond);
+		chiaki_mutex_unlock(&executor->mutex);
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiMutex shared_mutex;
+static bool shared_mutex_initialized = false;
+static ChiakiExecutor shared_executor;
+static unsigned int shared_refs = 0;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_executor_shared_init()
+{
+	if(shared_mutex_initialized)
+		return CHIAKI_ERR_SUCCESS;
+	ChiakiErrorCode err = chiaki_mutex_init(&shared_mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	shared_mutex_initialized = true;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiExecutor *chiaki_executor_shared_ref()
+{
+	assert(shared_mutex_initialized);
+	chiaki_mutex_lock(&shared_mutex);
+	ChiakiExecutor *r = &shared_executor;
+	if(!shared_refs && chiaki_executor_init(&shared_executor, 0) != CHIAKI_ERR_SUCCESS)
+		r = NULL;
+	else
+		shared_refs++;
+	chiaki_mutex_unlock(&shared_mutex);
+	return r;
+}
+
+CHIAKI_EXPORT void chiaki_executor_shared_unref(ChiakiExecutor *executor)
+{
+	assert(executor == &shared_executor);
+	chiaki_mutex_lock(&shared_mutex);
+	assert(shared_refs);
+	if(!--shared_refs)
+		chiaki_executor_fini(&shared_executor);
+	chiaki_mutex_unlock(&shared_mutex);
+}
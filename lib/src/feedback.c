@@ -172,34 +172,58 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_history_buffer_init(ChiakiFeedback
 	feedback_history_buffer->size = size;
 	feedback_history_buffer->begin = 0;
 	feedback_history_buffer->len = 0;
+
+	feedback_history_buffer->bytes_size = 2 * size * CHIAKI_HISTORY_EVENT_SIZE_MAX;
+	feedback_history_buffer->bytes = malloc(feedback_history_buffer->bytes_size);
+	if(!feedback_history_buffer->bytes)
+	{
+		free(feedback_history_buffer->events);
+		return CHIAKI_ERR_MEMORY;
+	}
+	feedback_history_buffer->bytes_begin = feedback_history_buffer->bytes_size;
+	feedback_history_buffer->bytes_len = 0;
 	return CHIAKI_ERR_SUCCESS;
 }
 
 CHIAKI_EXPORT void chiaki_feedback_history_buffer_fini(ChiakiFeedbackHistoryBuffer *feedback_history_buffer)
 {
+	free(feedback_history_buffer->bytes);
 	free(feedback_history_buffer->events);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_history_buffer_format(ChiakiFeedbackHistoryBuffer *feedback_history_buffer, uint8_t *buf, size_t *buf_size)
 {
-	size_t size_max = *buf_size;
-	size_t written = 0;
-
-	for(size_t i=0; i<feedback_history_buffer->len; i++)
-	{
-		ChiakiFeedbackHistoryEvent *event = &feedback_history_buffer->events[(feedback_history_buffer->begin + i) % feedback_history_buffer->size];
-		if(written + event->len > size_max)
-			return CHIAKI_ERR_BUF_TOO_SMALL;
-		memcpy(buf + written, event->buf, event->len);
-		written += event->len;
-	}
-
-	*buf_size = written;
+	size_t bytes_size;
+	const uint8_t *bytes = chiaki_feedback_history_buffer_bytes(feedback_history_buffer, &bytes_size);
+	if(bytes_size > *buf_size)
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	memcpy(buf, bytes, bytes_size);
+	*buf_size = bytes_size;
 	return CHIAKI_ERR_SUCCESS;
 }
 
 CHIAKI_EXPORT void chiaki_feedback_history_buffer_push(ChiakiFeedbackHistoryBuffer *feedback_history_buffer, ChiakiFeedbackHistoryEvent *event)
 {
+	if(feedback_history_buffer->len == feedback_history_buffer->size)
+	{
+		// the oldest event falls out at the back
+		ChiakiFeedbackHistoryEvent *oldest = &feedback_history_buffer->events[(feedback_history_buffer->begin + feedback_history_buffer->len - 1) % feedback_history_buffer->size];
+		feedback_history_buffer->bytes_len -= oldest->len;
+	}
+
+	if(feedback_history_buffer->bytes_begin < event->len)
+	{
+		// move everything to the back again, leaving at least as much room in front as is used
+		size_t bytes_begin = feedback_history_buffer->bytes_size - feedback_history_buffer->bytes_len;
+		memmove(feedback_history_buffer->bytes + bytes_begin,
+				feedback_history_buffer->bytes + feedback_history_buffer->bytes_begin,
+				feedback_history_buffer->bytes_len);
+		feedback_history_buffer->bytes_begin = bytes_begin;
+	}
+	feedback_history_buffer->bytes_begin -= event->len;
+	feedback_history_buffer->bytes_len += event->len;
+	memcpy(feedback_history_buffer->bytes + feedback_history_buffer->bytes_begin, event->buf, event->len);
+
 	feedback_history_buffer->begin = (feedback_history_buffer->begin + feedback_history_buffer->size - 1) % feedback_history_buffer->size;
 	feedback_history_buffer->len++;
 	if(feedback_history_buffer->len >= feedback_history_buffer->size)
@@ -1,13 +1,17 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/feedbacksender.h>
+#include <chiaki/trace.h>
+#include <chiaki/time.h>
+#include <chiaki/atomic.h>
 
 #define FEEDBACK_STATE_TIMEOUT_MIN_MS 8 // minimum time to wait between sending 2 packets
 #define FEEDBACK_STATE_TIMEOUT_MAX_MS 200 // maximum time to wait between sending 2 packets
 
 #define FEEDBACK_HISTORY_BUFFER_SIZE 0x10
 
-static void *feedback_sender_thread_func(void *user);
+static void feedback_sender_timer_cb(void *user);
+static void feedback_sender_send(ChiakiFeedbackSender *feedback_sender);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_init(ChiakiFeedbackSender *feedback_sender, ChiakiTakion *takion)
 {
@@ -28,21 +32,21 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_init(ChiakiFeedbackSender *
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_history_buffer;
 
-	err = chiaki_cond_init(&feedback_sender->state_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_mutex;
+	feedback_sender->controller_state_changed = false;
+	feedback_sender->motion_pending = false;
+	feedback_sender->change_us = 0;
+	feedback_sender->immediate = false;
 
-	err = chiaki_thread_create(&feedback_sender->thread, feedback_sender_thread_func, feedback_sender);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_cond;
+	feedback_sender->stats_sent = 0;
+	feedback_sender->stats_latency_sum_us = 0;
+	feedback_sender->stats_latency_max_us = 0;
+	for(size_t i=0; i<CHIAKI_FEEDBACK_LATENCY_HIST_BUCKETS; i++)
+		feedback_sender->stats_latency_hist[i] = 0;
 
-	chiaki_thread_set_name(&feedback_sender->thread, "Chiaki Feedback Sender");
+	chiaki_timer_init(&feedback_sender->timer, takion->timer_service, feedback_sender_timer_cb, feedback_sender);
+	chiaki_timer_start(&feedback_sender->timer, FEEDBACK_STATE_TIMEOUT_MAX_MS, FEEDBACK_STATE_TIMEOUT_MAX_MS);
 
 	return CHIAKI_ERR_SUCCESS;
-error_cond:
-	chiaki_cond_fini(&feedback_sender->state_cond);
-error_mutex:
-	chiaki_mutex_fini(&feedback_sender->state_mutex);
 error_history_buffer:
 	chiaki_feedback_history_buffer_fini(&feedback_sender->history_buf);
 	return err;
@@ -50,17 +54,21 @@ error_history_buffer:
 
 CHIAKI_EXPORT void chiaki_feedback_sender_fini(ChiakiFeedbackSender *feedback_sender)
 {
-	chiaki_mutex_lock(&feedback_sender->state_mutex);
-	feedback_sender->should_stop = true;
-	chiaki_mutex_unlock(&feedback_sender->state_mutex);
-	chiaki_cond_signal(&feedback_sender->state_cond);
-	chiaki_thread_join(&feedback_sender->thread, NULL);
-	chiaki_cond_fini(&feedback_sender->state_cond);
+	chiaki_timer_cancel(&feedback_sender->timer);
+
+	ChiakiFeedbackSenderStats stats;
+	chiaki_feedback_sender_stats(feedback_sender, &stats);
+	if(stats.sent)
+		CHIAKI_LOGI(feedback_sender->log, "Feedback Sender sent %llu controller state changes, latency avg %llu us, p99 <= %llu us, max %llu us",
+				(unsigned long long)stats.sent, (unsigned long long)(stats.latency_sum_us / stats.sent),
+				(unsigned long long)chiaki_feedback_sender_stats_latency_percentile_us(&stats, 0.99),
+				(unsigned long long)stats.latency_max_us);
+
 	chiaki_mutex_fini(&feedback_sender->state_mutex);
 	chiaki_feedback_history_buffer_fini(&feedback_sender->history_buf);
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_controller_state(ChiakiFeedbackSender *feedback_sender, ChiakiControllerState *state)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_controller_state(ChiakiFeedbackSender *feedback_sender, ChiakiControllerState *state, uint64_t change_us)
 {
 	ChiakiErrorCode err = chiaki_mutex_lock(&feedback_sender->state_mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -74,13 +82,102 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_controller_state(Chiaki
 
 	feedback_sender->controller_state = *state;
 	feedback_sender->controller_state_changed = true;
+	if(!feedback_sender->change_us)
+		feedback_sender->change_us = change_us;
+
+	if(feedback_sender->immediate)
+	{
+		feedback_sender_send(feedback_sender);
+		chiaki_timer_start(&feedback_sender->timer, FEEDBACK_STATE_TIMEOUT_MAX_MS, FEEDBACK_STATE_TIMEOUT_MAX_MS);
+	}
+	else
+	{
+		// send right away and restart the period from there
+		// started with the mutex held so a motion update can't push this back again in between
+		chiaki_timer_start(&feedback_sender->timer, 0, FEEDBACK_STATE_TIMEOUT_MAX_MS);
+	}
 
 	chiaki_mutex_unlock(&feedback_sender->state_mutex);
-	chiaki_cond_signal(&feedback_sender->state_cond);
 
 	return CHIAKI_ERR_SUCCESS;
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_set_motion(ChiakiFeedbackSender *feedback_sender, ChiakiControllerState *state)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&feedback_sender->state_mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	ChiakiControllerState *cur = &feedback_sender->controller_state;
+	cur->gyro_x = state->gyro_x;
+	cur->gyro_y = state->gyro_y;
+	cur->gyro_z = state->gyro_z;
+	cur->accel_x = state->accel_x;
+	cur->accel_y = state->accel_y;
+	cur->accel_z = state->accel_z;
+	cur->orient_x = state->orient_x;
+	cur->orient_y = state->orient_y;
+	cur->orient_z = state->orient_z;
+	cur->orient_w = state->orient_w;
+
+	// if the timer is already due for another change, this goes out together with it
+	if(!feedback_sender->controller_state_changed && !feedback_sender->motion_pending)
+	{
+		feedback_sender->motion_pending = true;
+		chiaki_timer_start(&feedback_sender->timer, FEEDBACK_STATE_TIMEOUT_MIN_MS, FEEDBACK_STATE_TIMEOUT_MAX_MS);
+	}
+	feedback_sender->controller_state_changed = true;
+
+	chiaki_mutex_unlock(&feedback_sender->state_mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_feedback_sender_set_immediate(ChiakiFeedbackSender *feedback_sender, bool immediate)
+{
+	chiaki_mutex_lock(&feedback_sender->state_mutex);
+	feedback_sender->immediate = immediate;
+	chiaki_mutex_unlock(&feedback_sender->state_mutex);
+}
+
+CHIAKI_EXPORT void chiaki_feedback_sender_stats(ChiakiFeedbackSender *feedback_sender, ChiakiFeedbackSenderStats *stats)
+{
+	stats->sent = chiaki_atomic_load_u64(&feedback_sender->stats_sent);
+	stats->latency_sum_us = chiaki_atomic_load_u64(&feedback_sender->stats_latency_sum_us);
+	stats->latency_max_us = chiaki_atomic_load_u64(&feedback_sender->stats_latency_max_us);
+	for(size_t i=0; i<CHIAKI_FEEDBACK_LATENCY_HIST_BUCKETS; i++)
+		stats->latency_hist[i] = chiaki_atomic_load_u64(&feedback_sender->stats_latency_hist[i]);
+}
+
+CHIAKI_EXPORT uint64_t chiaki_feedback_sender_stats_latency_percentile_us(const ChiakiFeedbackSenderStats *stats, double fraction)
+{
+	uint64_t total = 0;
+	for(size_t i=0; i<CHIAKI_FEEDBACK_LATENCY_HIST_BUCKETS; i++)
+		total += stats->latency_hist[i];
+	if(!total)
+		return 0;
+	uint64_t count = 0;
+	for(size_t i=0; i<CHIAKI_FEEDBACK_LATENCY_HIST_BUCKETS - 1; i++)
+	{
+		count += stats->latency_hist[i];
+		if((double)count >= fraction * (double)total)
+			return (uint64_t)CHIAKI_FEEDBACK_LATENCY_HIST_BASE_US << i;
+	}
+	return UINT64_MAX;
+}
+
+static void feedback_sender_record_latency(ChiakiFeedbackSender *feedback_sender, uint64_t latency_us)
+{
+	size_t bucket = 0;
+	while(bucket < CHIAKI_FEEDBACK_LATENCY_HIST_BUCKETS - 1 && latency_us > ((uint64_t)CHIAKI_FEEDBACK_LATENCY_HIST_BASE_US << bucket))
+		bucket++;
+	chiaki_atomic_fetch_add_u64(&feedback_sender->stats_latency_hist[bucket], 1);
+	chiaki_atomic_fetch_add_u64(&feedback_sender->stats_latency_sum_us, latency_us);
+	if(latency_us > feedback_sender->stats_latency_max_us)
+		chiaki_atomic_store_u64(&feedback_sender->stats_latency_max_us, latency_us);
+	// last so a reader seeing the count also sees everything above
+	chiaki_atomic_fetch_add_u64(&feedback_sender->stats_sent, 1);
+}
+
 static bool controller_state_equals_for_feedback_state(ChiakiControllerState *a, ChiakiControllerState *b)
 {
 	if(!(a->left_x == b->left_x
@@ -146,22 +243,32 @@ static bool controller_state_equals_for_feedback_history(ChiakiControllerState *
 
 static void feedback_sender_send_history_packet(ChiakiFeedbackSender *feedback_sender)
 {
-	uint8_t buf[0x300];
-	size_t buf_size = sizeof(buf);
-	ChiakiErrorCode err = chiaki_feedback_history_buffer_format(&feedback_sender->history_buf, buf, &buf_size);
-	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		CHIAKI_LOGE(feedback_sender->log, "Feedback Sender failed to format history buffer");
-		return;
-	}
+	size_t buf_size;
+	const uint8_t *buf = chiaki_feedback_history_buffer_bytes(&feedback_sender->history_buf, &buf_size);
 
 	//CHIAKI_LOGD(feedback_sender->log, "Feedback History:");
 	//chiaki_log_hexdump(feedback_sender->log, CHIAKI_LOG_DEBUG, buf, buf_size);
 	chiaki_takion_send_feedback_history(feedback_sender->takion, feedback_sender->history_seq_num++, buf, buf_size);
 }
 
+static void feedback_sender_push_history(ChiakiFeedbackSender *feedback_sender, ChiakiFeedbackHistoryEvent *event, size_t *pushed)
+{
+	// send what is there before the first events of this state change would fall out of the buffer
+	if(*pushed == feedback_sender->history_buf.size)
+	{
+		feedback_sender_send_history_packet(feedback_sender);
+		*pushed = 0;
+	}
+	chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, event);
+	(*pushed)++;
+}
+
+/**
+ * Push the events for all inputs that changed and send them together in a single packet.
+ */
 static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 {
+	size_t pushed = 0;
 	ChiakiControllerState *state_prev = &feedback_sender->controller_state_prev;
 	ChiakiControllerState *state_now = &feedback_sender->controller_state;
 	uint64_t buttons_prev = state_prev->buttons;
@@ -180,8 +287,7 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 				CHIAKI_LOGE(feedback_sender->log, "Feedback Sender failed to format button history event for button id %llu", (unsigned long long)button_id);
 				continue;
 			}
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history(feedback_sender, &event, &pushed);
 		}
 	}
 
@@ -191,8 +297,7 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 		ChiakiErrorCode err = chiaki_feedback_history_event_set_button(&event, CHIAKI_CONTROLLER_ANALOG_BUTTON_L2, state_now->l2_state);
 		if(err == CHIAKI_ERR_SUCCESS)
 		{
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history(feedback_sender, &event, &pushed);
 		}
 		else
 			CHIAKI_LOGE(feedback_sender->log, "Feedback Sender failed to format button history event for L2");
@@ -204,8 +309,7 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 		ChiakiErrorCode err = chiaki_feedback_history_event_set_button(&event, CHIAKI_CONTROLLER_ANALOG_BUTTON_R2, state_now->r2_state);
 		if(err == CHIAKI_ERR_SUCCESS)
 		{
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history(feedback_sender, &event, &pushed);
 		}
 		else
 			CHIAKI_LOGE(feedback_sender->log, "Feedback Sender failed to format button history event for R2");
@@ -218,8 +322,7 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 			ChiakiFeedbackHistoryEvent event;
 			chiaki_feedback_history_event_set_touchpad(&event, false, (uint8_t)state_prev->touches[i].id,
 					state_prev->touches[i].x, state_prev->touches[i].y);
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history(feedback_sender, &event, &pushed);
 		}
 		else if(state_now->touches[i].id >= 0
 				&& (state_prev->touches[i].id != state_now->touches[i].id
@@ -229,61 +332,64 @@ static void feedback_sender_send_history(ChiakiFeedbackSender *feedback_sender)
 			ChiakiFeedbackHistoryEvent event;
 			chiaki_feedback_history_event_set_touchpad(&event, true, (uint8_t)state_now->touches[i].id,
 					state_now->touches[i].x, state_now->touches[i].y);
-			chiaki_feedback_history_buffer_push(&feedback_sender->history_buf, &event);
-			feedback_sender_send_history_packet(feedback_sender);
+			feedback_sender_push_history(feedback_sender, &event, &pushed);
 		}
 	}
-}
 
-static bool state_cond_check(void *user)
-{
-	ChiakiFeedbackSender *feedback_sender = user;
-	return feedback_sender->should_stop || feedback_sender->controller_state_changed;
+	if(pushed)
+		feedback_sender_send_history_packet(feedback_sender);
 }
 
-static void *feedback_sender_thread_func(void *user)
+/**
+ * Send whatever is due, called with state_mutex held.
+ */
+static void feedback_sender_send(ChiakiFeedbackSender *feedback_sender)
 {
-	ChiakiFeedbackSender *feedback_sender = user;
+	bool send_feedback_state = true;
+	bool send_feedback_history = false;
 
-	ChiakiErrorCode err = chiaki_mutex_lock(&feedback_sender->state_mutex);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
+	feedback_sender->motion_pending = false;
 
-	uint64_t next_timeout = FEEDBACK_STATE_TIMEOUT_MAX_MS;
-	while(true)
+	if(feedback_sender->controller_state_changed)
 	{
-		err = chiaki_cond_timedwait_pred(&feedback_sender->state_cond, &feedback_sender->state_mutex, next_timeout, state_cond_check, feedback_sender);
-		if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
-			break;
+		// Only motion is held back to FEEDBACK_STATE_TIMEOUT_MIN_MS, in chiaki_feedback_sender_set_motion().
+		// Buttons, sticks and touches go out as soon as they change since they are rare compared to motion
+		// and the delay would add directly to the input latency.
+		feedback_sender->controller_state_changed = false;
 
-		if(feedback_sender->should_stop)
-			break;
+		// don't need to send feedback state if nothing relevant changed
+		if(controller_state_equals_for_feedback_state(&feedback_sender->controller_state, &feedback_sender->controller_state_prev))
+			send_feedback_state = false;
 
-		bool send_feedback_state = true;
-		bool send_feedback_history = false;
+		send_feedback_history = !controller_state_equals_for_feedback_history(&feedback_sender->controller_state, &feedback_sender->controller_state_prev);
+	} // else: timeout
 
-		if(feedback_sender->controller_state_changed)
-		{
-			// TODO: FEEDBACK_STATE_TIMEOUT_MIN_MS
-			feedback_sender->controller_state_changed = false;
+	CHIAKI_TRACE_BEGIN("feedback_send");
+	if(send_feedback_state)
+		feedback_sender_send_state(feedback_sender);
 
-			// don't need to send feedback state if nothing relevant changed
-			if(controller_state_equals_for_feedback_state(&feedback_sender->controller_state, &feedback_sender->controller_state_prev))
-				send_feedback_state = false;
+	if(send_feedback_history)
+		feedback_sender_send_history(feedback_sender);
+	CHIAKI_TRACE_END("feedback_send");
 
-			send_feedback_history = !controller_state_equals_for_feedback_history(&feedback_sender->controller_state, &feedback_sender->controller_state_prev);
-		} // else: timeout
+	if(feedback_sender->change_us)
+	{
+		feedback_sender_record_latency(feedback_sender, chiaki_time_now_monotonic_us() - feedback_sender->change_us);
+		feedback_sender->change_us = 0;
+	}
 
-		if(send_feedback_state)
-			feedback_sender_send_state(feedback_sender);
+	feedback_sender->controller_state_prev = feedback_sender->controller_state;
+}
 
-		if(send_feedback_history)
-			feedback_sender_send_history(feedback_sender);
+static void feedback_sender_timer_cb(void *user)
+{
+	ChiakiFeedbackSender *feedback_sender = user;
 
-		feedback_sender->controller_state_prev = feedback_sender->controller_state;
-	}
+	ChiakiErrorCode err = chiaki_mutex_lock(&feedback_sender->state_mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return;
 
-	chiaki_mutex_unlock(&feedback_sender->state_mutex);
+	feedback_sender_send(feedback_sender);
 
-	return NULL;
+	chiaki_mutex_unlock(&feedback_sender->state_mutex);
 }
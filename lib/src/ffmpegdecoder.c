@@ -1,5 +1,6 @@
 
 #include <chiaki/ffmpegdecoder.h>
+#include <chiaki/trace.h>
 
 #include <libavcodec/avcodec.h>
 
@@ -109,6 +110,7 @@ CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_cb(uint8_t *buf, size_t bu
 {
 	ChiakiFfmpegDecoder *decoder = user;
 
+	CHIAKI_TRACE_BEGIN("video_decode_send");
 	chiaki_mutex_lock(&decoder->mutex);
 	AVPacket packet;
 	av_init_packet(&packet);
@@ -146,11 +148,13 @@ send_packet:
 		}
 	}
 	chiaki_mutex_unlock(&decoder->mutex);
+	CHIAKI_TRACE_END("video_decode_send");
 
 	decoder->frame_available_cb(decoder, decoder->frame_available_cb_user);
 	return true;
 hell:
 	chiaki_mutex_unlock(&decoder->mutex);
+	CHIAKI_TRACE_END("video_decode_send");
 	return false;
 }
 
@@ -169,6 +173,7 @@ static AVFrame *pull_from_hw(ChiakiFfmpegDecoder *decoder, AVFrame *hw_frame)
 
 CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *decoder)
 {
+	CHIAKI_TRACE_BEGIN("video_decode_pull");
 	chiaki_mutex_lock(&decoder->mutex);
 	// always try to pull as much as possible and return only the very last frame
 	AVFrame *frame_last = NULL;
@@ -202,6 +207,7 @@ CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *dec
 		}
 	}
 	chiaki_mutex_unlock(&decoder->mutex);
+	CHIAKI_TRACE_END("video_decode_pull");
 
 	return frame;
 }
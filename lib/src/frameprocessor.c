@@ -3,6 +3,7 @@
 #include <chiaki/frameprocessor.h>
 #include <chiaki/fec.h>
 #include <chiaki/video.h>
+#include <chiaki/trace.h>
 
 #include <jerasure.h>
 
@@ -197,7 +198,7 @@ CHIAKI_EXPORT void chiaki_frame_processor_report_packet_stats(ChiakiFrameProcess
 
 static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_processor)
 {
-	CHIAKI_LOGI(frame_processor->log, "Frame Processor received %u+%u / %u+%u units, attempting FEC",
+	CHIAKI_LOGI_RL(frame_processor->log, "Frame Processor received %u+%u / %u+%u units, attempting FEC",
 				frame_processor->units_source_received, frame_processor->units_fec_received,
 				frame_processor->units_source_expected, frame_processor->units_fec_expected);
 
@@ -226,10 +227,12 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 	}
 	assert(erasure_index == erasures_count);
 
+	CHIAKI_TRACE_BEGIN("video_fec");
 	ChiakiErrorCode err = chiaki_fec_decode(frame_processor->frame_buf,
 			frame_processor->buf_size_per_unit, frame_processor->buf_stride_per_unit,
 			frame_processor->units_source_expected, frame_processor->units_fec_expected,
 			erasures, erasures_count);
+	CHIAKI_TRACE_END("video_fec");
 
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
@@ -239,7 +242,7 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 	else
 	{
 		err = CHIAKI_ERR_SUCCESS;
-		CHIAKI_LOGI(frame_processor->log, "FEC successful");
+		CHIAKI_LOGI_RL(frame_processor->log, "FEC successful");
 
 		// restore unit sizes
 		for(size_t i=0; i<frame_processor->units_source_expected; i++)
@@ -251,7 +254,7 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 			{
 				CHIAKI_LOGE(frame_processor->log, "Padding in unit (%#x) is larger or equals to the whole unit size (%#llx)",
 							(unsigned int)padding, frame_processor->buf_size_per_unit);
-				chiaki_log_hexdump(frame_processor->log, CHIAKI_LOG_DEBUG, buf_ptr, 0x50);
+				CHIAKI_LOG_HEXDUMP_RL(frame_processor->log, CHIAKI_LOG_DEBUG, buf_ptr, 0x50);
 				continue;
 			}
 			slot->data_size = frame_processor->buf_size_per_unit - padding;
@@ -287,13 +290,13 @@ CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(Chiak
 		ChiakiFrameUnit *unit = frame_processor->unit_slots + i;
 		if(!unit->data_size)
 		{
-			CHIAKI_LOGW(frame_processor->log, "Missing unit %#llx", (unsigned long long)i);
+			CHIAKI_LOGW_RL(frame_processor->log, "Missing unit %#llx", (unsigned long long)i);
 			continue;
 		}
 		if(unit->data_size < 2)
 		{
 			CHIAKI_LOGE(frame_processor->log, "Saved unit has size < 2");
-			chiaki_log_hexdump(frame_processor->log, CHIAKI_LOG_VERBOSE, frame_processor->frame_buf + i*frame_processor->buf_size_per_unit, 0x50);
+			CHIAKI_LOG_HEXDUMP_RL(frame_processor->log, CHIAKI_LOG_VERBOSE, frame_processor->frame_buf + i*frame_processor->buf_size_per_unit, 0x50);
 			continue;
 		}
 		size_t part_size = unit->data_size - 2;
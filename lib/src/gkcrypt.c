@@ -2,6 +2,7 @@
 
 #include <chiaki/gkcrypt.h>
 #include <chiaki/session.h>
+#include <chiaki/trace.h>
 
 #include <string.h>
 #include <assert.h>
@@ -23,23 +24,26 @@
 
 static ChiakiErrorCode gkcrypt_gen_key_iv(ChiakiGKCrypt *gkcrypt, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
 
-static void *gkcrypt_thread_func(void *user);
+static void gkcrypt_key_buf_schedule(ChiakiGKCrypt *gkcrypt);
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, ChiakiExecutor *executor, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
 {
 	gkcrypt->log = log;
 	gkcrypt->index = index;
+	gkcrypt->executor = executor;
 
 	gkcrypt->key_buf_size = key_buf_chunks * KEY_BUF_CHUNK_SIZE;
 	gkcrypt->key_buf_populated = 0;
 	gkcrypt->key_buf_key_pos_min = 0;
 	gkcrypt->key_buf_start_offset = 0;
 	gkcrypt->last_key_pos = 0;
-	gkcrypt->key_buf_thread_stop = false;
+	gkcrypt->key_buf_stop = false;
+	gkcrypt->key_buf_task_pending = false;
 
 	ChiakiErrorCode err;
 	if(gkcrypt->key_buf_size)
 	{
+		assert(executor);
 		gkcrypt->key_buf = chiaki_aligned_alloc(KEY_BUF_CHUNK_SIZE, gkcrypt->key_buf_size);
 		if(!gkcrypt->key_buf)
 		{
@@ -72,11 +76,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, Chiaki
 
 	if(gkcrypt->key_buf)
 	{
-		err = chiaki_thread_create(&gkcrypt->key_buf_thread, gkcrypt_thread_func, gkcrypt);
-		if(err != CHIAKI_ERR_SUCCESS)
-			goto error_key_buf_cond;
-
-		chiaki_thread_set_name(&gkcrypt->key_buf_thread, "Chiaki GKCrypt");
+		// start populating
+		chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+		gkcrypt_key_buf_schedule(gkcrypt);
+		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
 	}
 
 	return CHIAKI_ERR_SUCCESS;
@@ -98,10 +101,10 @@ CHIAKI_EXPORT void chiaki_gkcrypt_fini(ChiakiGKCrypt *gkcrypt)
 	if(gkcrypt->key_buf)
 	{
 		chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
-		gkcrypt->key_buf_thread_stop = true;
+		gkcrypt->key_buf_stop = true;
+		while(gkcrypt->key_buf_task_pending)
+			chiaki_cond_wait(&gkcrypt->key_buf_cond, &gkcrypt->key_buf_mutex);
 		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
-		chiaki_cond_signal(&gkcrypt->key_buf_cond);
-		chiaki_thread_join(&gkcrypt->key_buf_thread, NULL);
 		chiaki_cond_fini(&gkcrypt->key_buf_cond);
 		chiaki_mutex_fini(&gkcrypt->key_buf_mutex);
 		chiaki_aligned_free(gkcrypt->key_buf);
@@ -285,11 +288,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcry
 	if(!gkcrypt->key_buf)
 		return chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, buf, buf_size);
 
+	// time spent here while the producer holds the mutex shows up as a stall between the two threads
+	CHIAKI_TRACE_BEGIN("gkcrypt_key_buf_lock");
 	chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+	CHIAKI_TRACE_END("gkcrypt_key_buf_lock");
 
 	if(key_pos + buf_size > gkcrypt->last_key_pos)
 		gkcrypt->last_key_pos = key_pos + buf_size;
-	bool signal = gkcrypt_key_buf_should_generate(gkcrypt);
+	gkcrypt_key_buf_schedule(gkcrypt);
 
 	ChiakiErrorCode err;
 	if(key_pos < gkcrypt->key_buf_key_pos_min
@@ -305,7 +311,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcry
 				(unsigned long long)gkcrypt->key_buf_key_pos_min,
 				(unsigned long long)gkcrypt->last_key_pos);
 		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+		CHIAKI_TRACE_BEGIN("gkcrypt_key_buf_miss");
 		err = chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, buf, buf_size);
+		CHIAKI_TRACE_END("gkcrypt_key_buf_miss");
 	}
 	else
 	{
@@ -324,9 +332,6 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcry
 		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
 	}
 
-	if(signal)
-		chiaki_cond_signal(&gkcrypt->key_buf_cond);
-
 	return err;
 }
 
@@ -459,12 +464,8 @@ fail:
 #endif
 }
 
-static bool key_buf_mutex_pred(void *user)
+static bool gkcrypt_key_buf_needs_chunk(ChiakiGKCrypt *gkcrypt)
 {
-	ChiakiGKCrypt *gkcrypt = user;
-	if(gkcrypt->key_buf_thread_stop)
-		return true;
-
 	if(gkcrypt->key_buf_populated < gkcrypt->key_buf_size)
 		return true;
 
@@ -483,7 +484,9 @@ static ChiakiErrorCode gkcrypt_generate_next_chunk(ChiakiGKCrypt *gkcrypt)
 
 	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
 
+	CHIAKI_TRACE_BEGIN("gkcrypt_gen_chunk");
 	ChiakiErrorCode err = chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, buf_start, KEY_BUF_CHUNK_SIZE);
+	CHIAKI_TRACE_END("gkcrypt_gen_chunk");
 	if(err != CHIAKI_ERR_SUCCESS)
 		CHIAKI_LOGE(gkcrypt->log, "GKCrypt failed to generate key stream chunk");
 
@@ -491,24 +494,40 @@ static ChiakiErrorCode gkcrypt_generate_next_chunk(ChiakiGKCrypt *gkcrypt)
 
 	if(err == CHIAKI_ERR_SUCCESS)
 		gkcrypt->key_buf_populated += KEY_BUF_CHUNK_SIZE;
+	CHIAKI_TRACE_COUNTER("gkcrypt_key_buf_populated", gkcrypt->key_buf_populated);
 
 	return err;
 }
 
-static void *gkcrypt_thread_func(void *user)
+static void gkcrypt_key_buf_task(void *user);
+
+static void gkcrypt_key_buf_schedule(ChiakiGKCrypt *gkcrypt)
+{
+	// key_buf_mutex must be locked
+	if(gkcrypt->key_buf_task_pending || gkcrypt->key_buf_stop || !gkcrypt_key_buf_needs_chunk(gkcrypt))
+		return;
+	if(chiaki_executor_submit(gkcrypt->executor, gkcrypt_key_buf_task, gkcrypt) != CHIAKI_ERR_SUCCESS)
+	{
+		// misses are handled by generating the key stream synchronously
+		CHIAKI_LOGE(gkcrypt->log, "GKCrypt %d failed to submit key stream task", (int)gkcrypt->index);
+		return;
+	}
+	gkcrypt->key_buf_task_pending = true;
+}
+
+/**
+ * Generate a single chunk per task and re-submit if more are needed,
+ * so a full buffer refill does not hog a worker.
+ */
+static void gkcrypt_key_buf_task(void *user)
 {
 	ChiakiGKCrypt *gkcrypt = user;
-	CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d thread starting", (int)gkcrypt->index);
 
 	ChiakiErrorCode err = chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
-	while(1)
-	{
-		err = chiaki_cond_wait_pred(&gkcrypt->key_buf_cond, &gkcrypt->key_buf_mutex, key_buf_mutex_pred, gkcrypt);
-
-		if(gkcrypt->key_buf_thread_stop || err != CHIAKI_ERR_SUCCESS)
-			break;
 
+	if(!gkcrypt->key_buf_stop && gkcrypt_key_buf_needs_chunk(gkcrypt))
+	{
 		CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d key buf size %#llx, start offset: %#llx, populated: %#llx, min key pos: %#llx, last key pos: %#llx, generating next chunk",
 					(int)gkcrypt->index,
 					(unsigned long long)gkcrypt->key_buf_size,
@@ -535,12 +554,15 @@ static void *gkcrypt_thread_func(void *user)
 			gkcrypt->key_buf_populated -= KEY_BUF_CHUNK_SIZE;
 		}
 		err = gkcrypt_generate_next_chunk(gkcrypt);
-		if(err != CHIAKI_ERR_SUCCESS)
-			break;
 	}
 
+	gkcrypt->key_buf_task_pending = false;
+	if(gkcrypt->key_buf_stop)
+		chiaki_cond_signal(&gkcrypt->key_buf_cond);
+	else if(err == CHIAKI_ERR_SUCCESS)
+		gkcrypt_key_buf_schedule(gkcrypt);
+
 	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
-	return NULL;
 }
 
 CHIAKI_EXPORT void chiaki_key_state_init(ChiakiKeyState *state)
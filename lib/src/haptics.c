@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/haptics.h>
+#include <chiaki/atomic.h>
+
+#include <string.h>
+#include <math.h>
+
+static void haptics_play_frame(uint8_t *buf, size_t buf_size, void *user);
+static void haptics_play_lost(uint8_t *next_buf, size_t next_buf_size, void *user);
+
+CHIAKI_EXPORT void chiaki_haptics_config_dualsense(ChiakiHapticsConfig *config)
+{
+	config->stream_rate = CHIAKI_HAPTICS_STREAM_RATE;
+	config->channels = CHIAKI_HAPTICS_STREAM_CHANNELS;
+	config->report_rate = 3000;
+	config->report_samples = 32;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_haptics_pipeline_init(ChiakiHapticsPipeline *pipeline, ChiakiLog *log, bool playout_thread,
+		const ChiakiHapticsConfig *config, ChiakiHapticsReportCallback report_cb, void *report_cb_user)
+{
+	if(!config->stream_rate || !config->report_rate
+			|| !config->channels || config->channels > CHIAKI_HAPTICS_CHANNELS_MAX
+			|| !config->report_samples || config->report_samples > CHIAKI_HAPTICS_REPORT_SAMPLES_MAX)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	memset(pipeline, 0, sizeof(*pipeline));
+	pipeline->log = log;
+	pipeline->config = *config;
+	pipeline->step = (double)config->stream_rate / (double)config->report_rate;
+	pipeline->report_cb = report_cb;
+	pipeline->report_cb_user = report_cb_user;
+
+	ChiakiErrorCode err = chiaki_jitter_buffer_init(&pipeline->jitter_buffer, log, haptics_play_frame, haptics_play_lost, pipeline);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	if(playout_thread)
+	{
+		// waits for the frame duration to be known from the first frame
+		err = chiaki_jitter_buffer_playout_start(&pipeline->jitter_buffer, "Chiaki Haptics");
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			chiaki_jitter_buffer_fini(&pipeline->jitter_buffer);
+			return err;
+		}
+	}
+
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_haptics_pipeline_fini(ChiakiHapticsPipeline *pipeline)
+{
+	chiaki_jitter_buffer_playout_stop(&pipeline->jitter_buffer);
+
+	ChiakiJitterBufferStats stats;
+	chiaki_jitter_buffer_stats(&pipeline->jitter_buffer, &stats);
+	if(stats.played)
+		CHIAKI_LOGI(pipeline->log, "Haptics played %llu frames in %llu reports, concealed %llu, late %llu, dropped %llu, underruns %llu",
+				(unsigned long long)stats.played, (unsigned long long)chiaki_atomic_load_u64(&pipeline->reports),
+				(unsigned long long)stats.concealed, (unsigned long long)stats.late,
+				(unsigned long long)stats.dropped, (unsigned long long)stats.underruns);
+
+	chiaki_jitter_buffer_fini(&pipeline->jitter_buffer);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_pipeline_push(ChiakiHapticsPipeline *pipeline, ChiakiSeqNum16 frame_index, const uint8_t *buf, size_t buf_size, uint64_t arrival_us)
+{
+	if(!pipeline->started)
+	{
+		// there is no header for haptics, so the frame duration can only be told from the size of the frames
+		if(!buf_size || buf_size % pipeline->config.channels)
+		{
+			CHIAKI_LOGW(pipeline->log, "Haptics frame of invalid size %#llx", (unsigned long long)buf_size);
+			return;
+		}
+		uint64_t frame_duration_us = (uint64_t)(buf_size / pipeline->config.channels) * 1000000 / pipeline->config.stream_rate;
+		if(!frame_duration_us)
+			return;
+		chiaki_jitter_buffer_set_frame_duration(&pipeline->jitter_buffer, frame_duration_us);
+		CHIAKI_LOGI(pipeline->log, "Haptics frames of %llu us, resampled to %u Hz in reports of %llu samples",
+				(unsigned long long)frame_duration_us, pipeline->config.report_rate, (unsigned long long)pipeline->config.report_samples);
+		pipeline->started = true;
+	}
+
+	chiaki_jitter_buffer_push(&pipeline->jitter_buffer, frame_index, buf, buf_size, arrival_us);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_pipeline_play(ChiakiHapticsPipeline *pipeline, uint64_t now_us)
+{
+	chiaki_jitter_buffer_play(&pipeline->jitter_buffer, now_us);
+}
+
+/**
+ * Emit a single output sample, passing on the report once it is complete.
+ */
+static void haptics_emit(ChiakiHapticsPipeline *pipeline, const int8_t *sample)
+{
+	if(pipeline->skip_samples)
+	{
+		pipeline->skip_samples--;
+		return;
+	}
+	unsigned int channels = pipeline->config.channels;
+	memcpy(pipeline->report + pipeline->report_fill * channels, sample, channels);
+	if(++pipeline->report_fill < pipeline->config.report_samples)
+		return;
+	pipeline->report_fill = 0;
+	chiaki_atomic_fetch_add_u64(&pipeline->reports, 1);
+
+	if(pipeline->report_cb)
+		pipeline->report_cb(pipeline->report, pipeline->config.report_samples, pipeline->report_cb_user);
+}
+
+/**
+ * Catch up with the delay requested by chiaki_haptics_pipeline_set_delay(), called before each frame.
+ */
+static void haptics_apply_delay(ChiakiHapticsPipeline *pipeline)
+{
+	size_t delay_samples = (size_t)(chiaki_atomic_load_u64(&pipeline->delay_us) * pipeline->config.report_rate / 1000000);
+	if(delay_samples == pipeline->delay_samples)
+		return;
+	chiaki_atomic_store_u64(&pipeline->delay_applied_us, (uint64_t)delay_samples * 1000000 / pipeline->config.report_rate);
+	if(delay_samples < pipeline->delay_samples)
+	{
+		pipeline->skip_samples += pipeline->delay_samples - delay_samples;
+		pipeline->delay_samples = delay_samples;
+		return;
+	}
+
+	// an increase first cancels out samples that are still to be dropped
+	size_t add = delay_samples - pipeline->delay_samples;
+	pipeline->delay_samples = delay_samples;
+	if(pipeline->skip_samples >= add)
+	{
+		pipeline->skip_samples -= add;
+		return;
+	}
+	add -= pipeline->skip_samples;
+	pipeline->skip_samples = 0;
+	static const int8_t silence[CHIAKI_HAPTICS_CHANNELS_MAX] = { 0 };
+	for(size_t i = 0; i < add; i++)
+		haptics_emit(pipeline, silence);
+}
+
+/**
+ * Feed a single input sample of all channels to the linear interpolation.
+ */
+static void haptics_resample(ChiakiHapticsPipeline *pipeline, const int8_t *sample)
+{
+	unsigned int channels = pipeline->config.channels;
+	int8_t out[CHIAKI_HAPTICS_CHANNELS_MAX];
+	while(pipeline->pos < 1.0)
+	{
+		for(unsigned int c = 0; c < channels; c++)
+			out[c] = (int8_t)lrint((double)pipeline->prev[c] + (double)(sample[c] - pipeline->prev[c]) * pipeline->pos);
+		haptics_emit(pipeline, out);
+		pipeline->pos += pipeline->step;
+	}
+	pipeline->pos -= 1.0;
+	memcpy(pipeline->prev, sample, channels);
+}
+
+static void haptics_play_frame(uint8_t *buf, size_t buf_size, void *user)
+{
+	ChiakiHapticsPipeline *pipeline = user;
+	haptics_apply_delay(pipeline);
+	unsigned int channels = pipeline->config.channels;
+	size_t samples = buf_size / channels;
+	for(size_t i = 0; i < samples; i++)
+		haptics_resample(pipeline, (const int8_t *)buf + i * channels);
+	pipeline->frame_samples = samples;
+}
+
+static void haptics_play_lost(uint8_t *next_buf, size_t next_buf_size, void *user)
+{
+	ChiakiHapticsPipeline *pipeline = user;
+	haptics_apply_delay(pipeline);
+	// haptics carry no redundancy, and rather than repeating an effect, the motors stay still for the lost frame
+	static const int8_t silence[CHIAKI_HAPTICS_CHANNELS_MAX] = { 0 };
+	for(size_t i = 0; i < pipeline->frame_samples; i++)
+		haptics_resample(pipeline, silence);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_pipeline_set_delay(ChiakiHapticsPipeline *pipeline, uint64_t delay_us)
+{
+	chiaki_atomic_store_u64(&pipeline->delay_us, delay_us);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_pipeline_stats(ChiakiHapticsPipeline *pipeline, ChiakiHapticsStats *stats)
+{
+	stats->reports = chiaki_atomic_load_u64(&pipeline->reports);
+	chiaki_jitter_buffer_stats(&pipeline->jitter_buffer, &stats->jitter_buffer);
+	// jitter buffer delay plus the time the samples of a report pile up
+	stats->latency_us = stats->jitter_buffer.delay_us
+		+ (uint64_t)pipeline->config.report_samples * 1000000 / pipeline->config.report_rate;
+	stats->delay_us = chiaki_atomic_load_u64(&pipeline->delay_applied_us);
+}
@@ -0,0 +1,354 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/jitterbuffer.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+#include <math.h>
+
+#define JITTER_BUFFER_TARGET_MIN 2
+#define JITTER_BUFFER_TARGET_MAX (CHIAKI_JITTER_BUFFER_SIZE / 2)
+
+// playout delay covers this many times the measured jitter
+#define JITTER_BUFFER_JITTER_FACTOR 4.0
+
+// frames to conceal when running empty before giving up and buffering up again
+#define JITTER_BUFFER_UNDERRUN_CONCEAL_MAX 5
+
+// at most one frame is dropped per this many frames played to reduce the delay
+#define JITTER_BUFFER_DROP_INTERVAL 50
+
+#define FRAME(jitter_buffer, index) (&(jitter_buffer)->frames[(index) & (CHIAKI_JITTER_BUFFER_SIZE - 1)])
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_jitter_buffer_init(ChiakiJitterBuffer *jitter_buffer, ChiakiLog *log,
+		ChiakiJitterBufferFrameCallback frame_cb, ChiakiJitterBufferLostCallback lost_cb, void *cb_user)
+{
+	memset(jitter_buffer, 0, sizeof(*jitter_buffer));
+	jitter_buffer->log = log;
+	jitter_buffer->target_frames = JITTER_BUFFER_TARGET_MIN;
+	jitter_buffer->frame_cb = frame_cb;
+	jitter_buffer->lost_cb = lost_cb;
+	jitter_buffer->cb_user = cb_user;
+	ChiakiErrorCode err = chiaki_mutex_init(&jitter_buffer->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	err = chiaki_cond_init(&jitter_buffer->playout_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_mutex_fini(&jitter_buffer->mutex);
+		return err;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_jitter_buffer_fini(ChiakiJitterBuffer *jitter_buffer)
+{
+	chiaki_jitter_buffer_playout_stop(jitter_buffer);
+	chiaki_cond_fini(&jitter_buffer->playout_cond);
+	chiaki_mutex_fini(&jitter_buffer->mutex);
+}
+
+static void jitter_buffer_reset(ChiakiJitterBuffer *jitter_buffer)
+{
+	for(size_t i = 0; i < CHIAKI_JITTER_BUFFER_SIZE; i++)
+		jitter_buffer->frames[i].present = false;
+	jitter_buffer->index_valid = false;
+	jitter_buffer->started = false;
+	jitter_buffer->playing = false;
+	jitter_buffer->underrun_frames = 0;
+	jitter_buffer->frames_since_drop = 0;
+}
+
+CHIAKI_EXPORT void chiaki_jitter_buffer_set_frame_duration(ChiakiJitterBuffer *jitter_buffer, uint64_t frame_duration_us)
+{
+	chiaki_mutex_lock(&jitter_buffer->mutex);
+	jitter_buffer_reset(jitter_buffer);
+	jitter_buffer->frame_duration_us = frame_duration_us;
+	jitter_buffer->arrival_prev_valid = false;
+	jitter_buffer->jitter_us = 0.0;
+	jitter_buffer->target_frames = JITTER_BUFFER_TARGET_MIN;
+	// the playout thread waits for this to know its period
+	chiaki_cond_signal(&jitter_buffer->playout_cond);
+	chiaki_mutex_unlock(&jitter_buffer->mutex);
+}
+
+/**
+ * @return number of frames from next_index up to and including last_index, whether present or not
+ */
+static size_t jitter_buffer_span(ChiakiJitterBuffer *jitter_buffer)
+{
+	if(!jitter_buffer->index_valid || chiaki_seq_num_16_lt(jitter_buffer->last_index, jitter_buffer->next_index))
+		return 0;
+	return (size_t)(ChiakiSeqNum16)(jitter_buffer->last_index - jitter_buffer->next_index) + 1;
+}
+
+static void jitter_buffer_update_jitter(ChiakiJitterBuffer *jitter_buffer, ChiakiSeqNum16 index, uint64_t arrival_us)
+{
+	if(!jitter_buffer->arrival_prev_valid)
+	{
+		jitter_buffer->arrival_prev_valid = true;
+		jitter_buffer->arrival_prev_us = arrival_us;
+		jitter_buffer->arrival_prev_index = index;
+		return;
+	}
+
+	// out of order frames are only counted through the delay of the newer ones
+	if(!chiaki_seq_num_16_gt(index, jitter_buffer->arrival_prev_index))
+		return;
+
+	double expected_us = (double)(ChiakiSeqNum16)(index - jitter_buffer->arrival_prev_index) * (double)jitter_buffer->frame_duration_us;
+	double d = (double)(arrival_us - jitter_buffer->arrival_prev_us) - expected_us;
+	jitter_buffer->jitter_us += (fabs(d) - jitter_buffer->jitter_us) / 16.0;
+	jitter_buffer->arrival_prev_us = arrival_us;
+	jitter_buffer->arrival_prev_index = index;
+
+	double target = 1.0 + ceil(JITTER_BUFFER_JITTER_FACTOR * jitter_buffer->jitter_us / (double)jitter_buffer->frame_duration_us);
+	if(target < JITTER_BUFFER_TARGET_MIN)
+		target = JITTER_BUFFER_TARGET_MIN;
+	else if(target > JITTER_BUFFER_TARGET_MAX)
+		target = JITTER_BUFFER_TARGET_MAX;
+	jitter_buffer->target_frames = (size_t)target;
+}
+
+CHIAKI_EXPORT bool chiaki_jitter_buffer_push(ChiakiJitterBuffer *jitter_buffer, ChiakiSeqNum16 index, const uint8_t *buf, size_t buf_size, uint64_t arrival_us)
+{
+	bool r = false;
+	chiaki_mutex_lock(&jitter_buffer->mutex);
+
+	if(!jitter_buffer->frame_duration_us)
+		goto beach;
+
+	if(buf_size > CHIAKI_JITTER_BUFFER_FRAME_SIZE_MAX)
+	{
+		CHIAKI_LOGE(jitter_buffer->log, "Jitter Buffer got frame of size %#llx, which exceeds the maximum", (unsigned long long)buf_size);
+		goto beach;
+	}
+
+	jitter_buffer_update_jitter(jitter_buffer, index, arrival_us);
+
+	if(!jitter_buffer->index_valid)
+	{
+		jitter_buffer->index_valid = true;
+		jitter_buffer->next_index = index;
+		jitter_buffer->last_index = index;
+	}
+	else if(chiaki_seq_num_16_lt(index, jitter_buffer->next_index))
+	{
+		if(jitter_buffer->started
+			|| (ChiakiSeqNum16)(jitter_buffer->last_index - index) >= CHIAKI_JITTER_BUFFER_SIZE)
+		{
+			jitter_buffer->stats.late++;
+			goto beach;
+		}
+		// not started yet, so there is still time for earlier frames
+		jitter_buffer->next_index = index;
+	}
+	else if((ChiakiSeqNum16)(index - jitter_buffer->next_index) >= CHIAKI_JITTER_BUFFER_SIZE)
+	{
+		CHIAKI_LOGW(jitter_buffer->log, "Jitter Buffer got frame %#x too far ahead of %#x, resetting",
+				(unsigned int)index, (unsigned int)jitter_buffer->next_index);
+		jitter_buffer_reset(jitter_buffer);
+		jitter_buffer->index_valid = true;
+		jitter_buffer->next_index = index;
+		jitter_buffer->last_index = index;
+	}
+
+	ChiakiJitterBufferFrame *frame = FRAME(jitter_buffer, index);
+	if(frame->present)
+		goto beach;
+	frame->present = true;
+	frame->buf_size = buf_size;
+	memcpy(frame->buf, buf, buf_size);
+	if(chiaki_seq_num_16_gt(index, jitter_buffer->last_index))
+		jitter_buffer->last_index = index;
+	r = true;
+
+beach:
+	chiaki_mutex_unlock(&jitter_buffer->mutex);
+	return r;
+}
+
+/**
+ * Call the frame or lost callback with the mutex released.
+ *
+ * @param frame copy of the frame to pass on, or of the next one for a lost frame, NULL to conceal it
+ * @return whether playout can go on, false if the buffer was reset in the meantime
+ */
+static bool jitter_buffer_deliver(ChiakiJitterBuffer *jitter_buffer, bool lost, ChiakiJitterBufferFrame *frame)
+{
+	chiaki_mutex_unlock(&jitter_buffer->mutex);
+	if(!lost)
+	{
+		if(jitter_buffer->frame_cb)
+			jitter_buffer->frame_cb(frame->buf, frame->buf_size, jitter_buffer->cb_user);
+	}
+	else if(jitter_buffer->lost_cb)
+		jitter_buffer->lost_cb(frame ? frame->buf : NULL, frame ? frame->buf_size : 0, jitter_buffer->cb_user);
+	chiaki_mutex_lock(&jitter_buffer->mutex);
+	return jitter_buffer->playing;
+}
+
+CHIAKI_EXPORT void chiaki_jitter_buffer_play(ChiakiJitterBuffer *jitter_buffer, uint64_t now_us)
+{
+	// frames are passed on from here, their slots may be taken by new ones while the callbacks run
+	ChiakiJitterBufferFrame out;
+
+	chiaki_mutex_lock(&jitter_buffer->mutex);
+
+	uint64_t frame_duration_us = jitter_buffer->frame_duration_us;
+	if(!frame_duration_us || !jitter_buffer->index_valid)
+		goto beach;
+
+	if(!jitter_buffer->playing)
+	{
+		// a missing head frame is recovered or concealed below like any other lost one,
+		// waiting for it would stall playout forever if it never arrives
+		if(jitter_buffer_span(jitter_buffer) < jitter_buffer->target_frames)
+			goto beach;
+		jitter_buffer->started = true;
+		jitter_buffer->playing = true;
+		jitter_buffer->playout_next_us = now_us;
+		jitter_buffer->underrun_frames = 0;
+	}
+
+	// if play was not called for a long time, don't try to catch up with everything missed
+	if(now_us > jitter_buffer->playout_next_us + jitter_buffer->target_frames * frame_duration_us)
+		jitter_buffer->playout_next_us = now_us;
+
+	while(jitter_buffer->playout_next_us <= now_us)
+	{
+		size_t span = jitter_buffer_span(jitter_buffer);
+		if(!span)
+		{
+			if(jitter_buffer->underrun_frames >= JITTER_BUFFER_UNDERRUN_CONCEAL_MAX)
+			{
+				CHIAKI_LOGV(jitter_buffer->log, "Jitter Buffer ran empty, buffering up again");
+				jitter_buffer->playing = false;
+				break;
+			}
+			if(!jitter_buffer->underrun_frames)
+				jitter_buffer->stats.underruns++;
+			jitter_buffer->underrun_frames++;
+			// fill the gap without skipping the frame that is still to come
+			jitter_buffer->stats.concealed++;
+			jitter_buffer->playout_next_us += frame_duration_us;
+			if(!jitter_buffer_deliver(jitter_buffer, true, NULL))
+				break;
+			continue;
+		}
+		jitter_buffer->underrun_frames = 0;
+
+		ChiakiJitterBufferFrame *frame = FRAME(jitter_buffer, jitter_buffer->next_index);
+		bool lost = !frame->present;
+		ChiakiJitterBufferFrame *deliver = &out;
+		if(!lost)
+		{
+			frame->present = false;
+			if(span > jitter_buffer->target_frames + 1 && jitter_buffer->frames_since_drop >= JITTER_BUFFER_DROP_INTERVAL)
+			{
+				jitter_buffer->stats.dropped++;
+				jitter_buffer->frames_since_drop = 0;
+				jitter_buffer->next_index++;
+				continue;
+			}
+			jitter_buffer->stats.played++;
+			out.buf_size = frame->buf_size;
+			memcpy(out.buf, frame->buf, frame->buf_size);
+		}
+		else
+		{
+			// span > 0 and this one is missing, so there must be a later one
+			ChiakiJitterBufferFrame *next_frame = FRAME(jitter_buffer, (ChiakiSeqNum16)(jitter_buffer->next_index + 1));
+			if(next_frame->present)
+			{
+				jitter_buffer->stats.recovered++;
+				out.buf_size = next_frame->buf_size;
+				memcpy(out.buf, next_frame->buf, next_frame->buf_size);
+			}
+			else
+			{
+				jitter_buffer->stats.concealed++;
+				deliver = NULL;
+			}
+		}
+
+		jitter_buffer->next_index++;
+		jitter_buffer->frames_since_drop++;
+		jitter_buffer->playout_next_us += frame_duration_us;
+		if(!jitter_buffer_deliver(jitter_buffer, lost, deliver))
+			break;
+	}
+
+beach:
+	chiaki_mutex_unlock(&jitter_buffer->mutex);
+}
+
+static void *jitter_buffer_playout_thread_func(void *user)
+{
+	ChiakiJitterBuffer *jitter_buffer = user;
+	chiaki_mutex_lock(&jitter_buffer->mutex);
+	while(!jitter_buffer->playout_stop)
+	{
+		if(!jitter_buffer->frame_duration_us)
+		{
+			chiaki_cond_wait(&jitter_buffer->playout_cond, &jitter_buffer->mutex);
+			continue;
+		}
+		// wake up twice per frame so playout is never off by more than half a frame
+		uint64_t period_ms = jitter_buffer->frame_duration_us / 2000;
+		if(!period_ms)
+			period_ms = 1;
+		chiaki_cond_timedwait(&jitter_buffer->playout_cond, &jitter_buffer->mutex, period_ms);
+		if(jitter_buffer->playout_stop)
+			break;
+		chiaki_mutex_unlock(&jitter_buffer->mutex);
+		chiaki_jitter_buffer_play(jitter_buffer, chiaki_time_now_monotonic_us());
+		chiaki_mutex_lock(&jitter_buffer->mutex);
+	}
+	chiaki_mutex_unlock(&jitter_buffer->mutex);
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_jitter_buffer_playout_start(ChiakiJitterBuffer *jitter_buffer, const char *thread_name)
+{
+	if(jitter_buffer->playout_running)
+		return CHIAKI_ERR_SUCCESS;
+	jitter_buffer->playout_stop = false;
+	ChiakiErrorCode err = chiaki_thread_create(&jitter_buffer->playout_thread, jitter_buffer_playout_thread_func, jitter_buffer);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(jitter_buffer->log, "Jitter Buffer failed to start playout thread");
+		return err;
+	}
+	chiaki_thread_set_name(&jitter_buffer->playout_thread, thread_name);
+	jitter_buffer->playout_running = true;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_jitter_buffer_playout_stop(ChiakiJitterBuffer *jitter_buffer)
+{
+	if(!jitter_buffer->playout_running)
+		return;
+	chiaki_mutex_lock(&jitter_buffer->mutex);
+	jitter_buffer->playout_stop = true;
+	chiaki_cond_signal(&jitter_buffer->playout_cond);
+	chiaki_mutex_unlock(&jitter_buffer->mutex);
+	chiaki_thread_join(&jitter_buffer->playout_thread, NULL);
+	jitter_buffer->playout_running = false;
+}
+
+CHIAKI_EXPORT void chiaki_jitter_buffer_stats(ChiakiJitterBuffer *jitter_buffer, ChiakiJitterBufferStats *stats)
+{
+	chiaki_mutex_lock(&jitter_buffer->mutex);
+	*stats = jitter_buffer->stats;
+	stats->delay_us = (uint64_t)jitter_buffer->target_frames * jitter_buffer->frame_duration_us;
+	chiaki_mutex_unlock(&jitter_buffer->mutex);
+}
+
+CHIAKI_EXPORT size_t chiaki_jitter_buffer_target_frames(ChiakiJitterBuffer *jitter_buffer)
+{
+	chiaki_mutex_lock(&jitter_buffer->mutex);
+	size_t r = jitter_buffer->target_frames;
+	chiaki_mutex_unlock(&jitter_buffer->mutex);
+	return r;
+}
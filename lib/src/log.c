@@ -1,6 +1,9 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/log.h>
+#include <chiaki/logasync.h>
+#include <chiaki/atomic.h>
+#include <chiaki/time.h>
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -30,6 +33,7 @@ CHIAKI_EXPORT void chiaki_log_init(ChiakiLog *log, uint32_t level_mask, ChiakiLo
 	log->level_mask = level_mask;
 	log->cb = cb;
 	log->user = user;
+	log->rate_limit_pending = NULL;
 }
 
 CHIAKI_EXPORT void chiaki_log_cb_print(ChiakiLogLevel level, const char *msg, void *user)
@@ -67,6 +71,15 @@ CHIAKI_EXPORT void chiaki_log(ChiakiLog *log, ChiakiLogLevel level, const char *
 		return;
 
 	va_list args;
+	if(log && log->cb == chiaki_log_async_cb)
+	{
+		// format directly into the ring, the sink is called from the async log thread
+		va_start(args, fmt);
+		chiaki_log_async_pushv(log->user, level, fmt, args);
+		va_end(args);
+		return;
+	}
+
 	char buf[0x100];
 	char *msg = buf;
 
@@ -102,6 +115,94 @@ CHIAKI_EXPORT void chiaki_log(ChiakiLog *log, ChiakiLogLevel level, const char *
 		free(msg);
 }
 
+/**
+ * Add a call site to the ones of log whose summary has not been logged yet, linked by next.
+ * The list is only ever pushed to or taken as a whole.
+ */
+static void log_rate_limit_push(ChiakiLog *log, ChiakiLogRateLimit *rate_limit)
+{
+	void *head = chiaki_atomic_load_ptr(&log->rate_limit_pending);
+	do
+		rate_limit->next = head;
+	while(!chiaki_atomic_cas_ptr(&log->rate_limit_pending, &head, rate_limit));
+}
+
+static void log_rate_limit_summary(ChiakiLog *log, ChiakiLogLevel level, const char *file, int line, uint32_t suppressed, uint64_t duration_ms)
+{
+	const char *file_name = file;
+	for(const char *c = file; *c; c++)
+	{
+		if(*c == '/' || *c == '\\')
+			file_name = c + 1;
+	}
+	chiaki_log(log, level, "Suppressed %u similar message(s) from %s:%d within %llu ms",
+			(unsigned int)suppressed, file_name, line,
+			(unsigned long long)duration_ms);
+}
+
+CHIAKI_EXPORT void chiaki_log_rate_limit_flush(ChiakiLog *log, bool force)
+{
+	uint64_t now = chiaki_time_now_monotonic_ms();
+	ChiakiLogRateLimit *rate_limit = chiaki_atomic_exchange_ptr(&log->rate_limit_pending, NULL);
+	while(rate_limit)
+	{
+		// as soon as pending is cleared, another thread may push it again
+		ChiakiLogRateLimit *next = rate_limit->next;
+		uint64_t window_start = chiaki_atomic_load_u64(&rate_limit->window_start_ms);
+		if(force || now - window_start >= CHIAKI_LOG_RATE_LIMIT_INTERVAL_MS)
+		{
+			chiaki_atomic_store_u32(&rate_limit->pending, 0);
+			uint32_t suppressed = chiaki_atomic_exchange_u32(&rate_limit->suppressed, 0);
+			if(suppressed)
+				log_rate_limit_summary(log, rate_limit->level, rate_limit->file, rate_limit->line, suppressed, now - window_start);
+		}
+		else if(!chiaki_atomic_load_u32(&rate_limit->suppressed))
+		{
+			// summary already logged by the call site itself
+			chiaki_atomic_store_u32(&rate_limit->pending, 0);
+			uint32_t pending = 0;
+			if(chiaki_atomic_load_u32(&rate_limit->suppressed) && chiaki_atomic_cas_u32(&rate_limit->pending, &pending, 1))
+				log_rate_limit_push(log, rate_limit);
+		}
+		else
+			log_rate_limit_push(log, rate_limit);
+		rate_limit = next;
+	}
+}
+
+CHIAKI_EXPORT bool chiaki_log_rate_limit_check(ChiakiLog *log, ChiakiLogLevel level, ChiakiLogRateLimit *rate_limit, const char *file, int line)
+{
+	if(log && !(log->level_mask & level))
+		return false;
+
+	uint64_t now = chiaki_time_now_monotonic_ms();
+	uint64_t window_start = chiaki_atomic_load_u64(&rate_limit->window_start_ms);
+	if(now - window_start >= CHIAKI_LOG_RATE_LIMIT_INTERVAL_MS
+		&& chiaki_atomic_cas_u64(&rate_limit->window_start_ms, &window_start, now))
+	{
+		// only the thread that won the cas starts the new interval
+		uint32_t suppressed = chiaki_atomic_exchange_u32(&rate_limit->suppressed, 0);
+		chiaki_atomic_store_u32(&rate_limit->count, 0);
+		if(suppressed)
+			log_rate_limit_summary(log, level, file, line, suppressed, now - window_start);
+	}
+
+	if(chiaki_atomic_fetch_add_u32(&rate_limit->count, 1) < CHIAKI_LOG_RATE_LIMIT_BURST)
+		return true;
+	chiaki_atomic_fetch_add_u32(&rate_limit->suppressed, 1);
+
+	// make sure the summary is logged even if the call site is never hit again
+	uint32_t pending = 0;
+	if(log && chiaki_atomic_cas_u32(&rate_limit->pending, &pending, 1))
+	{
+		rate_limit->level = level;
+		rate_limit->file = file;
+		rate_limit->line = line;
+		log_rate_limit_push(log, rate_limit);
+	}
+	return false;
+}
+
 #define HEXDUMP_WIDTH 0x10
 
 static const char hex_char[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/logasync.h>
+#include <chiaki/atomic.h>
+
+#include <stdio.h>
+#include <string.h>
+
+static void *log_async_thread_func(void *user);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_log_async_init(ChiakiLogAsync *async, size_t size_exp, ChiakiLogCb cb, void *cb_user)
+{
+	async->cb = cb ? cb : chiaki_log_cb_print;
+	async->cb_user = cb_user;
+
+	size_t slots_count = (size_t)1 << size_exp;
+	async->slots = calloc(slots_count, sizeof(ChiakiLogAsyncSlot));
+	if(!async->slots)
+		return CHIAKI_ERR_MEMORY;
+	async->slots_mask = slots_count - 1;
+	for(size_t i=0; i<slots_count; i++)
+		async->slots[i].seq = i;
+	async->enqueue_pos = 0;
+	async->dequeue_pos = 0;
+	async->dropped = 0;
+	async->dropped_reported = 0;
+	async->sleeping = 0;
+	async->should_stop = 0;
+
+	ChiakiErrorCode err = chiaki_stop_pipe_init(&async->wakeup_pipe);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_slots;
+
+	err = chiaki_thread_create(&async->thread, log_async_thread_func, async);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_pipe;
+
+	chiaki_thread_set_name(&async->thread, "Chiaki Log");
+	return CHIAKI_ERR_SUCCESS;
+
+error_pipe:
+	chiaki_stop_pipe_fini(&async->wakeup_pipe);
+error_slots:
+	free(async->slots);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_log_async_fini(ChiakiLogAsync *async)
+{
+	chiaki_atomic_exchange_u32(&async->should_stop, 1);
+	chiaki_stop_pipe_stop(&async->wakeup_pipe);
+	chiaki_thread_join(&async->thread, NULL);
+
+	chiaki_stop_pipe_fini(&async->wakeup_pipe);
+	free(async->slots);
+}
+
+/**
+ * Reserve the next slot for writing.
+ * @return NULL if the ring is full
+ */
+static ChiakiLogAsyncSlot *log_async_claim(ChiakiLogAsync *async, uint64_t *pos_out)
+{
+	uint64_t pos = chiaki_atomic_load_u64(&async->enqueue_pos);
+	while(true)
+	{
+		ChiakiLogAsyncSlot *slot = &async->slots[pos & async->slots_mask];
+		int64_t diff = (int64_t)(chiaki_atomic_load_u64(&slot->seq) - pos);
+		if(diff == 0)
+		{
+			// on failure, pos is updated to the current value
+			if(chiaki_atomic_cas_u64(&async->enqueue_pos, &pos, pos + 1))
+			{
+				*pos_out = pos;
+				return slot;
+			}
+		}
+		else if(diff < 0)
+			return NULL; // slot still holds a message from the previous round
+		else
+			pos = chiaki_atomic_load_u64(&async->enqueue_pos);
+	}
+}
+
+static void log_async_publish(ChiakiLogAsync *async, ChiakiLogAsyncSlot *slot, uint64_t pos)
+{
+	// Full barriers on both sides: either the thread sees the message before going to sleep
+	// or we see it sleeping. Only the first producer to see it clears the flag and writes to the pipe,
+	// so there is at most one byte in it and the write never blocks. A wakeup that arrives
+	// before the thread actually waits just stays in the pipe.
+	chiaki_atomic_exchange_u64(&slot->seq, pos + 1);
+	if(chiaki_atomic_exchange_u32(&async->sleeping, 0))
+		chiaki_stop_pipe_stop(&async->wakeup_pipe);
+}
+
+CHIAKI_EXPORT void chiaki_log_async_pushv(ChiakiLogAsync *async, ChiakiLogLevel level, const char *fmt, va_list args)
+{
+	uint64_t pos;
+	ChiakiLogAsyncSlot *slot = log_async_claim(async, &pos);
+	if(!slot)
+	{
+		chiaki_atomic_fetch_add_u64(&async->dropped, 1);
+		return;
+	}
+
+	va_list args_copy;
+	va_copy(args_copy, args);
+
+	slot->level = level;
+	slot->msg_heap = NULL;
+	int written = vsnprintf(slot->msg, sizeof(slot->msg), fmt, args);
+	if(written < 0)
+		slot->msg[0] = '\0';
+	else if((size_t)written >= sizeof(slot->msg))
+	{
+		// keep the truncated message if this fails
+		char *msg_heap = malloc((size_t)written + 1);
+		if(msg_heap && vsnprintf(msg_heap, (size_t)written + 1, fmt, args_copy) >= 0)
+			slot->msg_heap = msg_heap;
+		else
+			free(msg_heap);
+	}
+	va_end(args_copy);
+
+	log_async_publish(async, slot, pos);
+}
+
+CHIAKI_EXPORT void chiaki_log_async_cb(ChiakiLogLevel level, const char *msg, void *user)
+{
+	ChiakiLogAsync *async = user;
+	uint64_t pos;
+	ChiakiLogAsyncSlot *slot = log_async_claim(async, &pos);
+	if(!slot)
+	{
+		chiaki_atomic_fetch_add_u64(&async->dropped, 1);
+		return;
+	}
+
+	slot->level = level;
+	slot->msg_heap = NULL;
+	size_t len = strlen(msg);
+	if(len >= sizeof(slot->msg))
+	{
+		slot->msg_heap = malloc(len + 1);
+		if(slot->msg_heap)
+			memcpy(slot->msg_heap, msg, len + 1);
+		else
+			len = sizeof(slot->msg) - 1;
+	}
+	if(!slot->msg_heap)
+	{
+		memcpy(slot->msg, msg, len);
+		slot->msg[len] = '\0';
+	}
+
+	log_async_publish(async, slot, pos);
+}
+
+CHIAKI_EXPORT uint64_t chiaki_log_async_dropped(ChiakiLogAsync *async)
+{
+	return chiaki_atomic_load_u64(&async->dropped);
+}
+
+static bool log_async_available(ChiakiLogAsync *async)
+{
+	ChiakiLogAsyncSlot *slot = &async->slots[async->dequeue_pos & async->slots_mask];
+	return chiaki_atomic_load_u64(&slot->seq) == async->dequeue_pos + 1;
+}
+
+static bool log_async_dispatch_next(ChiakiLogAsync *async)
+{
+	if(!log_async_available(async))
+		return false;
+
+	ChiakiLogAsyncSlot *slot = &async->slots[async->dequeue_pos & async->slots_mask];
+	async->cb(slot->level, slot->msg_heap ? slot->msg_heap : slot->msg, async->cb_user);
+	free(slot->msg_heap);
+	slot->msg_heap = NULL;
+
+	// hand the slot back to the producers for the next round
+	chiaki_atomic_store_u64(&slot->seq, async->dequeue_pos + async->slots_mask + 1);
+	async->dequeue_pos++;
+	return true;
+}
+
+static void log_async_drain(ChiakiLogAsync *async)
+{
+	while(log_async_dispatch_next(async));
+
+	uint64_t dropped = chiaki_atomic_load_u64(&async->dropped);
+	if(dropped != async->dropped_reported)
+	{
+		char msg[0x40];
+		snprintf(msg, sizeof(msg), "Async log dropped %llu message(s)", (unsigned long long)(dropped - async->dropped_reported));
+		async->cb(CHIAKI_LOG_WARNING, msg, async->cb_user);
+		async->dropped_reported = dropped;
+	}
+}
+
+static void *log_async_thread_func(void *user)
+{
+	ChiakiLogAsync *async = user;
+
+	while(true)
+	{
+		log_async_drain(async);
+
+		if(chiaki_atomic_load_u32(&async->should_stop))
+			break;
+		// pairs with log_async_publish(), see there
+		chiaki_atomic_exchange_u32(&async->sleeping, 1);
+		ChiakiLogAsyncSlot *slot = &async->slots[async->dequeue_pos & async->slots_mask];
+		if(chiaki_atomic_fetch_add_u64(&slot->seq, 0) != async->dequeue_pos + 1)
+			chiaki_stop_pipe_sleep(&async->wakeup_pipe, UINT64_MAX);
+		chiaki_atomic_store_u32(&async->sleeping, 0);
+		chiaki_stop_pipe_reset(&async->wakeup_pipe);
+	}
+
+	log_async_drain(async);
+	return NULL;
+}
@@ -11,6 +11,7 @@
 
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user);
 static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user);
+static void chiaki_opus_decoder_frame_lost(uint8_t *next_buf, size_t next_buf_size, void *user);
 
 CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLog *log)
 {
@@ -24,6 +25,18 @@ CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLo
 	decoder->cb_user = NULL;
 	decoder->settings_cb = NULL;
 	decoder->frame_cb = NULL;
+
+	decoder->batch_cb = NULL;
+	decoder->batch_format = CHIAKI_OPUS_DECODER_FORMAT_S16;
+	decoder->batch_mem = NULL;
+	decoder->batch_mem_size = 0;
+	decoder->batch_samples = 0;
+	decoder->batch_frames_max = 0;
+	decoder->batch_slot_size = 0;
+	decoder->batch_slots = 0;
+	decoder->batch_slot_cur = 0;
+	decoder->batch_frames_cur = 0;
+	decoder->batch_samples_cur = 0;
 }
 
 CHIAKI_EXPORT void chiaki_opus_decoder_fini(ChiakiOpusDecoder *decoder)
@@ -31,17 +44,65 @@ CHIAKI_EXPORT void chiaki_opus_decoder_fini(ChiakiOpusDecoder *decoder)
 	free(decoder->pcm_buf);
 }
 
+static void opus_decoder_batch_layout(ChiakiOpusDecoder *decoder)
+{
+	decoder->batch_slots = 0;
+	decoder->batch_slot_cur = 0;
+	decoder->batch_frames_cur = 0;
+	decoder->batch_samples_cur = 0;
+
+	size_t frame_size = decoder->audio_header.frame_size;
+	if(!decoder->batch_cb || !frame_size || !decoder->audio_header.channels)
+		return;
+
+	decoder->batch_frames_max = (decoder->batch_samples + frame_size - 1) / frame_size;
+	if(!decoder->batch_frames_max)
+		decoder->batch_frames_max = 1;
+	decoder->batch_slot_size = decoder->batch_frames_max * frame_size * decoder->audio_header.channels
+		* chiaki_opus_decoder_format_sample_size(decoder->batch_format);
+	decoder->batch_slots = decoder->batch_mem_size / decoder->batch_slot_size;
+	if(!decoder->batch_slots)
+		CHIAKI_LOGE(decoder->log, "ChiakiOpusDecoder batch memory of %#llx bytes is too small for a batch of %#llx bytes",
+				(unsigned long long)decoder->batch_mem_size, (unsigned long long)decoder->batch_slot_size);
+}
+
+CHIAKI_EXPORT void chiaki_opus_decoder_set_batch(ChiakiOpusDecoder *decoder, ChiakiOpusDecoderFormat format,
+		void *mem, size_t mem_size, size_t batch_samples, ChiakiOpusDecoderBatchCallback batch_cb)
+{
+	decoder->batch_cb = batch_cb;
+	decoder->batch_format = format;
+	decoder->batch_mem = mem;
+	decoder->batch_mem_size = mem_size;
+	decoder->batch_samples = batch_samples;
+	opus_decoder_batch_layout(decoder);
+}
+
+CHIAKI_EXPORT void chiaki_opus_decoder_flush(ChiakiOpusDecoder *decoder)
+{
+	if(!decoder->batch_cb || !decoder->batch_samples_cur)
+		return;
+	decoder->batch_cb(decoder->batch_mem + decoder->batch_slot_cur * decoder->batch_slot_size,
+			decoder->batch_samples_cur, decoder->cb_user);
+	decoder->batch_slot_cur = (decoder->batch_slot_cur + 1) % decoder->batch_slots;
+	decoder->batch_frames_cur = 0;
+	decoder->batch_samples_cur = 0;
+}
+
 CHIAKI_EXPORT void chiaki_opus_decoder_get_sink(ChiakiOpusDecoder *decoder, ChiakiAudioSink *sink)
 {
 	sink->user = decoder;
 	sink->header_cb = chiaki_opus_decoder_header;
 	sink->frame_cb = chiaki_opus_decoder_frame;
+	sink->frame_lost_cb = chiaki_opus_decoder_frame_lost;
 }
 
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user)
 {
 	ChiakiOpusDecoder *decoder = user;
+	// anything still pending was decoded with the old header
+	chiaki_opus_decoder_flush(decoder);
 	memcpy(&decoder->audio_header, header, sizeof(decoder->audio_header));
+	opus_decoder_batch_layout(decoder);
 
 	opus_decoder_destroy(decoder->opus_decoder);
 
@@ -78,6 +139,45 @@ static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user)
 		decoder->settings_cb(header->channels, header->rate, decoder->cb_user);
 }
 
+/**
+ * Decode into the current batch slot or pcm_buf and pass it on.
+ * With buf = NULL, the frame is concealed, with fec, it is recovered from the in-band FEC data in buf.
+ */
+static void opus_decoder_decode(ChiakiOpusDecoder *decoder, uint8_t *buf, size_t buf_size, bool fec, const char *err_msg)
+{
+	opus_int32 len = buf ? (opus_int32)buf_size : 0;
+	int frame_size = decoder->audio_header.frame_size;
+	int decode_fec = fec ? 1 : 0;
+
+	if(!decoder->batch_cb)
+	{
+		int r = opus_decode(decoder->opus_decoder, buf, len, decoder->pcm_buf, frame_size, decode_fec);
+		if(r < 1)
+			CHIAKI_LOGE(decoder->log, "%s: %s", err_msg, opus_strerror(r));
+		else if(decoder->frame_cb)
+			decoder->frame_cb(decoder->pcm_buf, (size_t)r, decoder->cb_user);
+		return;
+	}
+
+	if(!decoder->batch_slots)
+		return;
+
+	uint8_t *out = decoder->batch_mem + decoder->batch_slot_cur * decoder->batch_slot_size
+		+ decoder->batch_samples_cur * decoder->audio_header.channels * chiaki_opus_decoder_format_sample_size(decoder->batch_format);
+	int r = decoder->batch_format == CHIAKI_OPUS_DECODER_FORMAT_FLOAT
+		? opus_decode_float(decoder->opus_decoder, buf, len, (float *)out, frame_size, decode_fec)
+		: opus_decode(decoder->opus_decoder, buf, len, (opus_int16 *)out, frame_size, decode_fec);
+	if(r < 1)
+	{
+		CHIAKI_LOGE(decoder->log, "%s: %s", err_msg, opus_strerror(r));
+		return;
+	}
+
+	decoder->batch_samples_cur += (size_t)r;
+	if(++decoder->batch_frames_cur >= decoder->batch_frames_max)
+		chiaki_opus_decoder_flush(decoder);
+}
+
 static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
 {
 	ChiakiOpusDecoder *decoder = user;
@@ -87,11 +187,17 @@ static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
 		return;
 	}
 
-	int r = opus_decode(decoder->opus_decoder, buf, (opus_int32)buf_size, decoder->pcm_buf, decoder->audio_header.frame_size, 0);
-	if(r < 1)
-		CHIAKI_LOGE(decoder->log, "Decoding audio frame with opus failed: %s", opus_strerror(r));
-	else if(decoder->frame_cb)
-		decoder->frame_cb(decoder->pcm_buf, (size_t)r, decoder->cb_user);
+	opus_decoder_decode(decoder, buf, buf_size, false, "Decoding audio frame with opus failed");
+}
+
+static void chiaki_opus_decoder_frame_lost(uint8_t *next_buf, size_t next_buf_size, void *user)
+{
+	ChiakiOpusDecoder *decoder = user;
+	if(!decoder->opus_decoder)
+		return;
+
+	// with the next frame, recover the lost one from its in-band FEC data, otherwise let opus conceal it
+	opus_decoder_decode(decoder, next_buf, next_buf_size, next_buf != NULL, "Concealing lost audio frame with opus failed");
 }
 
 #endif
\ No newline at end of file
@@ -12,6 +12,9 @@
 #define BETA_WARMUP 20.0f
 #define BETA_DEFAULT 0.05f
 
+// samples prepared at once by chiaki_orientation_tracker_update_batch()
+#define BATCH_CHUNK_SIZE 64
+
 CHIAKI_EXPORT void chiaki_orientation_init(ChiakiOrientation *orient)
 {
 	// 90 deg rotation around x for Madgwick
@@ -23,7 +26,10 @@ CHIAKI_EXPORT void chiaki_orientation_init(ChiakiOrientation *orient)
 
 static float inv_sqrt(float x);
 
-CHIAKI_EXPORT void chiaki_orientation_update(ChiakiOrientation *orient,
+/**
+ * @param ax, ay, az normalised accelerometer measurement, or all 0 if invalid
+ */
+static void orientation_update_normalized(ChiakiOrientation *orient,
 		float gx, float gy, float gz, float ax, float ay, float az, float beta, float time_step_sec)
 {
 	float q0 = orient->w, q1 = orient->x, q2 = orient->y, q3 = orient->z;
@@ -43,12 +49,6 @@ CHIAKI_EXPORT void chiaki_orientation_update(ChiakiOrientation *orient,
 	// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
 	if(!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)))
 	{
-		// Normalise accelerometer measurement
-		recip_norm = inv_sqrt(ax * ax + ay * ay + az * az);
-		ax *= recip_norm;
-		ay *= recip_norm;
-		az *= recip_norm;
-
 		// Auxiliary variables to avoid repeated arithmetic
 		_2q0 = 2.0f * q0;
 		_2q1 = 2.0f * q1;
@@ -106,10 +106,24 @@ CHIAKI_EXPORT void chiaki_orientation_update(ChiakiOrientation *orient,
 	orient->w = q0;
 }
 
+CHIAKI_EXPORT void chiaki_orientation_update(ChiakiOrientation *orient,
+		float gx, float gy, float gz, float ax, float ay, float az, float beta, float time_step_sec)
+{
+	if(!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)))
+	{
+		// Normalise accelerometer measurement
+		float recip_norm = inv_sqrt(ax * ax + ay * ay + az * az);
+		ax *= recip_norm;
+		ay *= recip_norm;
+		az *= recip_norm;
+	}
+	orientation_update_normalized(orient, gx, gy, gz, ax, ay, az, beta, time_step_sec);
+}
+
 static float inv_sqrt(float x)
 {
 #if 1
-	return 1.0f / sqrt(x);
+	return 1.0f / sqrtf(x);
 #else
 	// Fast inverse square-root
 	// See: http://en.wikipedia.org/wiki/Fast_inverse_square_root
@@ -137,26 +151,60 @@ CHIAKI_EXPORT void chiaki_orientation_tracker_init(ChiakiOrientationTracker *tra
 CHIAKI_EXPORT void chiaki_orientation_tracker_update(ChiakiOrientationTracker *tracker,
 		float gx, float gy, float gz, float ax, float ay, float az, uint32_t timestamp_us)
 {
-	tracker->gyro_x = gx;
-	tracker->gyro_y = gy;
-	tracker->gyro_z = gz;
-	tracker->accel_x = ax;
-	tracker->accel_y = ay;
-	tracker->accel_z = az;
-	tracker->sample_index++;
-	if(tracker->sample_index <= 1)
+	ChiakiMotionSample sample = { gx, gy, gz, ax, ay, az, timestamp_us };
+	chiaki_orientation_tracker_update_batch(tracker, &sample, 1);
+}
+
+CHIAKI_EXPORT void chiaki_orientation_tracker_update_batch(ChiakiOrientationTracker *tracker,
+		const ChiakiMotionSample *samples, size_t samples_count)
+{
+	float ax[BATCH_CHUNK_SIZE], ay[BATCH_CHUNK_SIZE], az[BATCH_CHUNK_SIZE];
+	float time_step_sec[BATCH_CHUNK_SIZE];
+
+	for(size_t chunk = 0; chunk < samples_count; chunk += BATCH_CHUNK_SIZE)
 	{
-		tracker->timestamp = timestamp_us;
-		return;
+		const ChiakiMotionSample *s = samples + chunk;
+		size_t count = samples_count - chunk;
+		if(count > BATCH_CHUNK_SIZE)
+			count = BATCH_CHUNK_SIZE;
+
+		// everything that does not depend on the orientation, with no dependencies between the samples
+		for(size_t i = 0; i < count; i++)
+		{
+			float norm = s[i].accel_x * s[i].accel_x + s[i].accel_y * s[i].accel_y + s[i].accel_z * s[i].accel_z;
+			float recip_norm = norm > 0.0f ? inv_sqrt(norm) : 0.0f;
+			ax[i] = s[i].accel_x * recip_norm;
+			ay[i] = s[i].accel_y * recip_norm;
+			az[i] = s[i].accel_z * recip_norm;
+		}
+		for(size_t i = 0; i < count; i++)
+		{
+			uint32_t timestamp_prev = i ? s[i - 1].timestamp_us : tracker->timestamp;
+			time_step_sec[i] = (float)(uint32_t)(s[i].timestamp_us - timestamp_prev) / 1000000.0f;
+		}
+
+		for(size_t i = 0; i < count; i++)
+		{
+			tracker->sample_index++;
+			// the first sample only gives the time to start from
+			if(tracker->sample_index <= 1)
+				continue;
+			orientation_update_normalized(&tracker->orient, s[i].gyro_x, s[i].gyro_y, s[i].gyro_z, ax[i], ay[i], az[i],
+					tracker->sample_index < WARMUP_SAMPLES_COUNT ? BETA_WARMUP : BETA_DEFAULT,
+					time_step_sec[i]);
+		}
+		tracker->timestamp = s[count - 1].timestamp_us;
 	}
-	uint64_t delta_us = timestamp_us;
-	if(delta_us < tracker->timestamp)
-		delta_us += (1ULL << 32);
-	delta_us -= tracker->timestamp;
-	tracker->timestamp = timestamp_us;
-	chiaki_orientation_update(&tracker->orient, gx, gy, gz, ax, ay, az,
-			tracker->sample_index < WARMUP_SAMPLES_COUNT ? BETA_WARMUP : BETA_DEFAULT,
-			(float)delta_us / 1000000.0f);
+
+	if(!samples_count)
+		return;
+	const ChiakiMotionSample *last = &samples[samples_count - 1];
+	tracker->gyro_x = last->gyro_x;
+	tracker->gyro_y = last->gyro_y;
+	tracker->gyro_z = last->gyro_z;
+	tracker->accel_x = last->accel_x;
+	tracker->accel_y = last->accel_y;
+	tracker->accel_z = last->accel_z;
 }
 
 CHIAKI_EXPORT void chiaki_orientation_tracker_apply_to_controller_state(ChiakiOrientationTracker *tracker,
@@ -1,15 +1,46 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/packetstats.h>
+#include <chiaki/atomic.h>
+#include <chiaki/time.h>
 #include <chiaki/log.h>
 
+#include <string.h>
+
+static void snapshot_clear(ChiakiPacketStatsSnapshot *snapshot)
+{
+	memset(snapshot, 0, sizeof(*snapshot));
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_packet_stats_init(ChiakiPacketStats *stats)
 {
 	stats->gen_received = 0;
 	stats->gen_lost = 0;
-	stats->seq_min = 0;
-	stats->seq_max = 0;
 	stats->seq_received = 0;
+	stats->seq_lost = 0;
+	stats->seq_recovered = 0;
+	stats->seq_duplicates = 0;
+	for(size_t i=0; i<CHIAKI_PACKET_STATS_HIST_BUCKETS; i++)
+	{
+		stats->loss_burst_hist[i] = 0;
+		stats->reorder_hist[i] = 0;
+	}
+	stats->goodput_bytes = 0;
+	stats->fec_recovered = 0;
+	stats->fec_missed = 0;
+	stats->jitter_us_x16 = 0;
+	stats->seq_interval_us = 0;
+	stats->delay_trend_bits = 0;
+	stats->delay_deltas = 0;
+	stats->seq_started = false;
+	stats->seq_max = 0;
+	stats->seq_last = 0;
+	stats->seq_last_arrival_us = 0;
+	stats->seq_ext_max = 0;
+	memset(stats->seq_received_mask, 0, sizeof(stats->seq_received_mask));
+	chiaki_trendline_init(&stats->delay_trendline);
+	snapshot_clear(&stats->get_prev);
+	stats->get_prev.timestamp_us = chiaki_time_now_monotonic_us();
 	return chiaki_mutex_init(&stats->mutex, false);
 }
 
@@ -18,59 +49,229 @@ CHIAKI_EXPORT void chiaki_packet_stats_fini(ChiakiPacketStats *stats)
 	chiaki_mutex_fini(&stats->mutex);
 }
 
-static void reset_stats(ChiakiPacketStats *stats)
-{
-	stats->gen_received = 0;
-	stats->gen_lost = 0;
-	stats->seq_min = stats->seq_max;
-	stats->seq_received = 0;
-}
-
 CHIAKI_EXPORT void chiaki_packet_stats_reset(ChiakiPacketStats *stats)
 {
 	chiaki_mutex_lock(&stats->mutex);
-	reset_stats(stats);
+	chiaki_packet_stats_snapshot(stats, &stats->get_prev);
 	chiaki_mutex_unlock(&stats->mutex);
 }
 
+static size_t hist_bucket(uint64_t v)
+{
+	size_t bucket = 0;
+	for(v = v ? v - 1 : 0; v && bucket < CHIAKI_PACKET_STATS_HIST_BUCKETS - 1; v >>= 1)
+		bucket++;
+	return bucket;
+}
+
 CHIAKI_EXPORT void chiaki_packet_stats_push_generation(ChiakiPacketStats *stats, uint64_t received, uint64_t lost)
 {
-	chiaki_mutex_lock(&stats->mutex);
-	stats->gen_received += received;
-	stats->gen_lost += lost;
-	chiaki_mutex_unlock(&stats->mutex);
+	chiaki_atomic_fetch_add_u64(&stats->gen_received, received);
+	if(!lost)
+		return;
+	chiaki_atomic_fetch_add_u64(&stats->gen_lost, lost);
+	// units of a generation are sent back to back, so all losses in it count as a single burst
+	chiaki_atomic_fetch_add_u64(&stats->loss_burst_hist[hist_bucket(lost)], 1);
+}
+
+static void push_seq_jitter(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num, uint64_t now_us)
+{
+	uint64_t interval_us = chiaki_atomic_load_u64(&stats->seq_interval_us);
+	if(!interval_us)
+		return;
+
+	// RFC 3550 6.4.1 with the sequence number as the sender clock
+	int64_t arrival_diff = (int64_t)(now_us - stats->seq_last_arrival_us);
+	int64_t send_diff = (int64_t)(ChiakiSeqNum16)(seq_num - stats->seq_last) * (int64_t)interval_us;
+	int64_t d = arrival_diff - send_diff;
+	if(d < 0)
+		d = -d;
+	uint64_t jitter = chiaki_atomic_load_u64(&stats->jitter_us_x16);
+	jitter += (uint64_t)d - ((jitter + 8) >> 4);
+	chiaki_atomic_store_u64(&stats->jitter_us_x16, jitter);
+}
+
+static void push_seq_delay(ChiakiPacketStats *stats, uint64_t now_us)
+{
+	uint64_t interval_us = chiaki_atomic_load_u64(&stats->seq_interval_us);
+	if(!interval_us)
+		return;
+
+	chiaki_trendline_update(&stats->delay_trendline, now_us, stats->seq_ext_max * interval_us);
+	double trend = chiaki_trendline_trend(&stats->delay_trendline);
+	uint64_t trend_bits;
+	memcpy(&trend_bits, &trend, sizeof(trend_bits));
+	chiaki_atomic_store_u64(&stats->delay_trend_bits, trend_bits);
+	chiaki_atomic_store_u64(&stats->delay_deltas, chiaki_trendline_deltas_count(&stats->delay_trendline));
+}
+
+static bool seq_received_get(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num)
+{
+	size_t bit = seq_num % CHIAKI_PACKET_STATS_SEQ_WINDOW;
+	return (stats->seq_received_mask[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void seq_received_set(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num, bool received)
+{
+	size_t bit = seq_num % CHIAKI_PACKET_STATS_SEQ_WINDOW;
+	if(received)
+		stats->seq_received_mask[bit / 64] |= (uint64_t)1 << (bit % 64);
+	else
+		stats->seq_received_mask[bit / 64] &= ~((uint64_t)1 << (bit % 64));
 }
 
 CHIAKI_EXPORT void chiaki_packet_stats_push_seq(ChiakiPacketStats *stats, ChiakiSeqNum16 seq_num)
 {
-	stats->seq_received++;
-	if(chiaki_seq_num_16_gt(seq_num, stats->seq_max))
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+
+	if(!stats->seq_started)
+	{
+		stats->seq_started = true;
+		stats->seq_max = seq_num;
+	}
+	else if(chiaki_seq_num_16_gt(seq_num, stats->seq_max))
+	{
+		ChiakiSeqNum16 gap = seq_num - stats->seq_max - 1;
+		if(gap)
+		{
+			chiaki_atomic_fetch_add_u64(&stats->seq_lost, gap);
+			chiaki_atomic_fetch_add_u64(&stats->loss_burst_hist[hist_bucket(gap)], 1);
+			if(gap >= CHIAKI_PACKET_STATS_SEQ_WINDOW)
+				memset(stats->seq_received_mask, 0, sizeof(stats->seq_received_mask));
+			else
+			{
+				for(ChiakiSeqNum16 i=1; i<=gap; i++)
+					seq_received_set(stats, stats->seq_max + i, false);
+			}
+		}
+		if(chiaki_seq_num_16_gt(seq_num, stats->seq_last))
+			push_seq_jitter(stats, seq_num, now_us);
+		stats->seq_ext_max += (ChiakiSeqNum16)(seq_num - stats->seq_max);
 		stats->seq_max = seq_num;
+		push_seq_delay(stats, now_us);
+	}
+	else
+	{
+		ChiakiSeqNum16 distance = stats->seq_max - seq_num;
+		if(distance < CHIAKI_PACKET_STATS_SEQ_WINDOW && seq_received_get(stats, seq_num))
+		{
+			chiaki_atomic_fetch_add_u64(&stats->seq_duplicates, 1);
+			return;
+		}
+		chiaki_atomic_fetch_add_u64(&stats->reorder_hist[hist_bucket(distance)], 1);
+		// A late packet in the window filled a gap that was counted as lost before,
+		// unless it is from before the first one. Older ones can't be told apart from duplicates.
+		if(distance < CHIAKI_PACKET_STATS_SEQ_WINDOW && stats->seq_recovered < stats->seq_lost)
+			chiaki_atomic_fetch_add_u64(&stats->seq_recovered, 1);
+	}
+
+	chiaki_atomic_fetch_add_u64(&stats->seq_received, 1);
+	seq_received_set(stats, seq_num, true);
+	stats->seq_last = seq_num;
+	stats->seq_last_arrival_us = now_us;
 }
 
-CHIAKI_EXPORT void chiaki_packet_stats_get(ChiakiPacketStats *stats, bool reset, uint64_t *received, uint64_t *lost)
+CHIAKI_EXPORT void chiaki_packet_stats_push_goodput(ChiakiPacketStats *stats, uint64_t bytes)
 {
-	chiaki_mutex_lock(&stats->mutex);
+	chiaki_atomic_fetch_add_u64(&stats->goodput_bytes, bytes);
+}
+
+CHIAKI_EXPORT void chiaki_packet_stats_push_fec(ChiakiPacketStats *stats, uint64_t recovered, uint64_t missed)
+{
+	if(recovered)
+		chiaki_atomic_fetch_add_u64(&stats->fec_recovered, recovered);
+	if(missed)
+		chiaki_atomic_fetch_add_u64(&stats->fec_missed, missed);
+}
+
+CHIAKI_EXPORT void chiaki_packet_stats_set_seq_interval(ChiakiPacketStats *stats, uint64_t interval_us)
+{
+	chiaki_atomic_store_u64(&stats->seq_interval_us, interval_us);
+}
 
-	// gen
-	*received = stats->gen_received;
-	*lost = stats->gen_lost;
+CHIAKI_EXPORT void chiaki_packet_stats_snapshot(ChiakiPacketStats *stats, ChiakiPacketStatsSnapshot *snapshot)
+{
+	snapshot->timestamp_us = chiaki_time_now_monotonic_us();
+	snapshot->gen_received = chiaki_atomic_load_u64(&stats->gen_received);
+	snapshot->gen_lost = chiaki_atomic_load_u64(&stats->gen_lost);
+	snapshot->seq_received = chiaki_atomic_load_u64(&stats->seq_received);
+	// recovered is always <= lost, load it first so lost can only be newer
+	uint64_t seq_recovered = chiaki_atomic_load_u64(&stats->seq_recovered);
+	snapshot->seq_lost = chiaki_atomic_load_u64(&stats->seq_lost) - seq_recovered;
+	snapshot->seq_duplicates = chiaki_atomic_load_u64(&stats->seq_duplicates);
+	for(size_t i=0; i<CHIAKI_PACKET_STATS_HIST_BUCKETS; i++)
+	{
+		snapshot->loss_burst_hist[i] = chiaki_atomic_load_u64(&stats->loss_burst_hist[i]);
+		snapshot->reorder_hist[i] = chiaki_atomic_load_u64(&stats->reorder_hist[i]);
+	}
+	snapshot->goodput_bytes = chiaki_atomic_load_u64(&stats->goodput_bytes);
+	snapshot->fec_recovered = chiaki_atomic_load_u64(&stats->fec_recovered);
+	snapshot->fec_missed = chiaki_atomic_load_u64(&stats->fec_missed);
+	snapshot->jitter_ms = (double)chiaki_atomic_load_u64(&stats->jitter_us_x16) / (16.0 * 1000.0);
+	uint64_t trend_bits = chiaki_atomic_load_u64(&stats->delay_trend_bits);
+	memcpy(&snapshot->delay_trend, &trend_bits, sizeof(snapshot->delay_trend));
+	snapshot->delay_deltas = chiaki_atomic_load_u64(&stats->delay_deltas);
+}
 
-	//CHIAKI_LOGD(NULL, "gen received: %llu, lost: %llu",
-	//		(unsigned long long)stats->gen_received,
-	//		(unsigned long long)stats->gen_lost);
+static uint64_t counter_diff(uint64_t now, uint64_t prev)
+{
+	// seq_lost can decrease when late packets arrive
+	return now > prev ? now - prev : 0;
+}
+
+CHIAKI_EXPORT void chiaki_packet_stats_snapshot_window(ChiakiPacketStats *stats, ChiakiPacketStatsSnapshot *prev, ChiakiPacketStatsSnapshot *window)
+{
+	ChiakiPacketStatsSnapshot now;
+	chiaki_packet_stats_snapshot(stats, &now);
+	window->timestamp_us = counter_diff(now.timestamp_us, prev->timestamp_us);
+	window->gen_received = counter_diff(now.gen_received, prev->gen_received);
+	window->gen_lost = counter_diff(now.gen_lost, prev->gen_lost);
+	window->seq_received = counter_diff(now.seq_received, prev->seq_received);
+	window->seq_lost = counter_diff(now.seq_lost, prev->seq_lost);
+	window->seq_duplicates = counter_diff(now.seq_duplicates, prev->seq_duplicates);
+	for(size_t i=0; i<CHIAKI_PACKET_STATS_HIST_BUCKETS; i++)
+	{
+		window->loss_burst_hist[i] = counter_diff(now.loss_burst_hist[i], prev->loss_burst_hist[i]);
+		window->reorder_hist[i] = counter_diff(now.reorder_hist[i], prev->reorder_hist[i]);
+	}
+	window->goodput_bytes = counter_diff(now.goodput_bytes, prev->goodput_bytes);
+	window->fec_recovered = counter_diff(now.fec_recovered, prev->fec_recovered);
+	window->fec_missed = counter_diff(now.fec_missed, prev->fec_missed);
+	window->jitter_ms = now.jitter_ms;
+	window->delay_trend = now.delay_trend;
+	window->delay_deltas = now.delay_deltas;
+	*prev = now;
+}
 
-	// seq
-	uint64_t seq_diff = stats->seq_max - stats->seq_min; // overflow on purpose if max < min
-	uint64_t seq_lost = stats->seq_received > seq_diff ? seq_diff : seq_diff - stats->seq_received;
-	*received += stats->seq_received;
-	*lost += seq_lost;
+CHIAKI_EXPORT uint64_t chiaki_packet_stats_snapshot_goodput_bps(const ChiakiPacketStatsSnapshot *window)
+{
+	if(!window->timestamp_us)
+		return 0;
+	return window->goodput_bytes * 8 * 1000000 / window->timestamp_us;
+}
 
-	//CHIAKI_LOGD(NULL, "seq received: %llu, lost: %llu",
-	//		(unsigned long long)stats->seq_received,
-	//		(unsigned long long)seq_lost);
+CHIAKI_EXPORT uint64_t chiaki_packet_stats_hist_max(const uint64_t hist[CHIAKI_PACKET_STATS_HIST_BUCKETS])
+{
+	for(size_t i=CHIAKI_PACKET_STATS_HIST_BUCKETS; i>0; i--)
+	{
+		if(!hist[i-1])
+			continue;
+		if(i == CHIAKI_PACKET_STATS_HIST_BUCKETS)
+			return UINT64_MAX;
+		return (uint64_t)1 << (i-1);
+	}
+	return 0;
+}
 
+CHIAKI_EXPORT void chiaki_packet_stats_get(ChiakiPacketStats *stats, bool reset, uint64_t *received, uint64_t *lost)
+{
+	chiaki_mutex_lock(&stats->mutex);
+	ChiakiPacketStatsSnapshot prev = stats->get_prev;
+	ChiakiPacketStatsSnapshot window;
+	chiaki_packet_stats_snapshot_window(stats, &prev, &window);
+	*received = chiaki_packet_stats_snapshot_received(&window);
+	*lost = chiaki_packet_stats_snapshot_lost(&window);
 	if(reset)
-		reset_stats(stats);
+		stats->get_prev = prev;
 	chiaki_mutex_unlock(&stats->mutex);
 }
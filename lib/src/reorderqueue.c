@@ -2,187 +2,230 @@
 
 #include <chiaki/reorderqueue.h>
 
+#include "bitops.h"
+
 #include <assert.h>
+#include <string.h>
 
-#define gt(a, b) (queue->seq_num_gt((a), (b)))
-#define lt(a, b) (queue->seq_num_lt((a), (b)))
-#define ge(a, b) ((a) == (b) || gt((a), (b)))
-#define le(a, b) ((a) == (b) || lt((a), (b)))
-#define add(a, b) (queue->seq_num_add((a), (b)))
 #define QUEUE_SIZE (1 << queue->size_exp)
 #define IDX_MASK ((1 << queue->size_exp) - 1)
-#define idx(seq_num) ((seq_num) & IDX_MASK)
+#define idx(seq_num) ((size_t)(seq_num) & IDX_MASK)
+#define OCCUPIED_WORDS(size_exp) ((((size_t)1 << (size_exp)) + 63) / 64)
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_init(ChiakiReorderQueue *queue, size_t size_exp,
-		uint64_t seq_num_start, ChiakiReorderQueueSeqNumGt seq_num_gt, ChiakiReorderQueueSeqNumLt seq_num_lt, ChiakiReorderQueueSeqNumAdd seq_num_add)
+static inline bool occupied_test(ChiakiReorderQueue *queue, size_t i)
 {
-	queue->size_exp = size_exp;
-	queue->begin = seq_num_start;
-	queue->count = 0;
-	queue->seq_num_gt = seq_num_gt;
-	queue->seq_num_lt = seq_num_lt;
-	queue->seq_num_add = seq_num_add;
-	queue->drop_strategy = CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END;
-	queue->drop_cb = NULL;
-	queue->drop_cb_user = NULL;
-	queue->queue = calloc(1 << size_exp, sizeof(ChiakiReorderQueueEntry));
-	if(!queue->queue)
-		return CHIAKI_ERR_MEMORY;
-	return CHIAKI_ERR_SUCCESS;
+	return (queue->occupied[i >> 6] >> (i & 63)) & 1;
 }
 
-#define REORDER_QUEUE_INIT(bits) \
-static bool seq_num_##bits##_gt(uint64_t a, uint64_t b) { return chiaki_seq_num_##bits##_gt((ChiakiSeqNum##bits)a, (ChiakiSeqNum##bits)b); } \
-static bool seq_num_##bits##_lt(uint64_t a, uint64_t b) { return chiaki_seq_num_##bits##_lt((ChiakiSeqNum##bits)a, (ChiakiSeqNum##bits)b); } \
-static uint64_t seq_num_##bits##_add(uint64_t a, uint64_t b) { return (uint64_t)((ChiakiSeqNum##bits)a + (ChiakiSeqNum##bits)b); } \
-\
-CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_init_##bits(ChiakiReorderQueue *queue, size_t size_exp, ChiakiSeqNum##bits seq_num_start) \
-{ \
-	return chiaki_reorder_queue_init(queue, size_exp, (uint64_t)seq_num_start, \
-			seq_num_##bits##_gt, seq_num_##bits##_lt, seq_num_##bits##_add); \
+static inline void occupied_set(ChiakiReorderQueue *queue, size_t i)
+{
+	queue->occupied[i >> 6] |= (uint64_t)1 << (i & 63);
 }
 
-REORDER_QUEUE_INIT(16)
-REORDER_QUEUE_INIT(32)
+static inline void occupied_clear(ChiakiReorderQueue *queue, size_t i)
+{
+	queue->occupied[i >> 6] &= ~((uint64_t)1 << (i & 63));
+}
 
-CHIAKI_EXPORT void chiaki_reorder_queue_fini(ChiakiReorderQueue *queue)
+/**
+ * @return index of the first set bit in [a, b) of the bitmap, or b if there is none
+ */
+static size_t bitmap_find(const uint64_t *bitmap, size_t a, size_t b)
 {
-	if(queue->drop_cb)
+	while(a < b)
 	{
-		for(uint64_t i=0; i<queue->count; i++)
+		uint64_t word = bitmap[a >> 6] >> (a & 63);
+		if(word)
 		{
-			uint64_t seq_num = add(queue->begin, i);
-			ChiakiReorderQueueEntry *entry = &queue->queue[idx(seq_num)];
-			if(entry->set)
-				queue->drop_cb(seq_num, entry->user, queue->drop_cb_user);
+			size_t r = a + ctz64(word);
+			return r < b ? r : b;
 		}
+		a = (a | 63) + 1;
 	}
-	free(queue->queue);
+	return b;
 }
 
-CHIAKI_EXPORT void chiaki_reorder_queue_push(ChiakiReorderQueue *queue, uint64_t seq_num, void *user)
+/**
+ * @return index after the last set bit in [a, b) of the bitmap, or a if there is none
+ */
+static size_t bitmap_find_last_end(const uint64_t *bitmap, size_t a, size_t b)
 {
-	assert(queue->count <= QUEUE_SIZE);
-	uint64_t end = add(queue->begin, queue->count);
-
-	if(ge(seq_num, queue->begin) && lt(seq_num, end))
+	while(b > a)
 	{
-		ChiakiReorderQueueEntry *entry = &queue->queue[idx(seq_num)];
-		if(entry->set) // received twice
-			goto drop_it;
-		entry->user = user;
-		entry->set = true;
-		return;
+		size_t i = b - 1;
+		uint64_t word = bitmap[i >> 6] << (63 - (i & 63));
+		if(word)
+		{
+			size_t r = i - clz64(word);
+			return r >= a ? r + 1 : a;
+		}
+		b = i & ~(size_t)63;
 	}
+	return a;
+}
 
-	if(lt(seq_num, queue->begin))
-		goto drop_it;
-
-	// => ge(seq_num, queue->end) == 1
-	assert(ge(seq_num, end));
+/**
+ * @param from index relative to begin
+ * @param to index relative to begin, from <= to <= QUEUE_SIZE
+ * @return index relative to begin of the first occupied entry in [from, to), or to if there is none
+ */
+static uint64_t occupied_find(ChiakiReorderQueue *queue, uint64_t from, uint64_t to)
+{
+	size_t start = idx(queue->begin + from);
+	size_t len = (size_t)(to - from);
+	size_t first_len = QUEUE_SIZE - start;
+	if(len <= first_len)
+		return from + (bitmap_find(queue->occupied, start, start + len) - start);
+	size_t r = bitmap_find(queue->occupied, start, QUEUE_SIZE);
+	if(r < QUEUE_SIZE)
+		return from + (r - start);
+	return from + first_len + bitmap_find(queue->occupied, 0, len - first_len);
+}
 
-	uint64_t free_elems = QUEUE_SIZE - queue->count;
-	uint64_t total_end = add(end, free_elems);
-	uint64_t new_end = add(seq_num, 1);
-	if(lt(total_end, new_end))
+/**
+ * @param to index relative to begin, to <= QUEUE_SIZE
+ * @return index relative to begin after the last occupied entry in [0, to), or 0 if there is none
+ */
+static uint64_t occupied_find_last_end(ChiakiReorderQueue *queue, uint64_t to)
+{
+	size_t start = idx(queue->begin);
+	size_t first_len = QUEUE_SIZE - start;
+	if(to > first_len)
 	{
-		if(queue->drop_strategy == CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END)
-			goto drop_it;
-
-		// drop first until empty or enough space
-		while(queue->count > 0 && lt(total_end, new_end))
-		{
-			ChiakiReorderQueueEntry *entry = &queue->queue[idx(queue->begin)];
-			if(entry->set && queue->drop_cb)
-				queue->drop_cb(queue->begin, entry->user, queue->drop_cb_user);
-			queue->begin = add(queue->begin, 1);
-			queue->count--;
-			free_elems = QUEUE_SIZE - queue->count;
-			total_end = add(end, free_elems);
-		}
-
-		// empty, just shift to the seq_num
-		if(queue->count == 0)
-			queue->begin = seq_num;
+		size_t r = bitmap_find_last_end(queue->occupied, 0, (size_t)to - first_len);
+		if(r)
+			return first_len + r;
+		to = first_len;
 	}
+	return bitmap_find_last_end(queue->occupied, start, start + (size_t)to) - start;
+}
 
-	// move end until new_end
-	end = add(queue->begin, queue->count);
-	while(lt(end, new_end))
+static ChiakiErrorCode reorder_queue_init(ChiakiReorderQueue *queue, size_t size_exp, uint64_t seq_num_start, unsigned int seq_num_bits)
+{
+	assert(size_exp <= seq_num_bits);
+	queue->size_exp = size_exp;
+	queue->begin = seq_num_start;
+	queue->count = 0;
+	queue->count_max = 0;
+	queue->size_exp_max = size_exp;
+	queue->seq_num_bits = seq_num_bits;
+	queue->drop_strategy = CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END;
+	queue->drop_cb = NULL;
+	queue->drop_cb_user = NULL;
+	queue->queue = calloc(1 << size_exp, sizeof(ChiakiReorderQueueEntry));
+	if(!queue->queue)
+		return CHIAKI_ERR_MEMORY;
+	queue->occupied = calloc(OCCUPIED_WORDS(size_exp), sizeof(uint64_t));
+	if(!queue->occupied)
 	{
-		queue->count++;
-		queue->queue[idx(end)].set = false;
-		end = add(queue->begin, queue->count);
-		assert(queue->count <= QUEUE_SIZE);
+		free(queue->queue);
+		return CHIAKI_ERR_MEMORY;
 	}
+	return CHIAKI_ERR_SUCCESS;
+}
 
-	ChiakiReorderQueueEntry *entry = &queue->queue[idx(seq_num)];
-	entry->set = true;
-	entry->user = user;
-
-	return;
-drop_it:
-	if(queue->drop_cb)
-		queue->drop_cb(seq_num, user, queue->drop_cb_user);
+CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_init_16(ChiakiReorderQueue *queue, size_t size_exp, ChiakiSeqNum16 seq_num_start)
+{
+	return reorder_queue_init(queue, size_exp, (uint64_t)seq_num_start, 16);
 }
 
-CHIAKI_EXPORT bool chiaki_reorder_queue_pull(ChiakiReorderQueue *queue, uint64_t *seq_num, void **user)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_init_32(ChiakiReorderQueue *queue, size_t size_exp, ChiakiSeqNum32 seq_num_start)
 {
-	assert(queue->count <= QUEUE_SIZE);
-	if(queue->count == 0)
-		return false;
+	return reorder_queue_init(queue, size_exp, (uint64_t)seq_num_start, 32);
+}
 
-	ChiakiReorderQueueEntry *entry = &queue->queue[idx(queue->begin)];
-	if(!entry->set)
-		return false;
+CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_init(ChiakiReorderQueue *queue, size_t size_exp,
+		uint64_t seq_num_start, ChiakiReorderQueueSeqNumGt seq_num_gt, ChiakiReorderQueueSeqNumLt seq_num_lt, ChiakiReorderQueueSeqNumAdd seq_num_add)
+{
+	(void)seq_num_gt;
+	(void)seq_num_lt;
+	if(seq_num_add(0xffff, 1) == 0)
+		return reorder_queue_init(queue, size_exp, seq_num_start & 0xffff, 16);
+	if(seq_num_add(0xffffffff, 1) == 0)
+		return reorder_queue_init(queue, size_exp, seq_num_start & 0xffffffff, 32);
+	return CHIAKI_ERR_INVALID_DATA;
+}
 
-	if(seq_num)
-		*seq_num = queue->begin;
-	if(user)
-		*user = entry->user;
-	queue->begin = add(queue->begin, 1);
-	queue->count--;
-	return true;
+CHIAKI_EXPORT void chiaki_reorder_queue_fini(ChiakiReorderQueue *queue)
+{
+	if(queue->drop_cb)
+	{
+		uint64_t seq_num_mask = ((uint64_t)1 << queue->seq_num_bits) - 1;
+		for(uint64_t index = occupied_find(queue, 0, queue->count); index < queue->count; index = occupied_find(queue, index + 1, queue->count))
+			queue->drop_cb((queue->begin + index) & seq_num_mask, queue->queue[idx(queue->begin + index)].user, queue->drop_cb_user);
+	}
+	free(queue->occupied);
+	free(queue->queue);
 }
 
-CHIAKI_EXPORT bool chiaki_reorder_queue_peek(ChiakiReorderQueue *queue, uint64_t index, uint64_t *seq_num, void **user)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_reorder_queue_resize(ChiakiReorderQueue *queue, size_t size_exp)
 {
-	if(index >= queue->count)
-		return false;
+	if(queue->count > ((uint64_t)1 << size_exp))
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	assert(size_exp <= queue->seq_num_bits);
 
-	uint64_t seq_num_val = add(queue->begin, index);
-	ChiakiReorderQueueEntry *entry = &queue->queue[idx(seq_num_val)];
-	if(!entry->set)
-		return false;
+	ChiakiReorderQueueEntry *entries = calloc(1 << size_exp, sizeof(ChiakiReorderQueueEntry));
+	if(!entries)
+		return CHIAKI_ERR_MEMORY;
+	uint64_t *occupied = calloc(OCCUPIED_WORDS(size_exp), sizeof(uint64_t));
+	if(!occupied)
+	{
+		free(entries);
+		return CHIAKI_ERR_MEMORY;
+	}
 
-	*seq_num = seq_num_val;
-	*user = entry->user;
-	return true;
+	size_t new_mask = ((size_t)1 << size_exp) - 1;
+	for(uint64_t index = occupied_find(queue, 0, queue->count); index < queue->count; index = occupied_find(queue, index + 1, queue->count))
+	{
+		size_t i = (size_t)(queue->begin + index) & new_mask;
+		entries[i] = queue->queue[idx(queue->begin + index)];
+		occupied[i >> 6] |= (uint64_t)1 << (i & 63);
+	}
+
+	free(queue->queue);
+	free(queue->occupied);
+	queue->queue = entries;
+	queue->occupied = occupied;
+	queue->size_exp = size_exp;
+	return CHIAKI_ERR_SUCCESS;
 }
 
-CHIAKI_EXPORT void chiaki_reorder_queue_drop(ChiakiReorderQueue *queue, uint64_t index)
+/**
+ * Grow the queue so that it can hold at least count elements, if allowed by size_exp_max
+ */
+static bool reorder_queue_grow(ChiakiReorderQueue *queue, uint64_t count)
 {
-	if(index >= queue->count)
-		return;
-
-	uint64_t seq_num = add(queue->begin, index);
-	ChiakiReorderQueueEntry *entry = &queue->queue[idx(seq_num)];
-	if(!entry->set)
-		return;
+	if(count > ((uint64_t)1 << queue->size_exp_max))
+		return false;
+	size_t size_exp = queue->size_exp;
+	while(((uint64_t)1 << size_exp) < count)
+		size_exp++;
+	return chiaki_reorder_queue_resize(queue, size_exp) == CHIAKI_ERR_SUCCESS;
+}
 
-	if(queue->drop_cb)
-		queue->drop_cb(seq_num, entry->user, queue->drop_cb_user);
+#define ge(a, b) ((a) == (b) || gt((a), (b)))
+#define le(a, b) ((a) == (b) || lt((a), (b)))
 
-	// reduce count if necessary
-	if(index == queue->count - 1)
-	{
-		while(!entry->set)
-		{
-			queue->count--;
-			if(queue->count == 0)
-				break;
-			seq_num = add(queue->begin, queue->count - 1);
-			entry = &queue->queue[idx(seq_num)];
-		}
-	}
-}
\ No newline at end of file
+#define REORDER_QUEUE_FN(name) chiaki_reorder_queue_##name##_16
+#define gt(a, b) chiaki_seq_num_16_gt((ChiakiSeqNum16)(a), (ChiakiSeqNum16)(b))
+#define lt(a, b) chiaki_seq_num_16_lt((ChiakiSeqNum16)(a), (ChiakiSeqNum16)(b))
+#define add(a, b) ((uint64_t)(ChiakiSeqNum16)((a) + (b)))
+#define sub(a, b) ((uint64_t)(ChiakiSeqNum16)((a) - (b)))
+#include "reorderqueue_template.h"
+#undef REORDER_QUEUE_FN
+#undef gt
+#undef lt
+#undef add
+#undef sub
+
+#define REORDER_QUEUE_FN(name) chiaki_reorder_queue_##name##_32
+#define gt(a, b) chiaki_seq_num_32_gt((ChiakiSeqNum32)(a), (ChiakiSeqNum32)(b))
+#define lt(a, b) chiaki_seq_num_32_lt((ChiakiSeqNum32)(a), (ChiakiSeqNum32)(b))
+#define add(a, b) ((uint64_t)(ChiakiSeqNum32)((a) + (b)))
+#define sub(a, b) ((uint64_t)(ChiakiSeqNum32)((a) - (b)))
+#include "reorderqueue_template.h"
+#undef REORDER_QUEUE_FN
+#undef gt
+#undef lt
+#undef add
+#undef sub
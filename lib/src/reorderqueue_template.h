@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Implementation of ChiakiReorderQueue for a single sequence number width,
+ * included by reorderqueue.c once per width with the following defined:
+ *
+ * REORDER_QUEUE_FN(name): name of the generated function, e.g. chiaki_reorder_queue_##name##_16
+ * gt(a, b), lt(a, b): sequence number comparisons
+ * add(a, b), sub(a, b): sequence number arithmetic, the result wrapped to the width
+ */
+
+CHIAKI_EXPORT void REORDER_QUEUE_FN(push)(ChiakiReorderQueue *queue, uint64_t seq_num, void *user)
+{
+	assert(queue->count <= QUEUE_SIZE);
+	uint64_t end = add(queue->begin, queue->count);
+
+	if(ge(seq_num, queue->begin) && lt(seq_num, end))
+	{
+		size_t i = idx(seq_num);
+		if(occupied_test(queue, i)) // received twice
+			goto drop_it;
+		queue->queue[i].user = user;
+		occupied_set(queue, i);
+		return;
+	}
+
+	if(lt(seq_num, queue->begin))
+		goto drop_it;
+
+	// => ge(seq_num, queue->end) == 1
+	assert(ge(seq_num, end));
+
+	uint64_t free_elems = QUEUE_SIZE - queue->count;
+	uint64_t total_end = add(end, free_elems);
+	uint64_t new_end = add(seq_num, 1);
+	if(lt(total_end, new_end) && !reorder_queue_grow(queue, sub(new_end, queue->begin)))
+	{
+		if(queue->drop_strategy == CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END)
+			goto drop_it;
+
+		// drop first until empty or enough space
+		uint64_t drop_count = sub(new_end, total_end);
+		if(drop_count > queue->count)
+			drop_count = queue->count;
+		for(uint64_t index = occupied_find(queue, 0, drop_count); index < drop_count; index = occupied_find(queue, index + 1, drop_count))
+		{
+			size_t i = idx(queue->begin + index);
+			occupied_clear(queue, i);
+			if(queue->drop_cb)
+				queue->drop_cb(add(queue->begin, index), queue->queue[i].user, queue->drop_cb_user);
+		}
+		queue->begin = add(queue->begin, drop_count);
+		queue->count -= drop_count;
+
+		// empty, just shift to the seq_num
+		if(queue->count == 0)
+			queue->begin = seq_num;
+	}
+
+	// move end until new_end, all entries in between are already unoccupied
+	queue->count = sub(new_end, queue->begin);
+	assert(queue->count <= QUEUE_SIZE);
+	if(queue->count > queue->count_max)
+		queue->count_max = queue->count;
+
+	size_t i = idx(seq_num);
+	queue->queue[i].user = user;
+	occupied_set(queue, i);
+
+	return;
+drop_it:
+	if(queue->drop_cb)
+		queue->drop_cb(seq_num, user, queue->drop_cb_user);
+}
+
+CHIAKI_EXPORT bool REORDER_QUEUE_FN(pull)(ChiakiReorderQueue *queue, uint64_t *seq_num, void **user)
+{
+	assert(queue->count <= QUEUE_SIZE);
+	if(queue->count == 0)
+		return false;
+
+	size_t i = idx(queue->begin);
+	if(!occupied_test(queue, i))
+		return false;
+
+	occupied_clear(queue, i);
+	if(seq_num)
+		*seq_num = queue->begin;
+	if(user)
+		*user = queue->queue[i].user;
+	queue->begin = add(queue->begin, 1);
+	queue->count--;
+	return true;
+}
+
+CHIAKI_EXPORT bool REORDER_QUEUE_FN(peek)(ChiakiReorderQueue *queue, uint64_t index, uint64_t *seq_num, void **user)
+{
+	if(index >= queue->count)
+		return false;
+
+	size_t i = idx(queue->begin + index);
+	if(!occupied_test(queue, i))
+		return false;
+
+	if(seq_num)
+		*seq_num = add(queue->begin, index);
+	*user = queue->queue[i].user;
+	return true;
+}
+
+CHIAKI_EXPORT void REORDER_QUEUE_FN(drop)(ChiakiReorderQueue *queue, uint64_t index)
+{
+	if(index >= queue->count)
+		return;
+
+	size_t i = idx(queue->begin + index);
+	if(!occupied_test(queue, i))
+		return;
+
+	occupied_clear(queue, i);
+	if(queue->drop_cb)
+		queue->drop_cb(add(queue->begin, index), queue->queue[i].user, queue->drop_cb_user);
+
+	// reduce count if necessary
+	if(index == queue->count - 1)
+		queue->count = occupied_find_last_end(queue, index);
+}
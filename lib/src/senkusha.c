@@ -18,7 +18,9 @@
 #include <chiaki/takion.h>
 #include <chiaki/gkcrypt.h>
 
-#ifndef _WIN32
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -31,7 +33,9 @@
 #define EXPECT_TIMEOUT_MS 5000
 
 #define SENKUSHA_PING_COUNT_DEFAULT 10
+#define SENKUSHA_PING_COUNT_CACHED 3
 #define EXPECT_PONG_TIMEOUT_MS 1000
+#define EXPECT_PONG_TIMEOUT_MIN_MS 20
 
 // Assuming IPv4, sizeof(ip header) + sizeof(udp header)
 #define MTU_UDP_PACKET_ADD 0x1c
@@ -41,6 +45,12 @@
 // Amount of bytes to add to AV data size for MTU pings to get the full size of the ip packet for MTU
 #define MTU_PING_DATA_ADD (MTU_UDP_PACKET_ADD + MTU_AV_PACKET_ADD)
 
+#define MTU_MIN 576
+#define MTU_MAX 1454
+
+// with a cached profile, on average every n-th session also searches above the cached MTUs
+#define MTU_PROBE_ABOVE_CACHED_ONE_IN 8
+
 typedef enum {
 	STATE_IDLE,
 	STATE_TAKION_CONNECT,
@@ -48,12 +58,17 @@ typedef enum {
 	STATE_EXPECT_DATA_ACK,
 	STATE_EXPECT_PONG,
 	STATE_EXPECT_MTU,
+	STATE_EXPECT_MTU_PONG,
 	STATE_EXPECT_CLIENT_MTU_COMMAND
 } SenkushaState;
 
 static ChiakiErrorCode senkusha_run_rtt_test(ChiakiSenkusha *senkusha, uint16_t ping_test_index, uint16_t ping_count, uint64_t *rtt_us);
-static ChiakiErrorCode senkusha_run_mtu_in_test(ChiakiSenkusha *senkusha, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu);
-static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint32_t mtu_in, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu);
+static ChiakiErrorCode senkusha_run_mtu_in_test(ChiakiSenkusha *senkusha, uint32_t cached, bool probe_above, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu);
+static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint32_t mtu_in, uint32_t cached, bool probe_above, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu);
+static ChiakiErrorCode senkusha_mtu_search(ChiakiSenkusha *senkusha, bool out, uint8_t *packet_buf, size_t packet_buf_size, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu);
+static ChiakiErrorCode senkusha_mtu_search_cached(ChiakiSenkusha *senkusha, bool out, uint8_t *packet_buf, size_t packet_buf_size, uint32_t cached, bool probe_above, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu, uint32_t *max);
+static void senkusha_local_addr(ChiakiSenkusha *senkusha, char *buf, size_t buf_size);
+static bool senkusha_network_profile_usable(const ChiakiNetworkProfile *cached, const char *local_addr);
 static void senkusha_takion_cb(ChiakiTakionEvent *event, void *user);
 static void senkusha_takion_data(ChiakiSenkusha *senkusha, ChiakiTakionMessageDataType data_type, uint8_t *buf, size_t buf_size);
 static void senkusha_takion_data_ack(ChiakiSenkusha *senkusha, ChiakiSeqNum32 seq_num);
@@ -85,6 +100,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_init(ChiakiSenkusha *senkusha, Chi
 	senkusha->data_ack_seq_num_expected = 0;
 	senkusha->ping_tag = 0;
 	senkusha->pong_time_us = 0;
+	senkusha->mtu_probes_count = 0;
+	senkusha->mtu_probes_received = 0;
 
 	chiaki_key_state_init(&senkusha->takion.key_state);
 
@@ -108,7 +125,7 @@ static bool state_finished_cond_check(void *user)
 	return senkusha->state_finished || senkusha->should_stop;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint32_t *mtu_in, uint32_t *mtu_out, uint64_t *rtt_us)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, const ChiakiNetworkProfile *cached, ChiakiNetworkProfile *profile)
 {
 	ChiakiSession *session = senkusha->session;
 	ChiakiErrorCode err;
@@ -144,6 +161,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint
 
 	takion_info.enable_crypt = false;
 	takion_info.protocol_version = 7;
+	takion_info.rtt_us = 0;
+	takion_info.bandwidth_bps = 0;
+	takion_info.mtu = 0;
+	takion_info.timer_service = session->timer_service;
+	memset(&takion_info.thread_sched, 0, sizeof(takion_info.thread_sched));
 
 	takion_info.cb = senkusha_takion_cb;
 	takion_info.cb_user = senkusha;
@@ -205,33 +227,55 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint
 
 	CHIAKI_LOGI(session->log, "Senkusha successfully received bang");
 
-	err = senkusha_run_rtt_test(senkusha, 0, SENKUSHA_PING_COUNT_DEFAULT, rtt_us);
+	memset(profile, 0, sizeof(*profile));
+	senkusha_local_addr(senkusha, profile->local_addr, sizeof(profile->local_addr));
+
+	// With a usable cached profile, a single probe per direction confirms the cached MTUs
+	// and only a changed network falls through to searching the whole range.
+	// Once in a while, the range above is searched too, so the MTUs can also grow again.
+	bool use_cached = senkusha_network_profile_usable(cached, profile->local_addr);
+	bool probe_above = use_cached && chiaki_random_32() % MTU_PROBE_ABOVE_CACHED_ONE_IN == 0;
+	if(use_cached)
+		CHIAKI_LOGI(session->log, "Senkusha validating cached network profile for %s: MTU in %u, out %u, RTT %.3f ms%s",
+				profile->local_addr, (unsigned int)cached->mtu_in, (unsigned int)cached->mtu_out, (float)cached->rtt_us * 0.001f,
+				probe_above ? ", probing above" : "");
+	else if(cached)
+		CHIAKI_LOGI(session->log, "Senkusha ignoring cached network profile of interface %s", cached->local_addr);
+
+	err = senkusha_run_rtt_test(senkusha, 0, use_cached ? SENKUSHA_PING_COUNT_CACHED : SENKUSHA_PING_COUNT_DEFAULT, &profile->rtt_us);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(senkusha->log, "Senkusha Ping Test failed");
 		goto disconnect;
 	}
 
-	uint64_t mtu_timeout_ms = (*rtt_us * 5) / 1000;
+	uint64_t mtu_timeout_ms = (profile->rtt_us * 5) / 1000;
 	if(mtu_timeout_ms < 5)
 		mtu_timeout_ms = 5;
 	if(mtu_timeout_ms > 500)
 		mtu_timeout_ms = 500;
 
-	err = senkusha_run_mtu_in_test(senkusha, 576, 1454, 3, mtu_timeout_ms, mtu_in);
+	err = senkusha_run_mtu_in_test(senkusha, use_cached ? cached->mtu_in : 0, probe_above, 3, mtu_timeout_ms, &profile->mtu_in);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(senkusha->log, "Senkusha MTU in test failed");
 		goto disconnect;
 	}
 
-	err = senkusha_run_mtu_out_test(senkusha, *mtu_in, 576, 1454, 3, mtu_timeout_ms, mtu_out);
+	err = senkusha_run_mtu_out_test(senkusha, profile->mtu_in, use_cached ? cached->mtu_out : 0, probe_above, 3, mtu_timeout_ms, &profile->mtu_out);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(senkusha->log, "Senkusha MTU out test failed");
 		goto disconnect;
 	}
 
+	if(use_cached && (profile->mtu_in < cached->mtu_in || profile->mtu_out < cached->mtu_out))
+		CHIAKI_LOGW(senkusha->log, "Senkusha cached network profile was outdated, MTU in %u, out %u",
+				(unsigned int)profile->mtu_in, (unsigned int)profile->mtu_out);
+	else if(use_cached && (profile->mtu_in != cached->mtu_in || profile->mtu_out != cached->mtu_out))
+		CHIAKI_LOGI(senkusha->log, "Senkusha MTU grew since the cached network profile, MTU in %u, out %u",
+				(unsigned int)profile->mtu_in, (unsigned int)profile->mtu_out);
+
 disconnect:
 	CHIAKI_LOGI(session->log, "Senkusha is disconnecting");
 
@@ -260,6 +304,7 @@ static ChiakiErrorCode senkusha_run_rtt_test(ChiakiSenkusha *senkusha, uint16_t
 
 	uint64_t rtt_us_acc = 0;
 	uint64_t pings_successful = 0;
+	uint64_t pong_timeout_ms = EXPECT_PONG_TIMEOUT_MS;
 	for(uint16_t ping_index=0; ping_index<ping_count; ping_index++)
 	{
 		CHIAKI_LOGI(senkusha->log, "Senkusha sending Ping %u of test index %u", (unsigned int)ping_index, (unsigned int)ping_test_index);
@@ -301,7 +346,7 @@ static ChiakiErrorCode senkusha_run_rtt_test(ChiakiSenkusha *senkusha, uint16_t
 			return err;
 		}
 
-		err = chiaki_cond_timedwait_pred(&senkusha->state_cond, &senkusha->state_mutex, EXPECT_PONG_TIMEOUT_MS, state_finished_cond_check, senkusha);
+		err = chiaki_cond_timedwait_pred(&senkusha->state_cond, &senkusha->state_mutex, pong_timeout_ms, state_finished_cond_check, senkusha);
 		assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
 
 		if(!senkusha->state_finished)
@@ -320,6 +365,13 @@ static ChiakiErrorCode senkusha_run_rtt_test(ChiakiSenkusha *senkusha, uint16_t
 		uint64_t delta_us = senkusha->pong_time_us - time_start_us;
 		rtt_us_acc += delta_us;
 		pings_successful += 1;
+
+		// once the rtt is roughly known, a lost pong should not stall the test for the full timeout
+		pong_timeout_ms = (rtt_us_acc / pings_successful * 5) / 1000;
+		if(pong_timeout_ms < EXPECT_PONG_TIMEOUT_MIN_MS)
+			pong_timeout_ms = EXPECT_PONG_TIMEOUT_MIN_MS;
+		if(pong_timeout_ms > EXPECT_PONG_TIMEOUT_MS)
+			pong_timeout_ms = EXPECT_PONG_TIMEOUT_MS;
 		CHIAKI_LOGI(senkusha->log, "Senkusha received Pong, RTT = %.3f ms", (float)delta_us * 0.001f);
 	}
 
@@ -344,79 +396,33 @@ static ChiakiErrorCode senkusha_run_rtt_test(ChiakiSenkusha *senkusha, uint16_t
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static ChiakiErrorCode senkusha_run_mtu_in_test(ChiakiSenkusha *senkusha, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu)
+/**
+ * @param cached MTU to confirm first, 0 to search the whole range
+ * @param probe_above whether to search above cached if it is confirmed
+ */
+static ChiakiErrorCode senkusha_run_mtu_in_test(ChiakiSenkusha *senkusha, uint32_t cached, bool probe_above, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu)
 {
-	CHIAKI_LOGI(senkusha->log, "Senkusha starting MTU in test with min %u, max %u, retries %u, timeout %llu ms",
-			(unsigned int)min, (unsigned int)max, (unsigned int)retries, (unsigned long long)timeout_ms);
-
-	uint32_t cur = max;
-	uint32_t request_id = 0;
-	while((max - min) > 1)
-	{
-		bool success = false;
-		for(uint32_t attempt=0; attempt<retries; attempt++)
-		{
-			senkusha->state = STATE_EXPECT_MTU;
-			senkusha->state_finished = false;
-			senkusha->state_failed = false;
-			senkusha->mtu_id = ++request_id;
-
-			tkproto_SenkushaMtuCommand mtu_cmd = { 0 };
-			mtu_cmd.id = request_id;
-			mtu_cmd.mtu_req = cur;
-			mtu_cmd.num = 1;
-			ChiakiErrorCode err = senkusha_send_mtu_command(senkusha, &mtu_cmd);
-			if(err != CHIAKI_ERR_SUCCESS)
-			{
-				CHIAKI_LOGE(senkusha->log, "Senkusha failed to send MTU command");
-				return err;
-			}
-
-			CHIAKI_LOGI(senkusha->log, "Senkusha MTU request %u (min %u, max %u), id %u, attempt %u",
-					(unsigned int)cur, (unsigned int)min, (unsigned int)max, (unsigned int)request_id, (unsigned int)attempt);
-
-			err = chiaki_cond_timedwait_pred(&senkusha->state_cond, &senkusha->state_mutex, timeout_ms, state_finished_cond_check, senkusha);
-			assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
-
-			if(!senkusha->state_finished)
-			{
-				if(err == CHIAKI_ERR_TIMEOUT)
-				{
-					CHIAKI_LOGI(senkusha->log, "Senkusha MTU %u timeout", (unsigned int)cur);
-					continue;
-				}
-
-				if(senkusha->should_stop)
-					return CHIAKI_ERR_CANCELED;
-				else
-					CHIAKI_LOGE(senkusha->log, "Senkusha failed to receive MTU response");
-			}
-
-			CHIAKI_LOGI(senkusha->log, "Senkusha MTU %u success", (unsigned int)cur);
-			success = true;
-			break;
-		}
-
-		if(success)
-			min = cur;
-		else
-			max = cur;
-		cur = min + (max - min) / 2;
-	}
+	CHIAKI_LOGI(senkusha->log, "Senkusha starting MTU in test with min %u, max %u, cached %u, retries %u, timeout %llu ms",
+			(unsigned int)MTU_MIN, (unsigned int)MTU_MAX, (unsigned int)cached, (unsigned int)retries, (unsigned long long)timeout_ms);
 
-	CHIAKI_LOGI(senkusha->log, "Senkusha determined inbound MTU %u", (unsigned int)min);
-	*mtu = min;
+	senkusha->mtu_id = 0;
+	uint32_t max;
+	ChiakiErrorCode err = senkusha_mtu_search_cached(senkusha, false, NULL, 0, cached, probe_above, retries, timeout_ms, mtu, &max);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
 
+	CHIAKI_LOGI(senkusha->log, "Senkusha determined inbound MTU %u", (unsigned int)*mtu);
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint32_t mtu_in, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu)
+/**
+ * @param cached MTU to confirm first, 0 to search the whole range
+ * @param probe_above whether to search above cached if it is confirmed
+ */
+static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint32_t mtu_in, uint32_t cached, bool probe_above, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu)
 {
-	if(min < 8 + MTU_PING_DATA_ADD || max < min || mtu_in < min || mtu_in > max)
-		return CHIAKI_ERR_INVALID_DATA;
-
-	CHIAKI_LOGI(senkusha->log, "Senkusha starting MTU out test with min %u, max %u, retries %u, timeout %llu ms",
-				(unsigned int)min, (unsigned int)max, (unsigned int)retries, (unsigned long long)timeout_ms);
+	CHIAKI_LOGI(senkusha->log, "Senkusha starting MTU out test with min %u, max %u, cached %u, retries %u, timeout %llu ms",
+				(unsigned int)MTU_MIN, (unsigned int)MTU_MAX, (unsigned int)cached, (unsigned int)retries, (unsigned long long)timeout_ms);
 
 	senkusha->state = STATE_EXPECT_CLIENT_MTU_COMMAND;
 	senkusha->state_finished = false;
@@ -457,7 +463,7 @@ static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint3
 		return CHIAKI_ERR_UNKNOWN;
 	}
 
-	size_t packet_buf_size = max - MTU_UDP_PACKET_ADD;
+	size_t packet_buf_size = MTU_MAX - MTU_UDP_PACKET_ADD;
 	uint8_t *packet_buf = malloc(packet_buf_size);
 	if(!packet_buf)
 		return CHIAKI_ERR_MEMORY;
@@ -466,104 +472,227 @@ static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint3
 	for(size_t i=0; i<packet_buf_size - (MTU_AV_PACKET_ADD + 8); i++)
 		packet_buf[i + (MTU_AV_PACKET_ADD + 8)] = padding[i % sizeof(padding)];
 
-	err = CHIAKI_ERR_SUCCESS;
+	uint32_t max;
+	err = senkusha_mtu_search_cached(senkusha, true, packet_buf, packet_buf_size, cached, probe_above, retries, timeout_ms, mtu, &max);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto beach;
+
+	CHIAKI_LOGI(senkusha->log, "Senkusha determined outbound MTU %u", (unsigned int)*mtu);
 
-	uint32_t cur = mtu_in;
-	while((max - min) > 1)
+	CHIAKI_LOGI(senkusha->log, "Senkusha sending final Client MTU Command");
+	client_mtu_cmd.id = 2;
+	client_mtu_cmd.state = false;
+	client_mtu_cmd.mtu_req = *mtu < max ? *mtu + 1 : max; // smallest size that failed, if any
+	client_mtu_cmd.has_mtu_down = true;
+	client_mtu_cmd.mtu_down = mtu_in;
+	err = senkusha_send_client_mtu_command(senkusha, &client_mtu_cmd, true);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGE(senkusha->log, "Senkusha failed to send client MTU command");
+
+beach:
+	free(packet_buf);
+	return err;
+}
+
+static void mtu_probe_sizes(uint32_t lo, uint32_t hi, uint32_t *sizes, size_t *count)
+{
+	// spread the probes evenly over (lo, hi), the largest one always being hi - 1
+	uint32_t n = hi - lo - 1;
+	*count = n < CHIAKI_SENKUSHA_MTU_PROBES_MAX ? n : CHIAKI_SENKUSHA_MTU_PROBES_MAX;
+	for(size_t i=0; i<*count; i++)
+		sizes[i] = lo + (uint32_t)(((uint64_t)n * (i + 1)) / *count);
+}
+
+static bool mtu_probes_cond_check(void *user)
+{
+	ChiakiSenkusha *senkusha = user;
+	// responses to smaller probes can't change the result anymore once the largest one arrived
+	return senkusha->should_stop
+		|| (senkusha->mtu_probes_received & (1u << (senkusha->mtu_probes_count - 1)));
+}
+
+static ChiakiErrorCode senkusha_send_mtu_probe(ChiakiSenkusha *senkusha, bool out, uint8_t *packet_buf, size_t packet_buf_size, size_t probe, uint32_t size)
+{
+	if(!out)
 	{
-		bool success = false;
-		for(uint32_t attempt=0; attempt<retries; attempt++)
-		{
-			uint32_t tag = chiaki_random_32();
-
-			senkusha->state = STATE_EXPECT_PONG;
-			senkusha->state_finished = false;
-			senkusha->state_failed = false;
-			senkusha->ping_tag = tag;
-			senkusha->ping_test_index = 0;
-			senkusha->ping_index = (uint16_t)attempt;
-
-			ChiakiTakionAVPacket av_packet = { 0 };
-			av_packet.codec = 0xff;
-			av_packet.is_video = false;
-			av_packet.frame_index = senkusha->ping_test_index;
-			av_packet.unit_index = senkusha->ping_index;
-			av_packet.units_in_frame_total = 0x800;
-
-			size_t header_size;
-			err = chiaki_takion_v7_av_packet_format_header(packet_buf, packet_buf_size, &header_size, &av_packet);
-			if(err != CHIAKI_ERR_SUCCESS)
-			{
-				CHIAKI_LOGE(senkusha->log, "Senkusha failed to format AV Header");
-				return err;
-			}
-			assert(header_size == MTU_AV_PACKET_ADD);
+		tkproto_SenkushaMtuCommand mtu_cmd = { 0 };
+		mtu_cmd.id = senkusha->mtu_probe_ids[probe];
+		mtu_cmd.mtu_req = size;
+		mtu_cmd.num = 1;
+		ChiakiErrorCode err = senkusha_send_mtu_command(senkusha, &mtu_cmd);
+		if(err != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGE(senkusha->log, "Senkusha failed to send MTU command");
+		return err;
+	}
 
-			*((chiaki_unaligned_uint32_t *)(packet_buf + MTU_AV_PACKET_ADD)) = 0;
-			*((chiaki_unaligned_uint32_t *)(packet_buf + MTU_AV_PACKET_ADD + 4)) = htonl(tag);
+	ChiakiTakionAVPacket av_packet = { 0 };
+	av_packet.codec = 0xff;
+	av_packet.is_video = false;
+	av_packet.frame_index = senkusha->ping_test_index;
+	av_packet.unit_index = (uint16_t)probe;
+	av_packet.units_in_frame_total = 0x800;
 
-			CHIAKI_LOGI(senkusha->log, "Senkusha MTU %u out ping attempt %u", (unsigned int)cur, (unsigned int)attempt);
+	size_t header_size;
+	ChiakiErrorCode err = chiaki_takion_v7_av_packet_format_header(packet_buf, packet_buf_size, &header_size, &av_packet);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(senkusha->log, "Senkusha failed to format AV Header");
+		return err;
+	}
+	assert(header_size == MTU_AV_PACKET_ADD);
 
-			err = chiaki_takion_send_raw(&senkusha->takion, packet_buf, cur - MTU_UDP_PACKET_ADD);
-			if(err != CHIAKI_ERR_SUCCESS)
-			{
-				CHIAKI_LOGE(senkusha->log, "Senkusha failed to send ping");
-				err = CHIAKI_ERR_TIMEOUT;
-			}
-			else
+	*((chiaki_unaligned_uint32_t *)(packet_buf + MTU_AV_PACKET_ADD)) = 0;
+	*((chiaki_unaligned_uint32_t *)(packet_buf + MTU_AV_PACKET_ADD + 4)) = htonl(senkusha->mtu_probe_ids[probe]);
+
+	err = chiaki_takion_send_raw(&senkusha->takion, packet_buf, size - MTU_UDP_PACKET_ADD);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGI(senkusha->log, "Senkusha failed to send MTU %u ping, treating it as lost", (unsigned int)size);
+	// a ping that is too big for the local interface is just a failed probe
+	return CHIAKI_ERR_SUCCESS;
+}
+
+/**
+ * Search the MTU in [min, max] with up to CHIAKI_SENKUSHA_MTU_PROBES_MAX probes of different sizes in flight at once.
+ * Each round narrows the range to between the largest size that succeeded and the next larger one,
+ * so a range of ~900 is done in about 3 rounds of one RTT each instead of 10 sequential probes.
+ * min is assumed to succeed without probing it.
+ *
+ * @param out false to request MTU packets from the server, true to send MTU pings ourselves using packet_buf
+ */
+static ChiakiErrorCode senkusha_mtu_search(ChiakiSenkusha *senkusha, bool out, uint8_t *packet_buf, size_t packet_buf_size, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu)
+{
+	uint32_t lo = min; // largest size known to succeed
+	uint32_t hi = max + 1; // smallest size known to fail
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	while(hi - lo > 1)
+	{
+		uint32_t sizes[CHIAKI_SENKUSHA_MTU_PROBES_MAX];
+		size_t count;
+		mtu_probe_sizes(lo, hi, sizes, &count);
+
+		senkusha->state = out ? STATE_EXPECT_MTU_PONG : STATE_EXPECT_MTU;
+		senkusha->ping_test_index++;
+		senkusha->mtu_probes_count = count;
+		senkusha->mtu_probes_received = 0;
+		for(size_t i=0; i<count; i++)
+			senkusha->mtu_probe_ids[i] = out ? chiaki_random_32() : ++senkusha->mtu_id;
+
+		CHIAKI_LOGI(senkusha->log, "Senkusha MTU %s probing %u sizes from %u to %u",
+				out ? "out" : "in", (unsigned int)count, (unsigned int)sizes[0], (unsigned int)sizes[count - 1]);
+
+		// retries only repeat the probes above the largest one that succeeded so far, with a growing timeout
+		uint64_t attempt_timeout_ms = timeout_ms;
+		for(uint32_t attempt=0; attempt<retries; attempt++, attempt_timeout_ms += timeout_ms)
+		{
+			for(size_t i=0; i<count; i++)
 			{
-				err = chiaki_cond_timedwait_pred(&senkusha->state_cond, &senkusha->state_mutex, timeout_ms, state_finished_cond_check, senkusha);
+				if(senkusha->mtu_probes_received >> i)
+					continue;
+				err = senkusha_send_mtu_probe(senkusha, out, packet_buf, packet_buf_size, i, sizes[i]);
+				if(err != CHIAKI_ERR_SUCCESS)
+					goto beach;
 			}
 
+			err = chiaki_cond_timedwait_pred(&senkusha->state_cond, &senkusha->state_mutex, attempt_timeout_ms, mtu_probes_cond_check, senkusha);
 			assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
+			err = CHIAKI_ERR_SUCCESS;
 
-			if(!senkusha->state_finished)
+			if(senkusha->should_stop)
 			{
-				if(err == CHIAKI_ERR_TIMEOUT)
-				{
-					CHIAKI_LOGI(senkusha->log, "Senkusha MTU pong %u timeout", (unsigned int)cur);
-					continue;
-				}
-
-				if(senkusha->should_stop)
-				{
-					err = CHIAKI_ERR_CANCELED;
-					goto beach;
-				}
-				else
-					CHIAKI_LOGE(senkusha->log, "Senkusha failed to receive MTU pong");
+				err = CHIAKI_ERR_CANCELED;
+				goto beach;
 			}
 
-			CHIAKI_LOGI(senkusha->log, "Senkusha MTU ping %u success", (unsigned int)cur);
-			success = true;
-			break;
+			if(mtu_probes_cond_check(senkusha))
+				break;
+
+			CHIAKI_LOGI(senkusha->log, "Senkusha MTU %s probes attempt %u timeout, received %#x",
+					out ? "out" : "in", (unsigned int)attempt, (unsigned int)senkusha->mtu_probes_received);
+		}
+
+		uint32_t received = senkusha->mtu_probes_received;
+		senkusha->mtu_probes_count = 0;
+		size_t best = count;
+		for(size_t i=count; i>0; i--)
+		{
+			if(received & (1u << (i - 1)))
+			{
+				best = i - 1;
+				break;
+			}
 		}
 
-		if(success)
-			min = cur;
+		if(best == count)
+			hi = sizes[0];
 		else
-			max = cur;
-		cur = min + (max - min) / 2;
+		{
+			lo = sizes[best];
+			if(best + 1 < count)
+				hi = sizes[best + 1];
+		}
 	}
 
-	CHIAKI_LOGI(senkusha->log, "Senkusha determined outbound MTU %u", (unsigned int)min);
-	*mtu = min;
-
-	CHIAKI_LOGI(senkusha->log, "Senkusha sending final Client MTU Command");
-	client_mtu_cmd.id = 2;
-	client_mtu_cmd.state = false;
-	client_mtu_cmd.mtu_req = max;
-	client_mtu_cmd.has_mtu_down = true;
-	client_mtu_cmd.mtu_down = mtu_in;
-	err = senkusha_send_client_mtu_command(senkusha, &client_mtu_cmd, true);
-	if(err != CHIAKI_ERR_SUCCESS)
-		CHIAKI_LOGE(senkusha->log, "Senkusha failed to send client MTU command");
-
+	*mtu = lo;
 beach:
-	free(packet_buf);
+	senkusha->state = STATE_IDLE;
+	senkusha->mtu_probes_count = 0;
 	return err;
 }
 
+/**
+ * Run senkusha_mtu_search(), confirming cached with a single probe first if it is in range.
+ * Only if that fails, the whole range is searched.
+ *
+ * @param max set to the max of the last search, i.e. the result is either max or max + 1 failed
+ */
+static ChiakiErrorCode senkusha_mtu_search_cached(ChiakiSenkusha *senkusha, bool out, uint8_t *packet_buf, size_t packet_buf_size, uint32_t cached, bool probe_above, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu, uint32_t *max)
+{
+	if(cached > MTU_MIN && cached <= MTU_MAX)
+	{
+		*max = cached;
+		ChiakiErrorCode err = senkusha_mtu_search(senkusha, out, packet_buf, packet_buf_size, cached - 1, cached, retries, timeout_ms, mtu);
+		if(err != CHIAKI_ERR_SUCCESS)
+			return err;
+		if(*mtu == cached)
+		{
+			if(!probe_above || cached == MTU_MAX)
+				return CHIAKI_ERR_SUCCESS;
+			*max = MTU_MAX;
+			return senkusha_mtu_search(senkusha, out, packet_buf, packet_buf_size, cached, MTU_MAX, retries, timeout_ms, mtu);
+		}
+		CHIAKI_LOGI(senkusha->log, "Senkusha cached MTU %s %u failed, searching the whole range", out ? "out" : "in", (unsigned int)cached);
+	}
+	*max = MTU_MAX;
+	return senkusha_mtu_search(senkusha, out, packet_buf, packet_buf_size, MTU_MIN, MTU_MAX, retries, timeout_ms, mtu);
+}
+
+static void senkusha_local_addr(ChiakiSenkusha *senkusha, char *buf, size_t buf_size)
+{
+	buf[0] = '\0';
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	if(getsockname(senkusha->takion.sock, (struct sockaddr *)&addr, &addr_len) < 0)
+	{
+		CHIAKI_LOGW(senkusha->log, "Senkusha failed to get local address of its socket");
+		return;
+	}
+	int r = getnameinfo((struct sockaddr *)&addr, addr_len, buf, (socklen_t)buf_size, NULL, 0, NI_NUMERICHOST);
+	if(r != 0)
+	{
+		CHIAKI_LOGW(senkusha->log, "Senkusha getnameinfo for local address failed with %s", gai_strerror(r));
+		buf[0] = '\0';
+	}
+}
+
+static bool senkusha_network_profile_usable(const ChiakiNetworkProfile *cached, const char *local_addr)
+{
+	return cached
+		&& local_addr[0]
+		&& !strcmp(cached->local_addr, local_addr)
+		&& cached->mtu_in > MTU_MIN && cached->mtu_in <= MTU_MAX
+		&& cached->mtu_out > MTU_MIN && cached->mtu_out <= MTU_MAX;
+}
+
 static void senkusha_takion_cb(ChiakiTakionEvent *event, void *user)
 {
 	ChiakiSenkusha *senkusha = user;
@@ -694,21 +823,54 @@ static void senkusha_takion_av(ChiakiSenkusha *senkusha, ChiakiTakionAVPacket *p
 		chiaki_cond_signal(&senkusha->state_cond);
 		return;
 	}
+	else if(senkusha->state == STATE_EXPECT_MTU_PONG)
+	{
+		if(packet->is_video
+			|| packet->frame_index != senkusha->ping_test_index
+			|| packet->unit_index >= senkusha->mtu_probes_count
+			|| packet->data_size < 8)
+		{
+			CHIAKI_LOGW(senkusha->log, "Senkusha received invalid MTU Pong %u/%u, size: %#llx",
+					(unsigned int)packet->frame_index, (unsigned int)packet->unit_index, (unsigned long long)packet->data_size);
+			goto beach;
+		}
+
+		uint32_t tag = ntohl(*((uint32_t *)(packet->data + 4)));
+		if(tag != senkusha->mtu_probe_ids[packet->unit_index])
+		{
+			CHIAKI_LOGW(senkusha->log, "Senkusha received MTU Pong with invalid tag");
+			goto beach;
+		}
+
+		senkusha->mtu_probes_received |= 1u << packet->unit_index;
+		chiaki_mutex_unlock(&senkusha->state_mutex);
+		chiaki_cond_signal(&senkusha->state_cond);
+		return;
+	}
 	else if(senkusha->state == STATE_EXPECT_MTU)
 	{
 		//CHIAKI_LOGD(senkusha->log, "Senkusha received av while expecting mtu");
 		//chiaki_log_hexdump(senkusha->log, CHIAKI_LOG_DEBUG, packet->data, packet->data_size);
 		//CHIAKI_LOGD(senkusha->log, "packet index: %u, frame index: %u, unit index: %u, units in frame: %u", packet->packet_index, packet->frame_index, packet->unit_index, packet->units_in_frame_total);
 
-		if(!packet->is_video
-			|| packet->frame_index != senkusha->mtu_id)
+		size_t probe = senkusha->mtu_probes_count;
+		if(packet->is_video)
+		{
+			for(probe=0; probe<senkusha->mtu_probes_count; probe++)
+			{
+				if(packet->frame_index == (ChiakiSeqNum16)senkusha->mtu_probe_ids[probe])
+					break;
+			}
+		}
+
+		if(probe == senkusha->mtu_probes_count)
 		{
 			CHIAKI_LOGW(senkusha->log, "Senkusha received invalid MTU response %u, size: %#llx, is video: %d",
 					(unsigned int)packet->frame_index, (unsigned long long)packet->data_size, packet->is_video ? 1 : 0);
 			goto beach;
 		}
 
-		senkusha->state_finished = true;
+		senkusha->mtu_probes_received |= 1u << probe;
 		chiaki_mutex_unlock(&senkusha->state_mutex);
 		chiaki_cond_signal(&senkusha->state_cond);
 		return;
@@ -4,8 +4,11 @@
 #include <chiaki/senkusha.h>
 #include <chiaki/session.h>
 #include <chiaki/http.h>
+#include <chiaki/trace.h>
 #include <chiaki/base64.h>
 #include <chiaki/random.h>
+#include <chiaki/time.h>
+#include <chiaki/atomic.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -164,6 +167,29 @@ CHIAKI_EXPORT const char *chiaki_quit_reason_string(ChiakiQuitReason reason)
 	}
 }
 
+CHIAKI_EXPORT const char *chiaki_session_startup_phase_string(ChiakiSessionStartupPhase phase)
+{
+	switch(phase)
+	{
+		case CHIAKI_SESSION_STARTUP_PHASE_SESSION_REQUEST:
+			return "session request";
+		case CHIAKI_SESSION_STARTUP_PHASE_CTRL:
+			return "ctrl";
+		case CHIAKI_SESSION_STARTUP_PHASE_LOGIN_PIN:
+			return "login pin";
+		case CHIAKI_SESSION_STARTUP_PHASE_SENKUSHA:
+			return "senkusha";
+		case CHIAKI_SESSION_STARTUP_PHASE_CRYPTO:
+			return "crypto";
+		case CHIAKI_SESSION_STARTUP_PHASE_STREAM_CONNECTION:
+			return "stream connection";
+		case CHIAKI_SESSION_STARTUP_PHASE_FIRST_FRAME:
+			return "first frame";
+		default:
+			return "unknown";
+	}
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, ChiakiConnectInfo *connect_info, ChiakiLog *log)
 {
 	memset(session, 0, sizeof(ChiakiSession));
@@ -184,6 +210,27 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_state_mutex;
 
+	session->timer_service = chiaki_timer_service_shared_ref();
+	if(!session->timer_service)
+	{
+		CHIAKI_LOGE(session->log, "Failed to start Timer Service");
+		err = CHIAKI_ERR_UNKNOWN;
+		goto error_stop_pipe;
+	}
+
+	session->executor = chiaki_executor_shared_ref();
+	if(!session->executor)
+	{
+		CHIAKI_LOGE(session->log, "Failed to start Executor");
+		err = CHIAKI_ERR_UNKNOWN;
+		goto error_timer_service;
+	}
+
+	err = chiaki_av_sync_init(&session->av_sync);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_executor;
+
+	session->audio_jitter_delay_us = 0;
 	session->should_stop = false;
 	session->ctrl_session_id_received = false;
 	session->ctrl_login_pin_requested = false;
@@ -195,7 +242,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(session->log, "Ctrl init failed");
-		goto error_stop_pipe;
+		goto error_av_sync;
 	}
 
 	err = chiaki_stream_connection_init(&session->stream_connection, session);
@@ -213,6 +260,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	}
 
 	chiaki_controller_state_set_idle(&session->controller_state);
+	chiaki_orientation_tracker_init(&session->motion_tracker);
+	session->motion_active = false;
 
 	session->connect_info.ps5 = connect_info->ps5;
 	memcpy(session->connect_info.regist_key, connect_info->regist_key, sizeof(session->connect_info.regist_key));
@@ -228,12 +277,25 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->connect_info.video_profile_auto_downgrade = connect_info->video_profile_auto_downgrade;
 	session->connect_info.enable_keyboard = connect_info->enable_keyboard;
 	session->connect_info.enable_dualsense = connect_info->enable_dualsense;
+	session->connect_info.takion_thread_sched = connect_info->takion_thread_sched;
+	session->connect_info.network_profile_valid = connect_info->network_profile_valid;
+	if(connect_info->network_profile_valid)
+	{
+		session->connect_info.network_profile = connect_info->network_profile;
+		session->connect_info.network_profile.local_addr[sizeof(session->connect_info.network_profile.local_addr) - 1] = '\0';
+	}
 
 	return CHIAKI_ERR_SUCCESS;
-error_stop_pipe:
-	chiaki_stop_pipe_fini(&session->stop_pipe);
 error_ctrl:
 	chiaki_ctrl_fini(&session->ctrl);
+error_av_sync:
+	chiaki_av_sync_fini(&session->av_sync);
+error_executor:
+	chiaki_executor_shared_unref(session->executor);
+error_timer_service:
+	chiaki_timer_service_shared_unref(session->timer_service);
+error_stop_pipe:
+	chiaki_stop_pipe_fini(&session->stop_pipe);
 error_state_mutex:
 	chiaki_mutex_fini(&session->state_mutex);
 error_state_cond:
@@ -250,6 +312,9 @@ CHIAKI_EXPORT void chiaki_session_fini(ChiakiSession *session)
 	free(session->quit_reason_str);
 	chiaki_stream_connection_fini(&session->stream_connection);
 	chiaki_ctrl_fini(&session->ctrl);
+	chiaki_av_sync_fini(&session->av_sync);
+	chiaki_executor_shared_unref(session->executor);
+	chiaki_timer_service_shared_unref(session->timer_service);
 	chiaki_stop_pipe_fini(&session->stop_pipe);
 	chiaki_cond_fini(&session->state_cond);
 	chiaki_mutex_fini(&session->state_mutex);
@@ -258,6 +323,8 @@ CHIAKI_EXPORT void chiaki_session_fini(ChiakiSession *session)
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_start(ChiakiSession *session)
 {
+	memset(&session->startup_timings, 0, sizeof(session->startup_timings));
+	session->startup_mark_ns = chiaki_time_now_ns();
 	ChiakiErrorCode err = chiaki_thread_create(&session->session_thread, session_thread_func, session);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
@@ -287,12 +354,75 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_join(ChiakiSession *session)
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_controller_state(ChiakiSession *session, ChiakiControllerState *state)
 {
+	uint64_t change_us = chiaki_time_now_monotonic_us();
 	ChiakiErrorCode err = chiaki_mutex_lock(&session->stream_connection.feedback_sender_mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 	session->controller_state = *state;
+	if(session->motion_active)
+		chiaki_orientation_tracker_apply_to_controller_state(&session->motion_tracker, &session->controller_state);
+	if(session->stream_connection.feedback_sender_active)
+		chiaki_feedback_sender_set_controller_state(&session->stream_connection.feedback_sender, &session->controller_state, change_us);
+	chiaki_mutex_unlock(&session->stream_connection.feedback_sender_mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_set_feedback_immediate(ChiakiSession *session, bool immediate)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&session->stream_connection.feedback_sender_mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	session->feedback_immediate = immediate;
+	if(session->stream_connection.feedback_sender_active)
+		chiaki_feedback_sender_set_immediate(&session->stream_connection.feedback_sender, immediate);
+	chiaki_mutex_unlock(&session->stream_connection.feedback_sender_mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_get_feedback_stats(ChiakiSession *session, ChiakiFeedbackSenderStats *stats)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&session->stream_connection.feedback_sender_mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	if(session->stream_connection.feedback_sender_active)
+		chiaki_feedback_sender_stats(&session->stream_connection.feedback_sender, stats);
+	else
+		err = CHIAKI_ERR_UNINITIALIZED;
+	chiaki_mutex_unlock(&session->stream_connection.feedback_sender_mutex);
+	return err;
+}
+
+CHIAKI_EXPORT uint64_t chiaki_session_get_audio_jitter_delay_us(ChiakiSession *session)
+{
+	return chiaki_atomic_load_u64(&session->audio_jitter_delay_us);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_push_motion(ChiakiSession *session, const ChiakiMotionSample *samples, size_t samples_count)
+{
+	if(!samples_count)
+		return CHIAKI_ERR_SUCCESS;
+	ChiakiErrorCode err = chiaki_mutex_lock(&session->stream_connection.feedback_sender_mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	chiaki_orientation_tracker_update_batch(&session->motion_tracker, samples, samples_count);
+	session->motion_active = true;
+	chiaki_orientation_tracker_apply_to_controller_state(&session->motion_tracker, &session->controller_state);
+	if(session->stream_connection.feedback_sender_active)
+		chiaki_feedback_sender_set_motion(&session->stream_connection.feedback_sender, &session->controller_state);
+	chiaki_mutex_unlock(&session->stream_connection.feedback_sender_mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_session_reset_motion(ChiakiSession *session)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&session->stream_connection.feedback_sender_mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	chiaki_orientation_tracker_init(&session->motion_tracker);
+	session->motion_active = false;
+	chiaki_orientation_tracker_apply_to_controller_state(&session->motion_tracker, &session->controller_state);
 	if(session->stream_connection.feedback_sender_active)
-		chiaki_feedback_sender_set_controller_state(&session->stream_connection.feedback_sender, &session->controller_state);
+		chiaki_feedback_sender_set_motion(&session->stream_connection.feedback_sender, &session->controller_state);
 	chiaki_mutex_unlock(&session->stream_connection.feedback_sender_mutex);
 	return CHIAKI_ERR_SUCCESS;
 }
@@ -322,6 +452,70 @@ void chiaki_session_send_event(ChiakiSession *session, ChiakiEvent *event)
 	session->event_cb(event, session->event_cb_user);
 }
 
+/**
+ * Phases follow each other, so each one is accounted the time since the previous one ended.
+ * Must be called from the thread that is currently driving the startup,
+ * which is the session thread until the stream connection hands over to the takion thread.
+ * No-op after the first frame has been reported.
+ */
+void chiaki_session_startup_phase_done(ChiakiSession *session, ChiakiSessionStartupPhase phase)
+{
+	if(!session->startup_mark_ns)
+		return;
+	uint64_t now_ns = chiaki_time_now_ns();
+	session->startup_timings.phase_us[phase] += (now_ns - session->startup_mark_ns) / 1000;
+	session->startup_mark_ns = now_ns;
+	if(phase != CHIAKI_SESSION_STARTUP_PHASE_FIRST_FRAME)
+		return;
+
+	session->startup_mark_ns = 0;
+	session->startup_timings.total_us = 0;
+	for(size_t i=0; i<CHIAKI_SESSION_STARTUP_PHASES_COUNT; i++)
+	{
+		CHIAKI_LOGV(session->log, "Startup phase %s took %llu ms",
+				chiaki_session_startup_phase_string(i),
+				(unsigned long long)session->startup_timings.phase_us[i] / 1000);
+		session->startup_timings.total_us += session->startup_timings.phase_us[i];
+	}
+	CHIAKI_LOGI(session->log, "First frame received %llu ms after session start",
+			(unsigned long long)session->startup_timings.total_us / 1000);
+
+	ChiakiEvent event = { 0 };
+	event.type = CHIAKI_EVENT_STARTUP_TIMINGS;
+	event.startup_timings = session->startup_timings;
+	chiaki_session_send_event(session, &event);
+}
+
+/**
+ * Key generation does not depend on anything from the console, so it runs on the executor
+ * while the session thread is waiting for the session request, ctrl and senkusha.
+ */
+static void session_crypto_prepare_task(void *user)
+{
+	ChiakiSession *session = user;
+	ChiakiErrorCode err = chiaki_random_bytes_crypt(session->handshake_key, sizeof(session->handshake_key));
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGE(session->log, "Session failed to generate handshake key");
+	else
+	{
+		err = chiaki_ecdh_init(&session->ecdh);
+		if(err != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGE(session->log, "Session failed to initialize ECDH");
+	}
+
+	chiaki_mutex_lock(&session->state_mutex);
+	session->crypto_prepare_err = err;
+	session->crypto_prepared = true;
+	chiaki_cond_signal(&session->state_cond);
+	chiaki_mutex_unlock(&session->state_mutex);
+}
+
+static bool session_check_crypto_prepared_pred(void *user)
+{
+	ChiakiSession *session = user;
+	return session->crypto_prepared;
+}
+
 
 static bool session_check_state_pred(void *user)
 {
@@ -349,9 +543,19 @@ static bool session_check_state_pred_pin(void *user)
 
 #define ENABLE_SENKUSHA
 
+static void session_log_flush_timer_cb(void *user)
+{
+	ChiakiSession *session = user;
+	chiaki_log_rate_limit_flush(session->log, false);
+}
+
 static void *session_thread_func(void *arg)
 {
 	ChiakiSession *session = arg;
+	CHIAKI_TRACE_THREAD_NAME("Chiaki Session");
+
+	chiaki_timer_init(&session->log_flush_timer, session->timer_service, session_log_flush_timer_cb, session);
+	chiaki_timer_start(&session->log_flush_timer, CHIAKI_LOG_RATE_LIMIT_INTERVAL_MS, CHIAKI_LOG_RATE_LIMIT_INTERVAL_MS);
 
 	chiaki_mutex_lock(&session->state_mutex);
 
@@ -368,6 +572,14 @@ static void *session_thread_func(void *arg)
 
 	CHECK_STOP(quit);
 
+	session->crypto_prepared = false;
+	if(chiaki_executor_submit(session->executor, session_crypto_prepare_task, session) != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_mutex_unlock(&session->state_mutex);
+		session_crypto_prepare_task(session);
+		chiaki_mutex_lock(&session->state_mutex);
+	}
+
 	CHIAKI_LOGI(session->log, "Starting session request for %s", session->connect_info.ps5 ? "PS5" : "PS4");
 
 	ChiakiTarget server_target = CHIAKI_TARGET_PS4_UNKNOWN;
@@ -380,7 +592,7 @@ static void *session_thread_func(void *arg)
 		err = session_thread_request_session(session, &server_target);
 	}
 	else if(err != CHIAKI_ERR_SUCCESS)
-		QUIT(quit);
+		QUIT(quit_crypto);
 
 	if(err == CHIAKI_ERR_VERSION_MISMATCH && !chiaki_target_is_unknown(server_target))
 	{
@@ -389,12 +601,13 @@ static void *session_thread_func(void *arg)
 		err = session_thread_request_session(session, NULL);
 	}
 	else if(err != CHIAKI_ERR_SUCCESS)
-		QUIT(quit);
+		QUIT(quit_crypto);
 
 	if(err != CHIAKI_ERR_SUCCESS)
-		QUIT(quit);
+		QUIT(quit_crypto);
 
 	CHIAKI_LOGI(session->log, "Session request successful");
+	chiaki_session_startup_phase_done(session, CHIAKI_SESSION_STARTUP_PHASE_SESSION_REQUEST);
 
 	chiaki_rpcrypt_init_auth(&session->rpcrypt, session->target, session->nonce, session->connect_info.morning);
 
@@ -405,7 +618,7 @@ static void *session_thread_func(void *arg)
 
 	err = chiaki_ctrl_start(&session->ctrl);
 	if(err != CHIAKI_ERR_SUCCESS)
-		QUIT(quit);
+		QUIT(quit_crypto);
 
 	chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, SESSION_EXPECT_TIMEOUT_MS, session_check_state_pred_ctrl_start, session);
 	CHECK_STOP(quit_ctrl);
@@ -424,6 +637,7 @@ static void *session_thread_func(void *arg)
 			CHIAKI_LOGI(session->log, "Login PIN was incorrect, requested again by Ctrl");
 		else
 			CHIAKI_LOGI(session->log, "Ctrl requested Login PIN");
+		chiaki_session_startup_phase_done(session, CHIAKI_SESSION_STARTUP_PHASE_CTRL);
 		ChiakiEvent event = { 0 };
 		event.type = CHIAKI_EVENT_LOGIN_PIN_REQUEST;
 		event.login_pin_request.pin_incorrect = pin_incorrect;
@@ -439,6 +653,7 @@ static void *session_thread_func(void *arg)
 		}
 
 		assert(session->login_pin_entered && session->login_pin);
+		chiaki_session_startup_phase_done(session, CHIAKI_SESSION_STARTUP_PHASE_LOGIN_PIN);
 		CHIAKI_LOGI(session->log, "Session received entered Login PIN, forwarding to Ctrl");
 		chiaki_ctrl_set_login_pin(&session->ctrl, session->login_pin, session->login_pin_size);
 		session->login_pin_entered = false;
@@ -461,6 +676,8 @@ ctrl_failed:
 		QUIT(quit_ctrl);
 	}
 
+	chiaki_session_startup_phase_done(session, CHIAKI_SESSION_STARTUP_PHASE_CTRL);
+
 #ifdef ENABLE_SENKUSHA
 	CHIAKI_LOGI(session->log, "Starting Senkusha");
 
@@ -469,11 +686,24 @@ ctrl_failed:
 	if(err != CHIAKI_ERR_SUCCESS)
 		QUIT(quit_ctrl);
 
-	err = chiaki_senkusha_run(&senkusha, &session->mtu_in, &session->mtu_out, &session->rtt_us);
+	ChiakiNetworkProfile network_profile;
+	err = chiaki_senkusha_run(&senkusha,
+			session->connect_info.network_profile_valid ? &session->connect_info.network_profile : NULL,
+			&network_profile);
 	chiaki_senkusha_fini(&senkusha);
 
 	if(err == CHIAKI_ERR_SUCCESS)
+	{
 		CHIAKI_LOGI(session->log, "Senkusha completed successfully");
+		session->mtu_in = network_profile.mtu_in;
+		session->mtu_out = network_profile.mtu_out;
+		session->rtt_us = network_profile.rtt_us;
+
+		ChiakiEvent event = { 0 };
+		event.type = CHIAKI_EVENT_NETWORK_PROFILE;
+		event.network_profile = network_profile;
+		chiaki_session_send_event(session, &event);
+	}
 	else if(err == CHIAKI_ERR_CANCELED)
 		QUIT(quit_ctrl);
 	else
@@ -483,21 +713,13 @@ ctrl_failed:
 		session->mtu_out = 1454;
 		session->rtt_us = 1000;
 	}
+	chiaki_session_startup_phase_done(session, CHIAKI_SESSION_STARTUP_PHASE_SENKUSHA);
 #endif
 
-	err = chiaki_random_bytes_crypt(session->handshake_key, sizeof(session->handshake_key));
-	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		CHIAKI_LOGE(session->log, "Session failed to generate handshake key");
+	chiaki_cond_wait_pred(&session->state_cond, &session->state_mutex, session_check_crypto_prepared_pred, session);
+	chiaki_session_startup_phase_done(session, CHIAKI_SESSION_STARTUP_PHASE_CRYPTO);
+	if(session->crypto_prepare_err != CHIAKI_ERR_SUCCESS)
 		QUIT(quit_ctrl);
-	}
-
-	err = chiaki_ecdh_init(&session->ecdh);
-	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		CHIAKI_LOGE(session->log, "Session failed to initialize ECDH");
-		QUIT(quit_ctrl);
-	}
 
 	chiaki_mutex_unlock(&session->state_mutex);
 	err = chiaki_stream_connection_run(&session->stream_connection);
@@ -520,15 +742,23 @@ ctrl_failed:
 	}
 
 	chiaki_mutex_unlock(&session->state_mutex);
-	chiaki_ecdh_fini(&session->ecdh);
 
 quit_ctrl:
 	chiaki_ctrl_stop(&session->ctrl);
 	chiaki_ctrl_join(&session->ctrl);
 	CHIAKI_LOGI(session->log, "Ctrl stopped");
 
+quit_crypto:
+	chiaki_mutex_lock(&session->state_mutex);
+	chiaki_cond_wait_pred(&session->state_cond, &session->state_mutex, session_check_crypto_prepared_pred, session);
+	chiaki_mutex_unlock(&session->state_mutex);
+	if(session->crypto_prepare_err == CHIAKI_ERR_SUCCESS)
+		chiaki_ecdh_fini(&session->ecdh);
+
 	ChiakiEvent quit_event;
 quit:
+	chiaki_timer_cancel(&session->log_flush_timer);
+	chiaki_log_rate_limit_flush(session->log, true);
 
 	CHIAKI_LOGI(session->log, "Session has quit");
 	quit_event.type = CHIAKI_EVENT_QUIT;
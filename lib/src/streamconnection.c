@@ -8,6 +8,8 @@
 #include <chiaki/base64.h>
 #include <chiaki/audio.h>
 #include <chiaki/video.h>
+#include <chiaki/trace.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 #include <assert.h>
@@ -33,6 +35,9 @@
 
 #define HEARTBEAT_INTERVAL_MS 1000
 
+// relative rtt change from the last reported value to report a new one
+#define NETWORK_STATS_RTT_CHANGE_PERCENT 25
+
 
 typedef enum {
 	STATE_IDLE,
@@ -41,8 +46,6 @@ typedef enum {
 	STATE_EXPECT_STREAMINFO
 } StreamConnectionState;
 
-void chiaki_session_send_event(ChiakiSession *session, ChiakiEvent *event);
-
 static void stream_connection_takion_cb(ChiakiTakionEvent *event, void *user);
 static void stream_connection_takion_data(ChiakiStreamConnection *stream_connection, ChiakiTakionMessageDataType data_type, uint8_t *buf, size_t buf_size);
 static void stream_connection_takion_data_protobuf(ChiakiStreamConnection *stream_connection, uint8_t *buf, size_t buf_size);
@@ -57,6 +60,7 @@ static void stream_connection_takion_data_expect_streaminfo(ChiakiStreamConnecti
 static ChiakiErrorCode stream_connection_send_streaminfo_ack(ChiakiStreamConnection *stream_connection);
 static void stream_connection_takion_av(ChiakiStreamConnection *stream_connection, ChiakiTakionAVPacket *packet);
 static ChiakiErrorCode stream_connection_send_heartbeat(ChiakiStreamConnection *stream_connection);
+static void stream_connection_heartbeat_timer_cb(void *user);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnection *stream_connection, ChiakiSession *session)
 {
@@ -148,6 +152,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 	takion_info.enable_crypt = true;
 	takion_info.enable_dualsense = session->connect_info.enable_dualsense;
 	takion_info.protocol_version = chiaki_target_is_ps5(session->target) ? 12 : 9;
+	takion_info.rtt_us = session->rtt_us;
+	takion_info.bandwidth_bps = (uint64_t)session->connect_info.video_profile.bitrate * 1000;
+	takion_info.mtu = session->mtu_in;
+	takion_info.timer_service = session->timer_service;
+	takion_info.thread_sched = session->connect_info.takion_thread_sched;
 
 	takion_info.cb = stream_connection_takion_cb;
 	takion_info.cb_user = stream_connection;
@@ -270,7 +279,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		goto disconnect;
 	}
 	stream_connection->feedback_sender_active = true;
-	chiaki_feedback_sender_set_controller_state(&stream_connection->feedback_sender, &session->controller_state);
+	chiaki_feedback_sender_set_immediate(&stream_connection->feedback_sender, session->feedback_immediate);
+	chiaki_feedback_sender_set_controller_state(&stream_connection->feedback_sender, &session->controller_state, chiaki_time_now_monotonic_us());
 	chiaki_mutex_unlock(&stream_connection->feedback_sender_mutex);
 
 	stream_connection->state = STATE_IDLE;
@@ -284,18 +294,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 	err = chiaki_mutex_lock(&stream_connection->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
 
-	while(true)
-	{
-		err = chiaki_cond_timedwait_pred(&stream_connection->state_cond, &stream_connection->state_mutex, HEARTBEAT_INTERVAL_MS, state_finished_cond_check, stream_connection);
-		if(err != CHIAKI_ERR_TIMEOUT)
-			break;
+	memset(&stream_connection->network_stats_reported, 0, sizeof(stream_connection->network_stats_reported));
+	chiaki_timer_init(&stream_connection->heartbeat_timer, session->timer_service, stream_connection_heartbeat_timer_cb, stream_connection);
+	chiaki_timer_start(&stream_connection->heartbeat_timer, HEARTBEAT_INTERVAL_MS, HEARTBEAT_INTERVAL_MS);
 
-		err = stream_connection_send_heartbeat(stream_connection);
-		if(err != CHIAKI_ERR_SUCCESS)
-			CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to send heartbeat");
-		else
-			CHIAKI_LOGV(stream_connection->log, "StreamConnection sent heartbeat");
-	}
+	err = chiaki_cond_wait_pred(&stream_connection->state_cond, &stream_connection->state_mutex, state_finished_cond_check, stream_connection);
+	assert(err == CHIAKI_ERR_SUCCESS);
+
+	chiaki_timer_cancel(&stream_connection->heartbeat_timer);
 
 	err = chiaki_mutex_lock(&stream_connection->feedback_sender_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
@@ -508,13 +514,13 @@ static ChiakiErrorCode stream_connection_init_crypt(ChiakiStreamConnection *stre
 {
 	ChiakiSession *session = stream_connection->session;
 
-	stream_connection->gkcrypt_local = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 2, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_local = chiaki_gkcrypt_new(stream_connection->log, session->executor, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 2, session->handshake_key, stream_connection->ecdh_secret);
 	if(!stream_connection->gkcrypt_local)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize local GKCrypt with index 2");
 		return CHIAKI_ERR_UNKNOWN;
 	}
-	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 3, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new(stream_connection->log, session->executor, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 3, session->handshake_key, stream_connection->ecdh_secret);
 	if(!stream_connection->gkcrypt_remote)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize remote GKCrypt with index 3");
@@ -739,6 +745,8 @@ static void stream_connection_takion_data_expect_streaminfo(ChiakiStreamConnecti
 	// TODO: do some checks?
 
 	stream_connection_send_streaminfo_ack(stream_connection);
+	// marked here on the takion thread, which also reports the first frame right after
+	chiaki_session_startup_phase_done(stream_connection->session, CHIAKI_SESSION_STARTUP_PHASE_STREAM_CONNECTION);
 
 	// stream_connection->state_mutex is expected to be locked by the caller of this function
 	stream_connection->state_finished = true;
@@ -938,7 +946,9 @@ static ChiakiErrorCode stream_connection_send_disconnect(ChiakiStreamConnection
 
 static void stream_connection_takion_av(ChiakiStreamConnection *stream_connection, ChiakiTakionAVPacket *packet)
 {
+	CHIAKI_TRACE_BEGIN("av_decrypt");
 	chiaki_gkcrypt_decrypt(stream_connection->gkcrypt_remote, packet->key_pos + CHIAKI_GKCRYPT_BLOCK_SIZE, packet->data, packet->data_size);
+	CHIAKI_TRACE_END("av_decrypt");
 
 	if(packet->is_video)
 		chiaki_video_receiver_av_packet(stream_connection->video_receiver, packet);
@@ -966,6 +976,46 @@ static ChiakiErrorCode stream_connection_send_heartbeat(ChiakiStreamConnection *
 	return chiaki_takion_send_message_data(&stream_connection->takion, 1, 1, buf, stream.bytes_written, NULL);
 }
 
+/**
+ * Report the rtt and path mtu measured during the stream when they changed noticeably,
+ * the heartbeats sent alongside guarantee at least one rtt sample per interval.
+ */
+static void stream_connection_check_network_stats(ChiakiStreamConnection *stream_connection)
+{
+	ChiakiTakionNetworkStats stats;
+	chiaki_takion_get_network_stats(&stream_connection->takion, &stats);
+	if(!stats.rtt_us)
+		return;
+
+	ChiakiTakionNetworkStats *prev = &stream_connection->network_stats_reported;
+	uint64_t rtt_delta_us = stats.rtt_us > prev->rtt_us ? stats.rtt_us - prev->rtt_us : prev->rtt_us - stats.rtt_us;
+	if(prev->rtt_us
+		&& rtt_delta_us * 100 < prev->rtt_us * NETWORK_STATS_RTT_CHANGE_PERCENT
+		&& stats.path_mtu == prev->path_mtu)
+		return;
+
+	CHIAKI_LOGI(stream_connection->log, "StreamConnection network changed, rtt: %.3f ms (var %.3f ms), path mtu: %u",
+			(float)stats.rtt_us * 0.001f, (float)stats.rtt_var_us * 0.001f, (unsigned int)stats.path_mtu);
+	*prev = stats;
+
+	ChiakiEvent event = { 0 };
+	event.type = CHIAKI_EVENT_NETWORK_STATS;
+	event.network_stats = stats;
+	chiaki_session_send_event(stream_connection->session, &event);
+}
+
+static void stream_connection_heartbeat_timer_cb(void *user)
+{
+	ChiakiStreamConnection *stream_connection = user;
+	ChiakiErrorCode err = stream_connection_send_heartbeat(stream_connection);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to send heartbeat");
+	else
+		CHIAKI_LOGV(stream_connection->log, "StreamConnection sent heartbeat");
+
+	stream_connection_check_network_stats(stream_connection);
+}
+
 CHIAKI_EXPORT ChiakiErrorCode stream_connection_send_corrupt_frame(ChiakiStreamConnection *stream_connection, ChiakiSeqNum16 start, ChiakiSeqNum16 end)
 {
 	tkproto_TakionMessage msg = { 0 };
@@ -5,6 +5,8 @@
 #include <chiaki/congestioncontrol.h>
 #include <chiaki/random.h>
 #include <chiaki/gkcrypt.h>
+#include <chiaki/trace.h>
+#include <chiaki/time.h>
 
 #include <fcntl.h>
 #include <stdbool.h>
@@ -34,7 +36,13 @@
 #define TAKION_OUTBOUND_STREAMS 0x64
 #define TAKION_INBOUND_STREAMS 0x64
 
-#define TAKION_REORDER_QUEUE_SIZE_EXP 4 // => 16 entries
+#define TAKION_REORDER_QUEUE_SIZE_EXP 4 // => 16 entries, initial and minimum size
+#define TAKION_REORDER_QUEUE_SIZE_EXP_MAX 11 // => 2048 entries, upper bound regardless of the bandwidth-delay product
+#define TAKION_REORDER_QUEUE_SHRINK_IDLE_MS 5000
+#define TAKION_REORDER_QUEUE_SHRINK_CHECK_MS 1000 // while grown, also checked this often when no packets arrive
+
+// time the remote takes to resend a lost data packet on top of the rtt, assumed to be the same as ours
+#define TAKION_REMOTE_RESEND_TIMEOUT_MS 200
 #define TAKION_SEND_BUFFER_SIZE 16
 
 #define TAKION_POSTPONE_PACKETS_SIZE 32
@@ -171,6 +179,23 @@ static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *b
 static ChiakiErrorCode takion_recv_message_init_ack(ChiakiTakion *takion, TakionMessagePayloadInitAck *payload);
 static ChiakiErrorCode takion_recv_message_cookie_ack(ChiakiTakion *takion);
 static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size);
+static void takion_shrink_data_queue(ChiakiTakion *takion);
+
+/**
+ * The data queue must hold everything that arrives after a lost packet until it has been resent,
+ * which is bounded by the bandwidth-delay product over the rtt plus the resend timeout.
+ */
+static size_t takion_data_queue_size_exp_max(uint64_t rtt_us, uint64_t bandwidth_bps, uint32_t mtu)
+{
+	if(!rtt_us || !bandwidth_bps || !mtu)
+		return TAKION_REORDER_QUEUE_SIZE_EXP;
+	uint64_t window_us = rtt_us + TAKION_REMOTE_RESEND_TIMEOUT_MS * 1000;
+	uint64_t bdp_packets = (bandwidth_bps / 8) * window_us / 1000000 / mtu;
+	size_t size_exp = TAKION_REORDER_QUEUE_SIZE_EXP;
+	while(size_exp < TAKION_REORDER_QUEUE_SIZE_EXP_MAX && ((uint64_t)1 << size_exp) < bdp_packets)
+		size_exp++;
+	return size_exp;
+}
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, ChiakiTakionConnectInfo *info)
 {
@@ -178,6 +203,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 
 	takion->log = info->log;
 	takion->version = info->protocol_version;
+	takion->timer_service = info->timer_service;
+	takion->thread_sched = info->thread_sched;
 
 	switch(takion->version)
 	{
@@ -217,6 +244,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 	takion->postponed_packets_size = 0;
 	takion->postponed_packets_count = 0;
 	takion->enable_dualsense = info->enable_dualsense;
+	takion->rtt_us_initial = info->rtt_us;
+	takion->bandwidth_bps = info->bandwidth_bps;
+	takion->mtu = info->mtu;
+	takion->data_queue_size_exp_max = takion_data_queue_size_exp_max(info->rtt_us, info->bandwidth_bps, info->mtu);
+	takion->data_queue_busy_ms = 0;
 
 	CHIAKI_LOGI(takion->log, "Takion connecting (version %u)", (unsigned int)info->protocol_version);
 
@@ -563,7 +595,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_state(ChiakiTakion *ta
 	return takion_send_feedback_packet(takion, buf, buf_sz);
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_history(ChiakiTakion *takion, ChiakiSeqNum16 seq_num, uint8_t *payload, size_t payload_size)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_history(ChiakiTakion *takion, ChiakiSeqNum16 seq_num, const uint8_t *payload, size_t payload_size)
 {
 	size_t buf_size = 0xc + payload_size;
 	uint8_t *buf = malloc(buf_size);
@@ -672,6 +704,8 @@ static void takion_data_drop(uint64_t seq_num, void *elem_user, void *cb_user)
 static void *takion_thread_func(void *user)
 {
 	ChiakiTakion *takion = user;
+	CHIAKI_TRACE_THREAD_NAME("Chiaki Takion");
+	chiaki_thread_sched_apply(&takion->thread_sched, "Takion", takion->log);
 
 	uint32_t seq_num_remote_initial;
 	if(takion_handshake(takion, &seq_num_remote_initial) != CHIAKI_ERR_SUCCESS)
@@ -681,6 +715,9 @@ static void *takion_thread_func(void *user)
 		goto beach;
 
 	chiaki_reorder_queue_set_drop_cb(&takion->data_queue, takion_data_drop, takion);
+	chiaki_reorder_queue_set_size_exp_max(&takion->data_queue, takion->data_queue_size_exp_max);
+	CHIAKI_LOGV(takion->log, "Takion data queue may grow up to %llu entries",
+		(unsigned long long)1 << takion->data_queue_size_exp_max);
 
 	// The send buffer size MUST be consistent with the acked seqnums array size in takion_handle_packet_message_data_ack()
 	if(chiaki_takion_send_buffer_init(&takion->send_buffer, takion, TAKION_SEND_BUFFER_SIZE) != CHIAKI_ERR_SUCCESS)
@@ -705,7 +742,7 @@ static void *takion_thread_func(void *user)
 			for(uint64_t i=0; i<chiaki_reorder_queue_count(&takion->data_queue); i++)
 			{
 				TakionDataPacketEntry *packet;
-				bool peeked = chiaki_reorder_queue_peek(&takion->data_queue, i, NULL, (void **)&packet);
+				bool peeked = chiaki_reorder_queue_peek_32(&takion->data_queue, i, NULL, (void **)&packet);
 				if(!peeked)
 					continue;
 				if(packet->packet_size == 0)
@@ -714,7 +751,7 @@ static void *takion_thread_func(void *user)
 				if(takion_handle_packet_mac(takion, base_type, packet->packet_buf, packet->packet_size) != CHIAKI_ERR_SUCCESS)
 				{
 					CHIAKI_LOGW(takion->log, "Found an invalid MAC");
-					chiaki_reorder_queue_drop(&takion->data_queue, i);
+					chiaki_reorder_queue_drop_32(&takion->data_queue, i);
 				}
 			}
 
@@ -741,7 +778,15 @@ static void *takion_thread_func(void *user)
 		uint8_t *buf = malloc(received_size); // TODO: no malloc?
 		if(!buf)
 			break;
-		ChiakiErrorCode err = takion_recv(takion, buf, &received_size, UINT64_MAX);
+		// data_queue belongs to this thread, so the periodic shrink check runs here when the stream is idle
+		bool data_queue_grown = chiaki_reorder_queue_size(&takion->data_queue) > ((size_t)1 << TAKION_REORDER_QUEUE_SIZE_EXP);
+		ChiakiErrorCode err = takion_recv(takion, buf, &received_size, data_queue_grown ? TAKION_REORDER_QUEUE_SHRINK_CHECK_MS : UINT64_MAX);
+		if(err == CHIAKI_ERR_TIMEOUT)
+		{
+			free(buf);
+			takion_shrink_data_queue(takion);
+			continue;
+		}
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			free(buf);
@@ -753,7 +798,9 @@ static void *takion_thread_func(void *user)
 			free(buf);
 			continue;
 		}
+		CHIAKI_TRACE_BEGIN("takion_packet_recv");
 		takion_handle_packet(takion, resized_buf, received_size);
+		CHIAKI_TRACE_END("takion_packet_recv");
 	}
 
 	// chiaki_congestion_control_stop(&congestion_control);
@@ -761,6 +808,9 @@ static void *takion_thread_func(void *user)
 	chiaki_takion_send_buffer_fini(&takion->send_buffer);
 
 error_reoder_queue:
+	CHIAKI_LOGI(takion->log, "Takion data queue high-water mark was %llu of up to %llu entries",
+		(unsigned long long)chiaki_reorder_queue_count_max(&takion->data_queue),
+		(unsigned long long)1 << takion->data_queue_size_exp_max);
 	chiaki_reorder_queue_fini(&takion->data_queue);
 
 beach:
@@ -812,7 +862,9 @@ static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t ba
 		CHIAKI_LOGE(takion->log, "Takion failed to pull key_pos out of received packet");
 		return err;
 	}
+	CHIAKI_TRACE_BEGIN("takion_mac");
 	err = chiaki_takion_packet_mac(takion->gkcrypt_remote, buf, buf_size, key_pos, mac_expected, mac);
+	CHIAKI_TRACE_END("takion_mac");
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(takion->log, "Takion failed to calculate mac for received packet");
@@ -821,12 +873,18 @@ static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t ba
 
 	if(memcmp(mac_expected, mac, sizeof(mac)) != 0)
 	{
-		CHIAKI_LOGE(takion->log, "Takion packet MAC mismatch for packet type %#x with key_pos %#lx", base_type, key_pos);
-		chiaki_log_hexdump(takion->log, CHIAKI_LOG_ERROR, buf, buf_size);
-		CHIAKI_LOGD(takion->log, "GMAC:");
-		chiaki_log_hexdump(takion->log, CHIAKI_LOG_DEBUG, mac, sizeof(mac));
-		CHIAKI_LOGD(takion->log, "GMAC expected:");
-		chiaki_log_hexdump(takion->log, CHIAKI_LOG_DEBUG, mac_expected, sizeof(mac_expected));
+		// one limit for the whole dump so it is never cut apart
+		static ChiakiLogRateLimit mac_mismatch_rate_limit = { 0 };
+		if(CHIAKI_LOG_ENABLED(CHIAKI_LOG_ERROR)
+				&& chiaki_log_rate_limit_check(takion->log, CHIAKI_LOG_ERROR, &mac_mismatch_rate_limit, __FILE__, __LINE__))
+		{
+			CHIAKI_LOGE(takion->log, "Takion packet MAC mismatch for packet type %#x with key_pos %#lx", base_type, key_pos);
+			chiaki_log_hexdump(takion->log, CHIAKI_LOG_ERROR, buf, buf_size);
+			CHIAKI_LOGD(takion->log, "GMAC:");
+			chiaki_log_hexdump(takion->log, CHIAKI_LOG_DEBUG, mac, sizeof(mac));
+			CHIAKI_LOGD(takion->log, "GMAC expected:");
+			chiaki_log_hexdump(takion->log, CHIAKI_LOG_DEBUG, mac_expected, sizeof(mac_expected));
+		}
 		return CHIAKI_ERR_INVALID_MAC;
 	}
 
@@ -888,10 +946,17 @@ static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_
 			}
 			break;
 		default:
-			CHIAKI_LOGW(takion->log, "Takion packet with unknown type %#x received", base_type);
-			chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, buf, buf_size);
+		{
+			static ChiakiLogRateLimit unknown_type_rate_limit = { 0 };
+			if(CHIAKI_LOG_ENABLED(CHIAKI_LOG_WARNING)
+					&& chiaki_log_rate_limit_check(takion->log, CHIAKI_LOG_WARNING, &unknown_type_rate_limit, __FILE__, __LINE__))
+			{
+				CHIAKI_LOGW(takion->log, "Takion packet with unknown type %#x received", base_type);
+				chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, buf, buf_size);
+			}
 			free(buf);
 			break;
+		}
 	}
 }
 
@@ -925,14 +990,33 @@ static void takion_handle_packet_message(ChiakiTakion *takion, uint8_t *buf, siz
 	}
 }
 
+/**
+ * Shrink the data queue back to its minimum size after it has been empty for a while since growing.
+ */
+static void takion_shrink_data_queue(ChiakiTakion *takion)
+{
+	uint64_t now_ms = chiaki_time_now_monotonic_ms();
+	if(chiaki_reorder_queue_count(&takion->data_queue))
+	{
+		takion->data_queue_busy_ms = now_ms;
+		return;
+	}
+	if(now_ms - takion->data_queue_busy_ms < TAKION_REORDER_QUEUE_SHRINK_IDLE_MS)
+		return;
+	if(chiaki_reorder_queue_resize(&takion->data_queue, TAKION_REORDER_QUEUE_SIZE_EXP) == CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGV(takion->log, "Takion data queue shrunk back to %llu entries",
+			(unsigned long long)chiaki_reorder_queue_size(&takion->data_queue));
+}
+
 static void takion_flush_data_queue(ChiakiTakion *takion)
 {
+	CHIAKI_TRACE_BEGIN("takion_reorder_flush");
 	uint64_t seq_num = 0;
 	bool ack = false;
 	while(true)
 	{
 		TakionDataPacketEntry *entry;
-		bool pulled = chiaki_reorder_queue_pull(&takion->data_queue, &seq_num, (void **)&entry);
+		bool pulled = chiaki_reorder_queue_pull_32(&takion->data_queue, &seq_num, (void **)&entry);
 		if(!pulled)
 			break;
 		ack = true;
@@ -955,8 +1039,13 @@ static void takion_flush_data_queue(ChiakiTakion *takion)
 				&& data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_TRIGGER_EFFECTS
 				&& data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_9)
 		{
-			CHIAKI_LOGW(takion->log, "Takion received data with unexpected data type %#x", data_type);
-			chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, entry->packet_buf, entry->packet_size);
+			static ChiakiLogRateLimit data_type_rate_limit = { 0 };
+			if(CHIAKI_LOG_ENABLED(CHIAKI_LOG_WARNING)
+					&& chiaki_log_rate_limit_check(takion->log, CHIAKI_LOG_WARNING, &data_type_rate_limit, __FILE__, __LINE__))
+			{
+				CHIAKI_LOGW(takion->log, "Takion received data with unexpected data type %#x", data_type);
+				chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, entry->packet_buf, entry->packet_size);
+			}
 		}
 		else if(takion->cb)
 		{
@@ -974,6 +1063,10 @@ static void takion_flush_data_queue(ChiakiTakion *takion)
 
 	if(ack)
 		chiaki_takion_send_message_data_ack(takion, (uint32_t)seq_num);
+	if(chiaki_reorder_queue_size(&takion->data_queue) > ((size_t)1 << TAKION_REORDER_QUEUE_SIZE_EXP))
+		takion_shrink_data_queue(takion);
+	CHIAKI_TRACE_COUNTER("takion_reorder_queue_count", chiaki_reorder_queue_count(&takion->data_queue));
+	CHIAKI_TRACE_END("takion_reorder_flush");
 }
 
 static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *packet_buf, size_t packet_buf_size, uint8_t type_b, uint8_t *payload, size_t payload_size)
@@ -999,10 +1092,47 @@ static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *pac
 	entry->channel = ntohs(*((chiaki_unaligned_uint16_t *)(payload + 4)));
 	ChiakiSeqNum32 seq_num = ntohl(*((chiaki_unaligned_uint32_t *)(payload + 0)));
 
-	chiaki_reorder_queue_push(&takion->data_queue, seq_num, entry);
+	size_t queue_size = chiaki_reorder_queue_size(&takion->data_queue);
+	chiaki_reorder_queue_push_32(&takion->data_queue, seq_num, entry);
+	if(chiaki_reorder_queue_size(&takion->data_queue) != queue_size)
+	{
+		CHIAKI_LOGV(takion->log, "Takion data queue grew to %llu entries",
+			(unsigned long long)chiaki_reorder_queue_size(&takion->data_queue));
+		takion->data_queue_busy_ms = chiaki_time_now_monotonic_ms();
+	}
 	takion_flush_data_queue(takion);
 }
 
+/**
+ * Follow changes of the rtt, e.g. after roaming to another access point.
+ * Only called from the takion thread, which owns data_queue.
+ */
+static void takion_update_data_queue_size(ChiakiTakion *takion)
+{
+	uint64_t rtt_us;
+	chiaki_takion_send_buffer_rtt(&takion->send_buffer, &rtt_us, NULL);
+	size_t size_exp_max = takion_data_queue_size_exp_max(rtt_us, takion->bandwidth_bps, takion->mtu);
+	if(size_exp_max == takion->data_queue_size_exp_max)
+		return;
+	CHIAKI_LOGI(takion->log, "Takion data queue may now grow up to %llu entries for an rtt of %.3f ms",
+		(unsigned long long)1 << size_exp_max, (float)rtt_us * 0.001f);
+	takion->data_queue_size_exp_max = size_exp_max;
+	chiaki_reorder_queue_set_size_exp_max(&takion->data_queue, size_exp_max);
+}
+
+CHIAKI_EXPORT void chiaki_takion_get_network_stats(ChiakiTakion *takion, ChiakiTakionNetworkStats *stats)
+{
+	chiaki_takion_send_buffer_rtt(&takion->send_buffer, &stats->rtt_us, &stats->rtt_var_us);
+	stats->path_mtu = 0;
+#ifdef IP_MTU
+	// updated by the os from icmp "fragmentation needed" because of the don't fragment bit
+	int mtu_val = 0;
+	socklen_t mtu_val_len = sizeof(mtu_val);
+	if(getsockopt(takion->sock, IPPROTO_IP, IP_MTU, (void *)&mtu_val, &mtu_val_len) == 0 && mtu_val > 0)
+		stats->path_mtu = (uint32_t)mtu_val;
+#endif
+}
+
 static void takion_handle_packet_message_data_ack(ChiakiTakion *takion, uint8_t flags, uint8_t *buf, size_t buf_size)
 {
 	if(buf_size != 0xc)
@@ -1031,6 +1161,7 @@ static void takion_handle_packet_message_data_ack(ChiakiTakion *takion, uint8_t
 	ChiakiSeqNum32 acked_seq_nums[TAKION_SEND_BUFFER_SIZE];
 	size_t acked_seq_nums_count = 0;
 	chiaki_takion_send_buffer_ack(&takion->send_buffer, cumulative_seq_num, acked_seq_nums, &acked_seq_nums_count);
+	takion_update_data_queue_size(takion);
 
 	for(size_t i=0; i<acked_seq_nums_count; i++)
 	{
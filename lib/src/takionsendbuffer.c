@@ -5,12 +5,14 @@
 #include <chiaki/takionsendbuffer.h>
 #include <chiaki/takion.h>
 #include <chiaki/time.h>
+#include <chiaki/trace.h>
 
 #include <string.h>
 #include <assert.h>
 
-#define TAKION_DATA_RESEND_TIMEOUT_MS 200
-#define TAKION_DATA_RESEND_WAKEUP_TIMEOUT_MS (TAKION_DATA_RESEND_TIMEOUT_MS/2)
+#define TAKION_DATA_RESEND_TIMEOUT_MS 200 // until the first rtt sample
+#define TAKION_DATA_RESEND_TIMEOUT_MIN_MS 50
+#define TAKION_DATA_RESEND_TIMEOUT_MAX_MS 1000
 #define TAKION_DATA_RESEND_TRIES_MAX 10
 
 #endif
@@ -20,18 +22,24 @@ struct chiaki_takion_send_buffer_packet_t
 	ChiakiSeqNum32 seq_num;
 	uint64_t tries;
 	uint64_t last_send_ms; // chiaki_time_now_monotonic_ms()
+	uint64_t first_send_us; // chiaki_time_now_monotonic_us()
 	uint8_t *buf;
 	size_t buf_size;
 }; // ChiakiTakionSendBufferPacket
 
 #ifndef CHIAKI_UNIT_TEST
 
-static void *takion_send_buffer_thread_func(void *user);
+static void takion_send_buffer_timer_cb(void *user);
+static uint64_t takion_send_buffer_resend_timeout_ms(ChiakiTakionSendBuffer *send_buffer);
+static void takion_send_buffer_rtt_sample(ChiakiTakionSendBuffer *send_buffer, uint64_t rtt_us);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuffer *send_buffer, ChiakiTakion *takion, size_t size)
 {
 	send_buffer->takion = takion;
 	send_buffer->log = takion ? takion->log : NULL;
+	send_buffer->srtt_us = takion ? takion->rtt_us_initial : 0;
+	send_buffer->rttvar_us = send_buffer->srtt_us / 2;
+	send_buffer->rtt_samples = 0;
 
 	send_buffer->packets = calloc(size, sizeof(ChiakiTakionSendBufferPacket));
 	if(!send_buffer->packets)
@@ -39,27 +47,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuf
 	send_buffer->packets_size = size;
 	send_buffer->packets_count = 0;
 
-	send_buffer->should_stop = false;
-
 	ChiakiErrorCode err = chiaki_mutex_init(&send_buffer->mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_packets;
 
-	err = chiaki_cond_init(&send_buffer->cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_mutex;
-
-	err = chiaki_thread_create(&send_buffer->thread, takion_send_buffer_thread_func, send_buffer);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_cond;
-
-	chiaki_thread_set_name(&send_buffer->thread, "Chiaki Takion Send Buffer");
+	if(takion)
+		chiaki_timer_init(&send_buffer->resend_timer, takion->timer_service, takion_send_buffer_timer_cb, send_buffer);
 
 	return CHIAKI_ERR_SUCCESS;
-error_cond:
-	chiaki_cond_fini(&send_buffer->cond);
-error_mutex:
-	chiaki_mutex_fini(&send_buffer->mutex);
 error_packets:
 	free(send_buffer->packets);
 	return err;
@@ -67,19 +62,13 @@ error_packets:
 
 CHIAKI_EXPORT void chiaki_takion_send_buffer_fini(ChiakiTakionSendBuffer *send_buffer)
 {
-	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
-	assert(err == CHIAKI_ERR_SUCCESS);
-	send_buffer->should_stop = true;
-	chiaki_mutex_unlock(&send_buffer->mutex);
-	err = chiaki_cond_signal(&send_buffer->cond);
-	assert(err == CHIAKI_ERR_SUCCESS);
-	err = chiaki_thread_join(&send_buffer->thread, NULL);
-	assert(err == CHIAKI_ERR_SUCCESS);
+	// must not hold the mutex here, the callback might be waiting for it
+	if(send_buffer->takion)
+		chiaki_timer_cancel(&send_buffer->resend_timer);
 
 	for(size_t i=0; i<send_buffer->packets_count; i++)
 		free(send_buffer->packets[i].buf);
 
-	chiaki_cond_fini(&send_buffer->cond);
 	chiaki_mutex_fini(&send_buffer->mutex);
 	free(send_buffer->packets);
 }
@@ -110,16 +99,17 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuf
 	ChiakiTakionSendBufferPacket *packet = &send_buffer->packets[send_buffer->packets_count++];
 	packet->seq_num = seq_num;
 	packet->tries = 0;
-	packet->last_send_ms = chiaki_time_now_monotonic_ms();
+	packet->first_send_us = chiaki_time_now_monotonic_us();
+	packet->last_send_ms = packet->first_send_us / 1000;
 	packet->buf = buf;
 	packet->buf_size = buf_size;
 
 	CHIAKI_LOGV(send_buffer->log, "Pushed seq num %#llx into Takion Send Buffer", (unsigned long long)seq_num);
 
-	if(send_buffer->packets_count == 1)
+	if(send_buffer->packets_count == 1 && send_buffer->takion)
 	{
-		// buffer was empty before, so it will sleep without timeout => WAKE UP!!
-		chiaki_cond_signal(&send_buffer->cond);
+		// buffer was empty before, so the timer is not armed
+		chiaki_timer_start(&send_buffer->resend_timer, takion_send_buffer_resend_timeout_ms(send_buffer) / 2, 0);
 	}
 
 beach:
@@ -138,6 +128,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuff
 	if(acked_seq_nums_count)
 		*acked_seq_nums_count = 0;
 
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+
 	size_t i;
 	size_t shift = 0; // amount to shift back
 	size_t shift_start = SIZE_MAX;
@@ -148,6 +140,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuff
 			if(acked_seq_nums)
 				acked_seq_nums[(*acked_seq_nums_count)++] = send_buffer->packets[i].seq_num;
 
+			// an ack for a re-sent packet can't be matched to one of the sends (Karn's algorithm)
+			if(send_buffer->packets[i].seq_num == seq_num && !send_buffer->packets[i].tries)
+				takion_send_buffer_rtt_sample(send_buffer, now_us - send_buffer->packets[i].first_send_us);
+
 			free(send_buffer->packets[i].buf);
 			if(shift_start == SIZE_MAX)
 			{
@@ -191,47 +187,58 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuff
 	return err;
 }
 
-static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer);
+CHIAKI_EXPORT void chiaki_takion_send_buffer_rtt(ChiakiTakionSendBuffer *send_buffer, uint64_t *srtt_us, uint64_t *rttvar_us)
+{
+	chiaki_mutex_lock(&send_buffer->mutex);
+	*srtt_us = send_buffer->srtt_us;
+	if(rttvar_us)
+		*rttvar_us = send_buffer->rttvar_us;
+	chiaki_mutex_unlock(&send_buffer->mutex);
+}
 
-static bool takion_send_buffer_check_pred_packets(void *user)
+static void takion_send_buffer_rtt_sample(ChiakiTakionSendBuffer *send_buffer, uint64_t rtt_us)
 {
-	ChiakiTakionSendBuffer *send_buffer = user;
-	return send_buffer->should_stop;
+	if(!send_buffer->rtt_samples++)
+	{
+		// the first sample replaces the initial estimate
+		send_buffer->srtt_us = rtt_us;
+		send_buffer->rttvar_us = rtt_us / 2;
+		return;
+	}
+	uint64_t delta_us = send_buffer->srtt_us > rtt_us ? send_buffer->srtt_us - rtt_us : rtt_us - send_buffer->srtt_us;
+	send_buffer->rttvar_us = (send_buffer->rttvar_us * 3 + delta_us) / 4;
+	send_buffer->srtt_us = (send_buffer->srtt_us * 7 + rtt_us) / 8;
 }
 
-static bool takion_send_buffer_check_pred_no_packets(void *user)
+static uint64_t takion_send_buffer_resend_timeout_ms(ChiakiTakionSendBuffer *send_buffer)
 {
-	ChiakiTakionSendBuffer *send_buffer = user;
-	return send_buffer->should_stop || send_buffer->packets_count;
+	if(!send_buffer->rtt_samples)
+		return TAKION_DATA_RESEND_TIMEOUT_MS;
+	uint64_t timeout_ms = (send_buffer->srtt_us + 4 * send_buffer->rttvar_us) / 1000;
+	if(timeout_ms < TAKION_DATA_RESEND_TIMEOUT_MIN_MS)
+		return TAKION_DATA_RESEND_TIMEOUT_MIN_MS;
+	if(timeout_ms > TAKION_DATA_RESEND_TIMEOUT_MAX_MS)
+		return TAKION_DATA_RESEND_TIMEOUT_MAX_MS;
+	return timeout_ms;
 }
 
-static void *takion_send_buffer_thread_func(void *user)
+static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer);
+
+static void takion_send_buffer_timer_cb(void *user)
 {
 	ChiakiTakionSendBuffer *send_buffer = user;
 
 	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
-
-	while(true)
-	{
-		if(send_buffer->packets_count) // if there are packets, wait with timeout
-			err = chiaki_cond_timedwait_pred(&send_buffer->cond, &send_buffer->mutex, TAKION_DATA_RESEND_WAKEUP_TIMEOUT_MS, takion_send_buffer_check_pred_packets, send_buffer);
-		else // if not, wait without timeout, but also wakeup if packets become available
-			err = chiaki_cond_wait_pred(&send_buffer->cond, &send_buffer->mutex, takion_send_buffer_check_pred_no_packets, send_buffer);
-
-		if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
-			break;
+		return;
 
-		if(send_buffer->should_stop)
-			break;
+	takion_send_buffer_resend(send_buffer);
 
-		takion_send_buffer_resend(send_buffer);
-	}
+	// keep checking until everything is acked, push re-arms it otherwise
+	if(send_buffer->packets_count)
+		chiaki_timer_start(&send_buffer->resend_timer, takion_send_buffer_resend_timeout_ms(send_buffer) / 2, 0);
 
 	chiaki_mutex_unlock(&send_buffer->mutex);
-
-	return NULL;
 }
 
 static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer)
@@ -240,15 +247,18 @@ static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer)
 		return;
 
 	uint64_t now = chiaki_time_now_monotonic_ms();
+	uint64_t timeout_ms = takion_send_buffer_resend_timeout_ms(send_buffer);
 
 	for(size_t i=0; i<send_buffer->packets_count; i++)
 	{
 		ChiakiTakionSendBufferPacket *packet = &send_buffer->packets[i];
-		if(now - packet->last_send_ms > TAKION_DATA_RESEND_TIMEOUT_MS)
+		if(now - packet->last_send_ms > timeout_ms)
 		{
 			CHIAKI_LOGI(send_buffer->log, "Takion Send Buffer re-sending packet with seqnum %#llx, tries: %llu", (unsigned long long)packet->seq_num, (unsigned long long)packet->tries);
 			packet->last_send_ms = now;
+			CHIAKI_TRACE_BEGIN("takion_resend");
 			chiaki_takion_send_raw(send_buffer->takion, packet->buf, packet->buf_size);
+			CHIAKI_TRACE_END("takion_resend");
 			packet->tries++;
 			// TODO: check tries and disconnect if necessary
 		}
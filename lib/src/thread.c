@@ -4,11 +4,23 @@
 
 #include <chiaki/thread.h>
 #include <chiaki/time.h>
+#include <chiaki/log.h>
+#include <chiaki/trace.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 
+#if !defined(_WIN32) && !defined(__SWITCH__)
+#include <sched.h>
+#endif
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
 #ifdef __SWITCH__
 #include <switch.h>
 #endif
@@ -18,8 +30,17 @@ static DWORD WINAPI win32_thread_func(LPVOID param)
 {
 	ChiakiThread *thread = (ChiakiThread *)param;
 	thread->ret = thread->func(thread->arg);
+	CHIAKI_TRACE_THREAD_EXIT();
 	return 0;
 }
+#else
+static void *posix_thread_func(void *param)
+{
+	ChiakiThread *thread = (ChiakiThread *)param;
+	void *ret = thread->func(thread->arg);
+	CHIAKI_TRACE_THREAD_EXIT();
+	return ret;
+}
 #endif
 
 #ifdef __SWITCH__
@@ -49,7 +70,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_create(ChiakiThread *thread, ChiakiT
 	if(get_thread_limit() <= 1)
 		return CHIAKI_ERR_THREAD;
 #endif
-	int r = pthread_create(&thread->thread, NULL, func, arg);
+	thread->func = func;
+	thread->arg = arg;
+	int r = pthread_create(&thread->thread, NULL, posix_thread_func, thread);
 	if(r != 0)
 		return CHIAKI_ERR_THREAD;
 #endif
@@ -97,6 +120,186 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const
 	return CHIAKI_ERR_SUCCESS;
 }
 
+CHIAKI_EXPORT const char *chiaki_thread_priority_string(ChiakiThreadPriority priority)
+{
+	switch(priority)
+	{
+		case CHIAKI_THREAD_PRIORITY_DEFAULT:
+			return "default";
+		case CHIAKI_THREAD_PRIORITY_LOW:
+			return "low";
+		case CHIAKI_THREAD_PRIORITY_NORMAL:
+			return "normal";
+		case CHIAKI_THREAD_PRIORITY_HIGH:
+			return "high";
+		case CHIAKI_THREAD_PRIORITY_REALTIME:
+			return "realtime";
+		default:
+			return "unknown";
+	}
+}
+
+#ifdef __linux__
+/**
+ * @return kernel id of thread if it is the calling one, which is required for per-thread niceness, otherwise -1
+ */
+static pid_t thread_linux_tid(ChiakiThread *thread)
+{
+	if(thread && !pthread_equal(thread->thread, pthread_self()))
+		return -1;
+	return (pid_t)syscall(SYS_gettid);
+}
+
+static ChiakiErrorCode thread_set_nice(ChiakiThread *thread, int nice)
+{
+	pid_t tid = thread_linux_tid(thread);
+	if(tid < 0)
+		return CHIAKI_ERR_THREAD;
+	if(setpriority(PRIO_PROCESS, (id_t)tid, nice) < 0)
+		return CHIAKI_ERR_THREAD;
+	return CHIAKI_ERR_SUCCESS;
+}
+#endif
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_priority(ChiakiThread *thread, ChiakiThreadPriority priority)
+{
+	if(priority == CHIAKI_THREAD_PRIORITY_DEFAULT)
+		return CHIAKI_ERR_SUCCESS;
+#if defined(_WIN32)
+	int win_priority;
+	switch(priority)
+	{
+		case CHIAKI_THREAD_PRIORITY_LOW:
+			win_priority = THREAD_PRIORITY_BELOW_NORMAL;
+			break;
+		case CHIAKI_THREAD_PRIORITY_HIGH:
+			win_priority = THREAD_PRIORITY_HIGHEST;
+			break;
+		case CHIAKI_THREAD_PRIORITY_REALTIME:
+			win_priority = THREAD_PRIORITY_TIME_CRITICAL;
+			break;
+		default:
+			win_priority = THREAD_PRIORITY_NORMAL;
+			break;
+	}
+	if(!SetThreadPriority(thread ? thread->thread : GetCurrentThread(), win_priority))
+		return CHIAKI_ERR_THREAD;
+	return CHIAKI_ERR_SUCCESS;
+#elif defined(__SWITCH__)
+	(void)thread;
+	return CHIAKI_ERR_THREAD;
+#else
+	pthread_t pthread = thread ? thread->thread : pthread_self();
+	struct sched_param param = { 0 };
+	int policy;
+	switch(priority)
+	{
+		case CHIAKI_THREAD_PRIORITY_REALTIME:
+			// stay below threaded interrupt handlers, which run at 50 on Linux
+			policy = SCHED_FIFO;
+			param.sched_priority = sched_get_priority_min(policy) + (sched_get_priority_max(policy) - sched_get_priority_min(policy)) / 4;
+			break;
+		case CHIAKI_THREAD_PRIORITY_HIGH:
+			policy = SCHED_RR;
+			param.sched_priority = sched_get_priority_min(policy);
+			break;
+		default:
+			// the range is only [0, 0] on Linux
+			policy = SCHED_OTHER;
+			param.sched_priority = priority == CHIAKI_THREAD_PRIORITY_LOW
+				? sched_get_priority_min(policy)
+				: (sched_get_priority_min(policy) + sched_get_priority_max(policy)) / 2;
+			break;
+	}
+
+	int r = pthread_setschedparam(pthread, policy, &param);
+#ifdef __linux__
+	// SCHED_OTHER has no static priorities on Linux, niceness takes their place
+	if(policy == SCHED_OTHER)
+	{
+		if(r != 0)
+			return CHIAKI_ERR_THREAD;
+		return thread_set_nice(thread, priority == CHIAKI_THREAD_PRIORITY_LOW ? 10 : 0);
+	}
+	// real-time policies need CAP_SYS_NICE or RLIMIT_RTPRIO, a negative niceness often only RLIMIT_NICE
+	if(r != 0 && priority == CHIAKI_THREAD_PRIORITY_HIGH)
+		return thread_set_nice(thread, -10);
+#endif
+	if(r != 0)
+		return CHIAKI_ERR_THREAD;
+	return CHIAKI_ERR_SUCCESS;
+#endif
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_affinity(ChiakiThread *thread, uint64_t cpu_mask)
+{
+	if(!cpu_mask)
+		return CHIAKI_ERR_INVALID_DATA;
+#if defined(_WIN32)
+	if(!SetThreadAffinityMask(thread ? thread->thread : GetCurrentThread(), (DWORD_PTR)cpu_mask))
+		return CHIAKI_ERR_THREAD;
+	return CHIAKI_ERR_SUCCESS;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(int i=0; i<64; i++)
+	{
+		if(cpu_mask & (1ull << i))
+			CPU_SET(i, &set);
+	}
+#ifdef __GLIBC__
+	int r = pthread_setaffinity_np(thread ? thread->thread : pthread_self(), sizeof(set), &set);
+#else
+	pid_t tid = thread_linux_tid(thread);
+	if(tid < 0)
+		return CHIAKI_ERR_THREAD;
+	int r = sched_setaffinity(tid, sizeof(set), &set);
+#endif
+	if(r != 0)
+		return CHIAKI_ERR_THREAD;
+	return CHIAKI_ERR_SUCCESS;
+#else
+	// no hard affinity on macOS or the Switch
+	(void)thread;
+	return CHIAKI_ERR_THREAD;
+#endif
+}
+
+CHIAKI_EXPORT void chiaki_thread_sched_apply(const ChiakiThreadSched *sched, const char *name, ChiakiLog *log)
+{
+	if(sched->priority != CHIAKI_THREAD_PRIORITY_DEFAULT)
+	{
+		ChiakiThreadPriority priority = sched->priority;
+		while(chiaki_thread_set_priority(NULL, priority) != CHIAKI_ERR_SUCCESS)
+		{
+			if(priority <= CHIAKI_THREAD_PRIORITY_HIGH)
+			{
+				CHIAKI_LOGW(log, "Failed to set %s thread priority to %s, keeping the default",
+						name, chiaki_thread_priority_string(sched->priority));
+				priority = CHIAKI_THREAD_PRIORITY_DEFAULT;
+				break;
+			}
+			priority--;
+		}
+		if(priority != CHIAKI_THREAD_PRIORITY_DEFAULT)
+		{
+			if(priority == sched->priority)
+				CHIAKI_LOGI(log, "Set %s thread priority to %s", name, chiaki_thread_priority_string(priority));
+			else
+				CHIAKI_LOGW(log, "Setting %s thread priority to %s is not permitted, using %s instead",
+						name, chiaki_thread_priority_string(sched->priority), chiaki_thread_priority_string(priority));
+		}
+	}
+
+	if(sched->cpu_mask)
+	{
+		if(chiaki_thread_set_affinity(NULL, sched->cpu_mask) == CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGI(log, "Set %s thread cpu affinity to %#llx", name, (unsigned long long)sched->cpu_mask);
+		else
+			CHIAKI_LOGW(log, "Failed to set %s thread cpu affinity to %#llx", name, (unsigned long long)sched->cpu_mask);
+	}
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_mutex_init(ChiakiMutex *mutex, bool rec)
 {
 #if _WIN32
@@ -2,12 +2,29 @@
 
 #include <chiaki/time.h>
 
+#include <stdbool.h>
 #include <time.h>
 
 #ifdef _WIN32
 #include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#include <cpuid.h>
+#define TIME_TICKS_TSC
+#elif defined(__aarch64__) && defined(__linux__)
+#define TIME_TICKS_CNTVCT
 #endif
 
+#define NS_PER_SEC 1000000000ull
+
+/**
+ * Set once by chiaki_time_init(), chiaki_time_ticks() uses chiaki_time_now_ns() until then.
+ */
+static bool time_ticks_hw = false;
+static double time_ns_per_tick = 1.0;
+
 CHIAKI_EXPORT uint64_t chiaki_time_now_monotonic_us()
 {
 #if _WIN32
@@ -26,3 +43,104 @@ CHIAKI_EXPORT uint64_t chiaki_time_now_monotonic_us()
 	return time.tv_sec * 1000000 + time.tv_nsec / 1000;
 #endif
 }
+
+CHIAKI_EXPORT uint64_t chiaki_time_now_ns()
+{
+#if _WIN32
+	LARGE_INTEGER f;
+	if(!QueryPerformanceFrequency(&f))
+		return 0;
+	LARGE_INTEGER v;
+	if(!QueryPerformanceCounter(&v))
+		return 0;
+	// split to not overflow with a 10 MHz counter
+	uint64_t sec = v.QuadPart / f.QuadPart;
+	uint64_t rem = v.QuadPart % f.QuadPart;
+	return sec * NS_PER_SEC + rem * NS_PER_SEC / f.QuadPart;
+#elif defined(__APPLE__)
+	static mach_timebase_info_data_t timebase = { 0 };
+	if(!timebase.denom)
+		mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+	struct timespec time;
+#ifdef CLOCK_MONOTONIC_RAW
+	if(clock_gettime(CLOCK_MONOTONIC_RAW, &time) == 0)
+		return (uint64_t)time.tv_sec * NS_PER_SEC + time.tv_nsec;
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * NS_PER_SEC + time.tv_nsec;
+#endif
+}
+
+static inline uint64_t time_ticks_hw_read()
+{
+#if _WIN32
+	LARGE_INTEGER v;
+	QueryPerformanceCounter(&v);
+	return v.QuadPart;
+#elif defined(__APPLE__)
+	return mach_absolute_time();
+#elif defined(TIME_TICKS_TSC)
+	return __rdtsc();
+#elif defined(TIME_TICKS_CNTVCT)
+	uint64_t v;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+	return v;
+#else
+	return chiaki_time_now_ns();
+#endif
+}
+
+CHIAKI_EXPORT uint64_t chiaki_time_ticks()
+{
+	if(!time_ticks_hw)
+		return chiaki_time_now_ns();
+	return time_ticks_hw_read();
+}
+
+CHIAKI_EXPORT uint64_t chiaki_time_ticks_to_ns(uint64_t ticks)
+{
+	return (uint64_t)((double)ticks * time_ns_per_tick);
+}
+
+CHIAKI_EXPORT void chiaki_time_init()
+{
+	if(time_ticks_hw)
+		return;
+#if _WIN32
+	LARGE_INTEGER f;
+	if(!QueryPerformanceFrequency(&f))
+		return;
+	time_ns_per_tick = (double)NS_PER_SEC / (double)f.QuadPart;
+#elif defined(__APPLE__)
+	mach_timebase_info_data_t timebase;
+	if(mach_timebase_info(&timebase) != KERN_SUCCESS)
+		return;
+	time_ns_per_tick = (double)timebase.numer / (double)timebase.denom;
+#elif defined(TIME_TICKS_TSC)
+	// without an invariant tsc, the rate changes with frequency scaling and differs between cores
+	unsigned int eax, ebx, ecx, edx;
+	if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8)))
+		return;
+	uint64_t ns_start = chiaki_time_now_ns();
+	uint64_t ticks_start = __rdtsc();
+	uint64_t ns_end;
+	do
+		ns_end = chiaki_time_now_ns();
+	while(ns_end - ns_start < 10000000);
+	uint64_t ticks_end = __rdtsc();
+	if(ticks_end <= ticks_start)
+		return;
+	time_ns_per_tick = (double)(ns_end - ns_start) / (double)(ticks_end - ticks_start);
+#elif defined(TIME_TICKS_CNTVCT)
+	uint64_t freq;
+	__asm__ volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+	if(!freq)
+		return;
+	time_ns_per_tick = (double)NS_PER_SEC / (double)freq;
+#else
+	return;
+#endif
+	time_ticks_hw = true;
+}
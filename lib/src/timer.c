@@ -0,0 +1,353 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/timer.h>
+#include <chiaki/time.h>
+#include <chiaki/trace.h>
+
+#include "bitops.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#define TIMER_THREAD_LOCAL __declspec(thread)
+#else
+#define TIMER_THREAD_LOCAL __thread
+#endif
+
+#define SLOT_MASK (CHIAKI_TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) (CHIAKI_TIMER_WHEEL_BITS * (level))
+#define WHEEL_RANGE ((uint64_t)1 << LEVEL_SHIFT(CHIAKI_TIMER_WHEEL_LEVELS))
+
+// service whose callbacks are run by the current thread, if any
+static TIMER_THREAD_LOCAL ChiakiTimerService *thread_service = NULL;
+
+static void link_init(ChiakiTimerLink *link)
+{
+	link->prev = link;
+	link->next = link;
+}
+
+static void wheel_remove(ChiakiTimerService *service, ChiakiTimer *timer)
+{
+	assert(timer->pending);
+	timer->link.prev->next = timer->link.next;
+	timer->link.next->prev = timer->link.prev;
+	ChiakiTimerLink *head = &service->wheel[timer->level][timer->slot];
+	if(head->next == head)
+		service->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+	timer->pending = false;
+}
+
+/**
+ * Insert relative to service->now_tick. Timers expiring at or before now_tick end up in the current slot of level 0.
+ */
+static void wheel_insert(ChiakiTimerService *service, ChiakiTimer *timer)
+{
+	uint64_t expires = timer->expires_ms;
+	if(expires < service->now_tick)
+		expires = service->now_tick;
+	uint64_t delta = expires - service->now_tick;
+	if(delta >= WHEEL_RANGE)
+	{
+		// will be re-inserted when its slot is cascaded
+		delta = WHEEL_RANGE - 1;
+		expires = service->now_tick + delta;
+	}
+
+	unsigned int level = 0;
+	while(delta >> LEVEL_SHIFT(level + 1))
+		level++;
+	unsigned int slot = (unsigned int)(expires >> LEVEL_SHIFT(level)) & SLOT_MASK;
+
+	ChiakiTimerLink *head = &service->wheel[level][slot];
+	timer->link.prev = head->prev;
+	timer->link.next = head;
+	head->prev->next = &timer->link;
+	head->prev = &timer->link;
+	service->occupied[level] |= (uint64_t)1 << slot;
+	timer->level = (uint8_t)level;
+	timer->slot = (uint8_t)slot;
+	timer->pending = true;
+}
+
+/**
+ * @return next tick after now_tick at which a slot has to be processed, UINT64_MAX if there are no timers
+ */
+static uint64_t wheel_next_tick(ChiakiTimerService *service)
+{
+	uint64_t next = UINT64_MAX;
+	for(unsigned int level=0; level<CHIAKI_TIMER_WHEEL_LEVELS; level++)
+	{
+		uint64_t occupied = service->occupied[level];
+		if(!occupied)
+			continue;
+		uint64_t pos = service->now_tick >> LEVEL_SHIFT(level);
+		// bit i of rotated is the slot i+1 after the current one
+		uint64_t rotated = rotr64(occupied, (unsigned int)(pos + 1) & SLOT_MASK);
+		uint64_t tick = (pos + 1 + ctz64(rotated)) << LEVEL_SHIFT(level);
+		if(tick < next)
+			next = tick;
+	}
+	return next;
+}
+
+static void wheel_cascade(ChiakiTimerService *service)
+{
+	for(unsigned int level=CHIAKI_TIMER_WHEEL_LEVELS-1; level>0; level--)
+	{
+		if(service->now_tick & (((uint64_t)1 << LEVEL_SHIFT(level)) - 1))
+			continue;
+		unsigned int slot = (unsigned int)(service->now_tick >> LEVEL_SHIFT(level)) & SLOT_MASK;
+		ChiakiTimerLink *head = &service->wheel[level][slot];
+		while(head->next != head)
+		{
+			ChiakiTimer *timer = (ChiakiTimer *)head->next;
+			wheel_remove(service, timer);
+			wheel_insert(service, timer);
+		}
+	}
+}
+
+static void wheel_expire(ChiakiTimerService *service)
+{
+	// move the slot to a local list first, periodic timers with a multiple of the wheel size as period land in it again
+	unsigned int slot = (unsigned int)service->now_tick & SLOT_MASK;
+	ChiakiTimerLink *slot_head = &service->wheel[0][slot];
+	if(slot_head->next == slot_head)
+		return;
+	ChiakiTimerLink expired;
+	expired.next = slot_head->next;
+	expired.prev = slot_head->prev;
+	expired.next->prev = &expired;
+	expired.prev->next = &expired;
+	link_init(slot_head);
+	service->occupied[0] &= ~((uint64_t)1 << slot);
+
+	ChiakiTimerLink *head = &expired;
+	while(head->next != head)
+	{
+		ChiakiTimer *timer = (ChiakiTimer *)head->next;
+		wheel_remove(service, timer);
+		if(timer->period_ms)
+		{
+			timer->expires_ms += timer->period_ms;
+			if(timer->expires_ms <= service->now_tick) // fell behind, skip missed periods
+				timer->expires_ms = service->now_tick + timer->period_ms;
+			wheel_insert(service, timer);
+		}
+
+		service->running = timer;
+		chiaki_mutex_unlock(&service->mutex);
+		timer->cb(timer->user);
+		chiaki_mutex_lock(&service->mutex);
+		service->running = NULL;
+		if(service->cancel_waiters)
+			chiaki_cond_broadcast(&service->idle_cond);
+	}
+}
+
+static void timer_service_process(ChiakiTimerService *service, uint64_t now)
+{
+	while(service->now_tick < now)
+	{
+		uint64_t next = wheel_next_tick(service);
+		if(next > now)
+		{
+			// nothing to do in between, skip ahead
+			service->now_tick = now;
+			return;
+		}
+		service->now_tick = next;
+		wheel_cascade(service);
+		wheel_expire(service);
+	}
+}
+
+static void *timer_service_thread_func(void *user)
+{
+	ChiakiTimerService *service = user;
+	CHIAKI_TRACE_THREAD_NAME("Chiaki Timer");
+	thread_service = service;
+
+	chiaki_mutex_lock(&service->mutex);
+	while(!service->should_stop)
+	{
+		service->wakeup_tick = 0;
+		timer_service_process(service, chiaki_time_now_monotonic_ms());
+		if(service->should_stop)
+			break;
+
+		uint64_t next = wheel_next_tick(service);
+		if(next == UINT64_MAX)
+		{
+			service->wakeup_tick = UINT64_MAX;
+			chiaki_cond_wait(&service->cond, &service->mutex);
+			continue;
+		}
+
+		uint64_t now = chiaki_time_now_monotonic_ms();
+		if(next <= now)
+			continue;
+		service->wakeup_tick = next;
+		chiaki_cond_timedwait(&service->cond, &service->mutex, next - now);
+	}
+	chiaki_mutex_unlock(&service->mutex);
+
+	thread_service = NULL;
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_service_init(ChiakiTimerService *service)
+{
+	for(size_t level=0; level<CHIAKI_TIMER_WHEEL_LEVELS; level++)
+	{
+		for(size_t slot=0; slot<CHIAKI_TIMER_WHEEL_SLOTS; slot++)
+			link_init(&service->wheel[level][slot]);
+		service->occupied[level] = 0;
+	}
+	service->now_tick = chiaki_time_now_monotonic_ms();
+	service->wakeup_tick = 0;
+	service->running = NULL;
+	service->cancel_waiters = 0;
+	service->should_stop = false;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&service->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	err = chiaki_cond_init(&service->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	err = chiaki_cond_init(&service->idle_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_cond;
+
+	err = chiaki_thread_create(&service->thread, timer_service_thread_func, service);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_idle_cond;
+
+	chiaki_thread_set_name(&service->thread, "Chiaki Timer");
+
+	return CHIAKI_ERR_SUCCESS;
+error_idle_cond:
+	chiaki_cond_fini(&service->idle_cond);
+error_cond:
+	chiaki_cond_fini(&service->cond);
+error_mutex:
+	chiaki_mutex_fini(&service->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_timer_service_fini(ChiakiTimerService *service)
+{
+	chiaki_mutex_lock(&service->mutex);
+	service->should_stop = true;
+	chiaki_cond_signal(&service->cond);
+	chiaki_mutex_unlock(&service->mutex);
+	chiaki_thread_join(&service->thread, NULL);
+
+#ifndef NDEBUG
+	for(size_t level=0; level<CHIAKI_TIMER_WHEEL_LEVELS; level++)
+		assert(!service->occupied[level]);
+#endif
+
+	chiaki_cond_fini(&service->idle_cond);
+	chiaki_cond_fini(&service->cond);
+	chiaki_mutex_fini(&service->mutex);
+}
+
+static ChiakiMutex shared_mutex;
+static bool shared_mutex_initialized = false;
+static ChiakiTimerService shared_service;
+static unsigned int shared_refs = 0;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_timer_service_shared_init()
+{
+	if(shared_mutex_initialized)
+		return CHIAKI_ERR_SUCCESS;
+	ChiakiErrorCode err = chiaki_mutex_init(&shared_mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	shared_mutex_initialized = true;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiTimerService *chiaki_timer_service_shared_ref()
+{
+	assert(shared_mutex_initialized);
+	chiaki_mutex_lock(&shared_mutex);
+	ChiakiTimerService *r = &shared_service;
+	if(!shared_refs && chiaki_timer_service_init(&shared_service) != CHIAKI_ERR_SUCCESS)
+		r = NULL;
+	else
+		shared_refs++;
+	chiaki_mutex_unlock(&shared_mutex);
+	return r;
+}
+
+CHIAKI_EXPORT void chiaki_timer_service_shared_unref(ChiakiTimerService *service)
+{
+	assert(service == &shared_service);
+	chiaki_mutex_lock(&shared_mutex);
+	assert(shared_refs);
+	if(!--shared_refs)
+		chiaki_timer_service_fini(&shared_service);
+	chiaki_mutex_unlock(&shared_mutex);
+}
+
+CHIAKI_EXPORT void chiaki_timer_init(ChiakiTimer *timer, ChiakiTimerService *service, ChiakiTimerCb cb, void *user)
+{
+	memset(timer, 0, sizeof(*timer));
+	timer->service = service;
+	timer->cb = cb;
+	timer->user = user;
+}
+
+CHIAKI_EXPORT void chiaki_timer_start(ChiakiTimer *timer, uint64_t delay_ms, uint64_t period_ms)
+{
+	ChiakiTimerService *service = timer->service;
+	uint64_t now = chiaki_time_now_monotonic_ms();
+	chiaki_mutex_lock(&service->mutex);
+	if(timer->pending)
+		wheel_remove(service, timer);
+	timer->expires_ms = now + delay_ms;
+	if(timer->expires_ms <= service->now_tick)
+		timer->expires_ms = service->now_tick + 1;
+	timer->period_ms = period_ms;
+	wheel_insert(service, timer);
+	if(timer->expires_ms < service->wakeup_tick)
+		chiaki_cond_signal(&service->cond);
+	chiaki_mutex_unlock(&service->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_timer_cancel(ChiakiTimer *timer)
+{
+	ChiakiTimerService *service = timer->service;
+	chiaki_mutex_lock(&service->mutex);
+	if(timer->pending)
+		wheel_remove(service, timer);
+	if(thread_service != service)
+	{
+		while(service->running == timer)
+		{
+			service->cancel_waiters++;
+			chiaki_cond_wait(&service->idle_cond, &service->mutex);
+			service->cancel_waiters--;
+			// the callback might have re-started it
+			if(timer->pending)
+				wheel_remove(service, timer);
+		}
+	}
+	chiaki_mutex_unlock(&service->mutex);
+}
+
+CHIAKI_EXPORT bool chiaki_timer_pending(ChiakiTimer *timer)
+{
+	ChiakiTimerService *service = timer->service;
+	chiaki_mutex_lock(&service->mutex);
+	bool r = timer->pending;
+	chiaki_mutex_unlock(&service->mutex);
+	return r;
+}
@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/trace.h>
+
+#if CHIAKI_LIB_ENABLE_TRACE
+
+#include <chiaki/atomic.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+#define TRACE_RING_MASK (CHIAKI_TRACE_RING_SIZE - 1)
+
+#if (CHIAKI_TRACE_RING_SIZE & TRACE_RING_MASK) != 0
+#error "CHIAKI_TRACE_RING_SIZE must be a power of 2"
+#endif
+
+#define TRACE_THREAD_NAME_SIZE 32
+
+// recorded by chiaki_trace_thread_name() so the names of previous owners of a ring survive its reuse
+#define TRACE_EVENT_THREAD_NAME ((ChiakiTraceEventType)(CHIAKI_TRACE_EVENT_INSTANT + 1))
+
+typedef struct trace_event_t
+{
+	uint64_t ts_ticks; // chiaki_time_ticks()
+	const char *name;
+	int64_t value;
+	uint32_t tid; // rings are reused, so the thread that recorded the event is kept per event
+	ChiakiTraceEventType type;
+} TraceEvent;
+
+typedef struct trace_ring_t
+{
+	struct trace_ring_t *next;
+	volatile uint32_t owned; // whether a running thread is recording into this ring
+	uint32_t tid; // of the current or last owner
+	char thread_name[TRACE_THREAD_NAME_SIZE];
+	volatile uint64_t head; // total number of events ever written, only written by the owning thread
+	TraceEvent events[CHIAKI_TRACE_RING_SIZE];
+} TraceRing;
+
+/**
+ * All rings ever created. Rings are never freed, but handed on to new threads
+ * once their owner exited, so the events of exited threads stay available until they are overwritten.
+ */
+static void *volatile trace_rings = NULL;
+static volatile uint32_t trace_tid_next = 1;
+static TRACE_THREAD_LOCAL TraceRing *trace_ring_local = NULL;
+
+static TraceRing *trace_ring_reuse()
+{
+	for(TraceRing *ring = chiaki_atomic_load_ptr(&trace_rings); ring; ring = ring->next)
+	{
+		uint32_t owned = 0;
+		if(chiaki_atomic_cas_u32(&ring->owned, &owned, 1))
+			return ring;
+	}
+	return NULL;
+}
+
+static TraceRing *trace_ring_get()
+{
+	if(trace_ring_local)
+		return trace_ring_local;
+	TraceRing *ring = trace_ring_reuse();
+	if(!ring)
+	{
+		ring = calloc(1, sizeof(TraceRing));
+		if(!ring)
+			return NULL;
+		ring->owned = 1;
+		void *head = chiaki_atomic_load_ptr(&trace_rings);
+		do
+			ring->next = head;
+		while(!chiaki_atomic_cas_ptr(&trace_rings, &head, ring));
+	}
+	ring->tid = chiaki_atomic_fetch_add_u32(&trace_tid_next, 1);
+	ring->thread_name[0] = '\0';
+	trace_ring_local = ring;
+	return ring;
+}
+
+CHIAKI_EXPORT void chiaki_trace_event(ChiakiTraceEventType type, const char *name, int64_t value)
+{
+	TraceRing *ring = trace_ring_get();
+	if(!ring)
+		return;
+	uint64_t head = ring->head; // we are the only writer
+	TraceEvent *event = &ring->events[head & TRACE_RING_MASK];
+	event->ts_ticks = chiaki_time_ticks();
+	event->name = name;
+	event->value = value;
+	event->tid = ring->tid;
+	event->type = type;
+	chiaki_atomic_store_u64(&ring->head, head + 1);
+}
+
+CHIAKI_EXPORT void chiaki_trace_thread_name(const char *name)
+{
+	TraceRing *ring = trace_ring_get();
+	if(!ring)
+		return;
+	strncpy(ring->thread_name, name, sizeof(ring->thread_name) - 1);
+	chiaki_trace_event(TRACE_EVENT_THREAD_NAME, name, 0);
+}
+
+CHIAKI_EXPORT void chiaki_trace_thread_exit()
+{
+	TraceRing *ring = trace_ring_local;
+	if(!ring)
+		return;
+	trace_ring_local = NULL;
+	chiaki_atomic_store_u32(&ring->owned, 0);
+}
+
+static void trace_write_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for(; *str; str++)
+	{
+		unsigned char c = (unsigned char)*str;
+		if(c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if(c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_trace_dump(FILE *f)
+{
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	bool first = true;
+	for(TraceRing *ring = chiaki_atomic_load_ptr(&trace_rings); ring; ring = ring->next)
+	{
+		if(ring->thread_name[0])
+		{
+			fprintf(f, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":", first ? "" : ",", (unsigned int)ring->tid);
+			trace_write_string(f, ring->thread_name);
+			fprintf(f, "}}");
+			first = false;
+		}
+
+		uint64_t head = chiaki_atomic_load_u64(&ring->head);
+		uint64_t i = head > CHIAKI_TRACE_RING_SIZE ? head - CHIAKI_TRACE_RING_SIZE : 0;
+		for(; i < head; i++)
+		{
+			TraceEvent *event = &ring->events[i & TRACE_RING_MASK];
+			if(!event->name)
+				continue;
+			if(event->type == TRACE_EVENT_THREAD_NAME)
+			{
+				if(event->tid == ring->tid)
+					continue; // already written from ring->thread_name
+				fprintf(f, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":", first ? "" : ",", (unsigned int)event->tid);
+				trace_write_string(f, event->name);
+				fprintf(f, "}}");
+				first = false;
+				continue;
+			}
+			static const char phases[] = { 'B', 'E', 'C', 'i' };
+			uint64_t ts_ns = chiaki_time_ticks_to_ns(event->ts_ticks);
+			fprintf(f, "%s\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,\"name\":",
+					first ? "" : ",",
+					phases[event->type],
+					(unsigned int)event->tid,
+					(unsigned long long)(ts_ns / 1000),
+					(unsigned int)(ts_ns % 1000));
+			trace_write_string(f, event->name);
+			switch(event->type)
+			{
+				case CHIAKI_TRACE_EVENT_COUNTER:
+					fprintf(f, ",\"args\":{\"value\":%lld}", (long long)event->value);
+					break;
+				case CHIAKI_TRACE_EVENT_INSTANT:
+					fprintf(f, ",\"s\":\"t\"");
+					break;
+				default:
+					break;
+			}
+			fputc('}', f);
+			first = false;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	return ferror(f) ? CHIAKI_ERR_UNKNOWN : CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_trace_dump_file(const char *filename)
+{
+	FILE *f = fopen(filename, "w");
+	if(!f)
+		return CHIAKI_ERR_UNKNOWN;
+	ChiakiErrorCode err = chiaki_trace_dump(f);
+	if(fclose(f) != 0 && err == CHIAKI_ERR_SUCCESS)
+		err = CHIAKI_ERR_UNKNOWN;
+	return err;
+}
+
+#endif
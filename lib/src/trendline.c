@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/trendline.h>
+
+#include <string.h>
+
+#define TRENDLINE_SMOOTHING 0.9
+
+CHIAKI_EXPORT void chiaki_trendline_init(ChiakiTrendline *trendline)
+{
+	memset(trendline, 0, sizeof(*trendline));
+}
+
+static double trendline_slope(ChiakiTrendline *trendline)
+{
+	double x_sum = 0.0;
+	double y_sum = 0.0;
+	for(size_t i=0; i<trendline->window_count; i++)
+	{
+		x_sum += trendline->window_x[i];
+		y_sum += trendline->window_y[i];
+	}
+	double x_avg = x_sum / trendline->window_count;
+	double y_avg = y_sum / trendline->window_count;
+
+	double numerator = 0.0;
+	double denominator = 0.0;
+	for(size_t i=0; i<trendline->window_count; i++)
+	{
+		double x = trendline->window_x[i] - x_avg;
+		numerator += x * (trendline->window_y[i] - y_avg);
+		denominator += x * x;
+	}
+	if(denominator == 0.0)
+		return trendline->trend;
+	return numerator / denominator;
+}
+
+CHIAKI_EXPORT void chiaki_trendline_update(ChiakiTrendline *trendline, uint64_t arrival_us, uint64_t send_us)
+{
+	if(!trendline->first_arrival_us)
+	{
+		trendline->first_arrival_us = arrival_us ? arrival_us : 1;
+		trendline->prev_arrival_us = arrival_us;
+		trendline->prev_send_us = send_us;
+		return;
+	}
+
+	int64_t arrival_delta_us = (int64_t)(arrival_us - trendline->prev_arrival_us);
+	int64_t send_delta_us = (int64_t)(send_us - trendline->prev_send_us);
+	trendline->prev_arrival_us = arrival_us;
+	trendline->prev_send_us = send_us;
+
+	trendline->deltas_count++;
+	trendline->accumulated_delay_ms += (double)(arrival_delta_us - send_delta_us) / 1000.0;
+	trendline->smoothed_delay_ms = TRENDLINE_SMOOTHING * trendline->smoothed_delay_ms
+		+ (1.0 - TRENDLINE_SMOOTHING) * trendline->accumulated_delay_ms;
+
+	trendline->window_x[trendline->window_next] = (double)(arrival_us - trendline->first_arrival_us) / 1000.0;
+	trendline->window_y[trendline->window_next] = trendline->smoothed_delay_ms;
+	trendline->window_next = (trendline->window_next + 1) % CHIAKI_TRENDLINE_WINDOW_SIZE;
+	if(trendline->window_count < CHIAKI_TRENDLINE_WINDOW_SIZE)
+		trendline->window_count++;
+
+	if(trendline->window_count == CHIAKI_TRENDLINE_WINDOW_SIZE)
+		trendline->trend = trendline_slope(trendline);
+}
+
+#define OVERUSE_TREND_GAIN 4.0
+#define OVERUSE_MAX_DELTAS 60
+#define OVERUSE_THRESHOLD_INIT 12.5
+#define OVERUSE_THRESHOLD_MIN 6.0
+#define OVERUSE_THRESHOLD_MAX 600.0
+#define OVERUSE_THRESHOLD_K_UP 0.0087
+#define OVERUSE_THRESHOLD_K_DOWN 0.039
+#define OVERUSE_THRESHOLD_MAX_STEP_MS 100
+#define OVERUSE_TIME_THRESHOLD_MS 10.0
+
+CHIAKI_EXPORT const char *chiaki_bandwidth_usage_string(ChiakiBandwidthUsage usage)
+{
+	switch(usage)
+	{
+		case CHIAKI_BANDWIDTH_USAGE_NORMAL:
+			return "normal";
+		case CHIAKI_BANDWIDTH_USAGE_UNDERUSING:
+			return "underusing";
+		case CHIAKI_BANDWIDTH_USAGE_OVERUSING:
+			return "overusing";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT void chiaki_overuse_detector_init(ChiakiOveruseDetector *detector)
+{
+	detector->threshold = OVERUSE_THRESHOLD_INIT;
+	detector->last_update_ms = 0;
+	detector->overuse_time_ms = 0.0;
+	detector->overuse_count = 0;
+	detector->prev_trend = 0.0;
+	detector->usage = CHIAKI_BANDWIDTH_USAGE_NORMAL;
+}
+
+static void overuse_detector_update_threshold(ChiakiOveruseDetector *detector, double modified_trend, uint64_t now_ms)
+{
+	if(!detector->last_update_ms)
+		detector->last_update_ms = now_ms;
+
+	double abs_trend = modified_trend < 0.0 ? -modified_trend : modified_trend;
+	// don't let single spikes, e.g. from a burst of retransmissions, move the threshold
+	if(abs_trend > detector->threshold + 15.0)
+	{
+		detector->last_update_ms = now_ms;
+		return;
+	}
+
+	double k = abs_trend < detector->threshold ? OVERUSE_THRESHOLD_K_DOWN : OVERUSE_THRESHOLD_K_UP;
+	uint64_t dt_ms = now_ms - detector->last_update_ms;
+	if(dt_ms > OVERUSE_THRESHOLD_MAX_STEP_MS)
+		dt_ms = OVERUSE_THRESHOLD_MAX_STEP_MS;
+	detector->threshold += k * (abs_trend - detector->threshold) * (double)dt_ms;
+	if(detector->threshold < OVERUSE_THRESHOLD_MIN)
+		detector->threshold = OVERUSE_THRESHOLD_MIN;
+	else if(detector->threshold > OVERUSE_THRESHOLD_MAX)
+		detector->threshold = OVERUSE_THRESHOLD_MAX;
+	detector->last_update_ms = now_ms;
+}
+
+CHIAKI_EXPORT ChiakiBandwidthUsage chiaki_overuse_detector_detect(ChiakiOveruseDetector *detector, double trend, uint64_t deltas_count, uint64_t now_ms)
+{
+	if(deltas_count < 2)
+		return detector->usage = CHIAKI_BANDWIDTH_USAGE_NORMAL;
+
+	double modified_trend = (double)(deltas_count < OVERUSE_MAX_DELTAS ? deltas_count : OVERUSE_MAX_DELTAS)
+		* trend * OVERUSE_TREND_GAIN;
+	double dt_ms = detector->last_update_ms ? (double)(now_ms - detector->last_update_ms) : 0.0;
+
+	if(modified_trend > detector->threshold)
+	{
+		// overuse must persist for a while and not be decreasing already
+		detector->overuse_time_ms += dt_ms;
+		detector->overuse_count++;
+		if(detector->overuse_time_ms > OVERUSE_TIME_THRESHOLD_MS && detector->overuse_count > 1
+			&& trend >= detector->prev_trend)
+		{
+			detector->overuse_time_ms = 0.0;
+			detector->overuse_count = 0;
+			detector->usage = CHIAKI_BANDWIDTH_USAGE_OVERUSING;
+		}
+	}
+	else if(modified_trend < -detector->threshold)
+	{
+		detector->overuse_time_ms = 0.0;
+		detector->overuse_count = 0;
+		detector->usage = CHIAKI_BANDWIDTH_USAGE_UNDERUSING;
+	}
+	else
+	{
+		detector->overuse_time_ms = 0.0;
+		detector->overuse_count = 0;
+		detector->usage = CHIAKI_BANDWIDTH_USAGE_NORMAL;
+	}
+
+	detector->prev_trend = trend;
+	overuse_detector_update_threshold(detector, modified_trend, now_ms);
+	return detector->usage;
+}
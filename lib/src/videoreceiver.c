@@ -2,6 +2,8 @@
 
 #include <chiaki/videoreceiver.h>
 #include <chiaki/session.h>
+#include <chiaki/trace.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 
@@ -48,6 +50,10 @@ CHIAKI_EXPORT void chiaki_video_receiver_stream_info(ChiakiVideoReceiver *video_
 		CHIAKI_LOGI(video_receiver->log, "  %zu: %ux%u", i, profile->width, profile->height);
 		//chiaki_log_hexdump(video_receiver->log, CHIAKI_LOG_DEBUG, profile->header, profile->header_sz);
 	}
+
+	unsigned int fps = video_receiver->session->connect_info.video_profile.max_fps;
+	if(fps)
+		chiaki_av_sync_set_frame_rate(&video_receiver->session->av_sync, CHIAKI_AV_SYNC_STREAM_VIDEO, fps, 1);
 }
 
 CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_receiver, ChiakiTakionAVPacket *packet)
@@ -94,7 +100,7 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 		if(chiaki_seq_num_16_gt(frame_index, next_frame_expected)
 			&& !(frame_index == 1 && video_receiver->frame_index_cur < 0)) // ok for frame 1
 		{
-			CHIAKI_LOGW(video_receiver->log, "Detected missing or corrupt frame(s) from %d to %d", next_frame_expected, (int)frame_index);
+			CHIAKI_LOGW_RL(video_receiver->log, "Detected missing or corrupt frame(s) from %d to %d", next_frame_expected, (int)frame_index);
 			stream_connection_send_corrupt_frame(&video_receiver->session->stream_connection, next_frame_expected, frame_index - 1);
 		}
 
@@ -115,7 +121,17 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 
 #define FLUSH_CORRUPT_FRAMES
 
+static ChiakiErrorCode video_receiver_flush_frame_impl(ChiakiVideoReceiver *video_receiver);
+
 static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *video_receiver)
+{
+	CHIAKI_TRACE_BEGIN("video_frame_flush");
+	ChiakiErrorCode err = video_receiver_flush_frame_impl(video_receiver);
+	CHIAKI_TRACE_END("video_frame_flush");
+	return err;
+}
+
+static ChiakiErrorCode video_receiver_flush_frame_impl(ChiakiVideoReceiver *video_receiver)
 {
 	uint8_t *frame;
 	size_t frame_size;
@@ -127,7 +143,7 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 #endif
 		)
 	{
-		CHIAKI_LOGW(video_receiver->log, "Failed to complete frame %d", (int)video_receiver->frame_index_cur);
+		CHIAKI_LOGW_RL(video_receiver->log, "Failed to complete frame %d", (int)video_receiver->frame_index_cur);
 		return CHIAKI_ERR_UNKNOWN;
 	}
 
@@ -135,6 +151,10 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 
 	bool succ = flush_result != CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
 
+	// the frame can be presented from now on, however long its units took to arrive
+	chiaki_av_sync_push(&video_receiver->session->av_sync, CHIAKI_AV_SYNC_STREAM_VIDEO,
+			(ChiakiSeqNum16)video_receiver->frame_index_cur, chiaki_time_now_monotonic_us());
+
 	if(video_receiver->session->video_sample_cb)
 	{
 		bool cb_succ = video_receiver->session->video_sample_cb(frame, frame_size, video_receiver->session->video_sample_cb_user);
@@ -148,7 +168,12 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 	video_receiver->frame_index_prev = video_receiver->frame_index_cur;
 
 	if(succ)
+	{
+		chiaki_session_startup_phase_done(video_receiver->session, CHIAKI_SESSION_STARTUP_PHASE_FIRST_FRAME); // no-op after the first frame
 		video_receiver->frame_index_prev_complete = video_receiver->frame_index_cur;
+		if(video_receiver->packet_stats)
+			chiaki_packet_stats_push_goodput(video_receiver->packet_stats, frame_size);
+	}
 
 	return CHIAKI_ERR_SUCCESS;
 }
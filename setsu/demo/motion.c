@@ -154,7 +154,8 @@ int main(int argc, const char *argv[])
 		if(dirty && !log_mode)
 			print_state();
 		dirty = false;
-		setsu_poll(setsu, event, NULL);
+		if(setsu_wait(setsu, -1))
+			setsu_poll(setsu, event, NULL);
 	}
 	setsu_free(setsu);
 	printf("\nさよなら!\n");
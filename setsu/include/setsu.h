@@ -4,6 +4,7 @@
 #define _SETSU_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -59,6 +60,11 @@ typedef uint64_t SetsuButton;
 typedef struct setsu_event_t
 {
 	SetsuEventType type;
+
+	/* Kernel time of the report that contained the event, in microseconds of CLOCK_MONOTONIC.
+	 * 0 for SETSU_EVENT_DEVICE_ADDED and SETSU_EVENT_DEVICE_REMOVED. */
+	uint64_t time_us;
+
 	union
 	{
 		struct
@@ -92,7 +98,22 @@ typedef void (*SetsuEventCb)(SetsuEvent *event, void *user);
 
 Setsu *setsu_new();
 void setsu_free(Setsu *setsu);
+
+/* Deliver all pending events.
+ * Only reads from the devices that have something to read, so it is cheap to call
+ * whenever the fd from setsu_get_fd() becomes readable. */
 void setsu_poll(Setsu *setsu, SetsuEventCb cb, void *user);
+
+/* Get an fd that becomes readable whenever setsu_poll() has new input or hotplug events to deliver,
+ * for integration into an event loop, so setsu_poll() does not have to be called on a timer.
+ * Returns -1 if unavailable, setsu_poll() must be called periodically then. */
+int setsu_get_fd(Setsu *setsu);
+
+/* Block until there is something for setsu_poll() or timeout_ms (-1 for infinite) has passed.
+ * Returns whether there is, false also if interrupted by a signal.
+ * Without the fd from setsu_get_fd(), this only sleeps, 4 ms for an infinite timeout, and returns true. */
+bool setsu_wait(Setsu *setsu, int timeout_ms);
+
 SetsuDevice *setsu_connect(Setsu *setsu, const char *path, SetsuDeviceType type);
 void setsu_disconnect(Setsu *setsu, SetsuDevice *dev);
 const char *setsu_device_get_path(SetsuDevice *dev);
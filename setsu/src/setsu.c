@@ -12,6 +12,9 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <math.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include <stdio.h>
 
@@ -25,6 +28,18 @@
 
 #define DEG2RAD (2.0f * M_PI / 360.0f)
 
+// ready fds taken at once by setsu_poll(), any others stay ready for the next call
+#define EPOLL_EVENTS_MAX 16
+
+// how often setsu_wait() without an epoll fd returns when asked to wait forever
+#define WAIT_FALLBACK_INTERVAL_MS 4
+
+// older kernel headers only have the timeval
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
 typedef struct setsu_avail_device_t
 {
 	struct setsu_avail_device_t *next;
@@ -43,6 +58,7 @@ typedef struct setsu_device_t
 	SetsuDeviceType type;
 	int fd;
 	struct libevdev *evdev;
+	bool dead; // read failed (usually ENODEV) and removed from epoll, waiting for udev to report it
 
 	union
 	{
@@ -86,6 +102,13 @@ struct setsu_t
 	struct udev_monitor *udev_mon;
 	SetsuAvailDevice *avail_dev;
 	SetsuDevice *dev;
+
+	/* Watches the udev monitor, pending_fd and all connected devices,
+	 * with the SetsuDevice as data for devices and NULL for the others. */
+	int epoll_fd;
+
+	/* eventfd signaling avail device events that did not come from the udev monitor, i.e. the initial scan */
+	int pending_fd;
 };
 
 bool get_dev_ids(const char *path, uint32_t *vendor_id, uint32_t *model_id);
@@ -95,13 +118,25 @@ static SetsuDevice *connect(Setsu *setsu, const char *path);
 static void disconnect(Setsu *setsu, SetsuDevice *dev);
 static void poll_device(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user);
 static void device_event(Setsu *setsu, SetsuDevice *dev, struct input_event *ev, SetsuEventCb cb, void *user);
-static void device_drain(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user);
+static void device_drain(Setsu *setsu, SetsuDevice *dev, uint64_t time_us, SetsuEventCb cb, void *user);
+
+static void epoll_add(Setsu *setsu, int fd, void *ptr)
+{
+	if(setsu->epoll_fd < 0)
+		return;
+	struct epoll_event ev = { 0 };
+	ev.events = EPOLLIN;
+	ev.data.ptr = ptr;
+	if(epoll_ctl(setsu->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		perror("setsu epoll_ctl");
+}
 
 Setsu *setsu_new()
 {
 	Setsu *setsu = calloc(1, sizeof(Setsu));
 	if(!setsu)
 		return NULL;
+	setsu->pending_fd = -1;
 
 	setsu->udev = udev_new();
 	if(!setsu->udev)
@@ -110,16 +145,39 @@ Setsu *setsu_new()
 		return NULL;
 	}
 
+	setsu->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(setsu->epoll_fd < 0)
+		SETSU_LOG("Failed to create epoll fd, setsu_get_fd() will not be available\n");
+	else
+	{
+		setsu->pending_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(setsu->pending_fd < 0)
+		{
+			SETSU_LOG("Failed to create eventfd, setsu_get_fd() will not be available\n");
+			close(setsu->epoll_fd);
+			setsu->epoll_fd = -1;
+		}
+		else
+			epoll_add(setsu, setsu->pending_fd, NULL);
+	}
+
 	setsu->udev_mon = udev_monitor_new_from_netlink(setsu->udev, "udev");
 	if(setsu->udev_mon)
 	{
 		udev_monitor_filter_add_match_subsystem_devtype(setsu->udev_mon, "input", NULL);
 		udev_monitor_enable_receiving(setsu->udev_mon);
+		epoll_add(setsu, udev_monitor_get_fd(setsu->udev_mon), NULL);
 	}
 	else
 		SETSU_LOG("Failed to create udev monitor\n");
 
 	scan_udev(setsu);
+	if(setsu->avail_dev && setsu->pending_fd >= 0)
+	{
+		uint64_t v = 1;
+		if(write(setsu->pending_fd, &v, sizeof(v)) != sizeof(v))
+			perror("setsu eventfd write");
+	}
 
 	return setsu;
 }
@@ -133,6 +191,10 @@ void setsu_free(Setsu *setsu)
 	if(setsu->udev_mon)
 		udev_monitor_unref(setsu->udev_mon);
 	udev_unref(setsu->udev);
+	if(setsu->pending_fd >= 0)
+		close(setsu->pending_fd);
+	if(setsu->epoll_fd >= 0)
+		close(setsu->epoll_fd);
 	while(setsu->avail_dev)
 	{
 		SetsuAvailDevice *adev = setsu->avail_dev;
@@ -360,6 +422,12 @@ SetsuDevice *setsu_connect(Setsu *setsu, const char *path, SetsuDeviceType type)
 			break;
 	}
 
+	// timestamps comparable to clock_gettime(CLOCK_MONOTONIC) instead of jumping with the wall clock
+	if(libevdev_set_clock_id(dev->evdev, CLOCK_MONOTONIC) < 0)
+		SETSU_LOG("Failed to set clock of %s to monotonic\n", dev->path);
+
+	epoll_add(setsu, dev->fd, dev);
+
 	dev->next = setsu->dev;
 	setsu->dev = dev;
 	return dev;
@@ -388,6 +456,8 @@ void setsu_disconnect(Setsu *setsu, SetsuDevice *dev)
 			}
 		}
 	}
+	if(setsu->epoll_fd >= 0 && !dev->dead)
+		epoll_ctl(setsu->epoll_fd, EPOLL_CTL_DEL, dev->fd, NULL);
 	libevdev_free(dev->evdev);
 	close(dev->fd);
 	free(dev->path);
@@ -444,9 +514,45 @@ void kill_avail_device(Setsu *setsu, SetsuAvailDevice *adev)
 	free(adev);
 }
 
+int setsu_get_fd(Setsu *setsu)
+{
+	return setsu->epoll_fd;
+}
+
+bool setsu_wait(Setsu *setsu, int timeout_ms)
+{
+	if(setsu->epoll_fd < 0)
+	{
+		// nothing to wait on, behave like a timer so callers don't spin
+		if(timeout_ms < 0)
+			timeout_ms = WAIT_FALLBACK_INTERVAL_MS;
+		if(timeout_ms > 0)
+			usleep((useconds_t)timeout_ms * 1000);
+		return true;
+	}
+	struct epoll_event ev;
+	return epoll_wait(setsu->epoll_fd, &ev, 1, timeout_ms) > 0;
+}
+
+static bool device_connected(Setsu *setsu, SetsuDevice *dev)
+{
+	for(SetsuDevice *d = setsu->dev; d; d = d->next)
+	{
+		if(d == dev)
+			return true;
+	}
+	return false;
+}
+
 void setsu_poll(Setsu *setsu, SetsuEventCb cb, void *user)
 {
 	poll_udev_monitor(setsu);
+	if(setsu->pending_fd >= 0)
+	{
+		uint64_t v;
+		if(read(setsu->pending_fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+			perror("setsu eventfd read");
+	}
 
 	for(SetsuAvailDevice *adev = setsu->avail_dev; adev;)
 	{
@@ -475,8 +581,26 @@ void setsu_poll(Setsu *setsu, SetsuEventCb cb, void *user)
 		adev = adev->next;
 	}
 
-	for(SetsuDevice *dev = setsu->dev; dev; dev = dev->next)
+	if(setsu->epoll_fd < 0)
+	{
+		for(SetsuDevice *dev = setsu->dev; dev; dev = dev->next)
+		{
+			if(!dev->dead)
+				poll_device(setsu, dev, cb, user);
+		}
+		return;
+	}
+
+	struct epoll_event events[EPOLL_EVENTS_MAX];
+	int events_count = epoll_wait(setsu->epoll_fd, events, EPOLL_EVENTS_MAX, 0);
+	for(int i=0; i<events_count; i++)
+	{
+		SetsuDevice *dev = events[i].data.ptr;
+		// the callback might have disconnected it in the meantime
+		if(!dev || !device_connected(setsu, dev))
+			continue;
 		poll_device(setsu, dev, cb, user);
+	}
 }
 
 static void poll_device(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user)
@@ -499,12 +623,19 @@ static void poll_device(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *u
 			device_event(setsu, dev, &ev, cb, user);
 		else if(r == LIBEVDEV_READ_STATUS_SYNC)
 			sync = true;
-		else if(r == -ENODEV) { break; } // device probably disconnected, udev remove event should follow soon
 		else
 		{
-			char buf[256];
-			strerror_r(-r, buf, sizeof(buf));
-			SETSU_LOG("evdev poll failed: %s\n", buf);
+			// ENODEV: device probably disconnected, udev remove event should follow soon
+			if(r != -ENODEV)
+			{
+				char buf[256];
+				strerror_r(-r, buf, sizeof(buf));
+				SETSU_LOG("evdev poll failed: %s\n", buf);
+			}
+			// either way, the fd would stay ready and wake up every epoll_wait(), failing again
+			if(setsu->epoll_fd >= 0)
+				epoll_ctl(setsu->epoll_fd, EPOLL_CTL_DEL, dev->fd, NULL);
+			dev->dead = true;
 			break;
 		}
 	}
@@ -531,7 +662,7 @@ static void device_event(Setsu *setsu, SetsuDevice *dev, struct input_event *ev,
 #endif
 	if(ev->type == EV_SYN && ev->code == SYN_REPORT)
 	{
-		device_drain(setsu, dev, cb, user);
+		device_drain(setsu, dev, (uint64_t)ev->input_event_sec * 1000000 + (uint64_t)ev->input_event_usec, cb, user);
 		return;
 	}
 	switch(dev->type)
@@ -631,10 +762,10 @@ static void device_event(Setsu *setsu, SetsuDevice *dev, struct input_event *ev,
 	}
 }
 
-static void device_drain(Setsu *setsu, SetsuDevice *dev, SetsuEventCb cb, void *user)
+static void device_drain(Setsu *setsu, SetsuDevice *dev, uint64_t time_us, SetsuEventCb cb, void *user)
 {
 	SetsuEvent event;
-#define BEGIN_EVENT(tp) do { memset(&event, 0, sizeof(event)); event.dev = dev; event.type = tp; } while(0)
+#define BEGIN_EVENT(tp) do { memset(&event, 0, sizeof(event)); event.dev = dev; event.type = tp; event.time_us = time_us; } while(0)
 #define SEND_EVENT() do { cb(&event, user); } while (0)
 	switch(dev->type)
 	{
@@ -17,11 +17,16 @@
 #include "io.h"
 #include "settings.h"
 
+// samples per channel passed to IO::AudioCB at once, two frames of 10ms at 48kHz,
+// to halve the SDL_QueueAudio() calls on the thread that plays out the audio
+#define AUDIO_BATCH_SAMPLES 960
+
 class DiscoveryManager;
 static void Discovery(ChiakiDiscoveryHost *, void *);
 static void InitAudioCB(unsigned int channels, unsigned int rate, void *user);
 static bool VideoCB(uint8_t *buf, size_t buf_size, void *user);
 static void AudioCB(int16_t *buf, size_t samples_count, void *user);
+static void AudioBatchCB(void *buf, size_t samples_count, void *user);
 static void EventCB(ChiakiEvent *event, void *user);
 static void RegistEventCB(ChiakiRegistEvent *event, void *user);
 
@@ -87,6 +92,8 @@ class Host
 		bool session_init = false;
 		ChiakiSession session;
 		ChiakiOpusDecoder opus_decoder;
+		// two batches of stereo samples for opus_decoder
+		int16_t audio_batch_mem[AUDIO_BATCH_SAMPLES * 2 * 2];
 		ChiakiConnectVideoProfile video_profile;
 		friend class Settings;
 		friend class DiscoveryManager;
@@ -25,6 +25,12 @@ static void AudioCB(int16_t *buf, size_t samples_count, void *user)
 	io->AudioCB(buf, samples_count);
 }
 
+static void AudioBatchCB(void *buf, size_t samples_count, void *user)
+{
+	IO *io = (IO *)user;
+	io->AudioCB((int16_t *)buf, samples_count);
+}
+
 static void EventCB(ChiakiEvent *event, void *user)
 {
 	Host *host = (Host *)user;
@@ -156,6 +162,10 @@ int Host::InitSession(IO *user)
 	this->session_init = true;
 	// audio setting_cb and frame_cb
 	chiaki_opus_decoder_set_cb(&this->opus_decoder, InitAudioCB, AudioCB, user);
+	// queue a few frames at once, the sink is called from the thread playing out the audio jitter buffer,
+	// which has to keep the pace of the frames and shouldn't spend its time in SDL_QueueAudio()
+	chiaki_opus_decoder_set_batch(&this->opus_decoder, CHIAKI_OPUS_DECODER_FORMAT_S16,
+		this->audio_batch_mem, sizeof(this->audio_batch_mem), AUDIO_BATCH_SAMPLES, AudioBatchCB);
 	chiaki_opus_decoder_get_sink(&this->opus_decoder, &audio_sink);
 	chiaki_session_set_audio_sink(&this->session, &audio_sink);
 	chiaki_session_set_video_sample_cb(&this->session, VideoCB, user);
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audioreceiver.h>
+#include <chiaki/session.h>
+
+#include <stdlib.h>
+
+#include "test_log.h"
+
+#define FEC_UNITS 2
+
+/**
+ * Feed a packet carrying frame_index as its single source unit and the FEC_UNITS frames before it as FEC units,
+ * like the audio packets of the stream.
+ */
+static void push_packet(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index)
+{
+	uint8_t data[1 + FEC_UNITS];
+	data[0] = (uint8_t)frame_index;
+	for(size_t i = 0; i < FEC_UNITS; i++)
+		data[1 + i] = (uint8_t)(frame_index - FEC_UNITS + i);
+
+	ChiakiTakionAVPacket packet = { 0 };
+	packet.codec = 5;
+	packet.frame_index = frame_index;
+	packet.units_in_frame_total = 1 + FEC_UNITS;
+	packet.units_in_frame_fec = (1 << 8) | (FEC_UNITS << 4) | 1; // unit size 1, FEC_UNITS fec units, 1 source unit
+	packet.data = data;
+	packet.data_size = sizeof(data);
+	chiaki_audio_receiver_av_packet(audio_receiver, &packet);
+}
+
+static bool frame_marked(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index)
+{
+	ChiakiSeqNum16 age = audio_receiver->frame_window_end - frame_index;
+	munit_assert_uint16(age, <, CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE);
+	return (audio_receiver->frame_window_received >> age) & 1;
+}
+
+static MunitResult test_fec_window(const MunitParameter params[], void *user)
+{
+	ChiakiSession *session = calloc(1, sizeof(ChiakiSession));
+	munit_assert_not_null(session);
+	session->log = get_test_log();
+	ChiakiErrorCode err = chiaki_av_sync_init(&session->av_sync);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiAudioReceiver audio_receiver;
+	err = chiaki_audio_receiver_init(&audio_receiver, session, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// frames before the first one are not counted as missed
+	push_packet(&audio_receiver, 10);
+	push_packet(&audio_receiver, 11);
+	munit_assert_uint64(audio_receiver.frames_recovered, ==, 0);
+	munit_assert_uint64(audio_receiver.frames_missed, ==, 0);
+
+	// packets of 12 and 13 lost, both recovered from the fec units of 14
+	push_packet(&audio_receiver, 14);
+	munit_assert_uint64(audio_receiver.frames_recovered, ==, 2);
+	munit_assert_true(frame_marked(&audio_receiver, 12));
+	munit_assert_true(frame_marked(&audio_receiver, 13));
+
+	// a duplicate recovers nothing again
+	push_packet(&audio_receiver, 14);
+	munit_assert_uint64(audio_receiver.frames_recovered, ==, 2);
+
+	// packets of 16, 17 and 18 lost, only 17 and 18 are covered by the fec units of 19
+	push_packet(&audio_receiver, 15);
+	push_packet(&audio_receiver, 19);
+	munit_assert_uint64(audio_receiver.frames_recovered, ==, 4);
+	munit_assert_true(frame_marked(&audio_receiver, 15));
+	munit_assert_false(frame_marked(&audio_receiver, 16));
+	munit_assert_true(frame_marked(&audio_receiver, 17));
+	munit_assert_true(frame_marked(&audio_receiver, 18));
+	munit_assert_true(frame_marked(&audio_receiver, 19));
+
+	// 16 is only counted as missed once it leaves the window
+	ChiakiSeqNum16 frame_index = 20;
+	for(; frame_index < 16 + CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE; frame_index++)
+		push_packet(&audio_receiver, frame_index);
+	munit_assert_uint64(audio_receiver.frames_missed, ==, 0);
+	munit_assert_false(frame_marked(&audio_receiver, 16));
+	push_packet(&audio_receiver, frame_index);
+	munit_assert_uint64(audio_receiver.frames_missed, ==, 1);
+	munit_assert_uint64(audio_receiver.frames_recovered, ==, 4);
+
+	// a jump beyond the window misses everything pushed out of it right away, the fec units are still recovered
+	frame_index += CHIAKI_AUDIO_RECEIVER_WINDOW_SIZE + 10;
+	push_packet(&audio_receiver, frame_index);
+	munit_assert_uint64(audio_receiver.frames_recovered, ==, 4 + FEC_UNITS);
+	munit_assert_uint64(audio_receiver.frames_missed, ==, 1 + 10);
+	munit_assert_true(frame_marked(&audio_receiver, frame_index - 1));
+	munit_assert_true(frame_marked(&audio_receiver, frame_index - 2));
+	munit_assert_false(frame_marked(&audio_receiver, frame_index - 3));
+
+	chiaki_audio_receiver_fini(&audio_receiver);
+	chiaki_av_sync_fini(&session->av_sync);
+	free(session);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_receiver[] = {
+	{
+		"/fec_window",
+		test_fec_window,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
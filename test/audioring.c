@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audioring.h>
+
+static MunitResult test_buffering(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	ChiakiErrorCode err = chiaki_audio_ring_init(&ring, 1, 48000, 16, 4);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	int16_t in[] = { 1, 2, 3, 4 };
+	int16_t out[4];
+
+	// nothing is played before the target is reached
+	munit_assert_size(chiaki_audio_ring_write(&ring, in, 3), ==, 3);
+	munit_assert_size(chiaki_audio_ring_read(&ring, out, 4), ==, 0);
+	munit_assert_int16(out[0], ==, 0);
+	munit_assert_int16(out[3], ==, 0);
+
+	// fill is exactly at the target, so this is a plain copy
+	munit_assert_size(chiaki_audio_ring_write(&ring, in + 3, 1), ==, 1);
+	munit_assert_size(chiaki_audio_ring_read(&ring, out, 2), ==, 2);
+	munit_assert_int16(out[0], ==, 1);
+	munit_assert_int16(out[1], ==, 2);
+	munit_assert_size(chiaki_audio_ring_fill(&ring), ==, 2);
+
+	// the last frame can't be interpolated, so it runs empty
+	munit_assert_size(chiaki_audio_ring_read(&ring, out, 4), ==, 2);
+	munit_assert_int16(out[0], ==, 3);
+	munit_assert_int16(out[1], ==, 4);
+	munit_assert_int16(out[2], ==, 0);
+	munit_assert_int16(out[3], ==, 0);
+
+	ChiakiAudioRingStats stats;
+	chiaki_audio_ring_stats(&ring, &stats);
+	munit_assert_uint64(stats.underruns, ==, 1);
+	munit_assert_uint64(stats.overflow_frames, ==, 0);
+
+	// buffering up again after the underrun
+	munit_assert_size(chiaki_audio_ring_read(&ring, out, 4), ==, 0);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+static MunitResult test_overflow(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	ChiakiErrorCode err = chiaki_audio_ring_init(&ring, 2, 48000, 5, 2);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(ring.size, ==, 8);
+
+	int16_t in[2 * 10] = { 0 };
+	munit_assert_size(chiaki_audio_ring_write(&ring, in, 10), ==, 8);
+	munit_assert_size(chiaki_audio_ring_write(&ring, in, 1), ==, 0);
+
+	ChiakiAudioRingStats stats;
+	chiaki_audio_ring_stats(&ring, &stats);
+	munit_assert_uint64(stats.overflow_frames, ==, 3);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+#define DRIFT_RATE 48000
+#define DRIFT_PERIOD 480
+#define DRIFT_TARGET 960
+
+static MunitResult test_drift(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	ChiakiErrorCode err = chiaki_audio_ring_init(&ring, 2, DRIFT_RATE, 4096, DRIFT_TARGET);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	static int16_t in[2 * (DRIFT_PERIOD + 1)];
+	static int16_t out[2 * DRIFT_PERIOD];
+	for(size_t i = 0; i < sizeof(in) / sizeof(in[0]); i++)
+		in[i] = 1000;
+
+	// the sender's clock runs about 0.2% faster than the local device
+	for(size_t i = 0; i < 2000; i++)
+	{
+		chiaki_audio_ring_write(&ring, in, DRIFT_PERIOD + 1);
+		size_t played = chiaki_audio_ring_read(&ring, out, DRIFT_PERIOD);
+		if(i < 2)
+			continue;
+		munit_assert_size(played, ==, DRIFT_PERIOD);
+		munit_assert_int16(out[0], ==, 1000);
+		munit_assert_int16(out[2 * DRIFT_PERIOD - 1], ==, 1000);
+	}
+
+	ChiakiAudioRingStats stats;
+	chiaki_audio_ring_stats(&ring, &stats);
+	munit_assert_uint64(stats.overflow_frames, ==, 0);
+	munit_assert_uint64(stats.underruns, ==, 0);
+	munit_assert_double(stats.ratio, >, 1.001);
+	munit_assert_double(stats.ratio, <=, 1.0 + CHIAKI_AUDIO_RING_RATIO_MAX);
+
+	// latency settles above the target, but not far from it
+	uint64_t target_us = (uint64_t)DRIFT_TARGET * 1000000 / DRIFT_RATE;
+	munit_assert_uint64(stats.latency_us, >, target_us);
+	munit_assert_uint64(stats.latency_us, <, target_us * 3 / 2);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_ring[] = {
+	{
+		"/buffering",
+		test_buffering,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/overflow",
+		test_overflow,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/drift",
+		test_drift,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
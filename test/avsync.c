@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/avsync.h>
+
+#define AUDIO_FPS 100
+#define VIDEO_FPS 60
+
+// sender time of a frame, exact to the microsecond like the time of an actual clock
+#define AUDIO_FRAME_TIME_US(i) ((i) * 1000000 / AUDIO_FPS)
+#define VIDEO_FRAME_TIME_US(i) ((i) * 1000000 / VIDEO_FPS)
+
+/**
+ * Push frames of both streams for one second, arriving transit_us after they were sent,
+ * with every third frame delayed by another jitter_us.
+ */
+static void push_second(ChiakiAVSync *sync, uint64_t audio_transit_us, uint64_t video_transit_us, uint64_t jitter_us)
+{
+	for(uint64_t i = 0; i < AUDIO_FPS; i++)
+		chiaki_av_sync_push(sync, CHIAKI_AV_SYNC_STREAM_AUDIO, (ChiakiSeqNum16)i,
+				AUDIO_FRAME_TIME_US(i) + audio_transit_us + (i % 3 ? 0 : jitter_us));
+	for(uint64_t i = 0; i < VIDEO_FPS; i++)
+		chiaki_av_sync_push(sync, CHIAKI_AV_SYNC_STREAM_VIDEO, (ChiakiSeqNum16)i,
+				VIDEO_FRAME_TIME_US(i) + video_transit_us + (i % 3 ? 0 : jitter_us));
+}
+
+static MunitResult test_aligned(const MunitParameter params[], void *user)
+{
+	ChiakiAVSync sync;
+	ChiakiErrorCode err = chiaki_av_sync_init(&sync);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiAVSyncCorrection correction;
+	chiaki_av_sync_correction(&sync, &correction);
+	munit_assert_false(correction.valid);
+
+	// no frame rate yet, so nothing is taken
+	push_second(&sync, 5000, 5000, 0);
+	chiaki_av_sync_correction(&sync, &correction);
+	munit_assert_false(correction.valid);
+
+	chiaki_av_sync_set_frame_rate(&sync, CHIAKI_AV_SYNC_STREAM_AUDIO, AUDIO_FPS, 1);
+	chiaki_av_sync_set_frame_rate(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, VIDEO_FPS, 1);
+	chiaki_av_sync_set_playout_delay(&sync, CHIAKI_AV_SYNC_STREAM_AUDIO, 30000, 0);
+	chiaki_av_sync_set_playout_delay(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, 30000, 0);
+	push_second(&sync, 5000, 5000, 50000);
+
+	// the jitter does not matter, and aligned streams are left alone
+	chiaki_av_sync_correction(&sync, &correction);
+	munit_assert_true(correction.valid);
+	munit_assert_int64(correction.skew_us, ==, 0);
+	for(size_t i = 0; i < CHIAKI_AV_SYNC_STREAMS_COUNT; i++)
+	{
+		munit_assert_uint64(correction.delay_us[i], ==, 0);
+		munit_assert_uint64(correction.drop_us[i], ==, 0);
+	}
+
+	// still within the bound
+	chiaki_av_sync_set_playout_delay(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, 60000, 20000);
+	chiaki_av_sync_correction(&sync, &correction);
+	munit_assert_int64(correction.skew_us, ==, -30000);
+	munit_assert_uint64(correction.delay_us[CHIAKI_AV_SYNC_STREAM_AUDIO], ==, 0);
+	munit_assert_uint64(correction.drop_us[CHIAKI_AV_SYNC_STREAM_VIDEO], ==, 0);
+
+	chiaki_av_sync_fini(&sync);
+	return MUNIT_OK;
+}
+
+static MunitResult test_skew(const MunitParameter params[], void *user)
+{
+	ChiakiAVSync sync;
+	ChiakiErrorCode err = chiaki_av_sync_init(&sync);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	chiaki_av_sync_set_frame_rate(&sync, CHIAKI_AV_SYNC_STREAM_AUDIO, AUDIO_FPS, 1);
+	chiaki_av_sync_set_frame_rate(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, VIDEO_FPS, 1);
+
+	// audio takes 20ms longer through the network and another 50ms through the frontend
+	chiaki_av_sync_set_playout_delay(&sync, CHIAKI_AV_SYNC_STREAM_AUDIO, 80000, 0);
+	chiaki_av_sync_set_playout_delay(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, 30000, 0);
+	push_second(&sync, 25000, 5000, 10000);
+
+	ChiakiAVSyncCorrection correction;
+	chiaki_av_sync_correction(&sync, &correction);
+	munit_assert_true(correction.valid);
+	munit_assert_int64(correction.skew_us, ==, 70000);
+	munit_assert_uint64(correction.delay_us[CHIAKI_AV_SYNC_STREAM_VIDEO], ==, 70000);
+	munit_assert_uint64(correction.delay_us[CHIAKI_AV_SYNC_STREAM_AUDIO], ==, 0);
+	munit_assert_uint64(correction.drop_us[CHIAKI_AV_SYNC_STREAM_AUDIO], ==, 0);
+
+	// dropping buffered audio is preferred over delaying video
+	chiaki_av_sync_set_playout_delay(&sync, CHIAKI_AV_SYNC_STREAM_AUDIO, 80000, 50000);
+	chiaki_av_sync_correction(&sync, &correction);
+	munit_assert_uint64(correction.drop_us[CHIAKI_AV_SYNC_STREAM_AUDIO], ==, 50000);
+	munit_assert_uint64(correction.delay_us[CHIAKI_AV_SYNC_STREAM_VIDEO], ==, 20000);
+
+	chiaki_av_sync_set_bound(&sync, 100000);
+	chiaki_av_sync_correction(&sync, &correction);
+	munit_assert_int64(correction.skew_us, ==, 70000);
+	munit_assert_uint64(correction.drop_us[CHIAKI_AV_SYNC_STREAM_AUDIO], ==, 0);
+	munit_assert_uint64(correction.delay_us[CHIAKI_AV_SYNC_STREAM_VIDEO], ==, 0);
+
+	chiaki_av_sync_fini(&sync);
+	return MUNIT_OK;
+}
+
+static MunitResult test_wrap(const MunitParameter params[], void *user)
+{
+	ChiakiAVSync sync;
+	ChiakiErrorCode err = chiaki_av_sync_init(&sync);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	chiaki_av_sync_set_frame_rate(&sync, CHIAKI_AV_SYNC_STREAM_AUDIO, AUDIO_FPS, 1);
+	chiaki_av_sync_set_frame_rate(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, VIDEO_FPS, 1);
+
+	// audio indices wrap around after about 11 minutes
+	for(uint64_t i = 0; i < 0x10000 + 200; i++)
+		chiaki_av_sync_push(&sync, CHIAKI_AV_SYNC_STREAM_AUDIO, (ChiakiSeqNum16)i, AUDIO_FRAME_TIME_US(i) + 5000);
+	uint64_t video_start = 0x10000 * VIDEO_FPS / AUDIO_FPS;
+	for(uint64_t i = 0; i < video_start + 100; i++)
+	{
+		if(i >= video_start)
+			chiaki_av_sync_push(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, (ChiakiSeqNum16)i, VIDEO_FRAME_TIME_US(i) + 5000);
+		else if(!i)
+			chiaki_av_sync_push(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, 0, 5000);
+		else if(i % 0x1000 == 0)
+			chiaki_av_sync_push(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, (ChiakiSeqNum16)i, VIDEO_FRAME_TIME_US(i) + 5000);
+	}
+
+	ChiakiAVSyncCorrection correction;
+	chiaki_av_sync_correction(&sync, &correction);
+	munit_assert_true(correction.valid);
+	munit_assert_int64(correction.skew_us, ==, 0);
+
+	chiaki_av_sync_fini(&sync);
+	return MUNIT_OK;
+}
+
+static MunitResult test_long(const MunitParameter params[], void *user)
+{
+	ChiakiAVSync sync;
+	ChiakiErrorCode err = chiaki_av_sync_init(&sync);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// 48 kHz audio in frames of 480 samples, 60 fps video whose frames don't last a whole number of microseconds
+	chiaki_av_sync_set_frame_rate(&sync, CHIAKI_AV_SYNC_STREAM_AUDIO, 48000, 480);
+	chiaki_av_sync_set_frame_rate(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, VIDEO_FPS, 1);
+
+	// half an hour of aligned streams, long enough for 16666 us per frame to drift off by over 70 ms
+	uint64_t seconds = 30 * 60;
+	for(uint64_t i = 0; i < seconds * AUDIO_FPS; i++)
+		chiaki_av_sync_push(&sync, CHIAKI_AV_SYNC_STREAM_AUDIO, (ChiakiSeqNum16)i, AUDIO_FRAME_TIME_US(i) + 5000);
+	for(uint64_t i = 0; i < seconds * VIDEO_FPS; i++)
+		chiaki_av_sync_push(&sync, CHIAKI_AV_SYNC_STREAM_VIDEO, (ChiakiSeqNum16)i, VIDEO_FRAME_TIME_US(i) + 5000);
+
+	ChiakiAVSyncCorrection correction;
+	chiaki_av_sync_correction(&sync, &correction);
+	munit_assert_true(correction.valid);
+	munit_assert_int64(correction.skew_us, ==, 0);
+	munit_assert_uint64(correction.delay_us[CHIAKI_AV_SYNC_STREAM_AUDIO], ==, 0);
+	munit_assert_uint64(correction.delay_us[CHIAKI_AV_SYNC_STREAM_VIDEO], ==, 0);
+
+	chiaki_av_sync_fini(&sync);
+	return MUNIT_OK;
+}
+
+MunitTest tests_av_sync[] = {
+	{
+		"/aligned",
+		test_aligned,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/skew",
+		test_skew,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/wrap",
+		test_wrap,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/long",
+		test_long,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/executor.h>
+#include <chiaki/atomic.h>
+
+#include <stdlib.h>
+
+#define FAN_OUT 8
+#define DEPTH 4 // => 8^0 + ... + 8^4 tasks
+
+typedef struct executor_test_t
+{
+	ChiakiExecutor *executor;
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	volatile uint64_t done;
+	uint64_t expected;
+} ExecutorTest;
+
+typedef struct executor_test_task_t
+{
+	ExecutorTest *test;
+	unsigned int depth;
+} ExecutorTestTask;
+
+static ExecutorTestTask *tasks;
+static volatile uint64_t tasks_next;
+
+static void task_done(ExecutorTest *test)
+{
+	if(chiaki_atomic_fetch_add_u64(&test->done, 1) + 1 != test->expected)
+		return;
+	chiaki_mutex_lock(&test->mutex);
+	chiaki_cond_signal(&test->cond);
+	chiaki_mutex_unlock(&test->mutex);
+}
+
+static void fan_out_cb(void *user)
+{
+	ExecutorTestTask *task = user;
+	if(task->depth < DEPTH)
+	{
+		for(size_t i=0; i<FAN_OUT; i++)
+		{
+			ExecutorTestTask *child = &tasks[chiaki_atomic_fetch_add_u64(&tasks_next, 1)];
+			child->test = task->test;
+			child->depth = task->depth + 1;
+			ChiakiErrorCode err = chiaki_executor_submit(task->test->executor, fan_out_cb, child);
+			munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		}
+	}
+	task_done(task->test);
+}
+
+static bool all_done(void *user)
+{
+	ExecutorTest *test = user;
+	return chiaki_atomic_load_u64(&test->done) == test->expected;
+}
+
+static MunitResult test_fan_out(const MunitParameter params[], void *user)
+{
+	ChiakiExecutor executor;
+	ChiakiErrorCode err = chiaki_executor_init(&executor, 4);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(executor.workers_count, ==, 4);
+
+	ExecutorTest test;
+	test.executor = &executor;
+	test.done = 0;
+	test.expected = 0;
+	uint64_t level = 1;
+	for(size_t i=0; i<=DEPTH; i++, level *= FAN_OUT)
+		test.expected += level;
+	chiaki_mutex_init(&test.mutex, false);
+	chiaki_cond_init(&test.cond);
+
+	tasks = calloc(test.expected, sizeof(ExecutorTestTask));
+	munit_assert_not_null(tasks);
+	tasks_next = 1;
+	tasks[0].test = &test;
+	tasks[0].depth = 0;
+
+	// the root task queues everything on a single worker, the others have to steal to take part
+	err = chiaki_executor_submit(&executor, fan_out_cb, &tasks[0]);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	chiaki_mutex_lock(&test.mutex);
+	err = chiaki_cond_timedwait_pred(&test.cond, &test.mutex, 10000, all_done, &test);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_mutex_unlock(&test.mutex);
+	munit_assert_uint64(tasks_next, ==, test.expected);
+	munit_assert_uint64(chiaki_atomic_load_u64(&executor.pending), ==, 0);
+
+	chiaki_executor_fini(&executor);
+	chiaki_cond_fini(&test.cond);
+	chiaki_mutex_fini(&test.mutex);
+	free(tasks);
+	return MUNIT_OK;
+}
+
+static void count_cb(void *user)
+{
+	task_done(user);
+}
+
+static MunitResult test_submit_external(const MunitParameter params[], void *user)
+{
+	ChiakiExecutor executor;
+	ChiakiErrorCode err = chiaki_executor_init(&executor, 3);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ExecutorTest test;
+	test.executor = &executor;
+	test.done = 0;
+	test.expected = 1000;
+	chiaki_mutex_init(&test.mutex, false);
+	chiaki_cond_init(&test.cond);
+
+	// enough to grow the deques beyond their initial size
+	for(size_t i=0; i<test.expected; i++)
+	{
+		err = chiaki_executor_submit(&executor, count_cb, &test);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+
+	chiaki_mutex_lock(&test.mutex);
+	err = chiaki_cond_timedwait_pred(&test.cond, &test.mutex, 10000, all_done, &test);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_mutex_unlock(&test.mutex);
+
+	chiaki_executor_fini(&executor);
+	chiaki_cond_fini(&test.cond);
+	chiaki_mutex_fini(&test.mutex);
+	return MUNIT_OK;
+}
+
+MunitTest tests_executor[] = {
+	{
+		"/fan_out",
+		test_fan_out,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/submit_external",
+		test_submit_external,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
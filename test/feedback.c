@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/feedback.h>
+#include <chiaki/controller.h>
+#include <chiaki/feedbacksender.h>
+#include <chiaki/stoppipe.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+#include "test_log.h"
+
+#define HISTORY_SIZE 0x10
+
+static MunitResult test_history_buffer(const MunitParameter params[], void *user)
+{
+	ChiakiFeedbackHistoryBuffer history;
+	ChiakiErrorCode err = chiaki_feedback_history_buffer_init(&history, HISTORY_SIZE);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	size_t size;
+	chiaki_feedback_history_buffer_bytes(&history, &size);
+	munit_assert_size(size, ==, 0);
+
+	// mixed event lengths, far beyond the size so the oldest events fall out and the bytes get compacted a few times
+	ChiakiFeedbackHistoryEvent pushed[0x100];
+	for(size_t i = 0; i < 0x100; i++)
+	{
+		ChiakiFeedbackHistoryEvent *event = &pushed[i];
+		if(i % 3 == 0)
+			chiaki_feedback_history_event_set_touchpad(event, i % 2, (uint8_t)i, (uint16_t)(i * 7), (uint16_t)(i * 3));
+		else
+		{
+			err = chiaki_feedback_history_event_set_button(event, i % 3 == 1 ? CHIAKI_CONTROLLER_BUTTON_CROSS : CHIAKI_CONTROLLER_ANALOG_BUTTON_L2, (uint8_t)i);
+			munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		}
+		chiaki_feedback_history_buffer_push(&history, event);
+
+		// newest first, at most HISTORY_SIZE events
+		uint8_t expected[HISTORY_SIZE * CHIAKI_HISTORY_EVENT_SIZE_MAX];
+		size_t expected_size = 0;
+		for(size_t j = 0; j < HISTORY_SIZE && j <= i; j++)
+		{
+			memcpy(expected + expected_size, pushed[i - j].buf, pushed[i - j].len);
+			expected_size += pushed[i - j].len;
+		}
+
+		const uint8_t *bytes = chiaki_feedback_history_buffer_bytes(&history, &size);
+		munit_assert_size(size, ==, expected_size);
+		munit_assert_memory_equal(size, bytes, expected);
+
+		uint8_t buf[0x100];
+		size_t buf_size = sizeof(buf);
+		err = chiaki_feedback_history_buffer_format(&history, buf, &buf_size);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_size(buf_size, ==, expected_size);
+		munit_assert_memory_equal(buf_size, buf, expected);
+	}
+
+	uint8_t buf[4];
+	size_t buf_size = sizeof(buf);
+	err = chiaki_feedback_history_buffer_format(&history, buf, &buf_size);
+	munit_assert_int(err, ==, CHIAKI_ERR_BUF_TOO_SMALL);
+
+	chiaki_feedback_history_buffer_fini(&history);
+	return MUNIT_OK;
+}
+
+static MunitResult test_latency_percentile(const MunitParameter params[], void *user)
+{
+	ChiakiFeedbackSenderStats stats = { 0 };
+	munit_assert_uint64(chiaki_feedback_sender_stats_latency_percentile_us(&stats, 0.5), ==, 0);
+
+	stats.latency_hist[0] = 50; // <= 125 us
+	stats.latency_hist[3] = 45; // <= 1 ms
+	stats.latency_hist[5] = 4; // <= 4 ms
+	stats.latency_hist[CHIAKI_FEEDBACK_LATENCY_HIST_BUCKETS - 1] = 1;
+	munit_assert_uint64(chiaki_feedback_sender_stats_latency_percentile_us(&stats, 0.5), ==, 125);
+	munit_assert_uint64(chiaki_feedback_sender_stats_latency_percentile_us(&stats, 0.9), ==, 1000);
+	munit_assert_uint64(chiaki_feedback_sender_stats_latency_percentile_us(&stats, 0.99), ==, 4000);
+	munit_assert_uint64(chiaki_feedback_sender_stats_latency_percentile_us(&stats, 1.0), ==, UINT64_MAX);
+
+	return MUNIT_OK;
+}
+
+/**
+ * Takion that encrypts but has no socket, so the feedback packets go nowhere.
+ */
+typedef struct feedback_sender_test_t
+{
+	ChiakiTimerService timer_service;
+	ChiakiGKCrypt gkcrypt;
+	ChiakiTakion takion;
+	ChiakiFeedbackSender feedback_sender;
+} FeedbackSenderTest;
+
+static void feedback_sender_test_init(FeedbackSenderTest *test, bool immediate)
+{
+	static const uint8_t handshake_key[0x10] = { 0 };
+	static const uint8_t ecdh_secret[0x20] = { 0 };
+
+	memset(test, 0, sizeof(*test));
+	ChiakiErrorCode err = chiaki_timer_service_init(&test->timer_service);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	err = chiaki_gkcrypt_init(&test->gkcrypt, get_test_log(), NULL, 0, 2, handshake_key, ecdh_secret);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	test->takion.log = get_test_log();
+	test->takion.version = 12;
+	test->takion.timer_service = &test->timer_service;
+	test->takion.gkcrypt_local = &test->gkcrypt;
+	test->takion.sock = CHIAKI_INVALID_SOCKET;
+	err = chiaki_mutex_init(&test->takion.gkcrypt_local_mutex, true);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	err = chiaki_feedback_sender_init(&test->feedback_sender, &test->takion);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_feedback_sender_set_immediate(&test->feedback_sender, immediate);
+}
+
+static void feedback_sender_test_fini(FeedbackSenderTest *test)
+{
+	chiaki_feedback_sender_fini(&test->feedback_sender);
+	chiaki_timer_service_fini(&test->timer_service);
+	chiaki_mutex_fini(&test->takion.gkcrypt_local_mutex);
+	chiaki_gkcrypt_fini(&test->gkcrypt);
+}
+
+#define CHANGE_AGE_US 5000
+
+static MunitResult test_latency_immediate(const MunitParameter params[], void *user)
+{
+	FeedbackSenderTest test;
+	feedback_sender_test_init(&test, true);
+
+	ChiakiControllerState state;
+	chiaki_controller_state_set_idle(&state);
+	state.buttons = CHIAKI_CONTROLLER_BUTTON_CROSS;
+	// the latency counts from the time passed in, not from when the sender got the state
+	ChiakiErrorCode err = chiaki_feedback_sender_set_controller_state(&test.feedback_sender, &state, chiaki_time_now_monotonic_us() - CHANGE_AGE_US);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// sent and recorded before returning
+	ChiakiFeedbackSenderStats stats;
+	chiaki_feedback_sender_stats(&test.feedback_sender, &stats);
+	munit_assert_uint64(stats.sent, ==, 1);
+	munit_assert_uint64(stats.latency_sum_us, >=, CHANGE_AGE_US);
+	munit_assert_uint64(stats.latency_max_us, ==, stats.latency_sum_us);
+	munit_assert_uint64(chiaki_feedback_sender_stats_latency_percentile_us(&stats, 1.0), >=, CHANGE_AGE_US);
+
+	// nothing changed, nothing to send
+	err = chiaki_feedback_sender_set_controller_state(&test.feedback_sender, &state, chiaki_time_now_monotonic_us());
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_feedback_sender_stats(&test.feedback_sender, &stats);
+	munit_assert_uint64(stats.sent, ==, 1);
+
+	state.buttons = 0;
+	err = chiaki_feedback_sender_set_controller_state(&test.feedback_sender, &state, chiaki_time_now_monotonic_us());
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_feedback_sender_stats(&test.feedback_sender, &stats);
+	munit_assert_uint64(stats.sent, ==, 2);
+
+	feedback_sender_test_fini(&test);
+	return MUNIT_OK;
+}
+
+static MunitResult test_latency_timer(const MunitParameter params[], void *user)
+{
+	FeedbackSenderTest test;
+	feedback_sender_test_init(&test, false);
+
+	ChiakiStopPipe stop_pipe;
+	ChiakiErrorCode err = chiaki_stop_pipe_init(&stop_pipe);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiControllerState state;
+	chiaki_controller_state_set_idle(&state);
+	state.buttons = CHIAKI_CONTROLLER_BUTTON_CROSS;
+	uint64_t change_us = chiaki_time_now_monotonic_us() - CHANGE_AGE_US;
+	err = chiaki_feedback_sender_set_controller_state(&test.feedback_sender, &state, change_us);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// sent by the timer thread
+	ChiakiFeedbackSenderStats stats;
+	for(int i = 0; i < 1000; i++)
+	{
+		chiaki_feedback_sender_stats(&test.feedback_sender, &stats);
+		if(stats.sent)
+			break;
+		chiaki_stop_pipe_sleep(&stop_pipe, 1);
+	}
+	uint64_t sent_us = chiaki_time_now_monotonic_us();
+	munit_assert_uint64(stats.sent, ==, 1);
+	munit_assert_uint64(stats.latency_max_us, >=, CHANGE_AGE_US);
+	munit_assert_uint64(stats.latency_max_us, <=, sent_us - change_us);
+
+	chiaki_stop_pipe_fini(&stop_pipe);
+	feedback_sender_test_fini(&test);
+	return MUNIT_OK;
+}
+
+MunitTest tests_feedback[] = {
+	{
+		"/history_buffer",
+		test_history_buffer,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/latency_percentile",
+		test_latency_percentile,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/latency_immediate",
+		test_latency_immediate,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/latency_timer",
+		test_latency_timer,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -5,6 +5,8 @@
 #include <chiaki/ecdh.h>
 #include <chiaki/gkcrypt.h>
 
+#include "test_log.h"
+
 static MunitResult test_ecdh(const MunitParameter params[], void *user)
 {
 	static const uint8_t handshake_key[] = { 0xfc, 0x5d, 0x4b, 0xa0, 0x3a, 0x35, 0x3a, 0xbb, 0x6a, 0x7f, 0xac, 0x79, 0x1b, 0x17, 0xbb, 0x34 };
@@ -63,7 +65,7 @@ static MunitResult test_key_stream(const MunitParameter params[], void *user)
 	ChiakiLog log;
 
 	ChiakiGKCrypt gkcrypt;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, 42, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, NULL, 0, 42, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return MUNIT_ERROR;
 
@@ -109,7 +111,7 @@ static MunitResult test_endecrypt(const MunitParameter params[], void *user)
 	ChiakiLog log;
 
 	ChiakiGKCrypt gkcrypt;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, 0, 42, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, &log, NULL, 0, 42, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return MUNIT_ERROR;
 
@@ -365,7 +367,7 @@ static MunitResult test_gmac_multiple_of_key_refresh(const MunitParameter params
 
 	ChiakiLog log;
 	ChiakiGKCrypt gkcrypt;
-	chiaki_gkcrypt_init(&gkcrypt, &log, 0, crypt_index, handshake_key, ecdh_secret);
+	chiaki_gkcrypt_init(&gkcrypt, &log, NULL, 0, crypt_index, handshake_key, ecdh_secret);
 
 	uint8_t gmac[CHIAKI_GKCRYPT_GMAC_SIZE];
 	ChiakiErrorCode err = chiaki_gkcrypt_gmac(&gkcrypt, key_pos, data, sizeof(data), gmac);
@@ -380,6 +382,36 @@ static MunitResult test_gmac_multiple_of_key_refresh(const MunitParameter params
 }
 
 
+static MunitResult test_key_stream_buffered(const MunitParameter params[], void *user)
+{
+	static const uint8_t handshake_key[] = { 0x14, 0xf1, 0xe6, 0x94, 0x6c, 0x5d, 0xce, 0xa8, 0xb7, 0xaa, 0x48, 0x50, 0xf6, 0x4d, 0x21, 0xac };
+	static const uint8_t ecdh_secret[] = { 0xc, 0xeb, 0x77, 0x9, 0x83, 0x4d, 0x7a, 0xfc, 0x50, 0xb8, 0x46, 0x8c, 0xc6, 0x3c, 0x1e, 0x7c, 0x4e, 0x4a, 0x88, 0x93, 0x42, 0x80, 0xc1, 0x28, 0xe6, 0x1e, 0xe9, 0xd4, 0x1b, 0x8c, 0x69, 0x36 };
+
+	ChiakiExecutor executor;
+	ChiakiErrorCode err = chiaki_executor_init(&executor, 2);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiGKCrypt gkcrypt;
+	err = chiaki_gkcrypt_init(&gkcrypt, get_test_log(), &executor, 4, 42, handshake_key, ecdh_secret);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// whether the buffer has caught up or not, the result must match the synchronously generated stream
+	uint8_t buf[0x500];
+	uint8_t expected[sizeof(buf)];
+	for(uint64_t key_pos=0; key_pos<0x40000; key_pos+=sizeof(buf) - 0x30)
+	{
+		err = chiaki_gkcrypt_get_key_stream(&gkcrypt, key_pos, buf, sizeof(buf));
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		err = chiaki_gkcrypt_gen_key_stream(&gkcrypt, key_pos, expected, sizeof(expected));
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_memory_equal(sizeof(buf), buf, expected);
+	}
+
+	chiaki_gkcrypt_fini(&gkcrypt);
+	chiaki_executor_fini(&executor);
+	return MUNIT_OK;
+}
+
 MunitTest tests_gkcrypt[] = {
 	{
 		"/ecdh",
@@ -397,6 +429,14 @@ MunitTest tests_gkcrypt[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/key_stream_buffered",
+		test_key_stream_buffered,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{
 		"/en_decrypt",
 		test_endecrypt,
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/haptics.h>
+
+#include "test_log.h"
+
+#include <string.h>
+
+#define FRAME_SAMPLES 30 // => 10ms at 3 kHz
+#define FRAME_DURATION_US 10000
+#define FRAMES_COUNT 0x20
+#define REPORTS_MAX 0x100
+#define REPORT_SAMPLES 32
+
+typedef struct
+{
+	int8_t reports[REPORTS_MAX][REPORT_SAMPLES * 2];
+	size_t reports_count;
+} Reports;
+
+static void report_cb(int8_t *buf, size_t samples_count, void *user)
+{
+	Reports *reports = user;
+	munit_assert_size(samples_count, ==, REPORT_SAMPLES);
+	munit_assert_size(reports->reports_count, <, REPORTS_MAX);
+	memcpy(reports->reports[reports->reports_count++], buf, samples_count * 2);
+}
+
+/**
+ * Push frames of stereo samples, the left channel counting up from 0 and the right one down,
+ * or constantly value on both if ramp is false. Frame skip_index is never pushed.
+ */
+static void push_frames(ChiakiHapticsPipeline *pipeline, bool ramp, int8_t value, ChiakiSeqNum16 skip_index)
+{
+	uint64_t t = 1000000;
+	for(ChiakiSeqNum16 i = 0; i < FRAMES_COUNT; i++)
+	{
+		uint8_t frame[FRAME_SAMPLES * 2];
+		for(size_t s = 0; s < FRAME_SAMPLES; s++)
+		{
+			int8_t v = ramp ? (int8_t)(i * FRAME_SAMPLES + s) : value;
+			frame[s * 2] = (uint8_t)v;
+			frame[s * 2 + 1] = (uint8_t)(ramp ? -v : v);
+		}
+		if(i != skip_index)
+			chiaki_haptics_pipeline_push(pipeline, i, frame, sizeof(frame), t);
+		chiaki_haptics_pipeline_play(pipeline, t);
+		t += FRAME_DURATION_US;
+	}
+}
+
+static MunitResult test_batching(const MunitParameter params[], void *user)
+{
+	static Reports reports;
+	memset(&reports, 0, sizeof(reports));
+
+	ChiakiHapticsConfig config;
+	chiaki_haptics_config_dualsense(&config);
+	munit_assert_size(config.report_samples, ==, REPORT_SAMPLES);
+
+	ChiakiHapticsPipeline pipeline;
+	ChiakiErrorCode err = chiaki_haptics_pipeline_init(&pipeline, get_test_log(), false, &config, report_cb, &reports);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	push_frames(&pipeline, true, 0, FRAMES_COUNT);
+
+	// the last frame is still buffered, the samples of the others are passed on one late in whole reports only
+	ChiakiHapticsStats stats;
+	chiaki_haptics_pipeline_stats(&pipeline, &stats);
+	munit_assert_uint64(stats.jitter_buffer.played, ==, FRAMES_COUNT - 1);
+	munit_assert_size(reports.reports_count, ==, (FRAMES_COUNT - 1) * FRAME_SAMPLES / REPORT_SAMPLES);
+	munit_assert_uint64(stats.reports, ==, reports.reports_count);
+	for(size_t r = 0; r < reports.reports_count; r++)
+	{
+		for(size_t s = 0; s < REPORT_SAMPLES; s++)
+		{
+			size_t n = r * REPORT_SAMPLES + s;
+			int8_t expected = n ? (int8_t)(n - 1) : 0;
+			munit_assert_int8(reports.reports[r][s * 2], ==, expected);
+			munit_assert_int8(reports.reports[r][s * 2 + 1], ==, (int8_t)-expected);
+		}
+	}
+
+	// 2 frames in the jitter buffer plus one report piling up
+	munit_assert_uint64(stats.latency_us, ==, 2 * FRAME_DURATION_US + REPORT_SAMPLES * 1000000 / 3000);
+
+	chiaki_haptics_pipeline_fini(&pipeline);
+	return MUNIT_OK;
+}
+
+static MunitResult test_resample(const MunitParameter params[], void *user)
+{
+	static Reports reports;
+	memset(&reports, 0, sizeof(reports));
+
+	ChiakiHapticsConfig config;
+	chiaki_haptics_config_dualsense(&config);
+	config.report_rate = 6000;
+
+	ChiakiHapticsPipeline pipeline;
+	ChiakiErrorCode err = chiaki_haptics_pipeline_init(&pipeline, get_test_log(), false, &config, report_cb, &reports);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiSeqNum16 lost = 10;
+	push_frames(&pipeline, false, 100, lost);
+
+	// a lost frame still takes up its time, so the output keeps pace with the stream
+	munit_assert_size(reports.reports_count, ==, (FRAMES_COUNT - 1) * FRAME_SAMPLES * 2 / REPORT_SAMPLES);
+
+	// ramping up from silence at first
+	munit_assert_int8(reports.reports[0][0], ==, 0);
+	munit_assert_int8(reports.reports[0][2], ==, 50);
+	munit_assert_int8(reports.reports[0][4], ==, 100);
+
+	size_t silent = 0;
+	for(size_t r = 0; r < reports.reports_count; r++)
+	{
+		for(size_t s = 0; s < REPORT_SAMPLES * 2; s++)
+		{
+			size_t n = r * REPORT_SAMPLES * 2 + s;
+			int8_t v = reports.reports[r][s];
+			munit_assert_int8(v, ==, reports.reports[r][s ^ 1]);
+			if(n < 4)
+				continue;
+			if(!v)
+				silent++;
+			else if(v != 100)
+				munit_assert_int8(v, ==, 50); // interpolated at the edges of the lost frame
+		}
+	}
+	// all samples of the lost frame, except for the ones interpolated at the edges
+	munit_assert_size(silent, ==, (FRAME_SAMPLES * 2 - 1) * 2);
+
+	chiaki_haptics_pipeline_fini(&pipeline);
+	return MUNIT_OK;
+}
+
+static MunitResult test_delay(const MunitParameter params[], void *user)
+{
+	static Reports reports;
+	memset(&reports, 0, sizeof(reports));
+
+	ChiakiHapticsConfig config;
+	chiaki_haptics_config_dualsense(&config);
+
+	ChiakiHapticsPipeline pipeline;
+	ChiakiErrorCode err = chiaki_haptics_pipeline_init(&pipeline, get_test_log(), false, &config, report_cb, &reports);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// exactly one report of silence
+	chiaki_haptics_pipeline_set_delay(&pipeline, REPORT_SAMPLES * 1000000 / 3000 + 1);
+	push_frames(&pipeline, false, 100, FRAMES_COUNT);
+
+	munit_assert_size(reports.reports_count, ==, ((FRAMES_COUNT - 1) * FRAME_SAMPLES + REPORT_SAMPLES) / REPORT_SAMPLES);
+	for(size_t s = 0; s < REPORT_SAMPLES * 2; s++)
+		munit_assert_int8(reports.reports[0][s], ==, 0);
+	munit_assert_int8(reports.reports[1][0], ==, 0);
+	munit_assert_int8(reports.reports[1][2], ==, 100);
+
+	ChiakiHapticsStats stats;
+	chiaki_haptics_pipeline_stats(&pipeline, &stats);
+	munit_assert_uint64(stats.delay_us, ==, REPORT_SAMPLES * 1000000 / 3000);
+	munit_assert_uint64(stats.latency_us, ==, 2 * FRAME_DURATION_US + REPORT_SAMPLES * 1000000 / 3000);
+
+	// removing it again drops as many samples from the output
+	chiaki_haptics_pipeline_set_delay(&pipeline, 0);
+	size_t before = reports.reports_count;
+	chiaki_haptics_pipeline_play(&pipeline, 1000000 + (FRAMES_COUNT + 8) * FRAME_DURATION_US);
+	chiaki_haptics_pipeline_stats(&pipeline, &stats);
+	munit_assert_uint64(stats.delay_us, ==, 0);
+	munit_assert_size(reports.reports_count, ==, before);
+	// the last buffered frame was dropped as a whole, the rest goes with the next one
+	munit_assert_size(pipeline.skip_samples, ==, REPORT_SAMPLES - FRAME_SAMPLES);
+
+	chiaki_haptics_pipeline_fini(&pipeline);
+	return MUNIT_OK;
+}
+
+MunitTest tests_haptics[] = {
+	{
+		"/batching",
+		test_batching,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/resample",
+		test_resample,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/delay",
+		test_delay,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
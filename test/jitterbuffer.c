@@ -0,0 +1,445 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/jitterbuffer.h>
+#include <chiaki/time.h>
+
+#include "test_log.h"
+
+#define FRAME_DURATION_US 10000
+#define EVENTS_MAX 0x400
+
+typedef enum
+{
+	EVENT_FRAME,
+	EVENT_RECOVERED,
+	EVENT_CONCEALED
+} EventType;
+
+typedef struct
+{
+	EventType type;
+	uint8_t value; // first byte of the frame, or of the next frame for EVENT_RECOVERED
+} Event;
+
+typedef struct
+{
+	Event events[EVENTS_MAX];
+	size_t events_count;
+} Played;
+
+static void frame_cb(uint8_t *buf, size_t buf_size, void *user)
+{
+	Played *played = user;
+	munit_assert_size(buf_size, ==, 1);
+	munit_assert_size(played->events_count, <, EVENTS_MAX);
+	played->events[played->events_count].type = EVENT_FRAME;
+	played->events[played->events_count++].value = buf[0];
+}
+
+static void lost_cb(uint8_t *next_buf, size_t next_buf_size, void *user)
+{
+	Played *played = user;
+	munit_assert_size(played->events_count, <, EVENTS_MAX);
+	if(next_buf)
+	{
+		munit_assert_size(next_buf_size, ==, 1);
+		played->events[played->events_count].type = EVENT_RECOVERED;
+		played->events[played->events_count++].value = next_buf[0];
+	}
+	else
+	{
+		played->events[played->events_count].type = EVENT_CONCEALED;
+		played->events[played->events_count++].value = 0;
+	}
+}
+
+static bool push(ChiakiJitterBuffer *jitter_buffer, ChiakiSeqNum16 index, uint64_t arrival_us)
+{
+	uint8_t v = (uint8_t)index;
+	return chiaki_jitter_buffer_push(jitter_buffer, index, &v, 1, arrival_us);
+}
+
+static void assert_event(Played *played, size_t i, EventType type, uint8_t value)
+{
+	munit_assert_size(i, <, played->events_count);
+	munit_assert_int(played->events[i].type, ==, type);
+	munit_assert_uint8(played->events[i].value, ==, value);
+}
+
+static MunitResult test_in_order(const MunitParameter params[], void *user)
+{
+	Played played = { 0 };
+	ChiakiJitterBuffer jitter_buffer;
+	ChiakiErrorCode err = chiaki_jitter_buffer_init(&jitter_buffer, get_test_log(), frame_cb, lost_cb, &played);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// nothing is taken before the frame duration is known
+	munit_assert_false(push(&jitter_buffer, 0, 0));
+	chiaki_jitter_buffer_set_frame_duration(&jitter_buffer, FRAME_DURATION_US);
+
+	// index wraps around in between
+	ChiakiSeqNum16 first = 0xfff0;
+	uint64_t t = 1000000;
+	munit_assert_true(push(&jitter_buffer, first, t));
+	munit_assert_false(push(&jitter_buffer, first, t));
+	chiaki_jitter_buffer_play(&jitter_buffer, t);
+	munit_assert_size(played.events_count, ==, 0); // still buffering
+
+	for(ChiakiSeqNum16 i = 1; i < 0x20; i++)
+	{
+		t += FRAME_DURATION_US;
+		munit_assert_true(push(&jitter_buffer, (ChiakiSeqNum16)(first + i), t));
+		chiaki_jitter_buffer_play(&jitter_buffer, t);
+	}
+
+	munit_assert_size(jitter_buffer.target_frames, ==, 2);
+	munit_assert_size(played.events_count, ==, 0x1f);
+	for(size_t i = 0; i < played.events_count; i++)
+		assert_event(&played, i, EVENT_FRAME, (uint8_t)(first + i));
+
+	ChiakiJitterBufferStats stats;
+	chiaki_jitter_buffer_stats(&jitter_buffer, &stats);
+	munit_assert_uint64(stats.played, ==, 0x1f);
+	munit_assert_uint64(stats.concealed, ==, 0);
+	munit_assert_uint64(stats.recovered, ==, 0);
+	munit_assert_uint64(stats.underruns, ==, 0);
+	munit_assert_uint64(stats.delay_us, ==, 2 * FRAME_DURATION_US);
+
+	chiaki_jitter_buffer_fini(&jitter_buffer);
+	return MUNIT_OK;
+}
+
+static MunitResult test_loss(const MunitParameter params[], void *user)
+{
+	Played played = { 0 };
+	ChiakiJitterBuffer jitter_buffer;
+	ChiakiErrorCode err = chiaki_jitter_buffer_init(&jitter_buffer, get_test_log(), frame_cb, lost_cb, &played);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_jitter_buffer_set_frame_duration(&jitter_buffer, FRAME_DURATION_US);
+
+	uint64_t t = 1000000;
+	push(&jitter_buffer, 0, t);
+	push(&jitter_buffer, 1, t);
+	push(&jitter_buffer, 2, t);
+	// 3 lost, but 4 is there for fec
+	push(&jitter_buffer, 4, t);
+	// 5 and 6 lost completely
+	push(&jitter_buffer, 7, t);
+	// 8 arrives out of order before 1 was played
+	push(&jitter_buffer, 8, t);
+
+	for(size_t i = 0; i < 9; i++)
+		chiaki_jitter_buffer_play(&jitter_buffer, t + i * FRAME_DURATION_US);
+
+	munit_assert_size(played.events_count, ==, 9);
+	assert_event(&played, 0, EVENT_FRAME, 0);
+	assert_event(&played, 1, EVENT_FRAME, 1);
+	assert_event(&played, 2, EVENT_FRAME, 2);
+	assert_event(&played, 3, EVENT_RECOVERED, 4);
+	assert_event(&played, 4, EVENT_FRAME, 4);
+	assert_event(&played, 5, EVENT_CONCEALED, 0);
+	assert_event(&played, 6, EVENT_RECOVERED, 7);
+	assert_event(&played, 7, EVENT_FRAME, 7);
+	assert_event(&played, 8, EVENT_FRAME, 8);
+
+	// 3 arriving now is too late
+	munit_assert_false(push(&jitter_buffer, 3, t + 9 * FRAME_DURATION_US));
+
+	ChiakiJitterBufferStats stats;
+	chiaki_jitter_buffer_stats(&jitter_buffer, &stats);
+	munit_assert_uint64(stats.played, ==, 6);
+	munit_assert_uint64(stats.recovered, ==, 2);
+	munit_assert_uint64(stats.concealed, ==, 1);
+	munit_assert_uint64(stats.late, ==, 1);
+
+	chiaki_jitter_buffer_fini(&jitter_buffer);
+	return MUNIT_OK;
+}
+
+static MunitResult test_underrun(const MunitParameter params[], void *user)
+{
+	Played played = { 0 };
+	ChiakiJitterBuffer jitter_buffer;
+	ChiakiErrorCode err = chiaki_jitter_buffer_init(&jitter_buffer, get_test_log(), frame_cb, lost_cb, &played);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_jitter_buffer_set_frame_duration(&jitter_buffer, FRAME_DURATION_US);
+
+	uint64_t t = 1000000;
+	push(&jitter_buffer, 0, t);
+	push(&jitter_buffer, 1, t);
+	chiaki_jitter_buffer_play(&jitter_buffer, t);
+	t += FRAME_DURATION_US;
+	chiaki_jitter_buffer_play(&jitter_buffer, t);
+	munit_assert_size(played.events_count, ==, 2);
+
+	// empty now, conceal a few frames without giving up on frame 2
+	for(size_t i = 0; i < 2; i++)
+	{
+		t += FRAME_DURATION_US;
+		chiaki_jitter_buffer_play(&jitter_buffer, t);
+	}
+	munit_assert_size(played.events_count, ==, 4);
+	assert_event(&played, 2, EVENT_CONCEALED, 0);
+	assert_event(&played, 3, EVENT_CONCEALED, 0);
+
+	// late, but still played seamlessly
+	munit_assert_true(push(&jitter_buffer, 2, t));
+	t += FRAME_DURATION_US;
+	chiaki_jitter_buffer_play(&jitter_buffer, t);
+	munit_assert_size(played.events_count, ==, 5);
+	assert_event(&played, 4, EVENT_FRAME, 2);
+
+	// empty for too long, stops
+	for(size_t i = 0; i < 10; i++)
+	{
+		t += FRAME_DURATION_US;
+		chiaki_jitter_buffer_play(&jitter_buffer, t);
+	}
+	munit_assert_size(played.events_count, ==, 10);
+	munit_assert_false(jitter_buffer.playing);
+
+	ChiakiJitterBufferStats stats;
+	chiaki_jitter_buffer_stats(&jitter_buffer, &stats);
+	munit_assert_uint64(stats.underruns, ==, 2);
+	munit_assert_uint64(stats.concealed, ==, 7);
+
+	// the delay raised the target, which is buffered up to again before continuing
+	push(&jitter_buffer, 3, t);
+	size_t target = chiaki_jitter_buffer_target_frames(&jitter_buffer);
+	munit_assert_size(target, >, 2);
+	for(ChiakiSeqNum16 i = 4; i < 3 + target; i++)
+	{
+		chiaki_jitter_buffer_play(&jitter_buffer, t);
+		munit_assert_size(played.events_count, ==, 10);
+		push(&jitter_buffer, i, t);
+	}
+	chiaki_jitter_buffer_play(&jitter_buffer, t);
+	munit_assert_size(played.events_count, ==, 11);
+	assert_event(&played, 10, EVENT_FRAME, 3);
+
+	chiaki_jitter_buffer_fini(&jitter_buffer);
+	return MUNIT_OK;
+}
+
+static MunitResult test_underrun_head_lost(const MunitParameter params[], void *user)
+{
+	Played played = { 0 };
+	ChiakiJitterBuffer jitter_buffer;
+	ChiakiErrorCode err = chiaki_jitter_buffer_init(&jitter_buffer, get_test_log(), frame_cb, lost_cb, &played);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_jitter_buffer_set_frame_duration(&jitter_buffer, FRAME_DURATION_US);
+
+	uint64_t t = 1000000;
+	push(&jitter_buffer, 0, t);
+	push(&jitter_buffer, 1, t);
+	for(size_t i = 0; i < 10; i++)
+	{
+		chiaki_jitter_buffer_play(&jitter_buffer, t);
+		t += FRAME_DURATION_US;
+	}
+	munit_assert_false(jitter_buffer.playing);
+	size_t events_stopped = played.events_count;
+
+	// frame 2 never arrives, playout must still resume once enough frames after it are buffered
+	ChiakiSeqNum16 index = 3;
+	while(played.events_count == events_stopped)
+	{
+		munit_assert_uint16(index, <, 3 + CHIAKI_JITTER_BUFFER_SIZE / 2);
+		munit_assert_true(push(&jitter_buffer, index++, t));
+		chiaki_jitter_buffer_play(&jitter_buffer, t);
+	}
+	munit_assert_true(jitter_buffer.playing);
+	munit_assert_size((size_t)(index - 2), >=, chiaki_jitter_buffer_target_frames(&jitter_buffer));
+	munit_assert_size(played.events_count, ==, events_stopped + 1);
+	assert_event(&played, events_stopped, EVENT_RECOVERED, 3);
+
+	// and keeps going after it
+	for(size_t i = 0; i < 2; i++)
+	{
+		t += FRAME_DURATION_US;
+		chiaki_jitter_buffer_play(&jitter_buffer, t);
+	}
+	munit_assert_size(played.events_count, ==, events_stopped + 3);
+	assert_event(&played, events_stopped + 1, EVENT_FRAME, 3);
+	assert_event(&played, events_stopped + 2, EVENT_FRAME, 4);
+
+	chiaki_jitter_buffer_fini(&jitter_buffer);
+	return MUNIT_OK;
+}
+
+static MunitResult test_adapt(const MunitParameter params[], void *user)
+{
+	Played played = { 0 };
+	ChiakiJitterBuffer jitter_buffer;
+	ChiakiErrorCode err = chiaki_jitter_buffer_init(&jitter_buffer, get_test_log(), frame_cb, lost_cb, &played);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_jitter_buffer_set_frame_duration(&jitter_buffer, FRAME_DURATION_US);
+
+	// frames arrive in bursts of 4 every 4 frame durations
+	uint64_t t = 1000000;
+	ChiakiSeqNum16 index = 0;
+	for(size_t burst = 0; burst < 50; burst++)
+	{
+		for(size_t i = 0; i < 4; i++)
+			push(&jitter_buffer, index++, t);
+		for(size_t i = 0; i < 8; i++)
+		{
+			chiaki_jitter_buffer_play(&jitter_buffer, t);
+			t += FRAME_DURATION_US / 2;
+		}
+	}
+
+	size_t target = chiaki_jitter_buffer_target_frames(&jitter_buffer);
+	munit_assert_size(target, >=, 4);
+	munit_assert_size(target, <=, CHIAKI_JITTER_BUFFER_SIZE / 2);
+
+	// once adapted, no more gaps
+	ChiakiJitterBufferStats stats_before;
+	chiaki_jitter_buffer_stats(&jitter_buffer, &stats_before);
+	for(size_t burst = 0; burst < 50; burst++)
+	{
+		for(size_t i = 0; i < 4; i++)
+			push(&jitter_buffer, index++, t);
+		for(size_t i = 0; i < 8; i++)
+		{
+			chiaki_jitter_buffer_play(&jitter_buffer, t);
+			t += FRAME_DURATION_US / 2;
+		}
+	}
+	ChiakiJitterBufferStats stats;
+	chiaki_jitter_buffer_stats(&jitter_buffer, &stats);
+	munit_assert_uint64(stats.concealed, ==, stats_before.concealed);
+	munit_assert_uint64(stats.underruns, ==, stats_before.underruns);
+	munit_assert_uint64(stats.played - stats_before.played + stats.dropped - stats_before.dropped, >=, 196);
+
+	chiaki_jitter_buffer_fini(&jitter_buffer);
+	return MUNIT_OK;
+}
+
+typedef struct
+{
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	bool entered;
+	bool released;
+	size_t frames;
+} BlockingSink;
+
+static void blocking_frame_cb(uint8_t *buf, size_t buf_size, void *user)
+{
+	BlockingSink *sink = user;
+	chiaki_mutex_lock(&sink->mutex);
+	sink->frames++;
+	sink->entered = true;
+	chiaki_cond_broadcast(&sink->cond);
+	while(!sink->released)
+		chiaki_cond_wait(&sink->cond, &sink->mutex);
+	chiaki_mutex_unlock(&sink->mutex);
+}
+
+static bool blocking_sink_entered(void *user)
+{
+	BlockingSink *sink = user;
+	return sink->entered;
+}
+
+static bool blocking_sink_played_all(void *user)
+{
+	BlockingSink *sink = user;
+	return sink->frames >= 4;
+}
+
+static MunitResult test_playout_thread(const MunitParameter params[], void *user)
+{
+	BlockingSink sink = { 0 };
+	chiaki_mutex_init(&sink.mutex, false);
+	chiaki_cond_init(&sink.cond);
+
+	ChiakiJitterBuffer jitter_buffer;
+	ChiakiErrorCode err = chiaki_jitter_buffer_init(&jitter_buffer, get_test_log(), blocking_frame_cb, NULL, &sink);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	err = chiaki_jitter_buffer_playout_start(&jitter_buffer, "Test Playout");
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_jitter_buffer_set_frame_duration(&jitter_buffer, FRAME_DURATION_US);
+
+	munit_assert_true(push(&jitter_buffer, 0, chiaki_time_now_monotonic_us()));
+	munit_assert_true(push(&jitter_buffer, 1, chiaki_time_now_monotonic_us()));
+
+	chiaki_mutex_lock(&sink.mutex);
+	err = chiaki_cond_timedwait_pred(&sink.cond, &sink.mutex, 5000, blocking_sink_entered, &sink);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_mutex_unlock(&sink.mutex);
+
+	// the sink is stuck in the callback now, which must not hold up taking more frames
+	munit_assert_true(push(&jitter_buffer, 2, chiaki_time_now_monotonic_us()));
+	munit_assert_true(push(&jitter_buffer, 3, chiaki_time_now_monotonic_us()));
+
+	chiaki_mutex_lock(&sink.mutex);
+	sink.released = true;
+	chiaki_cond_broadcast(&sink.cond);
+	err = chiaki_cond_timedwait_pred(&sink.cond, &sink.mutex, 5000, blocking_sink_played_all, &sink);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_mutex_unlock(&sink.mutex);
+
+	chiaki_jitter_buffer_playout_stop(&jitter_buffer);
+	munit_assert_false(jitter_buffer.playout_running);
+
+	chiaki_jitter_buffer_fini(&jitter_buffer);
+	chiaki_cond_fini(&sink.cond);
+	chiaki_mutex_fini(&sink.mutex);
+	return MUNIT_OK;
+}
+
+MunitTest tests_jitter_buffer[] = {
+	{
+		"/in_order",
+		test_in_order,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/loss",
+		test_loss,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/underrun",
+		test_underrun,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/underrun_head_lost",
+		test_underrun_head_lost,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/adapt",
+		test_adapt,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/playout_thread",
+		test_playout_thread,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/log.h>
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct log_record_t
+{
+	size_t count;
+	size_t summaries;
+	unsigned int suppressed;
+} LogRecord;
+
+static void record_cb(ChiakiLogLevel level, const char *msg, void *user)
+{
+	LogRecord *record = user;
+	unsigned int suppressed;
+	if(sscanf(msg, "Suppressed %u similar message(s)", &suppressed) == 1)
+	{
+		record->summaries++;
+		record->suppressed += suppressed;
+		return;
+	}
+	record->count++;
+}
+
+static MunitResult test_log_rate_limit(const MunitParameter params[], void *user)
+{
+	LogRecord record = { 0 };
+	ChiakiLog log;
+	chiaki_log_init(&log, CHIAKI_LOG_ALL, record_cb, &record);
+
+	for(int i=0; i<100; i++)
+		CHIAKI_LOGW_RL(&log, "flood %d", i);
+	munit_assert_size(record.count, ==, CHIAKI_LOG_RATE_LIMIT_BURST);
+	munit_assert_size(record.summaries, ==, 0);
+
+	// explicit state to be able to move the interval back in time
+	ChiakiLogRateLimit rate_limit = { 0 };
+	size_t allowed = 0;
+	for(int i=0; i<100; i++)
+	{
+		if(chiaki_log_rate_limit_check(&log, CHIAKI_LOG_WARNING, &rate_limit, __FILE__, __LINE__))
+			allowed++;
+	}
+	munit_assert_size(allowed, ==, CHIAKI_LOG_RATE_LIMIT_BURST);
+	munit_assert_size(record.summaries, ==, 0);
+
+	rate_limit.window_start_ms -= CHIAKI_LOG_RATE_LIMIT_INTERVAL_MS;
+	munit_assert(chiaki_log_rate_limit_check(&log, CHIAKI_LOG_WARNING, &rate_limit, __FILE__, __LINE__));
+	munit_assert_size(record.summaries, ==, 1);
+	munit_assert_uint(record.suppressed, ==, 100 - CHIAKI_LOG_RATE_LIMIT_BURST);
+
+	// masked out levels are neither logged nor counted
+	log.level_mask = CHIAKI_LOG_ERROR;
+	ChiakiLogRateLimit rate_limit_masked = { 0 };
+	munit_assert(!chiaki_log_rate_limit_check(&log, CHIAKI_LOG_WARNING, &rate_limit_masked, __FILE__, __LINE__));
+	munit_assert_uint(rate_limit_masked.count, ==, 0);
+
+	// the call sites above are still pending with this log
+	chiaki_log_rate_limit_flush(&log, true);
+	munit_assert_ptr_null(log.rate_limit_pending);
+	return MUNIT_OK;
+}
+
+static MunitResult test_log_rate_limit_flush(const MunitParameter params[], void *user)
+{
+	LogRecord record = { 0 };
+	ChiakiLog log;
+	chiaki_log_init(&log, CHIAKI_LOG_ALL, record_cb, &record);
+	LogRecord record_other = { 0 };
+	ChiakiLog log_other;
+	chiaki_log_init(&log_other, CHIAKI_LOG_ALL, record_cb, &record_other);
+
+	ChiakiLogRateLimit rate_limit = { 0 };
+	ChiakiLogRateLimit rate_limit_other = { 0 };
+	for(int i=0; i<20; i++)
+	{
+		chiaki_log_rate_limit_check(&log, CHIAKI_LOG_WARNING, &rate_limit, __FILE__, __LINE__);
+		chiaki_log_rate_limit_check(&log_other, CHIAKI_LOG_WARNING, &rate_limit_other, __FILE__, __LINE__);
+	}
+
+	// interval still running
+	chiaki_log_rate_limit_flush(&log, false);
+	munit_assert_size(record.summaries, ==, 0);
+
+	// the flood stopped and the call site is never hit again
+	rate_limit.window_start_ms -= CHIAKI_LOG_RATE_LIMIT_INTERVAL_MS;
+	chiaki_log_rate_limit_flush(&log, false);
+	munit_assert_size(record.summaries, ==, 1);
+	munit_assert_uint(record.suppressed, ==, 20 - CHIAKI_LOG_RATE_LIMIT_BURST);
+	munit_assert_size(record_other.summaries, ==, 0);
+	munit_assert_ptr_not_null(log_other.rate_limit_pending);
+
+	chiaki_log_rate_limit_flush(&log, true);
+	munit_assert_size(record.summaries, ==, 1);
+	munit_assert_ptr_null(log.rate_limit_pending);
+
+	chiaki_log_rate_limit_flush(&log_other, true);
+	munit_assert_size(record_other.summaries, ==, 1);
+	munit_assert_uint(record_other.suppressed, ==, 20 - CHIAKI_LOG_RATE_LIMIT_BURST);
+	munit_assert_uint(rate_limit.pending, ==, 0);
+	munit_assert_uint(rate_limit_other.pending, ==, 0);
+	munit_assert_ptr_null(log_other.rate_limit_pending);
+
+	// a call site shared by both logs is summarized into the one it suppressed for first
+	ChiakiLogRateLimit rate_limit_shared = { 0 };
+	for(int i=0; i<CHIAKI_LOG_RATE_LIMIT_BURST + 2; i++)
+		chiaki_log_rate_limit_check(&log, CHIAKI_LOG_WARNING, &rate_limit_shared, __FILE__, __LINE__);
+	chiaki_log_rate_limit_check(&log_other, CHIAKI_LOG_WARNING, &rate_limit_shared, __FILE__, __LINE__);
+	munit_assert_ptr_null(log_other.rate_limit_pending);
+	chiaki_log_rate_limit_flush(&log_other, true);
+	munit_assert_size(record_other.summaries, ==, 1);
+	chiaki_log_rate_limit_flush(&log, true);
+	munit_assert_size(record.summaries, ==, 2);
+	munit_assert_uint(record.suppressed, ==, 20 - CHIAKI_LOG_RATE_LIMIT_BURST + 3);
+	munit_assert_ptr_null(log.rate_limit_pending);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_log[] = {
+	{
+		"/rate_limit",
+		test_log_rate_limit,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/rate_limit_flush",
+		test_log_rate_limit_flush,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/logasync.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS_COUNT 4
+#define MESSAGES_PER_THREAD 2000
+
+typedef struct ordering_record_t
+{
+	int next[THREADS_COUNT];
+	size_t received;
+	size_t long_received;
+	bool failed;
+} OrderingRecord;
+
+static void ordering_cb(ChiakiLogLevel level, const char *msg, void *user)
+{
+	OrderingRecord *record = user;
+	if(strlen(msg) > CHIAKI_LOG_ASYNC_MSG_SIZE)
+	{
+		record->long_received++;
+		return;
+	}
+	int thread_index, msg_index;
+	if(level != CHIAKI_LOG_INFO || sscanf(msg, "thread %d msg %d", &thread_index, &msg_index) != 2
+		|| thread_index < 0 || thread_index >= THREADS_COUNT)
+	{
+		record->failed = true;
+		return;
+	}
+	// messages from a single thread must arrive in order
+	if(msg_index != record->next[thread_index])
+		record->failed = true;
+	record->next[thread_index] = msg_index + 1;
+	record->received++;
+}
+
+typedef struct ordering_thread_t
+{
+	ChiakiLog *log;
+	int index;
+} OrderingThread;
+
+static void *ordering_thread_func(void *user)
+{
+	OrderingThread *thread = user;
+	for(int i=0; i<MESSAGES_PER_THREAD; i++)
+		CHIAKI_LOGI(thread->log, "thread %d msg %d", thread->index, i);
+	return NULL;
+}
+
+static MunitResult test_log_async_ordering(const MunitParameter params[], void *user)
+{
+	OrderingRecord record = { 0 };
+	ChiakiLogAsync async;
+	ChiakiErrorCode err = chiaki_log_async_init(&async, 14, ordering_cb, &record);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiLog log;
+	chiaki_log_init(&log, CHIAKI_LOG_ALL, chiaki_log_async_cb, &async);
+
+	ChiakiThread threads[THREADS_COUNT];
+	OrderingThread thread_data[THREADS_COUNT];
+	for(int i=0; i<THREADS_COUNT; i++)
+	{
+		thread_data[i].log = &log;
+		thread_data[i].index = i;
+		err = chiaki_thread_create(&threads[i], ordering_thread_func, &thread_data[i]);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+	for(int i=0; i<THREADS_COUNT; i++)
+		chiaki_thread_join(&threads[i], NULL);
+
+	char long_msg[CHIAKI_LOG_ASYNC_MSG_SIZE * 2];
+	memset(long_msg, 'a', sizeof(long_msg) - 1);
+	long_msg[sizeof(long_msg) - 1] = '\0';
+	CHIAKI_LOGI(&log, "%s", long_msg);
+	chiaki_log_async_cb(CHIAKI_LOG_INFO, long_msg, &async);
+
+	chiaki_log_async_fini(&async);
+
+	munit_assert(!record.failed);
+	munit_assert_uint64(chiaki_log_async_dropped(&async), ==, 0);
+	munit_assert_size(record.received, ==, THREADS_COUNT * MESSAGES_PER_THREAD);
+	munit_assert_size(record.long_received, ==, 2);
+	return MUNIT_OK;
+}
+
+typedef struct blocking_record_t
+{
+	ChiakiBoolPredCond entered;
+	ChiakiBoolPredCond release;
+	size_t received;
+	size_t warnings;
+} BlockingRecord;
+
+static void blocking_cb(ChiakiLogLevel level, const char *msg, void *user)
+{
+	BlockingRecord *record = user;
+	if(level == CHIAKI_LOG_WARNING)
+	{
+		record->warnings++;
+		return;
+	}
+	if(!record->received++)
+	{
+		chiaki_bool_pred_cond_signal(&record->entered);
+		chiaki_bool_pred_cond_lock(&record->release);
+		chiaki_bool_pred_cond_wait(&record->release);
+		chiaki_bool_pred_cond_unlock(&record->release);
+	}
+}
+
+static MunitResult test_log_async_overflow(const MunitParameter params[], void *user)
+{
+	BlockingRecord record = { 0 };
+	chiaki_bool_pred_cond_init(&record.entered);
+	chiaki_bool_pred_cond_init(&record.release);
+
+	ChiakiLogAsync async;
+	ChiakiErrorCode err = chiaki_log_async_init(&async, 2, blocking_cb, &record);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiLog log;
+	chiaki_log_init(&log, CHIAKI_LOG_ALL, chiaki_log_async_cb, &async);
+
+	// the first message blocks the log thread while still occupying its slot, so only 3 more fit into the ring
+	CHIAKI_LOGI(&log, "block");
+	chiaki_bool_pred_cond_lock(&record.entered);
+	chiaki_bool_pred_cond_wait(&record.entered);
+	chiaki_bool_pred_cond_unlock(&record.entered);
+	for(int i=0; i<10; i++)
+		CHIAKI_LOGI(&log, "msg %d", i);
+	munit_assert_uint64(chiaki_log_async_dropped(&async), ==, 7);
+
+	chiaki_bool_pred_cond_signal(&record.release);
+	chiaki_log_async_fini(&async);
+
+	munit_assert_size(record.received, ==, 4);
+	munit_assert_size(record.warnings, ==, 1);
+
+	chiaki_bool_pred_cond_fini(&record.entered);
+	chiaki_bool_pred_cond_fini(&record.release);
+	return MUNIT_OK;
+}
+
+MunitTest tests_log_async[] = {
+	{
+		"/ordering",
+		test_log_async_ordering,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/overflow",
+		test_log_async_overflow,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
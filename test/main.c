@@ -11,6 +11,20 @@ extern MunitTest tests_gkcrypt[];
 extern MunitTest tests_takion[];
 extern MunitTest tests_fec[];
 extern MunitTest tests_regist[];
+extern MunitTest tests_log[];
+extern MunitTest tests_log_async[];
+extern MunitTest tests_packet_stats[];
+extern MunitTest tests_trendline[];
+extern MunitTest tests_timer[];
+extern MunitTest tests_executor[];
+extern MunitTest tests_time[];
+extern MunitTest tests_jitter_buffer[];
+extern MunitTest tests_audio_ring[];
+extern MunitTest tests_av_sync[];
+extern MunitTest tests_haptics[];
+extern MunitTest tests_feedback[];
+extern MunitTest tests_orientation[];
+extern MunitTest tests_audio_receiver[];
 
 static MunitSuite suites[] = {
 	{
@@ -76,6 +90,104 @@ static MunitSuite suites[] = {
 		1,
 		MUNIT_SUITE_OPTION_NONE
 	},
+	{
+		"/log",
+		tests_log,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/log_async",
+		tests_log_async,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/packet_stats",
+		tests_packet_stats,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/trendline",
+		tests_trendline,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/timer",
+		tests_timer,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/executor",
+		tests_executor,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/time",
+		tests_time,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/jitter_buffer",
+		tests_jitter_buffer,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_ring",
+		tests_audio_ring,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/av_sync",
+		tests_av_sync,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/haptics",
+		tests_haptics,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/feedback",
+		tests_feedback,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/orientation",
+		tests_orientation,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_receiver",
+		tests_audio_receiver,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
 	{ NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE }
 };
 
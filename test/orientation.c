@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/orientation.h>
+
+#include <math.h>
+
+#define SAMPLES_COUNT 1000
+
+static void gen_samples(ChiakiMotionSample *samples, size_t count)
+{
+	// 1 kHz, with the timestamp wrapping around in between and one invalid accel reading
+	uint32_t t = 0xffffffff - 200 * 1000;
+	for(size_t i = 0; i < count; i++)
+	{
+		ChiakiMotionSample *s = &samples[i];
+		s->gyro_x = 0.5f * sinf((float)i * 0.01f);
+		s->gyro_y = 0.25f;
+		s->gyro_z = -0.1f * cosf((float)i * 0.02f);
+		s->accel_x = 0.1f * sinf((float)i * 0.03f);
+		s->accel_y = 1.0f;
+		s->accel_z = 0.05f;
+		if(i == 100)
+			s->accel_x = s->accel_y = s->accel_z = 0.0f;
+		s->timestamp_us = t;
+		t += 1000;
+	}
+}
+
+static MunitResult test_batch(const MunitParameter params[], void *user)
+{
+	static ChiakiMotionSample samples[SAMPLES_COUNT];
+	gen_samples(samples, SAMPLES_COUNT);
+
+	ChiakiOrientationTracker single;
+	chiaki_orientation_tracker_init(&single);
+	for(size_t i = 0; i < SAMPLES_COUNT; i++)
+	{
+		ChiakiMotionSample *s = &samples[i];
+		chiaki_orientation_tracker_update(&single, s->gyro_x, s->gyro_y, s->gyro_z, s->accel_x, s->accel_y, s->accel_z, s->timestamp_us);
+	}
+
+	// uneven batches crossing the internal chunks
+	ChiakiOrientationTracker batched;
+	chiaki_orientation_tracker_init(&batched);
+	size_t batch_sizes[] = { 1, 3, 64, 0, 65, 200 };
+	size_t pos = 0;
+	for(size_t i = 0; pos < SAMPLES_COUNT; i++)
+	{
+		size_t n = batch_sizes[i % (sizeof(batch_sizes) / sizeof(batch_sizes[0]))];
+		if(n > SAMPLES_COUNT - pos)
+			n = SAMPLES_COUNT - pos;
+		chiaki_orientation_tracker_update_batch(&batched, samples + pos, n);
+		pos += n;
+	}
+
+	munit_assert_uint64(batched.sample_index, ==, SAMPLES_COUNT);
+	munit_assert_uint32(batched.timestamp, ==, samples[SAMPLES_COUNT - 1].timestamp_us);
+	munit_assert_float(batched.gyro_z, ==, samples[SAMPLES_COUNT - 1].gyro_z);
+	munit_assert_float(batched.accel_x, ==, samples[SAMPLES_COUNT - 1].accel_x);
+	munit_assert_double_equal(batched.orient.x, single.orient.x, 6);
+	munit_assert_double_equal(batched.orient.y, single.orient.y, 6);
+	munit_assert_double_equal(batched.orient.z, single.orient.z, 6);
+	munit_assert_double_equal(batched.orient.w, single.orient.w, 6);
+
+	// the gyro has turned it away from the initial orientation, staying a unit quaternion
+	float norm = batched.orient.x * batched.orient.x + batched.orient.y * batched.orient.y
+		+ batched.orient.z * batched.orient.z + batched.orient.w * batched.orient.w;
+	munit_assert_double_equal(norm, 1.0, 4);
+	ChiakiOrientation initial;
+	chiaki_orientation_init(&initial);
+	munit_assert_float(fabsf(batched.orient.y - initial.y), >, 0.01f);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_orientation[] = {
+	{
+		"/batch",
+		test_batch,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/packetstats.h>
+
+static MunitResult test_packet_stats_seq(const MunitParameter params[], void *user)
+{
+	ChiakiPacketStats stats;
+	ChiakiErrorCode err = chiaki_packet_stats_init(&stats);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiPacketStatsSnapshot prev;
+	chiaki_packet_stats_snapshot(&stats, &prev);
+
+	// 0xfffe, 0xffff, (0 lost), 1, (2, 3, 4 lost), 5, 3 (late)
+	chiaki_packet_stats_push_seq(&stats, 0xfffe);
+	chiaki_packet_stats_push_seq(&stats, 0xffff);
+	chiaki_packet_stats_push_seq(&stats, 1);
+	chiaki_packet_stats_push_seq(&stats, 5);
+
+	ChiakiPacketStatsSnapshot window;
+	chiaki_packet_stats_snapshot_window(&stats, &prev, &window);
+	munit_assert_uint64(window.seq_received, ==, 4);
+	munit_assert_uint64(window.seq_lost, ==, 4);
+	munit_assert_uint64(window.loss_burst_hist[0], ==, 1);
+	munit_assert_uint64(window.loss_burst_hist[2], ==, 1);
+	munit_assert_uint64(chiaki_packet_stats_hist_max(window.loss_burst_hist), ==, 4);
+	munit_assert_uint64(chiaki_packet_stats_hist_max(window.reorder_hist), ==, 0);
+
+	chiaki_packet_stats_push_seq(&stats, 3);
+	chiaki_packet_stats_snapshot_window(&stats, &prev, &window);
+	munit_assert_uint64(window.seq_received, ==, 1);
+	munit_assert_uint64(window.seq_lost, ==, 0);
+	munit_assert_uint64(window.reorder_hist[1], ==, 1);
+
+	// cumulative values account for the late packet
+	ChiakiPacketStatsSnapshot total;
+	chiaki_packet_stats_snapshot(&stats, &total);
+	munit_assert_uint64(total.seq_received, ==, 5);
+	munit_assert_uint64(total.seq_lost, ==, 3);
+
+	// duplicates of the newest packet, of a late one and of one that arrived in order don't hide any loss
+	chiaki_packet_stats_push_seq(&stats, 5);
+	chiaki_packet_stats_push_seq(&stats, 3);
+	chiaki_packet_stats_push_seq(&stats, 1);
+	chiaki_packet_stats_snapshot_window(&stats, &prev, &window);
+	munit_assert_uint64(window.seq_received, ==, 0);
+	munit_assert_uint64(window.seq_duplicates, ==, 3);
+	munit_assert_uint64(window.reorder_hist[1], ==, 0);
+	chiaki_packet_stats_snapshot(&stats, &total);
+	munit_assert_uint64(total.seq_received, ==, 5);
+	munit_assert_uint64(total.seq_lost, ==, 3);
+
+	// a gap wider than the window forgets everything before it
+	chiaki_packet_stats_push_seq(&stats, 5 + CHIAKI_PACKET_STATS_SEQ_WINDOW + 2);
+	chiaki_packet_stats_push_seq(&stats, 5 + CHIAKI_PACKET_STATS_SEQ_WINDOW);
+	chiaki_packet_stats_push_seq(&stats, 5 + CHIAKI_PACKET_STATS_SEQ_WINDOW);
+	chiaki_packet_stats_snapshot(&stats, &total);
+	munit_assert_uint64(total.seq_received, ==, 7);
+	munit_assert_uint64(total.seq_lost, ==, 3 + CHIAKI_PACKET_STATS_SEQ_WINDOW);
+	munit_assert_uint64(total.seq_duplicates, ==, 4);
+
+	chiaki_packet_stats_fini(&stats);
+	return MUNIT_OK;
+}
+
+static MunitResult test_packet_stats_get(const MunitParameter params[], void *user)
+{
+	ChiakiPacketStats stats;
+	ChiakiErrorCode err = chiaki_packet_stats_init(&stats);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	chiaki_packet_stats_push_generation(&stats, 10, 2);
+	chiaki_packet_stats_push_generation(&stats, 12, 0);
+	chiaki_packet_stats_push_seq(&stats, 100);
+	chiaki_packet_stats_push_seq(&stats, 102);
+
+	uint64_t received, lost;
+	chiaki_packet_stats_get(&stats, false, &received, &lost);
+	munit_assert_uint64(received, ==, 24);
+	munit_assert_uint64(lost, ==, 3);
+
+	chiaki_packet_stats_get(&stats, true, &received, &lost);
+	munit_assert_uint64(received, ==, 24);
+	munit_assert_uint64(lost, ==, 3);
+
+	chiaki_packet_stats_push_generation(&stats, 5, 1);
+	chiaki_packet_stats_get(&stats, true, &received, &lost);
+	munit_assert_uint64(received, ==, 5);
+	munit_assert_uint64(lost, ==, 1);
+
+	chiaki_packet_stats_reset(&stats);
+	chiaki_packet_stats_get(&stats, true, &received, &lost);
+	munit_assert_uint64(received, ==, 0);
+	munit_assert_uint64(lost, ==, 0);
+
+	chiaki_packet_stats_fini(&stats);
+	return MUNIT_OK;
+}
+
+static MunitResult test_packet_stats_jitter(const MunitParameter params[], void *user)
+{
+	ChiakiPacketStats stats;
+	ChiakiErrorCode err = chiaki_packet_stats_init(&stats);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// without a nominal interval, no jitter can be calculated
+	for(ChiakiSeqNum16 i=0; i<100; i++)
+		chiaki_packet_stats_push_seq(&stats, i);
+	ChiakiPacketStatsSnapshot snapshot;
+	chiaki_packet_stats_snapshot(&stats, &snapshot);
+	munit_assert_double(snapshot.jitter_ms, ==, 0.0);
+
+	// packets nominally 10ms apart arriving all at once converge to a jitter close to 10ms
+	chiaki_packet_stats_set_seq_interval(&stats, 10000);
+	for(ChiakiSeqNum16 i=100; i<400; i++)
+		chiaki_packet_stats_push_seq(&stats, i);
+	chiaki_packet_stats_snapshot(&stats, &snapshot);
+	munit_assert_double(snapshot.jitter_ms, >, 9.0);
+	munit_assert_double(snapshot.jitter_ms, <=, 10.0);
+
+	chiaki_packet_stats_fini(&stats);
+	return MUNIT_OK;
+}
+
+static MunitResult test_packet_stats_fec(const MunitParameter params[], void *user)
+{
+	ChiakiPacketStats stats;
+	ChiakiErrorCode err = chiaki_packet_stats_init(&stats);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiPacketStatsSnapshot prev;
+	chiaki_packet_stats_snapshot(&stats, &prev);
+
+	chiaki_packet_stats_push_fec(&stats, 3, 1);
+	chiaki_packet_stats_push_fec(&stats, 0, 2);
+
+	ChiakiPacketStatsSnapshot window;
+	chiaki_packet_stats_snapshot_window(&stats, &prev, &window);
+	munit_assert_uint64(window.fec_recovered, ==, 3);
+	munit_assert_uint64(window.fec_missed, ==, 3);
+
+	chiaki_packet_stats_push_fec(&stats, 1, 0);
+	chiaki_packet_stats_snapshot_window(&stats, &prev, &window);
+	munit_assert_uint64(window.fec_recovered, ==, 1);
+	munit_assert_uint64(window.fec_missed, ==, 0);
+	munit_assert_uint64(prev.fec_recovered, ==, 4);
+	munit_assert_uint64(prev.fec_missed, ==, 3);
+
+	chiaki_packet_stats_fini(&stats);
+	return MUNIT_OK;
+}
+
+MunitTest tests_packet_stats[] = {
+	{
+		"/seq",
+		test_packet_stats_seq,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/get",
+		test_packet_stats_get,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/jitter",
+		test_packet_stats_jitter,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/fec",
+		test_packet_stats_fec,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -170,7 +170,175 @@ static MunitResult test_reorder_queue_16(const MunitParameter params[], void *te
 
 	return MUNIT_OK;
 }
+static MunitResult test_reorder_queue_32(const MunitParameter params[], void *test_user)
+{
+	// spans multiple words of the occupancy bitmap and wraps around the sequence number space
+	ChiakiReorderQueue queue;
+	ChiakiErrorCode err = chiaki_reorder_queue_init_32(&queue, 7, 0xfffffff0);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(chiaki_reorder_queue_size(&queue), ==, 128);
+
+	DropRecord drop_record = { 0 };
+	chiaki_reorder_queue_set_drop_cb(&queue, drop, &drop_record);
+
+	// 0xfffffff0 missing
+	chiaki_reorder_queue_push_32(&queue, 0xfffffff1, (void *)1);
+	chiaki_reorder_queue_push_32(&queue, 0x50, (void *)2);
+	chiaki_reorder_queue_push_32(&queue, 0x60, (void *)3);
+	chiaki_reorder_queue_push_32(&queue, 0x6f, (void *)4);
+	munit_assert_uint64(chiaki_reorder_queue_count(&queue), ==, 0x80);
+
+	// full, so this is dropped with CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END
+	chiaki_reorder_queue_push_32(&queue, 0x70, (void *)5);
+	munit_assert_uint64(drop_record.count[5], ==, 1);
+	munit_assert_uint64(drop_record.seq_num[5], ==, 0x70);
+
+	uint64_t seq_num = 0;
+	void *user = NULL;
+	munit_assert(!chiaki_reorder_queue_pull_32(&queue, &seq_num, &user));
+	munit_assert(!chiaki_reorder_queue_peek_32(&queue, 0, &seq_num, &user));
+	munit_assert(chiaki_reorder_queue_peek_32(&queue, 0x60, &seq_num, &user));
+	munit_assert_uint64(seq_num, ==, 0x50);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 2);
+
+	// dropping the last element shrinks the queue to the one before it
+	chiaki_reorder_queue_drop_32(&queue, 0x7f);
+	munit_assert_uint64(drop_record.count[4], ==, 1);
+	munit_assert_uint64(drop_record.seq_num[4], ==, 0x6f);
+	munit_assert_uint64(chiaki_reorder_queue_count(&queue), ==, 0x71);
+	munit_assert(!chiaki_reorder_queue_peek_32(&queue, 0x7f, &seq_num, &user));
+
+	// dropping in the middle leaves it
+	chiaki_reorder_queue_drop_32(&queue, 0x60);
+	munit_assert_uint64(drop_record.count[2], ==, 1);
+	munit_assert_uint64(chiaki_reorder_queue_count(&queue), ==, 0x71);
+	munit_assert(!chiaki_reorder_queue_peek_32(&queue, 0x60, &seq_num, &user));
+
+	// dropped elements can be received again
+	chiaki_reorder_queue_push_32(&queue, 0x50, (void *)6);
+	munit_assert_uint64(drop_record.count[6], ==, 0);
+
+	// make room with CHIAKI_REORDER_QUEUE_DROP_STRATEGY_BEGIN, everything before 0x50 is dropped
+	chiaki_reorder_queue_set_drop_strategy(&queue, CHIAKI_REORDER_QUEUE_DROP_STRATEGY_BEGIN);
+	chiaki_reorder_queue_push_32(&queue, 0xcf, (void *)7);
+	munit_assert_uint64(drop_record.count[1], ==, 1);
+	munit_assert_uint64(drop_record.seq_num[1], ==, 0xfffffff1);
+	munit_assert_uint64(drop_record.count[6], ==, 0);
+	munit_assert_uint64(chiaki_reorder_queue_count(&queue), ==, 0x80);
+
+	munit_assert(chiaki_reorder_queue_pull_32(&queue, &seq_num, &user));
+	munit_assert_uint64(seq_num, ==, 0x50);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 6);
+
+	// remaining elements are dropped on fini
+	memset(&drop_record, 0, sizeof(drop_record));
+	chiaki_reorder_queue_fini(&queue);
+	munit_assert_uint64(drop_record.count[3], ==, 1);
+	munit_assert_uint64(drop_record.seq_num[3], ==, 0x60);
+	munit_assert_uint64(drop_record.count[7], ==, 1);
+	munit_assert_uint64(drop_record.seq_num[7], ==, 0xcf);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, (i == 3 || i == 7) ? 1 : 0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_reorder_queue_grow(const MunitParameter params[], void *test_user)
+{
+	ChiakiReorderQueue queue;
+	ChiakiErrorCode err = chiaki_reorder_queue_init_32(&queue, 2, 0xfffffffe);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_reorder_queue_set_size_exp_max(&queue, 4);
+
+	DropRecord drop_record = { 0 };
+	chiaki_reorder_queue_set_drop_cb(&queue, drop, &drop_record);
+
+	chiaki_reorder_queue_push(&queue, 0xffffffff, (void *)1);
+	chiaki_reorder_queue_push(&queue, 2, (void *)2);
+	munit_assert_size(chiaki_reorder_queue_size(&queue), ==, 8);
+	chiaki_reorder_queue_push(&queue, 8, (void *)3);
+	munit_assert_size(chiaki_reorder_queue_size(&queue), ==, 16);
+	munit_assert_uint64(chiaki_reorder_queue_count(&queue), ==, 11);
+
+	// beyond the maximum size, dropped according to CHIAKI_REORDER_QUEUE_DROP_STRATEGY_END
+	chiaki_reorder_queue_push(&queue, 14, (void *)4);
+	munit_assert_size(chiaki_reorder_queue_size(&queue), ==, 16);
+	munit_assert_uint64(drop_record.count[4], ==, 1);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, i == 4 ? 1 : 0);
+
+	// elements are kept while growing
+	uint64_t seq_num;
+	void *user;
+	munit_assert(chiaki_reorder_queue_peek(&queue, 1, &seq_num, &user));
+	munit_assert_uint64(seq_num, ==, 0xffffffff);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 1);
+	munit_assert(chiaki_reorder_queue_peek(&queue, 4, &seq_num, &user));
+	munit_assert_uint64(seq_num, ==, 2);
+	munit_assert(chiaki_reorder_queue_peek(&queue, 10, &seq_num, &user));
+	munit_assert_uint64(seq_num, ==, 8);
+
+	// can't shrink below the count
+	err = chiaki_reorder_queue_resize(&queue, 3);
+	munit_assert_int(err, ==, CHIAKI_ERR_BUF_TOO_SMALL);
+
+	chiaki_reorder_queue_push(&queue, 0xfffffffe, (void *)0);
+	for(size_t i=0; i<2; i++)
+		munit_assert(chiaki_reorder_queue_pull(&queue, &seq_num, &user));
+	munit_assert_uint64(chiaki_reorder_queue_count(&queue), ==, 9);
+	err = chiaki_reorder_queue_resize(&queue, 4);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	err = chiaki_reorder_queue_resize(&queue, 3);
+	munit_assert_int(err, !=, CHIAKI_ERR_SUCCESS);
+
+	// after dropping the last one, the rest fits into 4 entries again
+	chiaki_reorder_queue_drop(&queue, 8);
+	munit_assert_uint64(chiaki_reorder_queue_count(&queue), ==, 3);
+	err = chiaki_reorder_queue_resize(&queue, 2);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(chiaki_reorder_queue_size(&queue), ==, 4);
+	munit_assert(chiaki_reorder_queue_peek(&queue, 2, &seq_num, &user));
+	munit_assert_uint64(seq_num, ==, 2);
+	munit_assert_uint64((uint64_t)(size_t)user, ==, 2);
 
+	munit_assert_uint64(chiaki_reorder_queue_count_max(&queue), ==, 11);
+
+	memset(&drop_record, 0, sizeof(drop_record));
+	chiaki_reorder_queue_fini(&queue);
+	for(size_t i=0; i<DROP_RECORD_MAX; i++)
+		munit_assert_uint64(drop_record.count[i], ==, i == 2 ? 1 : 0);
+
+	return MUNIT_OK;
+}
+
+static bool compat_16_gt(uint64_t a, uint64_t b) { return chiaki_seq_num_16_gt((ChiakiSeqNum16)a, (ChiakiSeqNum16)b); }
+static bool compat_16_lt(uint64_t a, uint64_t b) { return chiaki_seq_num_16_lt((ChiakiSeqNum16)a, (ChiakiSeqNum16)b); }
+static uint64_t compat_16_add(uint64_t a, uint64_t b) { return (uint64_t)(ChiakiSeqNum16)(a + b); }
+static uint64_t compat_64_add(uint64_t a, uint64_t b) { return a + b; }
+
+static MunitResult test_reorder_queue_init_compat(const MunitParameter params[], void *test_user)
+{
+	ChiakiReorderQueue queue;
+	ChiakiErrorCode err = chiaki_reorder_queue_init(&queue, 2, 0xffff, compat_16_gt, compat_16_lt, compat_16_add);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint(queue.seq_num_bits, ==, 16);
+
+	// wraps around like the functions passed
+	chiaki_reorder_queue_push(&queue, 0xffff, (void *)1);
+	chiaki_reorder_queue_push(&queue, 0, (void *)2);
+	uint64_t seq_num;
+	void *user;
+	munit_assert(chiaki_reorder_queue_pull(&queue, &seq_num, &user));
+	munit_assert_uint64(seq_num, ==, 0xffff);
+	munit_assert(chiaki_reorder_queue_pull(&queue, &seq_num, &user));
+	munit_assert_uint64(seq_num, ==, 0);
+	chiaki_reorder_queue_fini(&queue);
+
+	err = chiaki_reorder_queue_init(&queue, 2, 0, compat_16_gt, compat_16_lt, compat_64_add);
+	munit_assert_int(err, ==, CHIAKI_ERR_INVALID_DATA);
+
+	return MUNIT_OK;
+}
 
 MunitTest tests_reorder_queue[] = {
 	{
@@ -181,5 +349,29 @@ MunitTest tests_reorder_queue[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/reorder_queue_32",
+		test_reorder_queue_32,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/reorder_queue_grow",
+		test_reorder_queue_grow,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/reorder_queue_init_compat",
+		test_reorder_queue_init_compat,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
@@ -160,13 +160,63 @@ static MunitResult test_takion_send_buffer(const MunitParameter params[], void *
 #undef nums_count
 }
 
+static void push_ack_with_rtt(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, uint64_t rtt_us, uint64_t tries)
+{
+	ChiakiErrorCode err = chiaki_takion_send_buffer_push(send_buffer, seq_num, malloc(8), 8);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(send_buffer->packets_count, ==, 1);
+	send_buffer->packets[0].first_send_us -= rtt_us;
+	send_buffer->packets[0].tries = tries;
+	err = chiaki_takion_send_buffer_ack(send_buffer, seq_num, NULL, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(send_buffer->packets_count, ==, 0);
+}
+
+static MunitResult test_takion_send_buffer_rtt(const MunitParameter params[], void *user)
+{
+	ChiakiTakionSendBuffer send_buffer;
+	ChiakiErrorCode err = chiaki_takion_send_buffer_init(&send_buffer, NULL, 4);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	send_buffer.log = get_test_log();
+
+	uint64_t srtt_us, rttvar_us;
+	chiaki_takion_send_buffer_rtt(&send_buffer, &srtt_us, &rttvar_us);
+	munit_assert_uint64(srtt_us, ==, 0);
+
+	// the time between push and ack adds a little on top of each rtt
+#define SLACK_US 5000
+	push_ack_with_rtt(&send_buffer, 1, 10000, 0);
+	chiaki_takion_send_buffer_rtt(&send_buffer, &srtt_us, &rttvar_us);
+	munit_assert_uint64(srtt_us, >=, 10000);
+	munit_assert_uint64(srtt_us, <, 10000 + SLACK_US);
+	munit_assert_uint64(rttvar_us, >=, 5000);
+	munit_assert_uint64(rttvar_us, <, 5000 + SLACK_US);
+
+	// re-sent packets are ambiguous and must not be sampled
+	push_ack_with_rtt(&send_buffer, 2, 500000, 1);
+	chiaki_takion_send_buffer_rtt(&send_buffer, &srtt_us, NULL);
+	munit_assert_uint64(srtt_us, <, 10000 + SLACK_US);
+
+	// srtt = 7/8 * 10 + 1/8 * 20 ms, rttvar = 3/4 * 5 + 1/4 * 10 ms
+	push_ack_with_rtt(&send_buffer, 3, 20000, 0);
+	chiaki_takion_send_buffer_rtt(&send_buffer, &srtt_us, &rttvar_us);
+	munit_assert_uint64(srtt_us, >=, 11250);
+	munit_assert_uint64(srtt_us, <, 11250 + SLACK_US);
+	munit_assert_uint64(rttvar_us, >=, 6250 - SLACK_US);
+	munit_assert_uint64(rttvar_us, <, 6250 + SLACK_US);
+#undef SLACK_US
+
+	chiaki_takion_send_buffer_fini(&send_buffer);
+	return MUNIT_OK;
+}
+
 static MunitResult test_takion_format_congestion(const MunitParameter params[], void *user)
 {
 	static const uint8_t handshake_key[] = { 0x54, 0x65, 0x4c, 0x34, 0x5c, 0xac, 0x56, 0xb8, 0xea, 0xe6, 0x15, 0x2a, 0xde, 0x1c, 0xe2, 0xe8 };
 	static const uint8_t ecdh_secret[] = { 0x00, 0x34, 0xf8, 0x21, 0xc7, 0xd9, 0xde, 0xa9, 0xe9, 0x11, 0xca, 0x5a, 0xd6, 0x7d, 0x11, 0xce, 0x4f, 0x02, 0xb1, 0xce, 0x1e, 0xe7, 0xc3, 0x8d, 0x54, 0x39, 0xfa, 0x64, 0xe3, 0xdb, 0xd8, 0x0d };
 
 	ChiakiGKCrypt gkcrypt;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, NULL, 0, 2, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, NULL, NULL, 0, 2, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return MUNIT_ERROR;
 
@@ -220,6 +270,14 @@ MunitTest tests_takion[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/send_buffer_rtt",
+		test_takion_send_buffer_rtt,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{
 		"/format_congestion",
 		test_takion_format_congestion,
@@ -4,7 +4,7 @@ uint8_t ecdh_secret[] = { 0xaa, 0xbc, 0x10, 0x46, 0xd, 0x6d, 0xed, 0x4b, 0x58, 0
 
 static const uint8_t crypt_index = 3;
 ChiakiGKCrypt gkcrypt;
-ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, NULL, 0, crypt_index, handshake_key, ecdh_secret);
+ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, NULL, NULL, 0, crypt_index, handshake_key, ecdh_secret);
 if(err != CHIAKI_ERR_SUCCESS)
 	return MUNIT_ERROR;
 
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/time.h>
+
+static MunitResult test_now_ns(const MunitParameter params[], void *user)
+{
+	uint64_t prev = chiaki_time_now_ns();
+	for(size_t i=0; i<1000; i++)
+	{
+		uint64_t now = chiaki_time_now_ns();
+		munit_assert_uint64(now, >=, prev);
+		prev = now;
+	}
+
+	// same clock rate as the existing one, within the resolution of the coarser clock
+	uint64_t start_ns = chiaki_time_now_ns();
+	uint64_t start_us = chiaki_time_now_monotonic_us();
+	while(chiaki_time_now_monotonic_us() - start_us < 20000);
+	uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+	uint64_t elapsed_ns = chiaki_time_now_ns() - start_ns;
+	munit_assert_uint64(elapsed_ns, >=, (elapsed_us - 1000) * 1000);
+	munit_assert_uint64(elapsed_ns, <=, (elapsed_us + 1000) * 1000);
+	return MUNIT_OK;
+}
+
+static MunitResult test_ticks(const MunitParameter params[], void *user)
+{
+	chiaki_time_init();
+
+	uint64_t start_ns = chiaki_time_now_ns();
+	uint64_t start_ticks = chiaki_time_ticks();
+	while(chiaki_time_now_ns() - start_ns < 20000000);
+	uint64_t elapsed_ticks = chiaki_time_ticks() - start_ticks;
+	uint64_t elapsed_ns = chiaki_time_now_ns() - start_ns;
+
+	// calibration is only accurate to a few percent
+	uint64_t elapsed_ticks_ns = chiaki_time_ticks_to_ns(elapsed_ticks);
+	munit_assert_uint64(elapsed_ticks_ns, >=, elapsed_ns - elapsed_ns / 20);
+	munit_assert_uint64(elapsed_ticks_ns, <=, elapsed_ns + elapsed_ns / 20);
+	return MUNIT_OK;
+}
+
+MunitTest tests_time[] = {
+	{
+		"/now_ns",
+		test_now_ns,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/ticks",
+		test_ticks,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
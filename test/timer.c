@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/timer.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+#define TIMERS_MAX 4
+
+typedef struct timer_test_t
+{
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	ChiakiTimer timers[TIMERS_MAX];
+	unsigned int calls[TIMERS_MAX];
+	size_t order[16];
+	size_t order_count;
+	unsigned int cancel_after; // cancel timer 0 from its own callback after this many calls
+} TimerTest;
+
+typedef struct timer_test_ctx_t
+{
+	TimerTest *test;
+	size_t index;
+} TimerTestCtx;
+
+static TimerTestCtx ctxs[TIMERS_MAX];
+
+static void timer_cb(void *user)
+{
+	TimerTestCtx *ctx = user;
+	TimerTest *test = ctx->test;
+	chiaki_mutex_lock(&test->mutex);
+	test->calls[ctx->index]++;
+	if(test->order_count < sizeof(test->order) / sizeof(test->order[0]))
+		test->order[test->order_count++] = ctx->index;
+	if(ctx->index == 0 && test->cancel_after && test->calls[0] == test->cancel_after)
+		chiaki_timer_cancel(&test->timers[0]);
+	chiaki_cond_signal(&test->cond);
+	chiaki_mutex_unlock(&test->mutex);
+}
+
+static void timer_test_init(TimerTest *test, ChiakiTimerService *service)
+{
+	memset(test, 0, sizeof(*test));
+	chiaki_mutex_init(&test->mutex, false);
+	chiaki_cond_init(&test->cond);
+	for(size_t i=0; i<TIMERS_MAX; i++)
+	{
+		ctxs[i].test = test;
+		ctxs[i].index = i;
+		chiaki_timer_init(&test->timers[i], service, timer_cb, &ctxs[i]);
+	}
+}
+
+static void timer_test_fini(TimerTest *test)
+{
+	for(size_t i=0; i<TIMERS_MAX; i++)
+		chiaki_timer_cancel(&test->timers[i]);
+	chiaki_cond_fini(&test->cond);
+	chiaki_mutex_fini(&test->mutex);
+}
+
+static bool order_full(void *user)
+{
+	TimerTest *test = user;
+	return test->order_count >= TIMERS_MAX;
+}
+
+static bool never(void *user)
+{
+	return false;
+}
+
+static MunitResult test_one_shot(const MunitParameter params[], void *user)
+{
+	ChiakiTimerService service;
+	ChiakiErrorCode err = chiaki_timer_service_init(&service);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	TimerTest test;
+	timer_test_init(&test, &service);
+
+	// started in reverse order, the later two end up on higher levels of the wheel
+	uint64_t start_ms = chiaki_time_now_monotonic_ms();
+	chiaki_timer_start(&test.timers[3], 150, 0);
+	chiaki_timer_start(&test.timers[2], 70, 0);
+	chiaki_timer_start(&test.timers[1], 20, 0);
+	chiaki_timer_start(&test.timers[0], 10, 0);
+	munit_assert(chiaki_timer_pending(&test.timers[3]));
+
+	chiaki_mutex_lock(&test.mutex);
+	err = chiaki_cond_timedwait_pred(&test.cond, &test.mutex, 5000, order_full, &test);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint64(chiaki_time_now_monotonic_ms() - start_ms, >=, 150);
+	for(size_t i=0; i<TIMERS_MAX; i++)
+		munit_assert_size(test.order[i], ==, i);
+
+	// nothing fires again
+	err = chiaki_cond_timedwait_pred(&test.cond, &test.mutex, 50, never, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_TIMEOUT);
+	munit_assert_size(test.order_count, ==, TIMERS_MAX);
+	chiaki_mutex_unlock(&test.mutex);
+
+	for(size_t i=0; i<TIMERS_MAX; i++)
+		munit_assert(!chiaki_timer_pending(&test.timers[i]));
+
+	timer_test_fini(&test);
+	chiaki_timer_service_fini(&service);
+	return MUNIT_OK;
+}
+
+static bool periodic_done(void *user)
+{
+	TimerTest *test = user;
+	return test->calls[0] >= 5 && test->calls[1] >= 1;
+}
+
+static MunitResult test_periodic(const MunitParameter params[], void *user)
+{
+	ChiakiTimerService service;
+	ChiakiErrorCode err = chiaki_timer_service_init(&service);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	TimerTest test;
+	timer_test_init(&test, &service);
+
+	chiaki_timer_start(&test.timers[0], 0, 5);
+	chiaki_timer_start(&test.timers[1], 25, 0);
+	// re-starting replaces the previous schedule
+	chiaki_timer_start(&test.timers[2], 5, 0);
+	chiaki_timer_start(&test.timers[2], 100000, 0);
+
+	chiaki_mutex_lock(&test.mutex);
+	err = chiaki_cond_timedwait_pred(&test.cond, &test.mutex, 5000, periodic_done, &test);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	chiaki_mutex_unlock(&test.mutex);
+
+	chiaki_timer_cancel(&test.timers[0]);
+	munit_assert(!chiaki_timer_pending(&test.timers[0]));
+	chiaki_mutex_lock(&test.mutex);
+	unsigned int calls = test.calls[0];
+	err = chiaki_cond_timedwait_pred(&test.cond, &test.mutex, 30, never, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_TIMEOUT);
+	munit_assert_uint(test.calls[0], ==, calls);
+	munit_assert_uint(test.calls[1], ==, 1);
+	munit_assert_uint(test.calls[2], ==, 0);
+	chiaki_mutex_unlock(&test.mutex);
+	munit_assert(chiaki_timer_pending(&test.timers[2]));
+
+	timer_test_fini(&test);
+	chiaki_timer_service_fini(&service);
+	return MUNIT_OK;
+}
+
+static bool cancel_done(void *user)
+{
+	TimerTest *test = user;
+	return test->calls[1] >= 1;
+}
+
+static MunitResult test_cancel_in_callback(const MunitParameter params[], void *user)
+{
+	ChiakiTimerService service;
+	ChiakiErrorCode err = chiaki_timer_service_init(&service);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	TimerTest test;
+	timer_test_init(&test, &service);
+	test.cancel_after = 3;
+
+	chiaki_timer_start(&test.timers[0], 1, 2);
+	chiaki_timer_start(&test.timers[1], 40, 0);
+
+	chiaki_mutex_lock(&test.mutex);
+	err = chiaki_cond_timedwait_pred(&test.cond, &test.mutex, 5000, cancel_done, &test);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint(test.calls[0], ==, 3);
+	chiaki_mutex_unlock(&test.mutex);
+	munit_assert(!chiaki_timer_pending(&test.timers[0]));
+
+	timer_test_fini(&test);
+	chiaki_timer_service_fini(&service);
+	return MUNIT_OK;
+}
+
+MunitTest tests_timer[] = {
+	{
+		"/one_shot",
+		test_one_shot,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/periodic",
+		test_periodic,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/cancel_in_callback",
+		test_cancel_in_callback,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
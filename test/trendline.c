@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/trendline.h>
+
+#define SEND_INTERVAL_US 10000
+
+static void feed(ChiakiTrendline *trendline, uint64_t *arrival_us, uint64_t *send_us, uint64_t arrival_interval_us, size_t count)
+{
+	for(size_t i=0; i<count; i++)
+	{
+		*arrival_us += arrival_interval_us;
+		*send_us += SEND_INTERVAL_US;
+		chiaki_trendline_update(trendline, *arrival_us, *send_us);
+	}
+}
+
+static MunitResult test_trendline_slope(const MunitParameter params[], void *user)
+{
+	ChiakiTrendline trendline;
+	chiaki_trendline_init(&trendline);
+	uint64_t arrival_us = 123456789;
+	uint64_t send_us = 42;
+
+	// constant delay
+	feed(&trendline, &arrival_us, &send_us, SEND_INTERVAL_US, 100);
+	munit_assert_uint64(chiaki_trendline_deltas_count(&trendline), ==, 99);
+	munit_assert_double(chiaki_trendline_trend(&trendline), >, -0.001);
+	munit_assert_double(chiaki_trendline_trend(&trendline), <, 0.001);
+
+	// each packet arrives 1ms later than the one before relative to its send time,
+	// so delay grows by 1ms every 11ms
+	feed(&trendline, &arrival_us, &send_us, SEND_INTERVAL_US + 1000, 100);
+	munit_assert_double(chiaki_trendline_trend(&trendline), >, 0.08);
+	munit_assert_double(chiaki_trendline_trend(&trendline), <, 0.1);
+
+	// queue draining
+	feed(&trendline, &arrival_us, &send_us, SEND_INTERVAL_US - 1000, 100);
+	munit_assert_double(chiaki_trendline_trend(&trendline), <, -0.1);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_overuse_detector(const MunitParameter params[], void *user)
+{
+	ChiakiOveruseDetector detector;
+	chiaki_overuse_detector_init(&detector);
+	uint64_t now_ms = 1000;
+
+	// not enough samples
+	munit_assert_int(chiaki_overuse_detector_detect(&detector, 1.0, 1, now_ms), ==, CHIAKI_BANDWIDTH_USAGE_NORMAL);
+
+	for(int i=0; i<10; i++)
+	{
+		now_ms += 200;
+		munit_assert_int(chiaki_overuse_detector_detect(&detector, 0.001, 100, now_ms), ==, CHIAKI_BANDWIDTH_USAGE_NORMAL);
+	}
+
+	// a single sample above the threshold is not enough
+	now_ms += 200;
+	munit_assert_int(chiaki_overuse_detector_detect(&detector, 0.09, 100, now_ms), ==, CHIAKI_BANDWIDTH_USAGE_NORMAL);
+	now_ms += 200;
+	munit_assert_int(chiaki_overuse_detector_detect(&detector, 0.09, 100, now_ms), ==, CHIAKI_BANDWIDTH_USAGE_OVERUSING);
+	munit_assert_string_equal(chiaki_bandwidth_usage_string(detector.usage), "overusing");
+
+	now_ms += 50;
+	munit_assert_int(chiaki_overuse_detector_detect(&detector, -0.1, 100, now_ms), ==, CHIAKI_BANDWIDTH_USAGE_UNDERUSING);
+	now_ms += 50;
+	munit_assert_int(chiaki_overuse_detector_detect(&detector, 0.0, 100, now_ms), ==, CHIAKI_BANDWIDTH_USAGE_NORMAL);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_trendline[] = {
+	{
+		"/slope",
+		test_trendline_slope,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/overuse_detector",
+		test_overuse_detector,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};